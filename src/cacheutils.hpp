@@ -0,0 +1,214 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __CACHEUTILS_H__
+#define __CACHEUTILS_H__
+/**@file cacheutils.hpp
+ * @brief Size-bounded caches and their statistics.
+ *
+ */
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <ostream>
+#include <ext/hash_map>
+#include <tr1/functional>
+
+
+/***********************************************************************
+				   CacheStats
+ ***********************************************************************/
+
+//! Counters of a cache's usage.
+struct CacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t insertions;
+	uint64_t evictions;
+	size_t entries;		//!< Entries in the cache now
+	size_t bytes;		//!< Memory used by the entries, in bytes
+	size_t max_bytes;	//!< The cache's memory budget
+
+	CacheStats(size_t max_bytes = 0)
+	: hits(0), misses(0), insertions(0), evictions(0), entries(0),
+	  bytes(0), max_bytes(max_bytes)
+	{}
+
+	//! Fraction of the lookups that were hits, 0 if none yet.
+	inline double hitRate() const
+	{
+		uint64_t lookups = hits + misses;
+		return lookups ? double(hits) / lookups : 0.0;
+	}
+
+	//! Sum the usage of another cache, e.g. of another thread's.
+	CacheStats& operator+=(const CacheStats& other)
+	{
+		hits += other.hits;
+		misses += other.misses;
+		insertions += other.insertions;
+		evictions += other.evictions;
+		entries += other.entries;
+		bytes += other.bytes;
+		max_bytes += other.max_bytes;
+		return *this;
+	}
+};
+
+/**Write @p stats as "name.field value" lines.
+ *
+ * Plain text, easy to grep and to feed to monitoring scripts.
+ */
+inline void write_cache_stats(std::ostream& out, const std::string& name,
+				const CacheStats& stats)
+{
+	out << name << ".hits " << stats.hits << "\n" <<
+		name << ".misses " << stats.misses << "\n" <<
+		name << ".hit_rate " << stats.hitRate() << "\n" <<
+		name << ".insertions " << stats.insertions << "\n" <<
+		name << ".evictions " << stats.evictions << "\n" <<
+		name << ".entries " << stats.entries << "\n" <<
+		name << ".bytes " << stats.bytes << "\n" <<
+		name << ".max_bytes " << stats.max_bytes << "\n";
+}
+
+
+/***********************************************************************
+				    LRUCache
+ ***********************************************************************/
+
+/**Least-recently-used cache with a memory budget.
+ *
+ * Every entry is inserted with its cost, an estimate of the memory it
+ * takes in bytes. Once the costs of the entries add up past the budget,
+ * the least recently used ones are evicted. Lookups and insertions take
+ * O(1).
+ *
+ * @warning This class is not thread-safe: callers must serialize access.
+ */
+template<class Key, class Value, class Hash = std::tr1::hash<Key> >
+class LRUCache {
+	struct entry_t {
+		Key key;
+		Value value;
+		size_t cost;
+
+		entry_t(const Key& k, const Value& v, size_t c)
+		: key(k), value(v), cost(c)
+		{}
+	};
+
+	//! Most recently used first
+	typedef std::list<entry_t> entry_list_t;
+	typedef __gnu_cxx::hash_map<Key, typename entry_list_t::iterator,
+					Hash> index_t;
+
+	entry_list_t entries;
+	index_t index;
+	CacheStats stats;
+
+	//!This class is non-copyable
+	LRUCache(const LRUCache&);
+	//!This class is non-copyable
+	LRUCache& operator=(const LRUCache&);
+
+	//! Evict entries until @p cost more bytes fit in the budget.
+	void makeRoom(size_t cost)
+	{
+		while (!entries.empty() &&
+		       stats.bytes + cost > stats.max_bytes) {
+			entry_t& victim = entries.back();
+			stats.bytes -= victim.cost;
+			index.erase(victim.key);
+			entries.pop_back();
+			--stats.entries;
+			++stats.evictions;
+		}
+	}
+
+public:
+	/**Constructor.
+	 *
+	 * @param max_bytes The cache's memory budget.
+	 */
+	LRUCache(size_t max_bytes)
+	: entries(), index(), stats(max_bytes)
+	{}
+
+	/**Look up an entry, making it the most recently used one.
+	 *
+	 * @return The entry's value or NULL if it isn't cached. The
+	 * 	   pointer is valid until the next call to put() or clear().
+	 */
+	const Value* find(const Key& key)
+	{
+		typename index_t::iterator i = index.find(key);
+		if (i == index.end()) {
+			++stats.misses;
+			return 0;
+		}
+
+		++stats.hits;
+		entries.splice(entries.begin(), entries, i->second);
+		return &(i->second->value);
+	}
+
+	/**Insert or replace an entry, evicting others if needed.
+	 *
+	 * @param cost Memory taken by the entry, in bytes.
+	 * @return false if the entry alone is bigger than the whole
+	 * 	   budget: then it isn't cached at all.
+	 */
+	bool put(const Key& key, const Value& value, size_t cost)
+	{
+		erase(key);
+		if (cost > stats.max_bytes) {
+			return false;
+		}
+
+		makeRoom(cost);
+		entries.push_front(entry_t(key, value, cost));
+		index[key] = entries.begin();
+		stats.bytes += cost;
+		++stats.entries;
+		++stats.insertions;
+
+		return true;
+	}
+
+	//! Remove an entry, if cached.
+	void erase(const Key& key)
+	{
+		typename index_t::iterator i = index.find(key);
+		if (i != index.end()) {
+			stats.bytes -= i->second->cost;
+			entries.erase(i->second);
+			index.erase(i);
+			--stats.entries;
+		}
+	}
+
+	//! Remove all entries. The counters are kept.
+	void clear()
+	{
+		entries.clear();
+		index.clear();
+		stats.bytes = 0;
+		stats.entries = 0;
+	}
+
+	//! Is @p key cached? Doesn't count as a lookup nor as a use.
+	inline bool contains(const Key& key) const
+	{
+		return index.find(key) != index.end();
+	}
+
+	inline size_t size() const { return stats.entries; }
+
+	inline const CacheStats& getStats() const { return stats; }
+};
+
+
+#endif // __CACHEUTILS_H__
+
+//EOF
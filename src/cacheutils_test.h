@@ -0,0 +1,103 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __CACHEUTILS_TEST_H
+#define __CACHEUTILS_TEST_H
+
+#include "cacheutils.hpp"
+#include "cxxtest/TestSuite.h"
+
+#include <sstream>
+
+
+class LRUCacheTestSuit : public CxxTest::TestSuite {
+public:
+	void testFindAndEvict()
+	{
+		LRUCache<uint32_t, std::string> cache(30);
+
+		TS_ASSERT(cache.put(1, "one", 10));
+		TS_ASSERT(cache.put(2, "two", 10));
+		TS_ASSERT(cache.put(3, "three", 10));
+		TS_ASSERT_EQUALS(cache.size(), 3U);
+
+		// 1 becomes the most recently used, so 2 goes first
+		TS_ASSERT_EQUALS(*cache.find(1), "one");
+		TS_ASSERT(cache.put(4, "four", 10));
+		TS_ASSERT(!cache.contains(2));
+		TS_ASSERT(cache.find(2) == 0);
+		TS_ASSERT(cache.contains(1));
+		TS_ASSERT(cache.contains(3));
+		TS_ASSERT(cache.contains(4));
+
+		// A big entry pushes out as many as needed
+		TS_ASSERT(cache.put(5, "five", 25));
+		TS_ASSERT_EQUALS(cache.size(), 1U);
+		TS_ASSERT_EQUALS(*cache.find(5), "five");
+
+		const CacheStats& stats = cache.getStats();
+		TS_ASSERT_EQUALS(stats.hits, 2U);
+		TS_ASSERT_EQUALS(stats.misses, 1U);
+		TS_ASSERT_EQUALS(stats.insertions, 5U);
+		TS_ASSERT_EQUALS(stats.evictions, 4U);
+		TS_ASSERT_EQUALS(stats.bytes, 25U);
+		TS_ASSERT_EQUALS(stats.entries, 1U);
+	}
+
+	void testReplaceAndOversized()
+	{
+		LRUCache<std::string, int> cache(100);
+
+		TS_ASSERT(cache.put("a", 1, 40));
+		TS_ASSERT(cache.put("a", 2, 60));
+		TS_ASSERT_EQUALS(cache.size(), 1U);
+		TS_ASSERT_EQUALS(cache.getStats().bytes, 60U);
+		TS_ASSERT_EQUALS(*cache.find("a"), 2);
+
+		// Bigger than the whole budget: not cached, nothing evicted
+		TS_ASSERT(!cache.put("b", 3, 101));
+		TS_ASSERT(!cache.contains("b"));
+		TS_ASSERT(cache.contains("a"));
+
+		cache.erase("a");
+		TS_ASSERT_EQUALS(cache.size(), 0U);
+		TS_ASSERT_EQUALS(cache.getStats().bytes, 0U);
+
+		// Nothing fits in an empty budget
+		LRUCache<std::string, int> none(0);
+		TS_ASSERT(!none.put("a", 1, 1));
+		TS_ASSERT(none.find("a") == 0);
+	}
+
+	void testStatsOutput()
+	{
+		CacheStats stats(1000);
+		stats.hits = 3;
+		stats.misses = 1;
+
+		std::ostringstream out;
+		write_cache_stats(out, "results", stats);
+		TS_ASSERT_DIFFERS(out.str().find("results.hits 3\n"),
+				std::string::npos);
+		TS_ASSERT_DIFFERS(out.str().find("results.hit_rate 0.75\n"),
+				std::string::npos);
+		TS_ASSERT_DIFFERS(out.str().find("results.max_bytes 1000\n"),
+				std::string::npos);
+	}
+
+	void testStatsSum()
+	{
+		CacheStats a(100), b(50);
+		a.hits = 1; a.misses = 2; a.bytes = 10; a.entries = 1;
+		b.hits = 3; b.evictions = 4; b.bytes = 20; b.entries = 2;
+
+		a += b;
+		TS_ASSERT_EQUALS(a.hits, 4U);
+		TS_ASSERT_EQUALS(a.misses, 2U);
+		TS_ASSERT_EQUALS(a.evictions, 4U);
+		TS_ASSERT_EQUALS(a.bytes, 30U);
+		TS_ASSERT_EQUALS(a.entries, 3U);
+		TS_ASSERT_EQUALS(a.max_bytes, 150U);
+	}
+};
+
+
+#endif // __CACHEUTILS_TEST_H
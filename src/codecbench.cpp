@@ -0,0 +1,176 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+/**@file codecbench.cpp
+ * @brief Inverted list decoding throughput benchmark.
+ *
+ * Compresses a set of synthetic inverted lists, with short and long lists
+ * and skewed d-gaps, with ByteWiseCompressor and StreamVByteCompressor and
+ * reports, in millions of postings per second, how fast:
+ * - each codec decompresses whole lists into inverted_list_vec_t;
+ * - each Stream-VByte integer decoder available in this CPU decodes
+ *   the raw integer streams.
+ *
+ * Usage: codecbench [n_postings] [iterations]
+ */
+
+#include "indexcompression.hpp"
+#include "strmisc.h"
+
+#include <sys/time.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+
+/***********************************************************************
+				    HELPERS
+ ***********************************************************************/
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void report(const std::string& what, size_t n_postings, int iterations,
+		double elapsed)
+{
+	std::cout << "  " << std::setw(28) << std::left << what <<
+		std::setw(10) << std::right << std::fixed <<
+		std::setprecision(1) <<
+		double(n_postings) * iterations / elapsed / 1e6 <<
+		" Mpostings/s" << std::endl;
+}
+
+//! A compressed list, ready to be decoded.
+struct EncodedList {
+	uint32_t ft;
+	std::vector<uint8_t> data;
+};
+
+/**Create lists with about @p n_postings postings in total.
+ *
+ * List lengths and gaps are skewed: a few long lists with small gaps and
+ * many short ones with large gaps, as in a real collection.
+ */
+std::vector<inverted_list_vec_t> make_lists(size_t n_postings)
+{
+	std::vector<inverted_list_vec_t> lists;
+	size_t total = 0;
+
+	srand(42);
+	for(uint32_t t = 1; total < n_postings; ++t) {
+		uint32_t ft = 1 + n_postings / (8 * t);
+		uint32_t max_gap = 1 + 2 * t;
+		inverted_list_vec_t ilist;
+		uint32_t docid = 0;
+		for(uint32_t i = 0; i < ft; ++i) {
+			docid += 1 + rand() % max_gap;
+			uint32_t fdt = 1 + (rand() % 16 == 0 ? rand() % 200 :
+						rand() % 3);
+			ilist.push_back(d_fdt_t(docid, fdt));
+		}
+		total += ft;
+		lists.push_back(ilist);
+	}
+
+	return lists;
+}
+
+template<class Compressor>
+void benchCodec(const std::string& name,
+		const std::vector<inverted_list_vec_t>& lists,
+		size_t n_postings, int iterations)
+{
+	std::vector<EncodedList> encoded(lists.size());
+	size_t bytes = 0;
+	for(size_t l = 0; l < lists.size(); ++l) {
+		encoded[l].ft = lists[l].size();
+		Compressor::compress(lists[l], encoded[l].data);
+		bytes += encoded[l].data.size();
+	}
+
+	inverted_list_vec_t out;
+	double start = now();
+	for(int i = 0; i < iterations; ++i) {
+		for(size_t l = 0; l < encoded.size(); ++l) {
+			filebuf in((const char*) &encoded[l].data[0],
+					encoded[l].data.size());
+			out.clear();
+			Compressor::decompress(encoded[l].ft, in, out);
+		}
+	}
+	report(name, n_postings, iterations, now() - start);
+	std::cout << "    " << std::setprecision(2) <<
+		double(bytes) / n_postings << " bytes/posting" << std::endl;
+}
+
+//! Decode the d-gaps of all lists as a single stream with @p decode.
+void benchDecoder(const std::string& name,
+		StreamVByteCompressor::decode_fn decode,
+		const std::vector<uint32_t>& values, int iterations)
+{
+	StreamVByteCompressor::charvec_t stream;
+	StreamVByteCompressor::encode(&values[0], values.size(), stream);
+
+	std::vector<uint32_t> out(values.size());
+	const uint8_t* end = &stream[0] + stream.size();
+	double start = now();
+	for(int i = 0; i < iterations; ++i) {
+		decode(&stream[0], end, values.size(), &out[0]);
+	}
+	report("ints " + name, values.size(), iterations, now() - start);
+	if (out != values) {
+		std::cout << "  ** WRONG OUTPUT **" << std::endl;
+	}
+}
+
+
+/***********************************************************************
+				      MAIN
+ ***********************************************************************/
+
+int main(int argc, char* argv[])
+{
+	size_t n_postings = 10000000;
+	int iterations = 5;
+
+	if (argc > 1) { n_postings = fromString<size_t>(argv[1]); }
+	if (argc > 2) { iterations = fromString<int>(argv[2]); }
+
+	std::vector<inverted_list_vec_t> lists = make_lists(n_postings);
+	std::vector<uint32_t> gaps;
+	for(size_t l = 0; l < lists.size(); ++l) {
+		uint32_t last = 0;
+		for(size_t i = 0; i < lists[l].size(); ++i) {
+			gaps.push_back(lists[l][i].first - last);
+			last = lists[l][i].first;
+		}
+	}
+	n_postings = gaps.size();
+
+	std::cout << "# " << lists.size() << " lists, " << n_postings <<
+		" postings, " << iterations << " iterations" << std::endl;
+	std::cout << "# Stream-VByte decoder: " <<
+		StreamVByteCompressor::implementationName() << std::endl;
+
+	benchCodec<ByteWiseCompressor>("ByteWiseCompressor", lists,
+					n_postings, iterations);
+	benchCodec<StreamVByteCompressor>("StreamVByteCompressor", lists,
+					n_postings, iterations);
+
+	benchDecoder("scalar", StreamVByteCompressor::decodeScalar, gaps,
+			iterations);
+#ifdef INDEXCOMPRESSION_X86
+	if (__builtin_cpu_supports("ssse3")) {
+		benchDecoder("ssse3", StreamVByteCompressor::decodeSSSE3, gaps,
+				iterations);
+	}
+#endif
+
+	return 0;
+}
+
+//EOF
@@ -3,6 +3,7 @@
 #define __CONFIG_H__
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <string>
 
 
@@ -15,6 +16,31 @@
 //! Port used the the HTTP server.
 const int SERVER_PORT =  8090;
 
+//! Number of threads serving HTTP requests in the web interfaces.
+const int HTTP_WORKERS = 8;
+
+//! Number of matches shown by the Vector-Space Model web interface.
+const size_t VECTORIAL_TOP_K = 100;
+
+/**Maximum number of terms a prefix query term ("univers*") expands into.
+ *
+ * Terms past this limit, in the vocabulary's sorted order, are ignored.
+ */
+const size_t PREFIX_EXPANSION_LIMIT = 1000;
+
+//! Memory budget of the web interfaces' query results cache, in bytes.
+const size_t RESULT_CACHE_SIZE = 64<<20;
+
+//! Memory budget of the query resolvers' decoded inverted lists cache.
+const size_t LIST_CACHE_SIZE = 256<<20;
+
+/**Number of recently read inverted lists to remember.
+ *
+ * A list is only decoded and cached if it is read again before this many
+ * other lists are.
+ */
+const size_t LIST_CACHE_ADMISSION_WINDOW = 1<<16;
+
 /**Amount of entries to reserve during a docid reading
  *
  * @see read_docid_list
@@ -22,8 +48,44 @@ const int SERVER_PORT =  8090;
 const size_t DOCIDLIST_RESERVE = 1<<20;
 
 
-//! Number of crawler's working threads 
-const int N_OF_WORKERS = 100;
+//! Number of crawler's threads downloading pages, each with many transfers
+const int N_OF_FETCH_LOOPS = 2;
+
+//! Maximum number of pages being downloaded or waiting to be parsed
+const size_t MAX_FETCH_JOBS = 4000;
+
+/**Number of independent slices of the crawler's frontier.
+ *
+ * Each has its own lock, so there should be many more of them than
+ * threads crawling.
+ */
+const size_t N_OF_FRONTIER_SHARDS = 64;
+
+/**Size of the Bloom filter in front of the set of seen URLs, in bits.
+ *
+ * About 10 bits per URL crawled keep false positives, which cost a look
+ * in the on-disk set, at 1%.
+ */
+const uint64_t URL_SEEN_BLOOM_BITS = 1ULL<<30;
+
+//! Number of seen URLs kept in memory before merging them into the disk.
+const size_t URL_SEEN_DELTA_SIZE = 1<<20;
+
+/**Number of pages kept in memory at each end of a domain's queue.
+ *
+ * The ones in between are spilled to disk, so this bounds the memory each
+ * domain's pending pages take.
+ */
+const size_t DOMAIN_QUEUE_WINDOW = 64;
+
+/**Longest interval between requests to a domain we honour, in seconds.
+ *
+ * Longer robots.txt Crawl-delays are cut down to this.
+ */
+const int MAX_CRAWL_DELAY = 120;
+
+//! Number of crawler's threads parsing and storing downloaded pages
+const int N_OF_WORKERS = 4;
 
 const std::string CRAWLER_STORE_DIR = "/ri/tmacam/down/";
 
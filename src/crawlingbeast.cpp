@@ -8,6 +8,7 @@
 
 #include "deepthought.h"
 #include "paranoidandroid.h"
+#include "fetchengine.h"
 #include "sauron.h"
 #include "config.h"
 
@@ -41,9 +42,13 @@ int main(int argc, char* argv[])
 
 	MordorTuristGuide.start();
 
+	std::cout << "Starting the fetch engine" << std::endl;
+	FetchEngine engine(boss, N_OF_FETCH_LOOPS, MAX_FETCH_JOBS);
+	engine.start();
+
 	std::cout << "Starting paranoid crawling androids" << std::endl;
 	for(int i = 0; i < N_OF_WORKERS; ++i){
-		looser  = new ParanoidAndroid(boss);
+		looser  = new ParanoidAndroid(boss, engine);
 		looser->start();
 		ArmyOfMarvins.push_back( looser );
 	}
@@ -58,6 +63,9 @@ int main(int argc, char* argv[])
 
 	std::cout << "Exiting. Waiting for threads... What a bugger!" << std::endl;
 
+	// Downloads in flight still get parsed
+	engine.join();
+	engine.stopParsers(N_OF_WORKERS);
 
 	for(int i = 0; i < N_OF_WORKERS; ++i){
 		looser = ArmyOfMarvins.front();
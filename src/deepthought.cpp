@@ -42,52 +42,79 @@ void DeepThought::unserialize()
 	addPages(pending,false); // not unserializing - adding pending pages
 }
 
-//@synchronized(DOMAIN_LOCK) // domains may be updated while we read it...
-void DeepThought::addPages(const URLSet& urls, bool unserializing)
+DeepThought::~DeepThought()
 {
-	AutoLock synchronized(DOMAIN_LOCK);
+	for(size_t i = 0; i < shards.size(); ++i) {
+		delete shards[i];
+	}
+}
 
+void DeepThought::addPages(const URLSet& urls, bool unserializing)
+{
 	URLSet::const_iterator u;
 	DomainURLSetMap::iterator d;
 
-	// Group pages by domain
-	DomainURLSetMap domains; // It seemed so much nicer in python...
+	// Weed out the known ones, ignoring non-br domains
+	std::vector<const BaseURLParser*> candidates;
+	std::vector<URLSeenSet::fingerprint_t> fps;
 	for(u = urls.begin(); u != urls.end(); ++u){
-		domains[u->host].insert(*u);
+		if (endswith(u->host, ".br")) {
+			candidates.push_back(&(*u));
+			fps.push_back(URLSeenSet::fingerprint(u->str()));
+		}
+	}
+	std::vector<bool> unseen;
+	seen_urls.insert(fps, unseen);
+
+	// Group new pages by domain
+	DomainURLSetMap domains; // It seemed so much nicer in python...
+	for(size_t i = 0; i < candidates.size(); ++i){
+		if (unseen[i]) {
+			domains[candidates[i]->host].insert(*candidates[i]);
+		}
 	}
 
 	// Add pages per domain:
 	for(d = domains.begin(); d != domains.end(); ++d) {
 		const std::string& domainname = d->first;
 		URLSet& pages = d->second;
-		if (not endswith(domainname, ".br")) {
-			//ignore non-br domains
-			continue;
+
+		FrontierShard& shard = shardOf(domainname);
+		Domain* dom;
+		bool enqueued;
+		{
+			AutoLock synchronized(shard.lock);
+			dom = getDomain(shard, domainname);
 		}
-		// New domain...
-		if ( known_domains.find(domainname) == known_domains.end() ) {
-			addNewDomain(domainname, pages, unserializing);
-			// pages added by Domains constructor,
-			// domain was put in queue by _addNewDomain
-		} else {
-			Domain* dom = known_domains[domainname];
-			dom->addPages(pages, unserializing);
-			enqueueDomain(dom);
+		/* Registering pages doesn't hold up the shard: the domain's
+		 * queue has its own lock, that empty() and queueLength()
+		 * take too.
+		 */
+		dom->addPages(pages, unserializing);
+		{
+			AutoLock synchronized(shard.lock);
+			enqueued = shard.enqueue(dom);
+		}
+		if (enqueued) {
+			notifyNewWork();
 		}
 	}
 }
 
-//@synchronized(DOMAIN_LOCK)
-Domain* DeepThought::addNewDomain(const std::string& domain_name, const URLSet& pages, bool unserializing)
+//@synchronized(shard.lock)
+Domain* DeepThought::getDomain(FrontierShard& shard,
+				const std::string& domain_name)
 {
-	//XXX This function is only called by addPages,
-	//XXX that already holds DOMAIN_LOCK
-	//XXX AutoLock synchronized(DOMAIN_LOCK);
-	
-	Domain* dom = new Domain(domain_name, pages, *this, unserializing);
-	dom->timestamp = makeNextValidTimestamp();
-	known_domains[domain_name] = dom;
-	enqueueDomain(dom);
+	DomainMap::iterator known = shard.domains.find(domain_name);
+	if (known != shard.domains.end()) {
+		return known->second;
+	}
+
+	// New domain...
+	Domain* dom = new Domain(domain_name, URLSet(), *this, false,
+				getSpillFilename(domain_name));
+	dom->timestamp = makeNextValidTimestamp(dom);
+	shard.domains[domain_name] = dom;
 	return dom;
 }
 
@@ -126,42 +153,44 @@ std::string DeepThought::getDocIdPath(docid_t docid)
 	return id_path;
 }
 
-//@synchronized(DOMAIN_LOCK)
-void DeepThought::enqueueDomain(Domain* dom)
+std::string DeepThought::getSpillSubdir(int n)
 {
-	//XXX This function is only called by addPages, and addNewDomain
-	//XXX that already holds DOMAIN_LOCK
-	//XXX AutoLock synchronized(DOMAIN_LOCK);
+	std::ostringstream subdir;
 
-	bool was_empty = false;
-	if (domainQueuesEmpty()) {
-		was_empty = true;
-	}
-	// should this domain really be enqueued?
-	if (not dom->empty() and not dom->in_queue) {
-		dom->in_queue = true;
-		// our hopes and expectations
-		// black holes and revelations
-		idle_domain_queue.push_back(dom);
-	}
-	// If the list of domains in queue was empty,  there may be threads
-	// waiting to be notified
-	if (was_empty) DOMAIN_LOCK.notifyAll();
+	subdir << std::uppercase << std::hex << std::setw(2) <<
+		std::setfill('0') << n;
+	return subdir.str();
 }
 
-//@synchronized(DOCID_LOCK)
-docid_t DeepThought::getNewDocId()
+std::string DeepThought::getSpillFilename(const std::string& domain_name)
 {
-	AutoLock synchronized(DOCID_LOCK);
+	int subdir = FNV::hash32(domain_name) & 0xFF;
 
-	return ++last_docid;
+	return frontier_dir + getSpillSubdir(subdir) + "/" + domain_name;
 }
 
-//@synchronized(DOCID_LOCK)
-docid_t DeepThought::getLastDocId()
+//@synchronized(WORK_LOCK)
+void DeepThought::notifyNewWork()
 {
-	AutoLock synchronized(DOCID_LOCK);
+	AutoLock synchronized(WORK_LOCK);
+
+	++frontier_generation;
+	WORK_LOCK.notifyAll();
+}
+
+void DeepThought::stopPlease()
+{
+	this->running = false;
+	notifyNewWork();
+}
 
+docid_t DeepThought::getNewDocId()
+{
+	return __sync_add_and_fetch(&last_docid, 1);
+}
+
+docid_t DeepThought::getLastDocId()
+{
 	return this->last_docid;
 }
 
@@ -190,114 +219,143 @@ void DeepThought::incCrawled(bool downloaded, docid_t id, const std::string& url
 
 	if (downloaded) {
 		++download_counter;
-		crawllog << now() << " DOWN\t" << id << "\t"<< url << std::endl;
+		crawllog << now() << " DOWN\t" << id << "\t"<< url << "\n";
 	} else {
-		crawllog << now() << " CRAW\t" << id << "\t"<< url << std::endl;
+		crawllog << now() << " CRAW\t" << id << "\t"<< url << "\n";
+	}
+}
+
+void DeepThought::flushLogs()
+{
+	{
+		AutoLock synchronized(STORE_LOCK);
+		store.flush();
 	}
+
+	AutoLock synchronized(STATS_LOCK);
+	crawllog.flush();
 }
 
 
 //@synchronized(STATS_LOCK)
-//@synchronized(DOMAIN_LOCK)
 crawl_stat_t DeepThought::getCrawlingStats()
 {
-	AutoLock synchronized(STATS_LOCK);
-	AutoLock synchronized_domains(DOMAIN_LOCK);
-
+	docid_t n_domains = 0;
+	docid_t n_active = 0;
+	docid_t n_idle = 0;
 	time_t next_ts = 0;
-	if (not idle_domain_queue.empty()) {
-		next_ts = idle_domain_queue.front()->timestamp;
+
+	for(size_t i = 0; i < shards.size(); ++i) {
+		FrontierShard& shard = *shards[i];
+		AutoLock synchronized(shard.lock);
+
+		n_domains += shard.domains.size();
+		n_active += shard.active_queue.size();
+		n_idle += shard.idle_queue.size();
+		if (not shard.idle_queue.empty()) {
+			time_t ts = shard.idle_queue.top()->timestamp;
+			if (next_ts == 0 or ts < next_ts) { next_ts = ts; }
+		}
 	}
 
+	AutoLock synchronized(STATS_LOCK);
+
 	return crawl_stat_t(  getLastDocId(), crawled_counter, download_counter,
-				known_domains.size(),active_domain_queue.size(),
-				idle_domain_queue.size(), next_ts);
+				n_domains, n_active, n_idle, next_ts);
 }
 
 
-//@synchronized(DOMAIN_LOCK)
-PageRef DeepThought::popPage()
+PageRef DeepThought::popPage(size_t worker)
 {
-	AutoLock synchronized(DOMAIN_LOCK);
+	const size_t n = shards.size();
 
-	PageRef page;
-	Domain* dom = 0;
-
-	// print currentThread(), "popPage", "WAIT" # DEBUG
-	while (domainQueuesEmpty()) {
-		DOMAIN_LOCK.wait(); 
-	}
-	if ( not domainQueuesEmpty() ) {
-		// Queue management...
-		/* Move elegible domains from the idle queue
-		 * This first refresh MUST be done despite the loop
-		 * bellow because there may be "better" and elegible domains
-		 * in the idle queue that otherwise would not be crawled until
-		 * the active queue was empty.
-		 */
-		refreshActiveDomainQueue();
-		while(active_domain_queue.empty()) {
-			/* To avoid sleep/timing issues, we will do this
-			 * inside a loop
-			 */
-			waitUntillSafeToDownload();
-			refreshActiveDomainQueue();
+	while (running) {
+		unsigned long generation;
+		{
+			AutoLock synchronized(WORK_LOCK);
+			generation = frontier_generation;
 		}
-		assert( not active_domain_queue.empty());
-
-		dom = active_domain_queue.top();
-		active_domain_queue.pop();
-
-		dom->timestamp = makeNextValidTimestamp();
 
-		try{
-			page = dom->popPage();
-		} catch(GetRobotsForMePlzException) {
-			// Ok, I got it, we will ask
-			// someone else to get the robots.txt
-			// for you. Just rest for now.
-			idle_domain_queue.push_back(dom);
-			throw;
+		// Our own shard first, then steal from the others
+		time_t next_ts = 0;
+		time_t eligible_ts = now();
+		for(size_t k = 0; k < n; ++k) {
+			FrontierShard& shard = *shards[(worker + k) % n];
+			AutoLock synchronized(shard.lock);
+
+			shard.refreshActiveQueue(eligible_ts);
+			if (not shard.active_queue.empty()) {
+				return popPageFromShard(shard);
+			}
+			if (not shard.idle_queue.empty()) {
+				time_t ts = shard.idle_queue.top()->timestamp;
+				if (next_ts == 0 or ts < next_ts) {
+					next_ts = ts;
+				}
+			}
 		}
 
-		// Deal with empty domains
-		if ( dom->empty() ) {
-			//std::cerr << "DEBUG DeepThought popPage removed domain " << dom->name << std::endl;
-			dom->in_queue = false;
-		} else {
-			// non-empty domains should be added back to the queue
-			idle_domain_queue.push_back(dom);
+		/* Nothing elegible anywhere. Wait untill the first domain
+		 * is - or for new ones, if none was enqueued meanwhile.
+		 *
+		 * Domains others put back in the idle queues after our look
+		 * won't be elegible before MINIMUM_INTERVAL from now, so
+		 * waking up then at the latest is enough not to miss them.
+		 */
+		time_t deadline = eligible_ts + MINIMUM_INTERVAL;
+		if (next_ts and next_ts < deadline) {
+			deadline = next_ts;
+		}
+		AutoLock synchronized(WORK_LOCK);
+		if (running and generation == frontier_generation) {
+			WORK_LOCK.timedWait(deadline);
 		}
 	}
 
-	return page;
+	return PageRef();
 }
 
-void DeepThought::waitUntillSafeToDownload()
+//@synchronized(shard.lock)
+PageRef DeepThought::popPageFromShard(FrontierShard& shard)
 {
-	int time_left = 0;
-	Domain* dom = 0;
+	PageRef page;
 
-	if (active_domain_queue.empty()) {
-		// Sanity check - there must be idle domains....
-		if ( idle_domain_queue.empty()) {
-			throw std::runtime_error("No domains left to crawl!");
-		}
+	assert( not shard.active_queue.empty());
 
-		dom = idle_domain_queue.front();
+	Domain* dom = shard.active_queue.top();
+	shard.active_queue.pop();
 
-		time_left = dom->timestamp - now();
-		if (time_left > 0) {
-			sleep(time_left + 1); // +1 just to avoid timing issues
-		}
-	} // else, there is no reason to wait here...
+	dom->timestamp = makeNextValidTimestamp(dom);
+
+	try{
+		page = dom->popPage();
+	} catch(GetRobotsForMePlzException) {
+		// Ok, I got it, we will ask
+		// someone else to get the robots.txt
+		// for you. Just rest for now.
+		shard.idle_queue.push(dom);
+		throw;
+	}
+
+	// Deal with empty domains
+	if ( dom->empty() ) {
+		dom->in_queue = false;
+	} else {
+		// non-empty domains should be added back to the queue
+		shard.idle_queue.push(dom);
+	}
+
+	return page;
 }
 
+//@synchronized(STORE_LOCK)
 docid_t DeepThought::registerURL(std::string new_url)
 {
 	docid_t new_id = getNewDocId();
-	//FIXME shouldn't we have a lock just for this file?
-	store << new_id << "\t" << new_url << std::endl;
+
+	// No flushing here: see flushLogs()
+	AutoLock synchronized(STORE_LOCK);
+	store << new_id << "\t" << new_url << "\n";
 
 	return new_id;
 }
@@ -324,20 +382,36 @@ void DeepThought::makedirs(std::string path)
 
 
 
-void DeepThought::refreshActiveDomainQueue()
+/* ********************************************************************** *
+				 FRONTIER SHARD
+ * ********************************************************************** */
+
+void FrontierShard::refreshActiveQueue(time_t eligible_ts)
 {
 	Domain* dom = NULL;
-	time_t eligible_ts = now();
 
-	while( not idle_domain_queue.empty() and 
-		idle_domain_queue.front()->timestamp <= eligible_ts)
+	while( not idle_queue.empty() and
+		idle_queue.top()->timestamp <= eligible_ts)
 	{
-		dom = idle_domain_queue.front();
+		dom = idle_queue.top();
 		dom->previous_queue_length = dom->queueLength();
 		// Move the domain from the idle into the active queue
-		idle_domain_queue.pop_front();
-		active_domain_queue.push(dom);
+		idle_queue.pop();
+		active_queue.push(dom);
+	}
+}
+
+bool FrontierShard::enqueue(Domain* dom)
+{
+	// should this domain really be enqueued?
+	if (not dom->empty() and not dom->in_queue) {
+		dom->in_queue = true;
+		// our hopes and expectations
+		// black holes and revelations
+		idle_queue.push(dom);
+		return true;
 	}
+	return false;
 }
 
 
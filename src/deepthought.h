@@ -12,14 +12,19 @@
 #include "common.h"
 #include "threadingutils.h"
 #include "domains.h"
+#include "urlseenset.h"
+#include "config.h"
+#include "fnv1hash.hpp"
 
 #include <time.h>
 
+#include <algorithm>
 #include <fstream>
 #include <deque>
 #include <ext/hash_set>
 #include <ext/hash_map>
 #include <queue>
+#include <vector>
 
 
 
@@ -47,7 +52,7 @@ struct eqdomptr
 
 typedef __gnu_cxx::hash_map<std::string, Domain*,str_hash,eqstr> DomainMap;
 //typedef std::priority_queue<Domain*,std::vector<Domain*>,DomainPtrSmallest> DomainQueue;
-typedef std::deque<Domain*> OldestDomainQueue;
+typedef std::priority_queue<Domain*,std::vector<Domain*>,DomainPtrOldest> OldestDomainQueue;
 typedef std::priority_queue<Domain*,std::vector<Domain*>,DomainPtrLargerSitesFirst> LargestDomainQueue;
 typedef __gnu_cxx::hash_map<std::string, URLSet, str_hash, eqstr> DomainURLSetMap;
 
@@ -58,7 +63,7 @@ struct crawl_stat_t {
 	docid_t n_domains;	//!< Number of known domains
 	docid_t n_active;	//!< Lenght of the active domain queue
 	docid_t n_idle;		//!< Lenght of the idle domain queue
-	time_t next_ts;	//!< timestamp of the first domain in domain_queue
+	time_t next_ts;	//!< timestamp of the first domain in the idle queues
 
 	crawl_stat_t( docid_t seen=0, docid_t crawled=0, docid_t downloaded=0,
 		      docid_t n_domains=0, docid_t n_active=0,
@@ -72,6 +77,57 @@ struct crawl_stat_t {
 const std::string PAGE_DATA_PREFIX = "/data.gz";
 
 
+/* ********************************************************************** *
+				 FRONTIER SHARD
+ * ********************************************************************** */
+
+/**A slice of the crawling frontier: the domains whose names hash to it.
+ *
+ * Each shard has its own lock and domain queues, so threads working on
+ * different shards never wait for each other.
+ *
+ * Domains wait in idle_queue, a min-heap on the time they may be crawled
+ * again, until they are elegible and get moved to active_queue. A domain's
+ * timestamp must not change while it is in idle_queue.
+ */
+struct FrontierShard {
+	//! controls access to domains, active_queue and idle_queue
+	CatholicShameMutex lock;
+
+	//!@name Access to these structures must be done holding lock.
+	//@{
+	DomainMap domains;
+	LargestDomainQueue active_queue;
+	OldestDomainQueue idle_queue;
+	//@}
+
+	FrontierShard()
+	: lock(), domains(), active_queue(), idle_queue()
+	{}
+
+	//!Are both domain queues empty?
+	inline bool empty() const
+	{
+		return active_queue.empty() && idle_queue.empty();
+	}
+
+	/**Take domains elegible at @p now from idle_queue into
+	 * active_queue.
+	 *
+	 * It also takes care of updating  the domain's
+	 * previous_queue_length.
+	 */
+	void refreshActiveQueue(time_t now);
+
+	/**Add a Domain instance to the download queue, if it has pages
+	 * and isn't there already.
+	 *
+	 * @return true if the domain was enqueued.
+	 */
+	bool enqueue(Domain* dom);
+};
+
+
 /* ********************************************************************** *
 				  DEEP THOUGHT
 
@@ -85,10 +141,13 @@ class DeepThought : public AbstractHyperDimentionalCrawlerDeity {
 	//@{
 	//!Error log access lock.
 	CatholicShameMutex ERRLOG_LOCK;
-	//!DocID generator lock
-	CatholicShameMutex DOCID_LOCK;
-	//! controls access to known_domains, active_domain_queue and idle_domain_queue
-	BigBangBabyConditional DOMAIN_LOCK; 
+	//!Document Store access lock.
+	CatholicShameMutex STORE_LOCK;
+	/**Idle workers wait on it for new domains in the frontier.
+	 *
+	 * It controls access to frontier_generation.
+	 */
+	BigBangBabyConditional WORK_LOCK;
 	//! Statistics variables' lock
 	CatholicShameMutex STATS_LOCK;
 	//@}
@@ -110,15 +169,23 @@ class DeepThought : public AbstractHyperDimentionalCrawlerDeity {
 	std::string crawllog_filename;
 	std::ofstream crawllog;
 
+	//!Where domains' queues spill pending pages to. See DomainQueue.
+	std::string frontier_dir;
+
+	//!Every URL ever added.
+	URLSeenSet seen_urls;
+
 	//!@name Domain control
-	//!Access to these structures must be done helding DOMAIN_LOCK.
 	//@{
-	DomainMap known_domains;
-	LargestDomainQueue active_domain_queue;
-	OldestDomainQueue idle_domain_queue;
+	//! The frontier, partitioned by domain name hash.
+	std::vector<FrontierShard*> shards;
+
+	//! Incremented whenever a domain is enqueued. See popPage().
+	unsigned long frontier_generation;
 	//@}
-	
-	docid_t last_docid;
+
+	//! Only changed with atomic operations. See getNewDocId().
+	volatile docid_t last_docid;
 
 
 	docid_t download_counter;
@@ -134,7 +201,8 @@ public:
 	 *
          * @param store_dir The directory where we save our files
 	 */
-	DeepThought(std::string store_dir="/tmp/")
+	DeepThought(std::string store_dir="/tmp/",
+		    size_t n_shards=N_OF_FRONTIER_SHARDS)
 	: AbstractHyperDimentionalCrawlerDeity(),
 	  store_dir(store_dir),
 	  store_filename(store_dir + "/docids.dat"),
@@ -143,9 +211,11 @@ public:
 	  errlog(errlog_filename.c_str(), std::ios::app),
 	  crawllog_filename(store_dir + "/craw.log"),
 	  crawllog(crawllog_filename.c_str(), std::ios::app),
-	  known_domains(),
-	  active_domain_queue(),
-	  idle_domain_queue(),
+	  frontier_dir(store_dir + "/frontier/"),
+	  seen_urls(store_dir + "/seen.dat", URL_SEEN_BLOOM_BITS,
+		    URL_SEEN_DELTA_SIZE),
+	  shards(),
+	  frontier_generation(0),
 	  last_docid(0),
 	  download_counter(0),
 	  crawled_counter(0),
@@ -153,10 +223,19 @@ public:
 	{
 		// Turn store exceptions on
 		store.exceptions( std::ios_base::badbit|std::ios_base::failbit);
-		// FIXME set store unbuffered
 		errlog.rdbuf()->pubsetbuf(0,0);
+
+		for(size_t i = 0; i < n_shards; ++i) {
+			shards.push_back(new FrontierShard());
+		}
+
+		for(int i = 0; i < 256; ++i) {
+			makedirs(frontier_dir + getSpillSubdir(i));
+		}
 	}
 
+	~DeepThought();
+
 	/**Get the list of known docIds/URLs from docids file.
 	 *
 	 * @warning You must be sure that you are the sole user of this
@@ -167,26 +246,34 @@ public:
 
 	/**Enqueues pages for download.
 	 *
-	 * If pages are already known, nothing is done.
+	 * If pages are already known, nothing is done. All the URLs are
+	 * looked up in seen_urls at once.
 	 *
 	 * @param urls a list of url strings.
 	 * @param unserializing Are we reading URLs back from the disk?
 	 *
-	 * @synchronized(DOMAIN_LOCK) // domains may be updated while we read it...
+	 * Each domain's shard is locked only to find the domain and to
+	 * enqueue it: pages are registered holding just the domain's lock.
 	 *
 	 * @note .br only domains is implemented here!
 	 */
 	void addPages(const URLSet& urls, bool unserializing=false);
 
-	/**Creates a new domain, adding a group of pages to it.
+	/**Find a domain, creating it if it is a new one.
 	 *
-	 * @param unserializing Are we reading URLs back from the disk?
-	 * @return the Domain object of the new domain.
-	 *
-	 * @synchronized(DOMAIN_LOCK)
+	 * @warning This function must be called by a thread
+	 * holding @p shard 's lock.
 	 */
-	Domain* addNewDomain(const std::string& domain_name,
-			const URLSet& pages, bool unserializing);
+	Domain* getDomain(FrontierShard& shard,
+			  const std::string& domain_name);
+
+	//! The shard a domain belongs to.
+	inline FrontierShard& shardOf(const std::string& domain_name)
+	{
+		return *shards[FNV::hash64(domain_name) % shards.size()];
+	}
+
+	inline size_t shardCount() const { return shards.size(); }
 
 	/**Checks if a given page was already downloaded.
 	 *
@@ -204,19 +291,21 @@ public:
 
 	std::string getDocIdPath(docid_t docid);
 
-
-	/**Add a Domain instance to the download queue.
+	/**Where a domain's queue spills its pending pages to.
 	 *
-	 * @synchronized(DOMAIN_LOCK)
+	 * Domains are spread over 256 subdirectories of frontier_dir.
 	 */
-	void enqueueDomain(Domain* dom);
+	std::string getSpillFilename(const std::string& domain_name);
 
-	//!Are both domain queues empty?
-	inline bool domainQueuesEmpty()
-	{
-		return active_domain_queue.empty() &&
-			idle_domain_queue.empty();
-	}
+	//! The name of frontier_dir's @p n -th subdirectory.
+	static std::string getSpillSubdir(int n);
+
+
+	/**Wake up the workers waiting for domains in popPage().
+	 *
+	 * @synchronized(WORK_LOCK)
+	 */
+	void notifyNewWork();
 
 	//@synchronized(ERRLOG_LOCK)
 	void reportBadCrawling(docid_t id, const std::string& url,
@@ -226,25 +315,52 @@ public:
 	//@synchronized(STATS_LOCK)
 	void incCrawled(bool downloaded, docid_t id, const std::string& url);
 
+	/**Flush the document store and the crawling log.
+	 *
+	 * They are written without flushing every line, so call this once
+	 * in a while.
+	 *
+	 * @synchronized(STORE_LOCK)
+	 * @synchronized(STATS_LOCK)
+	 */
+	void flushLogs();
+
 	inline time_t now() {return time(NULL); }
 
-	inline time_t makeNextValidTimestamp() { return now() + MINIMUM_INTERVAL; }
+	/**When may @p dom be crawled again, if it is crawled now.
+	 *
+	 * We wait MINIMUM_INTERVAL at least, or the domain's robots.txt
+	 * Crawl-delay - up to MAX_CRAWL_DELAY.
+	 *
+	 * Takes @p dom's PAGES_LOCK to read its Crawl-delay.
+	 */
+	inline time_t makeNextValidTimestamp(const Domain* dom)
+	{
+		int interval = std::min(dom->crawlDelay(), MAX_CRAWL_DELAY);
+		return now() + std::max(interval, MINIMUM_INTERVAL);
+	}
 
 	/**Get a page to download from the queue.
 	 *
 	 * From the first domain in queue, get the first page in it's queue.
 	 *
-	 * @return a PageRef object - it can be a Null-one, but
-	 * 	   I sincerly doubt this will ever happen
+	 * Shards are tried starting at the worker's own one, stealing from
+	 * the others if it has no domain elegible now. If no shard has,
+	 * wait until one does or until a domain is enqueued - waiting on a
+	 * condition, so no locks are held meanwhile.
+	 *
+	 * @param worker The caller's index. Workers with different indexes
+	 * 	  start at different shards.
 	 *
-	 * @synchronized(DOMAIN_LOCK)
+	 * @return a PageRef object - it can be a Null-one if all the pages
+	 * 	   of a domain are disallowed or if the crawler was
+	 * 	   stopped meanwhile.
+	 *
+	 * @throw GetRobotsForMePlzException
 	 */
-	PageRef popPage();
+	PageRef popPage(size_t worker);
 
-	/**If needed, sleep untill it's safe to download the first domain
-	 * in queue.
-	 */
-	void waitUntillSafeToDownload();
+	PageRef popPage() { return popPage(0); }
 
 
 	/**Register a new found URL and assigns a docID to it.
@@ -255,13 +371,13 @@ public:
 	 *
 	 * @see getNewDocId
 	 * 
-	 * @note it was synchronized(DOCID_LOCK) but now only getNewDocId is.
+	 * @synchronized(STORE_LOCK)
 	 */
 	docid_t registerURL(std::string new_url);
 
 	/**Get a new docID.
 	 *
-	 * @synchronized(DOCID_LOCK)
+	 * Lock-free.
 	 */
 	docid_t getNewDocId();
 
@@ -281,29 +397,26 @@ public:
 	/**Retrieve crawling statistics.
 	 *
 	 * @synchronized(STATS_LOCK)
-	 * @synchronized(DOMAIN_LOCK)
-	 * @note this function calls getLastDocId, which in turn is
-	 *       syncronized on DOCID_LOCK.
+	 * @note Shards are locked one at a time, so the numbers may not
+	 * 	 add up exactly while the crawler runs.
 	 */
 	crawl_stat_t getCrawlingStats();
 
-	//!@synchronized(DOCID_LOCK)
 	docid_t getLastDocId();
 
-	void stopPlease() { this->running = false;}
+	/**Stop crawling.
+	 *
+	 * Workers waiting for domains in popPage() are woken up.
+	 */
+	void stopPlease();
 
 protected:
-	
-	/**Take elegible domains from idle_domain_queue into
-	 * active_domain_queue.
-	 *
-	 * It also takes care of updating  the domain's
-	 * previous_queue_length.
+	/**Pop a page from the best active domain of @p shard.
 	 *
 	 * @warning This function must be called by a thread
-	 * holding DOMAIN_LOCK.
+	 * holding @p shard 's lock.
 	 */
-	void refreshActiveDomainQueue();
+	PageRef popPageFromShard(FrontierShard& shard);
 
 };
 
@@ -0,0 +1,140 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __DEEPTHOUGHT_TEST_H
+#define __DEEPTHOUGHT_TEST_H
+
+#include "deepthought.h"
+#include "cxxtest/TestSuite.h"
+
+#include <stdlib.h>
+#include <set>
+
+
+//! Registers URLs in a loop, to race the others.
+struct URLRegistrar : public BaseThread {
+	DeepThought& manager;
+	std::vector<docid_t> ids;
+
+	URLRegistrar(DeepThought& manager) : manager(manager), ids() {}
+
+	void* run()
+	{
+		for(int i = 0; i < 1000; ++i) {
+			ids.push_back(manager.registerURL("http://a.com.br/"));
+		}
+		return NULL;
+	}
+};
+
+//! Waits for a page in an empty frontier.
+struct PagePopper : public BaseThread {
+	DeepThought& manager;
+	PageRef page;
+
+	PagePopper(DeepThought& manager) : manager(manager), page() {}
+
+	void* run()
+	{
+		page = manager.popPage(3);
+		return NULL;
+	}
+};
+
+class DeepThoughtTestSuit : public CxxTest::TestSuite {
+	std::string store_dir;
+
+public:
+	void setUp()
+	{
+		char dir[] = "/tmp/deepthought_testXXXXXX";
+		store_dir = mkdtemp(dir);
+	}
+
+	void tearDown()
+	{
+		system(("rm -rf " + store_dir).c_str());
+	}
+
+	void testConcurrentDocIds()
+	{
+		DeepThought manager(store_dir, 4);
+		std::vector<URLRegistrar*> threads;
+		for(int i = 0; i < 8; ++i) {
+			threads.push_back(new URLRegistrar(manager));
+			threads.back()->start();
+		}
+
+		std::set<docid_t> ids;
+		for(size_t i = 0; i < threads.size(); ++i) {
+			threads[i]->join();
+			ids.insert(threads[i]->ids.begin(),
+				   threads[i]->ids.end());
+			delete threads[i];
+		}
+
+		TS_ASSERT_EQUALS(ids.size(), 8000U);
+		TS_ASSERT_EQUALS(*ids.begin(), 1U);
+		TS_ASSERT_EQUALS(*ids.rbegin(), 8000U);
+		TS_ASSERT_EQUALS(manager.getLastDocId(), 8000U);
+	}
+
+	void testAddPagesAcrossShards()
+	{
+		DeepThought manager(store_dir, 4);
+		URLSet urls;
+		for(int d = 0; d < 20; ++d) {
+			std::string host = "http://www.d" + toString(d) +
+				".com.br/";
+			urls.insert(BaseURLParser(host));
+			urls.insert(BaseURLParser(host + "a.html"));
+		}
+		urls.insert(BaseURLParser("http://www.ignored.com/"));
+		manager.addPages(urls);
+		// Known pages are ignored
+		manager.addPages(urls);
+
+		crawl_stat_t stats = manager.getCrawlingStats();
+		TS_ASSERT_EQUALS(stats.n_domains, 20U);
+		TS_ASSERT_EQUALS(stats.n_idle, 20U);
+		TS_ASSERT_EQUALS(stats.n_active, 0U);
+		TS_ASSERT_EQUALS(stats.seen, 40U);
+		TS_ASSERT_DIFFERS(stats.next_ts, 0);
+	}
+
+	void testCrawlDelay()
+	{
+		DeepThought manager(store_dir, 4);
+		Domain dom("www.a.com.br", URLSet(), manager, false);
+		time_t now = manager.now();
+
+		TS_ASSERT_LESS_THAN_EQUALS(now + DeepThought::MINIMUM_INTERVAL,
+				manager.makeNextValidTimestamp(&dom));
+
+		dom.setRobotsRules(robots_rules_t(),
+				DeepThought::MINIMUM_INTERVAL + 10);
+		TS_ASSERT_LESS_THAN_EQUALS(
+				now + DeepThought::MINIMUM_INTERVAL + 10,
+				manager.makeNextValidTimestamp(&dom));
+
+		// Not forever, though
+		Domain slow("www.b.com.br", URLSet(), manager, false);
+		slow.setRobotsRules(robots_rules_t(), 1000000);
+		TS_ASSERT_LESS_THAN_EQUALS(manager.makeNextValidTimestamp(&slow),
+				manager.now() + MAX_CRAWL_DELAY);
+	}
+
+	void testStopWakesWaitingWorkers()
+	{
+		DeepThought manager(store_dir, 4);
+		PagePopper popper(manager);
+		popper.start();
+
+		usleep(100000);
+		manager.stopPlease();
+		popper.join();
+
+		TS_ASSERT_EQUALS(popper.page.second, 0U);
+	}
+};
+
+
+#endif // __DEEPTHOUGHT_TEST_H
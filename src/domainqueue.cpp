@@ -0,0 +1,115 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#include "domainqueue.h"
+#include "mmapedfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+
+
+DomainQueue::DomainQueue(const std::string& spill_filename, size_t window)
+: spill_filename(spill_filename), window(window), head(), tail(),
+  n_spilled(0), read_pos(0)
+{}
+
+DomainQueue::~DomainQueue()
+{
+	if (n_spilled) {
+		unlink(spill_filename.c_str());
+	}
+}
+
+void DomainQueue::push(const PathRef& page)
+{
+	if (n_spilled == 0 and tail.empty() and head.size() < window) {
+		// Nothing newer waiting, it can go right into the head
+		head.push_back(page);
+		return;
+	}
+
+	tail.push_back(page);
+	if (tail.size() >= window and not spill_filename.empty()) {
+		spill();
+	}
+}
+
+PathRef DomainQueue::pop()
+{
+	assert(not empty());
+
+	if (head.empty()) {
+		fill();
+	}
+
+	PathRef page = head.front();
+	head.pop_front();
+	return page;
+}
+
+void DomainQueue::spill()
+{
+	// Start a new file if the previous one was read back entirely
+	FILE* fh = fopen(spill_filename.c_str(), n_spilled ? "a" : "w");
+	if (fh == NULL) {
+		throw ErrnoSysException("Error opening " + spill_filename);
+	}
+	ManagedFilePtr file(fh);
+
+	std::deque<PathRef>::const_iterator p;
+	for(p = tail.begin(); p != tail.end(); ++p) {
+		fprintf(file, "%u\t%s\n", p->second, p->first.c_str());
+	}
+	if (fflush(file) != 0) {
+		throw ErrnoSysException("Error writing " + spill_filename);
+	}
+
+	n_spilled += tail.size();
+	tail.clear();
+}
+
+void DomainQueue::fill()
+{
+	if (n_spilled == 0) {
+		// Everything left is in the tail
+		head.swap(tail);
+		return;
+	}
+
+	FILE* fh = fopen(spill_filename.c_str(), "r");
+	if (fh == NULL or fseeko(fh, read_pos, SEEK_SET) != 0) {
+		throw ErrnoSysException("Error reading " + spill_filename);
+	}
+	ManagedFilePtr file(fh);
+
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while (head.size() < window and n_spilled and
+		(len = getline(&line, &line_size, file)) > 0)
+	{
+		// "docid\tpath\n"
+		char* path = NULL;
+		docid_t id = strtoul(line, &path, 10);
+		if (line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+		}
+		head.push_back(PathRef(std::string(path + 1), id));
+		--n_spilled;
+	}
+	free(line);
+
+	if (n_spilled == 0) {
+		read_pos = 0;
+		unlink(spill_filename.c_str());
+	} else {
+		read_pos = ftello(file);
+	}
+
+	if (head.empty()) {
+		throw std::runtime_error("Truncated " + spill_filename);
+	}
+}
+
+
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
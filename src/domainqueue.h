@@ -0,0 +1,101 @@
+#ifndef __DOMAINQUEUE_H
+#define __DOMAINQUEUE_H
+/**@file domainqueue.h
+ * @brief A domain's queue of pages to download, kept mostly on disk.
+ *
+ */
+
+#include "common.h"
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <string>
+#include <deque>
+
+
+/* ********************************************************************** *
+				    TYPEDEFS
+ * ********************************************************************** */
+
+//! A page's path in a domain and its docid.
+typedef std::pair<std::string, docid_t> PathRef;
+
+
+/* ********************************************************************** *
+				  DOMAIN QUEUE
+ * ********************************************************************** */
+
+/**A FIFO of pages that spills to an append-only file.
+ *
+ * Only the first and the last @c window pages are kept in memory: the
+ * ones in between wait in the spill file, written @c window pages at a
+ * time as the tail fills up and read back as many at a time as the head
+ * empties. So a domain's pending pages cost at most 2 * @c window entries
+ * of memory, however many there are.
+ *
+ * The spill file is created (or truncated) when first needed and removed
+ * once everything in it was read back.
+ *
+ * @warning Not thread-safe.
+ */
+class DomainQueue {
+	std::string spill_filename;	//!< Empty if we may not spill.
+	size_t window;
+
+	std::deque<PathRef> head;	//!< Oldest pages, popped from here
+	std::deque<PathRef> tail;	//!< Newest pages, pushed here
+	size_t n_spilled;		//!< Pages waiting in the spill file
+	off_t read_pos;			//!< Where the next unread one starts
+
+	//!This class is non-copyable
+	DomainQueue(const DomainQueue&);
+	//!This class is non-copyable
+	DomainQueue& operator=(const DomainQueue&);
+
+	/**Append the tail to the spill file.
+	 *
+	 * @throw ErrnoSysException
+	 */
+	void spill();
+
+	/**Refill the head from the spill file or the tail.
+	 *
+	 * @throw ErrnoSysException
+	 */
+	void fill();
+
+public:
+	/**Constructor.
+	 *
+	 * @param spill_filename Where the pages that don't fit in memory go.
+	 * 	  If empty, they are all kept in memory.
+	 * @param window Number of pages kept at each end of the queue.
+	 */
+	DomainQueue(const std::string& spill_filename="",
+		    size_t window=DOMAIN_QUEUE_WINDOW);
+
+	~DomainQueue();
+
+	void push(const PathRef& page);
+
+	/**Get the oldest page.
+	 *
+	 * @warning The queue must not be empty.
+	 */
+	PathRef pop();
+
+	inline size_t size() const
+	{
+		return head.size() + n_spilled + tail.size();
+	}
+
+	inline bool empty() const { return size() == 0; }
+
+	//! Number of pages in memory.
+	inline size_t inMemory() const { return head.size() + tail.size(); }
+};
+
+
+#endif // __DOMAINQUEUE_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
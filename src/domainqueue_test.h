@@ -0,0 +1,104 @@
+#ifndef __DOMAINQUEUE_TEST_H
+#define __DOMAINQUEUE_TEST_H
+
+#include "domainqueue.h"
+#include "strmisc.h"
+#include "cxxtest/TestSuite.h"
+
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+class DomainQueueTestSuit : public CxxTest::TestSuite {
+	std::string spill_filename;
+
+	bool spillExists()
+	{
+		struct stat statbuf;
+		return stat(spill_filename.c_str(), &statbuf) == 0;
+	}
+
+	PathRef page(docid_t i)
+	{
+		return PathRef("/page " + toString(i) + ".html", i);
+	}
+
+public:
+	void setUp()
+	{
+		spill_filename = "/tmp/domainqueue_test." + toString(getpid());
+	}
+
+	void tearDown()
+	{
+		unlink(spill_filename.c_str());
+	}
+
+	void testInMemory()
+	{
+		DomainQueue q("", 4);
+
+		for(docid_t i = 1; i <= 100; ++i) {
+			q.push(page(i));
+		}
+		TS_ASSERT_EQUALS(q.size(), 100U);
+		TS_ASSERT_EQUALS(q.inMemory(), 100U);
+		for(docid_t i = 1; i <= 100; ++i) {
+			TS_ASSERT_EQUALS(q.pop(), page(i));
+		}
+		TS_ASSERT(q.empty());
+	}
+
+	void testSpillsInOrder()
+	{
+		const size_t WINDOW = 8;
+		DomainQueue q(spill_filename, WINDOW);
+
+		for(docid_t i = 1; i <= 1000; ++i) {
+			q.push(page(i));
+			TS_ASSERT_LESS_THAN_EQUALS(q.inMemory(), 2 * WINDOW);
+		}
+		TS_ASSERT_EQUALS(q.size(), 1000U);
+		TS_ASSERT(spillExists());
+
+		// Mixing pushes and pops
+		docid_t next = 1;
+		for(docid_t i = 1001; i <= 1500; ++i) {
+			TS_ASSERT_EQUALS(q.pop(), page(next++));
+			q.push(page(i));
+			TS_ASSERT_LESS_THAN_EQUALS(q.inMemory(), 2 * WINDOW);
+		}
+		while (not q.empty()) {
+			TS_ASSERT_EQUALS(q.pop(), page(next++));
+		}
+		TS_ASSERT_EQUALS(next, 1501U);
+		TS_ASSERT(not spillExists());
+
+		// The file is started anew
+		for(docid_t i = 1; i <= 100; ++i) {
+			q.push(page(i));
+		}
+		TS_ASSERT(spillExists());
+		for(docid_t i = 1; i <= 100; ++i) {
+			TS_ASSERT_EQUALS(q.pop(), page(i));
+		}
+		TS_ASSERT(q.empty());
+	}
+
+	void testRemovesSpillOnDestruction()
+	{
+		{
+			DomainQueue q(spill_filename, 2);
+			for(docid_t i = 1; i <= 10; ++i) {
+				q.push(page(i));
+			}
+			TS_ASSERT(spillExists());
+		}
+		TS_ASSERT(not spillExists());
+	}
+};
+
+
+#endif // __DOMAINQUEUE_TEST_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
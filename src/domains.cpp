@@ -2,9 +2,9 @@
 
 Domain::Domain(std::string name,const URLSet& pages,
 	AbstractHyperDimentionalCrawlerDeity& manager,
-	bool unserializing)
-: known_pages(), pages_queue() , manager(manager),
-  got_robots(false), robots_docid(0), rules(), name(name),
+	bool unserializing, const std::string& spill_filename)
+: pages_queue(spill_filename) , manager(manager),
+  got_robots(false), robots_docid(0), rules(), crawl_delay(0), name(name),
   in_queue(false), timestamp(0), previous_queue_length(0)
 {
 	// FIXME if we had a url->docid map we could
@@ -24,19 +24,20 @@ void Domain::addPages(const URLSet& pages, bool unserializing)
 	URLSet::const_iterator p;
 
 
+	if (unserializing) {
+		// Already downloaded
+		return;
+	}
+
 	for(p = pages.begin(); p != pages.end(); ++p) {
 		// We just add paths to our structures..
 		const std::string& path = p->path;
-		// Unknown page?
-		if (known_pages.count(path) == 0) {
-			known_pages.insert(path);
-			if ( not unserializing ) {
-				// This page must be enqueued
-				std::string url_str = p->str();
-				docid_t id = manager.registerURL(
-							url_str);
-				pages_queue.push_back( PathRef(path, id) );
-			}
+		// robots.txt is fetched by checkRobotsFile()
+		if (path != "/robots.txt") {
+			// This page must be enqueued
+			std::string url_str = p->str();
+			docid_t id = manager.registerURL(url_str);
+			pages_queue.push( PathRef(path, id) );
 		}
 	}
 }
@@ -50,12 +51,11 @@ PageRef Domain::popPage()
 
 	while (not pages_queue.empty()) {
 		// Get a page from the queue
-		PathRef p = pages_queue.front();
+		PathRef p = pages_queue.pop();
 
 		std::string& path = p.first;
 		docid_t& id = p.second;
 
-		pages_queue.pop_front();
 		if ( allowedByRobotsTxt(p.first) ) {
 			return PageRef( "http://" + this->name + path, id);
 		}
@@ -65,13 +65,14 @@ PageRef Domain::popPage()
 	return PageRef();
 }
 
-void Domain::setRobotsRules(robots_rules_t newrules)
+void Domain::setRobotsRules(robots_rules_t newrules, int crawl_delay)
 {
 	AutoLock synchronized(PAGES_LOCK);
 
 	if (not got_robots) {
 		// We may have called this method before...
 		this->rules = newrules;
+		this->crawl_delay = crawl_delay;
 		got_robots = true;
 	}
 }
@@ -89,8 +90,6 @@ void Domain::checkRobotsFile()
 	robots_url.append(name);
 	robots_url.append("/robots.txt");
 
-	known_pages.insert("/robots.txt");
-
 	if (robots_docid == 0) {
 		// Ok, first time in this function?
 		// Ok, this is how it goes.
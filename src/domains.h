@@ -13,6 +13,7 @@
 #include "urltools.h"
 #include "pagedownloader.h"
 #include "robotshandler.h"
+#include "domainqueue.h"
 
 
 /* ********************************************************************** *
@@ -35,26 +36,28 @@ typedef RobotsParser::robots_rules_t robots_rules_t;
 /**Encapsulates our notion of something that about a domain.
  * 
  * Domain objects control certain domain's URL lists:
- *  - known URL, already downloaded or not
- *  - pending URLs that must be downloaded.
+ *  - pending URLs that must be downloaded, mostly kept on disk - see
+ *    DomainQueue.
+ *
+ *  Telling known URLs from new ones is up to the manager - see
+ *  URLSeenSet.
  *  - robots.txt rules
  *
  *  Robots rules are tested in popPage().
  */
 class Domain{
 protected:
-	typedef std::pair<std::string, docid_t> PathRef;
-
-	CatholicShameMutex PAGES_LOCK;
+	//! Guards pages_queue: pages are added without the manager's locks
+	mutable CatholicShameMutex PAGES_LOCK;
 
-	PathSet known_pages;
-	std::deque<PathRef> pages_queue;
+	DomainQueue pages_queue;
 
 	AbstractHyperDimentionalCrawlerDeity& manager;
 
 	bool got_robots;
 	docid_t robots_docid;
 	robots_rules_t rules;
+	int crawl_delay;
 public:
 	std::string name;
 	
@@ -64,7 +67,7 @@ public:
 	 */
 	bool in_queue;
 
-	//!The last time this domain was crawled.
+	//!When this domain may be crawled again.
 	time_t timestamp;
 
 	/**The queue length this domain had when it left the idle_domains queue.
@@ -77,30 +80,40 @@ public:
 	/**Constructor.
 	 *
 	 * @param name The name of this domain.
-	 * @param pages Initial set of known pages to this domain.
+	 * @param pages Initial set of new pages of this domain.
 	 * @param manager Reference DeepThought or to a concrete
 	 *	  AbstractHyperDimentionalCrawlerDeity&  instance.
 	 * @param unserializing Are we reading URLs back from the disk?
+	 * @param spill_filename Where pending pages that don't fit in
+	 * 	  memory go. If empty, they are all kept in memory.
 	 */
 	Domain(std::string name,const URLSet& pages,
 		AbstractHyperDimentionalCrawlerDeity& manager,
-		bool unserializing);
+		bool unserializing,
+		const std::string& spill_filename="");
 
 
 
 	/**Add pages for this domain.
 	 *
-	 * Add pages to the list of known pages and enque the previously
-	 * unknown ones to future download.
+	 * Register and enqueue pages for future download. They must be new
+	 * ones: known pages are not weeded out here.
 	 *
 	 * @param pages A list of URLs (str)
+	 * @param unserializing If true, the pages were already downloaded,
+	 * 	  so nothing is done.
 	 *
 	 * @synchronized(PAGES_LOCK)
 	 */
 	void addPages(const URLSet& pages, bool unserializing=false);
 
 
-	bool empty() { return pages_queue.empty(); }
+	//!@synchronized(PAGES_LOCK)
+	bool empty() const
+	{
+		AutoLock synchronized(PAGES_LOCK);
+		return pages_queue.empty();
+	}
 
 	/**Get a page from the queue.
 	 *
@@ -132,13 +145,29 @@ public:
 	void checkRobotsFile();
 
 	/**Register rules found in the robots.txt of this domain.
+	 *
+	 * @param crawl_delay Its Crawl-delay, in seconds, if any.
 	 *
 	 * @synchronized PAGES_LOCK
 	 */
-	void setRobotsRules(robots_rules_t newrules);
+	void setRobotsRules(robots_rules_t newrules, int crawl_delay=0);
 
-	// FIXME We probably should've used a lock here
-	int queueLength() const { return pages_queue.size(); }
+	/**Seconds robots.txt asks us to wait between requests, or 0.
+	 *
+	 * @synchronized(PAGES_LOCK)
+	 */
+	int crawlDelay() const
+	{
+		AutoLock synchronized(PAGES_LOCK);
+		return crawl_delay;
+	}
+
+	//!@synchronized(PAGES_LOCK)
+	int queueLength() const
+	{
+		AutoLock synchronized(PAGES_LOCK);
+		return pages_queue.size();
+	}
 
 };        
 
@@ -22,6 +22,8 @@ void dump_inverted_file(IntStrMap& id2term, const char* store_dir)
 	MMapedFile data(data_filename);
 
 	hdr_entry_t* _header = (hdr_entry_t*) _hdr.getBuf().start;
+	InvertedListCodec::format_t format =
+			InvertedListCodec::readFormat(prefix);
 	
 
 	for(i = id2term.begin(); i != id2term.end(); ++i){
@@ -34,7 +36,8 @@ void dump_inverted_file(IntStrMap& id2term, const char* store_dir)
 		comp_list.read(header.pos);
 		inverted_list_vec_t ilist;
 		inverted_list_vec_t::const_iterator doc;
-		ByteWiseCompressor::decompress(header.ft,comp_list,ilist);
+		InvertedListCodec::decompress(format, header.ft, comp_list,
+						ilist);
 		for(doc = ilist.begin(); doc != ilist.end(); ++doc){
 			std::cout << "<" << doc->first << "," << doc->second << "> ";
 		}
@@ -0,0 +1,234 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+/**@file fetchbench.cpp
+ * @brief Page fetching throughput benchmark.
+ *
+ * Runs a ThreadedHTTPServer in this process whose pages take a while to
+ * be served, as remote servers' do, and downloads them:
+ * - with a thread per download, each blocked in URLRetriever::go(), as
+ *   the crawler used to;
+ * - with FetchLoops, driving many transfers each.
+ *
+ * Pages per second and the process' peak resident memory are reported.
+ *
+ * Usage: fetchbench [n_pages] [latency_ms] [threads] [loops] [in_flight]
+ */
+
+#include "fetchengine.h"
+#include "httpserver.hpp"
+#include "strmisc.h"
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+
+/***********************************************************************
+				    HELPERS
+ ***********************************************************************/
+
+const uint16_t BENCH_PORT = 18092;
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//! Peak resident memory of this process so far, in MiB.
+inline double peak_rss()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+void report(const std::string& what, size_t n_pages, size_t ok,
+		double elapsed)
+{
+	std::cout << "  " << std::setw(28) << std::left << what <<
+		std::setw(10) << std::right << std::fixed <<
+		std::setprecision(1) << n_pages / elapsed << " pages/s  " <<
+		ok << " ok  peak RSS " << peak_rss() << " MiB" << std::endl;
+}
+
+//! A page served after @c latency_us.
+struct SlowPageHandler : public AbstractRequestHandler {
+	int latency_us;
+	std::string page;
+
+	SlowPageHandler(int latency_us)
+	: latency_us(latency_us), page(4096, 'x')
+	{}
+
+	void process(HTTPClientHandler& req)
+	{
+		usleep(latency_us);
+		req.respond(page);
+	}
+};
+
+struct ServerThread : public BaseThread {
+	ThreadedHTTPServer& server;
+
+	ServerThread(ThreadedHTTPServer& server) : server(server) {}
+
+	void* run()
+	{
+		server.run();
+		return NULL;
+	}
+};
+
+std::string page_url(size_t i)
+{
+	return "http://127.0.0.1:" + toString(BENCH_PORT) + "/page/" +
+		toString(i);
+}
+
+//! Downloads the pages a shared counter hands out, one at a time.
+struct BlockingFetcher : public BaseThread {
+	CatholicShameMutex& lock;
+	size_t& next;
+	size_t n_pages;
+	size_t ok;
+
+	BlockingFetcher(CatholicShameMutex& lock, size_t& next, size_t n)
+	: lock(lock), next(next), n_pages(n), ok(0)
+	{}
+
+	void* run()
+	{
+		while (true) {
+			size_t i;
+			{
+				AutoLock synchronized(lock);
+				if (next >= n_pages) { break; }
+				i = next++;
+			}
+			try {
+				URLRetriever page(page_url(i));
+				page.go();
+				++ok;
+			} catch (std::runtime_error& e) {
+				// Counted as not ok
+			}
+		}
+		return NULL;
+	}
+};
+
+size_t bench_threads(size_t n_pages, int n_threads)
+{
+	CatholicShameMutex lock;
+	size_t next = 0;
+	std::vector<BlockingFetcher*> fetchers;
+
+	for(int i = 0; i < n_threads; ++i) {
+		fetchers.push_back(new BlockingFetcher(lock, next, n_pages));
+		fetchers.back()->start();
+	}
+
+	size_t ok = 0;
+	for(size_t i = 0; i < fetchers.size(); ++i) {
+		fetchers[i]->join();
+		ok += fetchers[i]->ok;
+		delete fetchers[i];
+	}
+	return ok;
+}
+
+size_t bench_loops(size_t n_pages, int n_loops, size_t in_flight)
+{
+	FetchJobQueue fetched;
+	std::vector<FetchLoop*> loops;
+	for(int i = 0; i < n_loops; ++i) {
+		loops.push_back(new FetchLoop(fetched));
+		loops.back()->start();
+	}
+
+	size_t submitted = 0;
+	size_t ok = 0;
+	for(; submitted < in_flight && submitted < n_pages; ++submitted) {
+		loops[submitted % n_loops]->submit(
+			new FetchJob(PageRef(page_url(submitted), 1)));
+	}
+	for(size_t done = 0; done < n_pages; ++done) {
+		FetchJob* job = fetched.get();
+		try {
+			job->retriever.finish(job->result);
+			++ok;
+		} catch (std::runtime_error& e) {
+			// Counted as not ok
+		}
+		delete job;
+
+		if (submitted < n_pages) {
+			loops[submitted % n_loops]->submit(
+				new FetchJob(PageRef(page_url(submitted), 1)));
+			++submitted;
+		}
+	}
+
+	for(size_t i = 0; i < loops.size(); ++i) {
+		loops[i]->stop();
+		loops[i]->join();
+		delete loops[i];
+	}
+	return ok;
+}
+
+
+/***********************************************************************
+				      MAIN
+ ***********************************************************************/
+
+int main(int argc, char* argv[])
+{
+	size_t n_pages = 20000;
+	int latency_ms = 20;
+	int n_threads = 100;
+	int n_loops = 2;
+	size_t in_flight = 1000;
+
+	if (argc > 1) { n_pages = fromString<size_t>(argv[1]); }
+	if (argc > 2) { latency_ms = fromString<int>(argv[2]); }
+	if (argc > 3) { n_threads = fromString<int>(argv[3]); }
+	if (argc > 4) { n_loops = fromString<int>(argv[4]); }
+	if (argc > 5) { in_flight = fromString<size_t>(argv[5]); }
+
+	curl_global_init(CURL_GLOBAL_NOTHING);
+
+	// The server must not be the bottleneck
+	ThreadedHTTPServer server(BENCH_PORT, in_flight, 15, in_flight);
+	server.putChild("page", new SlowPageHandler(latency_ms * 1000));
+	ServerThread server_thread(server);
+	server_thread.start();
+
+	std::cout << "# " << n_pages << " pages, " << latency_ms <<
+		"ms latency each" << std::endl;
+
+	// The loops go first, so the threads' stacks don't count in
+	// their peak RSS
+	double start = now();
+	size_t ok = bench_loops(n_pages, n_loops, in_flight);
+	report(toString(n_loops) + " loops, " + toString(in_flight) +
+		" in flight", n_pages, ok, now() - start);
+
+	start = now();
+	ok = bench_threads(n_pages, n_threads);
+	report(toString(n_threads) + " blocking threads", n_pages, ok,
+		now() - start);
+
+	server.stop();
+	server_thread.join();
+
+	return 0;
+}
+
+//EOF
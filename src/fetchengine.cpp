@@ -0,0 +1,366 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#include "fetchengine.h"
+
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+
+
+/* ********************************************************************** *
+			       LIBCURL CALLBACKS
+ * ********************************************************************** */
+
+/**Called by libcurl when the events it waits for in a socket change.
+ *
+ * Sockets epoll already watches are marked with curl_multi_assign().
+ */
+int fetchloop_socket_callback(CURL* easy, curl_socket_t s, int what,
+				void* userp, void* socketp)
+{
+	FetchLoop& loop = *((FetchLoop*)userp);
+
+	if (what == CURL_POLL_REMOVE) {
+		epoll_ctl(loop.epoll_fd, EPOLL_CTL_DEL, s, NULL);
+		curl_multi_assign(loop.multi, s, NULL);
+		return 0;
+	}
+
+	struct epoll_event ev;
+	ev.events = 0;
+	if (what & CURL_POLL_IN) { ev.events |= EPOLLIN; }
+	if (what & CURL_POLL_OUT) { ev.events |= EPOLLOUT; }
+	ev.data.fd = s;
+
+	if (socketp) {
+		epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, s, &ev);
+	} else {
+		epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, s, &ev);
+		curl_multi_assign(loop.multi, s, &loop);
+	}
+
+	return 0;
+}
+
+//! Called by libcurl to tell when it wants to be called on a timeout.
+int fetchloop_timer_callback(CURLM* multi, long timeout_ms, void* userp)
+{
+	FetchLoop& loop = *((FetchLoop*)userp);
+
+	if (timeout_ms < 0) {
+		loop.timer_deadline = -1;
+	} else {
+		loop.timer_deadline = FetchLoop::now() + timeout_ms / 1000.0;
+	}
+
+	return 0;
+}
+
+
+/* ********************************************************************** *
+				   FETCHLOOP
+ * ********************************************************************** */
+
+FetchLoop::FetchLoop(FetchJobQueue& fetched)
+: BaseThread(),
+  multi(NULL),
+  epoll_fd(-1),
+  timer_deadline(-1),
+  fetched(fetched),
+  submit_lock(),
+  submitted(),
+  stopping(false),
+  in_flight(0)
+{
+	wake_fds[0] = wake_fds[1] = -1;
+
+	if ((epoll_fd = epoll_create(1024)) == -1) {
+		throw ErrnoSysException("Error in epoll_create()");
+	}
+	if (pipe(wake_fds) == -1) {
+		throw ErrnoSysException("Error creating wake-up pipe");
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = wake_fds[0];
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fds[0], &ev) == -1) {
+		throw ErrnoSysException("Error in epoll_ctl()");
+	}
+
+	if ((multi = curl_multi_init()) == NULL) {
+		throw UndeterminedURLRetrieverException("multi init");
+	}
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION,
+				fetchloop_socket_callback);
+	curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION,
+				fetchloop_timer_callback);
+	curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+}
+
+FetchLoop::~FetchLoop()
+{
+	if (multi) { curl_multi_cleanup(multi); }
+	close(wake_fds[0]);
+	close(wake_fds[1]);
+	close(epoll_fd);
+}
+
+double FetchLoop::now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void FetchLoop::wake()
+{
+	char c = 0;
+	if (::write(wake_fds[1], &c, 1) == -1 && errno != EAGAIN) {
+		throw ErrnoSysException("Error waking fetch loop up");
+	}
+}
+
+void FetchLoop::submit(FetchJob* job)
+{
+	bool was_empty;
+	{
+		AutoLock synchronized(submit_lock);
+		was_empty = submitted.empty();
+		submitted.push_back(job);
+	}
+	// A wake up is already pending otherwise
+	if (was_empty) { wake(); }
+}
+
+void FetchLoop::stop()
+{
+	{
+		AutoLock synchronized(submit_lock);
+		stopping = true;
+	}
+	wake();
+}
+
+bool FetchLoop::addSubmitted()
+{
+	std::deque<FetchJob*> jobs;
+	bool stopped;
+	{
+		AutoLock synchronized(submit_lock);
+		jobs.swap(submitted);
+		stopped = stopping;
+	}
+
+	for(size_t i = 0; i < jobs.size(); ++i) {
+		FetchJob* job = jobs[i];
+		CURL* handle = job->retriever.getHandle();
+		curl_easy_setopt(handle, CURLOPT_PRIVATE, job);
+		CURLMcode res = curl_multi_add_handle(multi, handle);
+		if (res != CURLM_OK) {
+			job->result = CURLE_FAILED_INIT;
+			fetched.put(job);
+		} else {
+			++in_flight;
+		}
+	}
+
+	return not (stopped and in_flight == 0);
+}
+
+void FetchLoop::collectFinished()
+{
+	CURLMsg* msg;
+	int msgs_left;
+
+	while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+
+		CURL* handle = msg->easy_handle;
+		CURLcode result = msg->data.result;
+		FetchJob* job = NULL;
+		curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char**)&job);
+		curl_multi_remove_handle(multi, handle); // msg is gone now
+
+		--in_flight;
+		job->result = result;
+		fetched.put(job);
+	}
+}
+
+void* FetchLoop::run()
+{
+	const int MAX_EVENTS = 256;
+	struct epoll_event events[MAX_EVENTS];
+	int running_handles;
+
+	while (addSubmitted()) {
+		// Wait untill the next libcurl timeout, at most
+		int wait_ms = 1000;
+		if (timer_deadline >= 0) {
+			double left = timer_deadline - now();
+			wait_ms = left > 0 ? int(left * 1000) + 1 : 0;
+			if (wait_ms > 1000) { wait_ms = 1000; }
+		}
+
+		int n = epoll_wait(epoll_fd, events, MAX_EVENTS, wait_ms);
+		if (n == -1 && errno != EINTR) {
+			throw ErrnoSysException("Error in epoll_wait()");
+		}
+
+		for(int i = 0; i < n; ++i) {
+			int fd = events[i].data.fd;
+			if (fd == wake_fds[0]) {
+				char buf[256];
+				if (read(fd, buf, sizeof(buf)) == -1) {
+					throw ErrnoSysException(
+						"Error reading wake-up pipe");
+				}
+				continue;
+			}
+
+			int flags = 0;
+			if (events[i].events & EPOLLIN) {
+				flags |= CURL_CSELECT_IN;
+			}
+			if (events[i].events & EPOLLOUT) {
+				flags |= CURL_CSELECT_OUT;
+			}
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				flags |= CURL_CSELECT_ERR;
+			}
+			curl_multi_socket_action(multi, fd, flags,
+						&running_handles);
+		}
+
+		if (timer_deadline >= 0 && now() >= timer_deadline) {
+			timer_deadline = -1;
+			curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0,
+						&running_handles);
+		}
+
+		collectFinished();
+	}
+
+	return (void*)this;
+}
+
+
+/* ********************************************************************** *
+				  FETCHENGINE
+ * ********************************************************************** */
+
+FetchEngine::FetchEngine(DeepThought& manager, int n_loops, size_t max_jobs)
+: BaseThread(),
+  manager(manager),
+  loops(),
+  max_jobs(max_jobs),
+  fetched(),
+  jobs_lock(),
+  n_jobs(0)
+{
+	for(int i = 0; i < n_loops; ++i) {
+		loops.push_back(new FetchLoop(fetched));
+	}
+}
+
+FetchEngine::~FetchEngine()
+{
+	for(size_t i = 0; i < loops.size(); ++i) {
+		delete loops[i];
+	}
+}
+
+void FetchEngine::acquireJob()
+{
+	AutoLock synchronized(jobs_lock);
+
+	while (n_jobs >= max_jobs) {
+		jobs_lock.wait();
+	}
+	++n_jobs;
+}
+
+void FetchEngine::release(FetchJob* job)
+{
+	delete job;
+
+	AutoLock synchronized(jobs_lock);
+	--n_jobs;
+	jobs_lock.notify();
+}
+
+void FetchEngine::stopParsers(int n_parsers)
+{
+	for(int i = 0; i < n_parsers; ++i) {
+		fetched.put(NULL);
+	}
+}
+
+void FetchEngine::feed(size_t loop)
+{
+	// Our own slice of the frontier
+	size_t worker = loop * manager.shardCount() / loops.size();
+
+	while (manager.running) {
+		PageRef page;
+		Domain* dom = NULL;
+		FetchJob* job = NULL;
+
+		acquireJob();
+		try {
+			page = manager.popPage(worker);
+		} catch (GetRobotsForMePlzException& e) {
+			page = e.page;
+			dom = e.domain;
+		}
+
+		if (page.second) {	// cuz He can return None...
+			try {
+				job = new FetchJob(page, dom);
+			} catch (std::runtime_error& e) {
+				manager.reportBadCrawling(page.second,
+							page.first, e.what());
+				manager.incCrawled(false, page.second,
+							page.first);
+			}
+		}
+
+		if (job) {
+			loops[loop]->submit(job);
+		} else {
+			release(NULL);
+		}
+	}
+}
+
+void* FetchEngine::run()
+{
+	std::vector<Feeder*> feeders;
+
+	for(size_t i = 0; i < loops.size(); ++i) {
+		loops[i]->start();
+		feeders.push_back(new Feeder(*this, i));
+		feeders.back()->start();
+	}
+
+	for(size_t i = 0; i < feeders.size(); ++i) {
+		feeders[i]->join();
+		delete feeders[i];
+	}
+
+	for(size_t i = 0; i < loops.size(); ++i) {
+		loops[i]->stop();
+	}
+	for(size_t i = 0; i < loops.size(); ++i) {
+		loops[i]->join();
+	}
+
+	return (void*)this;
+}
+
+
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
@@ -0,0 +1,195 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __FETCHENGINE_H
+#define __FETCHENGINE_H
+/**@file fetchengine.h
+ * @brief Event-driven page fetching, on libcurl's multi interface.
+ *
+ * Instead of a thread blocked in curl_easy_perform() per download, a few
+ * FetchLoop threads drive thousands of transfers each, waiting for their
+ * sockets with epoll. Finished downloads are handed over to a separate
+ * pool of threads for parsing - see ParanoidAndroid.
+ */
+
+#include "common.h"
+#include "threadingutils.h"
+#include "deepthought.h"
+#include "urlretriever.h"
+
+#include <curl/curl.h>
+
+#include <deque>
+#include <vector>
+
+
+/* ********************************************************************** *
+				    FETCHJOB
+ * ********************************************************************** */
+
+//! A page or robots.txt download, from submission till it is processed.
+struct FetchJob {
+	PageRef page;		//!< The URL and its docid
+	Domain* robots_for;	//!< Domain this robots.txt is for, or NULL
+	URLRetriever retriever;
+	CURLcode result;	//!< The transfer's result, once finished
+
+	/**Constructor.
+	 *
+	 * @param dom For robots.txt downloads, the domain they are for.
+	 */
+	FetchJob(const PageRef& page, Domain* dom = NULL)
+	: page(page), robots_for(dom), retriever(page.first, dom == NULL),
+	  result(CURLE_OK)
+	{}
+
+	inline bool isRobots() const { return robots_for != NULL; }
+};
+
+typedef BlockingQueue<FetchJob*> FetchJobQueue;
+
+
+/* ********************************************************************** *
+				   FETCHLOOP
+ * ********************************************************************** */
+
+/**A thread driving many downloads at once with a curl multi handle.
+ *
+ * Jobs can be submit()ted from any thread. Finished ones, successful or
+ * not, are put in the @c fetched queue.
+ *
+ * @note Name resolution doesn't block the loop only if libcurl was built
+ * 	 with an asynchronous resolver (threaded or c-ares).
+ */
+class FetchLoop : public BaseThread {
+	CURLM* multi;
+	int epoll_fd;
+	int wake_fds[2];	//!< Pipe submit() and stop() wake run() up with
+	double timer_deadline;	//!< When libcurl wants to be called, or < 0
+
+	FetchJobQueue& fetched;
+
+	//!@name Access to these must be done holding submit_lock
+	//@{
+	CatholicShameMutex submit_lock;
+	std::deque<FetchJob*> submitted;
+	bool stopping;
+	//@}
+
+	size_t in_flight;	//!< Only touched by the loop's own thread
+
+	//!This class is non-copyable
+	FetchLoop(const FetchLoop&);
+	//!This class is non-copyable
+	FetchLoop& operator=(const FetchLoop&);
+
+	//! Start the submitted transfers. @return false once stopped.
+	bool addSubmitted();
+
+	//! Hand the finished transfers over.
+	void collectFinished();
+
+	void wake();
+
+	static double now();
+
+	friend int fetchloop_socket_callback(CURL*, curl_socket_t, int, void*,
+						void*);
+	friend int fetchloop_timer_callback(CURLM*, long, void*);
+
+public:
+	/**Constructor.
+	 *
+	 * @param fetched Where finished jobs go to.
+	 * @throw ErrnoSysException
+	 */
+	FetchLoop(FetchJobQueue& fetched);
+
+	~FetchLoop();
+
+	//! Start downloading @p job.
+	void submit(FetchJob* job);
+
+	//! Make run() return once the submitted jobs have finished.
+	void stop();
+
+	void* run();
+};
+
+
+/* ********************************************************************** *
+				  FETCHENGINE
+ * ********************************************************************** */
+
+/**Downloads the pages DeepThought hands out, with a few FetchLoops.
+ *
+ * Each loop has a feeder thread that takes pages from the manager and
+ * submits them to it, while fewer than @c max_jobs are being downloaded or
+ * waiting to be processed. Feeders start looking for pages at different
+ * frontier shards. Processing threads take the finished ones with
+ * nextFetched() and give them back with release().
+ */
+class FetchEngine : public BaseThread {
+	//! Takes pages from the manager for one of the loops.
+	struct Feeder : public BaseThread {
+		FetchEngine& engine;
+		size_t loop;
+
+		Feeder(FetchEngine& engine, size_t loop)
+		: engine(engine), loop(loop)
+		{}
+
+		void* run()
+		{
+			engine.feed(loop);
+			return NULL;
+		}
+	};
+
+	DeepThought& manager;
+	std::vector<FetchLoop*> loops;
+	size_t max_jobs;
+
+	FetchJobQueue fetched;
+
+	//! Counts the jobs not released yet
+	BigBangBabyConditional jobs_lock;
+	size_t n_jobs;
+
+	//!This class is non-copyable
+	FetchEngine(const FetchEngine&);
+	//!This class is non-copyable
+	FetchEngine& operator=(const FetchEngine&);
+
+	//! Wait for room for another job.
+	void acquireJob();
+
+	//! Feed loops[@p loop] while the manager is running.
+	void feed(size_t loop);
+
+public:
+	/**Constructor.
+	 *
+	 * @param n_loops Number of FetchLoop threads.
+	 * @param max_jobs Maximum number of jobs alive at once.
+	 */
+	FetchEngine(DeepThought& manager, int n_loops, size_t max_jobs);
+
+	~FetchEngine();
+
+	/**Get a finished job, waiting for one if needed.
+	 *
+	 * @return The job or NULL, once stopParsers() is called.
+	 */
+	inline FetchJob* nextFetched() { return fetched.get(); }
+
+	//! Dispose of a processed job.
+	void release(FetchJob* job);
+
+	//! Make @p n_parsers callers of nextFetched() get a NULL.
+	void stopParsers(int n_parsers);
+
+	//! Run the loops and their feeders while the manager is running.
+	void* run();
+};
+
+
+#endif // __FETCHENGINE_H
@@ -0,0 +1,91 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __FETCHENGINE_TEST_H
+#define __FETCHENGINE_TEST_H
+
+#include "fetchengine.h"
+#include "httpserver.hpp"
+#include "strmisc.h"
+#include "cxxtest/TestSuite.h"
+
+#include <map>
+
+
+const uint16_t FETCH_TEST_PORT = 18091;
+
+//! Answers with the request's URI.
+struct FetchTestHandler : public AbstractRequestHandler {
+	void process(HTTPClientHandler& req)
+	{
+		req.respond(req.uri);
+	}
+};
+
+struct FetchTestServerThread : public BaseThread {
+	ThreadedHTTPServer server;
+
+	FetchTestServerThread() : server(FETCH_TEST_PORT, 4)
+	{
+		server.putChild("page", new FetchTestHandler());
+	}
+
+	void* run()
+	{
+		server.run();
+		return NULL;
+	}
+};
+
+class FetchLoopTestSuit : public CxxTest::TestSuite {
+public:
+	void testManyTransfers()
+	{
+		const docid_t N_PAGES = 200;
+		std::string base = "http://127.0.0.1:" +
+			toString(FETCH_TEST_PORT);
+
+		FetchTestServerThread server;
+		server.start();
+
+		FetchJobQueue fetched;
+		FetchLoop loop(fetched);
+		loop.start();
+
+		for(docid_t i = 1; i <= N_PAGES; ++i) {
+			std::string url = base + "/page/" + toString(i);
+			loop.submit(new FetchJob(PageRef(url, i)));
+		}
+		loop.submit(new FetchJob(PageRef(base + "/missing", 1000)));
+		// Nobody listens here
+		loop.submit(new FetchJob(PageRef("http://127.0.0.1:1/", 1001)));
+
+		std::map<docid_t, std::string> pages;
+		for(docid_t i = 0; i < N_PAGES + 2; ++i) {
+			FetchJob* job = fetched.get();
+			docid_t docid = job->page.second;
+			if (docid <= N_PAGES) {
+				TS_ASSERT_THROWS_NOTHING(job->retriever.finish(
+						job->result));
+				TS_ASSERT_EQUALS(job->retriever.getStatusCode(),
+						URLRetriever::STATUS_OK);
+				pages[docid] = job->retriever.getData().str();
+			} else {
+				TS_ASSERT_THROWS(job->retriever.finish(
+						job->result),
+					UndeterminedURLRetrieverException);
+			}
+			delete job;
+		}
+
+		TS_ASSERT_EQUALS(pages.size(), N_PAGES);
+		TS_ASSERT_EQUALS(pages[1], "/page/1");
+		TS_ASSERT_EQUALS(pages[N_PAGES], "/page/" + toString(N_PAGES));
+
+		loop.stop();
+		loop.join();
+		server.server.stop();
+		server.join();
+	}
+};
+
+
+#endif // __FETCHENGINE_TEST_H
@@ -41,13 +41,13 @@ using std::string;
  * filenames, text, IP addresses, etc. 
  */
 namespace FNV {
-	inline uint64_t hash64(const string& key)
+	inline uint64_t hash64(const char* key, size_t size)
 	{
 		const static uint64_t fnvPrime = 1099511628211ULL;
 		const static uint64_t offsetBasis = 14695981039346656037ULL;
 		uint64_t hash = offsetBasis;
 
-		for (size_t i = 0, l = key.size(); i < l; i++)
+		for (size_t i = 0; i < size; i++)
 		{
 			hash *= fnvPrime;
 			hash ^= key[i];
@@ -55,6 +55,11 @@ namespace FNV {
 
 		return hash;
 	}
+
+	inline uint64_t hash64(const string& key)
+	{
+		return hash64(key.c_str(),key.size());
+	}
 	
 	inline size_t hash32(const char* key, size_t size)
 	{
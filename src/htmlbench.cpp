@@ -0,0 +1,151 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+/**@file htmlbench.cpp
+ * @brief HTML parsing throughput benchmark.
+ *
+ * Reports, for each input page, the throughput in MB/s of:
+ * - each HTMLScanner::findChar implementation available in this CPU,
+ *   scanning for '<';
+ * - BaseHTMLParser, with handlers that do nothing;
+ * - HTMLContentIterator, as used by the indexer.
+ *
+ * Usage: htmlbench [iterations] [page ...]
+ *
+ * Defaults to ../html_tests/uol.html and ../html_tests/slashdot.html.
+ */
+
+#include "htmlparser.h"
+#include "htmlscanner.h"
+#include "htmliterators.hpp"
+#include "mmapedfile.h"
+
+#include <sys/time.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+
+/***********************************************************************
+				    HELPERS
+ ***********************************************************************/
+
+//! Parser that just counts what it sees.
+class NullHTMLParser : public BaseHTMLParser {
+public:
+	size_t n_text;
+	size_t n_tags;
+
+	NullHTMLParser(const filebuf& text)
+	: BaseHTMLParser(text), n_text(0), n_tags(0) {}
+
+	void handleText(filebuf text) { n_text += text.len(); }
+
+	void handleStartTag(const std::string& tag_name, attr_list_t& attrs,
+			bool empty_element_tag=false) { ++n_tags; }
+
+	void handleEndTag(const std::string& tag_name) { ++n_tags; }
+
+	void handleProcessingInstruction(const std::string& name,
+			attr_list_t& attrs) {}
+
+	void handleComment(const filebuf& comment) {}
+};
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void report(const std::string& what, size_t bytes, int iterations,
+		double elapsed)
+{
+	double mb = double(bytes) * iterations / (1024 * 1024);
+	std::cout << "  " << std::setw(24) << std::left << what <<
+		std::setw(10) << std::right << std::fixed <<
+		std::setprecision(1) << mb / elapsed << " MB/s" << std::endl;
+}
+
+//! Count every '<' in the page, scanning with @p find.
+void benchScanner(const std::string& name, HTMLScanner::find_char_fn find,
+		const filebuf& page, int iterations)
+{
+	size_t count = 0;
+	double start = now();
+	for(int i = 0; i < iterations; ++i) {
+		const char* p = page.current;
+		while ( (p = find(p, page.end, '<')) != page.end) {
+			++count;
+			++p;
+		}
+	}
+	report("scan " + name, page.len(), iterations, now() - start);
+}
+
+
+/***********************************************************************
+				      MAIN
+ ***********************************************************************/
+
+int main(int argc, char* argv[])
+{
+	int iterations = 100;
+	std::vector<std::string> pages;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	for(int i = 2; i < argc; ++i) {
+		pages.push_back(argv[i]);
+	}
+	if (pages.empty()) {
+		pages.push_back("../html_tests/uol.html");
+		pages.push_back("../html_tests/slashdot.html");
+	}
+
+	std::cout << "# findChar implementation: " <<
+		HTMLScanner::implementationName() << std::endl;
+
+	for(size_t p = 0; p < pages.size(); ++p) {
+		MMapedFile file(pages[p]);
+		filebuf page = file.getBuf();
+
+		std::cout << pages[p] << " (" << page.len() << " bytes, " <<
+			iterations << " iterations)" << std::endl;
+
+		benchScanner("scalar", HTMLScanner::findCharScalar, page,
+				iterations);
+#ifdef HTMLSCANNER_X86
+		if (__builtin_cpu_supports("sse2")) {
+			benchScanner("sse2", HTMLScanner::findCharSSE2, page,
+					iterations);
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			benchScanner("avx2", HTMLScanner::findCharAVX2, page,
+					iterations);
+		}
+#endif
+
+		double start = now();
+		for(int i = 0; i < iterations; ++i) {
+			NullHTMLParser parser(page);
+			parser.parse();
+		}
+		report("BaseHTMLParser", page.len(), iterations, now() - start);
+
+		start = now();
+		for(int i = 0; i < iterations; ++i) {
+			HTMLContentIterator ci(page), ce;
+			for(; ci != ce; ++ci) {
+			}
+		}
+		report("HTMLContentIterator", page.len(), iterations,
+			now() - start);
+	}
+
+	return 0;
+}
+
+//EOF
@@ -1,4 +1,5 @@
 #include "htmlparser.h"
+#include "htmlscanner.h"
 #include "strmisc.h"
 
 #include <sstream>
@@ -174,16 +175,19 @@ bool BaseHTMLParser::tagFollows(filebuf start)
 void BaseHTMLParser::readText()
 {
 	const char* start = text.current;
-	int length = 0;
+	const char* pos = start;
 
-	while ( not text.eof() and (*text != '<' or not this->tagFollows()) ){
-		++text;
-		++length;
+	// Jump from '<' to '<' until one of them seems to start a tag
+	while ( (pos = HTMLScanner::findChar(pos, text.end, '<')) != text.end
+		and not this->tagFollows(filebuf(pos, text.end - pos)) ) {
+		++pos;
 	}
+	text.current = pos;
+
 	// We may have reached the end or found a possible tag start
 	// in any case text[start:i] has all that matter for us -- nothing
 	// more, nothing less.
-	this->handleText( filebuf(start,length) );
+	this->handleText( filebuf(start, pos - start) );
 
 	// Parsing should re-start at current position - OK
 }
@@ -0,0 +1,142 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "htmlscanner.h"
+
+#include <string.h>
+
+#ifdef HTMLSCANNER_X86
+#include <immintrin.h>
+#endif
+
+
+/* **********************************************************************
+ *				IMPLEMENTATIONS
+ * ********************************************************************** */
+
+const char* HTMLScanner::findCharScalar(const char* start, const char* end,
+					char c)
+{
+	if (start >= end) {
+		return end;
+	}
+
+	const void* found = memchr(start, c, end - start);
+
+	return found ? (const char*) found : end;
+}
+
+#ifdef HTMLSCANNER_X86
+
+__attribute__((target("sse2")))
+const char* HTMLScanner::findCharSSE2(const char* p, const char* end, char c)
+{
+	const __m128i needle = _mm_set1_epi8(c);
+
+	while (end - p >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*) p);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+
+	// Less than a full stride left
+	while (p < end && *p != c) {
+		++p;
+	}
+
+	return p < end ? p : end;
+}
+
+__attribute__((target("avx2")))
+const char* HTMLScanner::findCharAVX2(const char* p, const char* end, char c)
+{
+	const __m256i needle = _mm256_set1_epi8(c);
+
+	while (end - p >= 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) p);
+		unsigned int mask = _mm256_movemask_epi8(
+					_mm256_cmpeq_epi8(chunk, needle));
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 32;
+	}
+
+	// Less than a full stride left
+	return findCharSSE2(p, end, c);
+}
+
+#endif // HTMLSCANNER_X86
+
+
+/* **********************************************************************
+ *				RUNTIME DISPATCH
+ * ********************************************************************** */
+
+namespace {
+	struct Implementation {
+		HTMLScanner::find_char_fn find_char;
+		const char* name;
+	};
+
+	Implementation selectImplementation()
+	{
+		Implementation impl = {HTMLScanner::findCharScalar, "scalar"};
+
+#ifdef HTMLSCANNER_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			impl.find_char = HTMLScanner::findCharAVX2;
+			impl.name = "avx2";
+		} else if (__builtin_cpu_supports("sse2")) {
+			impl.find_char = HTMLScanner::findCharSSE2;
+			impl.name = "sse2";
+		}
+#endif
+
+		return impl;
+	}
+
+	inline const Implementation& bestImplementation()
+	{
+		static const Implementation impl = selectImplementation();
+		return impl;
+	}
+}
+
+const char* HTMLScanner::findChar(const char* start, const char* end, char c)
+{
+	return bestImplementation().find_char(start, end, c);
+}
+
+const char* HTMLScanner::implementationName()
+{
+	return bestImplementation().name;
+}
+
+const char* HTMLScanner::findMark(const char* start, const char* end,
+				const char* mark, size_t mark_len)
+{
+	if (mark_len == 0) {
+		return start;
+	}
+
+	const char* p = start;
+	while ( size_t(end - p) >= mark_len) {
+		p = findChar(p, end - mark_len + 1, mark[0]);
+		if (p == end - mark_len + 1) {
+			break;
+		}
+		if (memcmp(p + 1, mark + 1, mark_len - 1) == 0) {
+			return p;
+		}
+		++p;
+	}
+
+	return end;
+}
+
+
+// EOF
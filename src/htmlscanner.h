@@ -0,0 +1,61 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __HTMLSCANNER_H
+#define __HTMLSCANNER_H
+/**@file htmlscanner.h
+ * @brief Vectorized character scanning for the parsers.
+ *
+ * Most of the time spent parsing a page goes into looking for the next
+ * markup character: the '<' that ends a text node, the '&' that starts
+ * an entity, the quote that ends an attribute value. The functions
+ * declared here do just that, 16 (SSE2) or 32 (AVX2) bytes at a time.
+ *
+ * The best implementation available in the running CPU is selected at
+ * runtime, falling back to a portable scalar version on other platforms.
+ */
+
+#include <stddef.h>
+
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HTMLSCANNER_X86 1
+#endif
+
+
+namespace HTMLScanner {
+	//! Signature shared by all the findChar implementations.
+	typedef const char* (*find_char_fn)(const char* start,
+					const char* end, char c);
+
+	/**Find the first occurrence of @p c in <em>[start, end)</em>.
+	 *
+	 * @return A pointer to the first @p c found or @p end if there is
+	 * 	   none.
+	 */
+	const char* findChar(const char* start, const char* end, char c);
+
+	//!@name Implementations
+	//! Exposed for testing and benchmarking. Use findChar instead.
+	//@{
+	const char* findCharScalar(const char* start, const char* end, char c);
+#ifdef HTMLSCANNER_X86
+	const char* findCharSSE2(const char* start, const char* end, char c);
+	const char* findCharAVX2(const char* start, const char* end, char c);
+#endif
+	//@}
+
+	//! Name of the implementation findChar uses in this CPU.
+	const char* implementationName();
+
+	/**Find the first occurrence of @p mark in <em>[start, end)</em>.
+	 *
+	 * @return A pointer to the start of the first occurrence of @p mark
+	 * 	   or @p end if there is none.
+	 */
+	const char* findMark(const char* start, const char* end,
+				const char* mark, size_t mark_len);
+};
+
+
+#endif // __HTMLSCANNER_H
+
+// EOF
@@ -0,0 +1,95 @@
+#ifndef __HTMLSCANNER_TEST_H
+#define __HTMLSCANNER_TEST_H
+
+#include "cxxtest/TestSuite.h"
+#include "htmlscanner.h"
+
+#include <string.h>
+#include <vector>
+
+
+class HTMLScannerTest : public CxxTest::TestSuite {
+
+	typedef std::vector<HTMLScanner::find_char_fn> ImplVec;
+
+	//! All the implementations the running CPU can use
+	ImplVec implementations()
+	{
+		ImplVec impls;
+		impls.push_back(HTMLScanner::findCharScalar);
+		impls.push_back(HTMLScanner::findChar);
+#ifdef HTMLSCANNER_X86
+		if (__builtin_cpu_supports("sse2")) {
+			impls.push_back(HTMLScanner::findCharSSE2);
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			impls.push_back(HTMLScanner::findCharAVX2);
+		}
+#endif
+		return impls;
+	}
+
+public:
+
+	void testFindCharAllPositionsAndAlignments() {
+		const size_t buf_len = 100;
+		char buf[buf_len];
+		ImplVec impls = implementations();
+
+		for(size_t i = 0; i < impls.size(); ++i) {
+			HTMLScanner::find_char_fn find = impls[i];
+			for(size_t start = 0; start < 40; ++start) {
+				// Needle absent
+				memset(buf, 'a', buf_len);
+				TS_ASSERT_EQUALS(find(buf + start, buf + buf_len,'<'),
+						buf + buf_len);
+
+				for(size_t pos = start; pos < buf_len; ++pos) {
+					memset(buf, 'a', buf_len);
+					buf[pos] = '<';
+					// A needle before start must be ignored
+					if (start > 0) {
+						buf[start - 1] = '<';
+					}
+					TS_ASSERT_EQUALS(find(buf + start,
+						buf + buf_len, '<'), buf + pos);
+					// ... and one past the end too
+					TS_ASSERT_EQUALS(find(buf + start,
+						buf + pos, '<'), buf + pos);
+				}
+			}
+		}
+	}
+
+	void testFindCharHighBytes() {
+		char buf[] = "ação <\xff\xfe&x";
+		const char* end = buf + strlen(buf);
+		ImplVec impls = implementations();
+
+		for(size_t i = 0; i < impls.size(); ++i) {
+			TS_ASSERT_EQUALS(impls[i](buf, end, '&'),
+					strchr(buf, '&'));
+			TS_ASSERT_EQUALS(impls[i](buf, end, '\xfe'),
+					strchr(buf, '\xfe'));
+			TS_ASSERT_EQUALS(impls[i](buf, buf, '&'), buf);
+		}
+	}
+
+	void testFindMark() {
+		const char text[] = "<script> a < b </scrip </script> x";
+		const char* end = text + sizeof(text) - 1;
+
+		TS_ASSERT_EQUALS(HTMLScanner::findMark(text, end, "</script", 8),
+				strstr(text, "</script>"));
+		TS_ASSERT_EQUALS(HTMLScanner::findMark(text, end, "</style", 7),
+				end);
+		TS_ASSERT_EQUALS(HTMLScanner::findMark(text, end, " x", 2),
+				end - 2);
+		TS_ASSERT_EQUALS(HTMLScanner::findMark(text, end, "x  ", 3),
+				end);
+		TS_ASSERT_EQUALS(HTMLScanner::findMark(text, end, "", 0), text);
+	}
+};
+
+
+#endif // __HTMLSCANNER_TEST_H
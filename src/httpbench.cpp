@@ -0,0 +1,231 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+/**@file httpbench.cpp
+ * @brief ThreadedHTTPServer throughput benchmark.
+ *
+ * Runs a ThreadedHTTPServer in this process, with a request handler that
+ * burns some CPU and then blocks for a while - as a query that reads a
+ * cold inverted list from disk would. Clients keep persistent connections
+ * to it and issue requests back to back, and the requests per second
+ * served are reported for 1, 2, 4 and 8 worker threads.
+ *
+ * Usage: httpbench [seconds] [clients] [work] [wait_us]
+ */
+
+#include "httpserver.hpp"
+#include "threadingutils.h"
+#include "strmisc.h"
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+
+/***********************************************************************
+				    HELPERS
+ ***********************************************************************/
+
+const uint16_t BENCH_PORT = 18090;
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void report(int workers, size_t requests, double elapsed)
+{
+	std::cout << "  " << std::setw(2) << std::right << workers <<
+		" workers" << std::setw(12) << std::fixed <<
+		std::setprecision(1) << requests / elapsed <<
+		" requests/s" << std::endl;
+}
+
+//! Burns @p work iterations of CPU, then sleeps for @p wait_us.
+struct BusyHandler : public AbstractRequestHandler {
+	int work;
+	int wait_us;
+
+	BusyHandler(int work, int wait_us) : work(work), wait_us(wait_us) {}
+
+	void process(HTTPClientHandler& req)
+	{
+		uint32_t h = 2166136261U;
+		for(int i = 0; i < work; ++i) {
+			h = (h ^ (i & 0xff)) * 16777619U;
+		}
+		if (wait_us) {
+			usleep(wait_us);
+		}
+
+		req.respond(toString(h) + "\n", "text/plain");
+	}
+};
+
+struct ServerThread : public BaseThread {
+	ThreadedHTTPServer& server;
+
+	ServerThread(ThreadedHTTPServer& server) : server(server) {}
+
+	void* run()
+	{
+		server.run();
+		return NULL;
+	}
+};
+
+/**Issues requests in a persistent connection until @c deadline.
+ *
+ * Responses are read up to the length in their Content-Length header.
+ */
+struct ClientThread : public BaseThread {
+	uint16_t port;
+	double deadline;
+	size_t requests;	//!< Responses received
+
+	ClientThread(uint16_t port, double deadline)
+	: port(port), deadline(deadline), requests(0)
+	{}
+
+	void* run()
+	{
+		const std::string request = "GET /busy HTTP/1.1" + http::CRLF +
+			"Host: localhost" + http::CRLF + http::CRLF;
+		char buf[4096];
+		int fd = connectTo();
+
+		while (fd != -1 && now() < deadline) {
+			if (send(fd, request.data(), request.size(), 0) !=
+			    ssize_t(request.size())) {
+				break;
+			}
+
+			std::string response;
+			std::string::size_type end;
+			ssize_t n = 1;
+			while ((end = response.find(http::CRLF_CRLF)) ==
+					std::string::npos &&
+			       0 < (n = recv(fd, buf, sizeof(buf), 0))) {
+				response.append(buf, n);
+			}
+			if (end == std::string::npos) {
+				break;
+			}
+
+			std::string::size_type len_pos =
+				response.find("Content-Length: ");
+			if (len_pos == std::string::npos) {
+				break;
+			}
+			size_t len = atoi(response.c_str() + len_pos + 16);
+			size_t body_start = end + http::CRLF_CRLF.size();
+			while (response.size() < body_start + len &&
+			       0 < (n = recv(fd, buf, sizeof(buf), 0))) {
+				response.append(buf, n);
+			}
+			if (response.size() < body_start + len) {
+				break;
+			}
+
+			++requests;
+		}
+
+		if (fd != -1) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	int connectTo()
+	{
+		struct sockaddr_in addr;
+		int yes = 1;
+
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		bzero(&addr, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+			close(fd);
+			return -1;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		return fd;
+	}
+};
+
+/**Serve @p n_clients for @p seconds with @p n_workers workers.
+ *
+ * @return The number of requests served.
+ */
+size_t bench(uint16_t port, int n_workers, int n_clients, double seconds,
+		int work, int wait_us)
+{
+	ThreadedHTTPServer server(port, n_workers);
+	server.putChild("busy", new BusyHandler(work, wait_us));
+
+	ServerThread server_thread(server);
+	server_thread.start();
+
+	double deadline = now() + seconds;
+	std::vector<ClientThread*> clients;
+	for(int i = 0; i < n_clients; ++i) {
+		clients.push_back(new ClientThread(port, deadline));
+		clients.back()->start();
+	}
+
+	size_t requests = 0;
+	for(size_t i = 0; i < clients.size(); ++i) {
+		clients[i]->join();
+		requests += clients[i]->requests;
+		delete clients[i];
+	}
+
+	server.stop();
+	server_thread.join();
+
+	return requests;
+}
+
+
+/***********************************************************************
+				      MAIN
+ ***********************************************************************/
+
+int main(int argc, char* argv[])
+{
+	double seconds = 3;
+	int n_clients = 16;
+	int work = 200000;
+	int wait_us = 500;
+
+	if (argc > 1) { seconds = fromString<double>(argv[1]); }
+	if (argc > 2) { n_clients = fromString<int>(argv[2]); }
+	if (argc > 3) { work = fromString<int>(argv[3]); }
+	if (argc > 4) { wait_us = fromString<int>(argv[4]); }
+
+	std::cout << "# " << n_clients << " keep-alive clients, " <<
+		seconds << "s per run, " << work << " iterations and " <<
+		wait_us << "us wait per request" << std::endl;
+
+	const int workers[] = {1, 2, 4, 8};
+	for(size_t i = 0; i < sizeof(workers)/sizeof(workers[0]); ++i) {
+		size_t requests = bench(BENCH_PORT, workers[i], n_clients,
+					seconds, work, wait_us);
+		report(workers[i], requests, seconds);
+	}
+
+	return 0;
+}
+
+//EOF
@@ -2,9 +2,16 @@
 #include "httpserver.hpp"
 
 #include <sstream>
+#include <limits>
 
 #include <arpa/inet.h>		// htons
+#include <netinet/in.h>
+#include <netinet/tcp.h>	// TCP_NODELAY
 #include <strings.h>		// bzero
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #include "strmisc.h"
 #include "urltools.h"
@@ -25,7 +32,7 @@ std::string http::mk_response_header(std::string msg, int code,
 	std::ostringstream buf;
 	const std::string& CRLF = http::CRLF;
 
-	buf <<	"HTTP/1.0 " << code <<  msg << CRLF <<
+	buf <<	"HTTP/1.0 " << code << " " << msg << CRLF <<
 		"Server: ProcastinationBroadcaster/0.1" << CRLF <<
 		"Connection: close" << CRLF << 
 		"Content-Type: " << type << CRLF << 
@@ -36,6 +43,25 @@ std::string http::mk_response_header(std::string msg, int code,
 
 }
 
+std::string http::mk_framed_response_header(size_t content_length,
+			bool keep_alive, std::string type,
+			std::string extra_hdrs)
+{
+	std::ostringstream buf;
+	const std::string& CRLF = http::CRLF;
+
+	buf <<	"HTTP/1.1 200 OK" << CRLF <<
+		"Server: ProcastinationBroadcaster/0.1" << CRLF <<
+		"Connection: " << (keep_alive ? "keep-alive" : "close") <<
+		CRLF <<
+		"Content-Type: " << type << CRLF <<
+		"Content-Length: " << content_length << CRLF <<
+		extra_hdrs <<  // They should contain line-ending CRLFs
+		CRLF;
+
+	return buf.str();
+}
+
 
 /******************************************************************************
 				   Exceptions
@@ -75,7 +101,10 @@ std::string HTTPException::make_error_page(std::string msg, int code,
 void HTTPClientHandler::go()
 {
 	try {
-		parseRequest();
+		if (! parseRequest()) {
+			loseConnection();
+			return;
+		}
 		handler->process(*this);
 	} catch (HTTPException& e) {
 		try {
@@ -87,24 +116,30 @@ void HTTPClientHandler::go()
 	}
 }
 
-void HTTPClientHandler::parseRequest()
+bool HTTPClientHandler::parseRequest()
 {
-	const int BUF_LEN = 1024;
+	const int BUF_LEN = 4096;
 	char buf[BUF_LEN];
-	ssize_t n;
-	std::string msg;
-
-	// Read untill the end of the request
-	while( 0 < (n = recv(fd,buf, BUF_LEN, 0)) ) {
-		msg.append(buf, n);
-		// Get out if found the request end
-		if (msg.find(http::CRLF_CRLF)) break;
+	ssize_t n = 1;
+	std::string::size_type end;
+
+	// Read untill the end of the request header. Whatever comes after
+	// it is left in pending.
+	while ( (end = pending.find(http::CRLF_CRLF)) == std::string::npos &&
+		0 < (n = recv(fd,buf, BUF_LEN, 0)) ) {
+		pending.append(buf, n);
 	}
 
 	// parse request
-	if (msg.empty()) {
+	if (end == std::string::npos) {
+		if (pending.empty() && n >= 0) {
+			return false; // Closed by the client
+		}
 		throw BadRequestHTTPException();
 	}
+	std::string msg(pending, 0, end);
+	pending.erase(0, end + http::CRLF_CRLF.size());
+
 	strvec_t fullreq_lines(split(msg,http::CRLF));
 	strvec_t::iterator line = fullreq_lines.begin();
 	strvec_t request_fields(split(*line," ",2));
@@ -125,6 +160,31 @@ void HTTPClientHandler::parseRequest()
 		std::string val = strip(header_fields[1]);
 		headers[key] = val;
 	}
+
+	// Keep-alive is the default in HTTP/1.1 only
+	std::string connection = headers["connection"];
+	if (proto_version == "HTTP/1.1") {
+		keep_alive = (connection != "close");
+	} else {
+		keep_alive = (connection == "keep-alive");
+	}
+
+	// Read the body, if any, so the next request starts after it
+	StrStrMap::const_iterator len_hdr = headers.find("content-length");
+	if (len_hdr != headers.end()) {
+		size_t len = fromString<size_t>(len_hdr->second);
+		while (pending.size() < len &&
+		       0 < (n = recv(fd, buf, BUF_LEN, 0))) {
+			pending.append(buf, n);
+		}
+		if (pending.size() < len) {
+			throw BadRequestHTTPException();
+		}
+		body.assign(pending, 0, len);
+		pending.erase(0, len);
+	}
+
+	return true;
 }
 
 void HTTPClientHandler::write(const std::string data)
@@ -147,6 +207,34 @@ void HTTPClientHandler::write(const std::string data)
 
 }
 
+std::string HTTPClientHandler::mkResponseHeader(size_t content_length,
+			std::string type, std::string extra_hdrs)
+{
+	framed = true;
+	return http::mk_framed_response_header(content_length,
+				allow_keep_alive && keep_alive, type,
+				extra_hdrs);
+}
+
+void HTTPClientHandler::respond(const std::string& body, std::string type,
+			std::string extra_hdrs)
+{
+	// A single write, so header and body go in the same segments
+	write(mkResponseHeader(body.size(), type, extra_hdrs) + body);
+}
+
+void HTTPClientHandler::sendFile(int file_fd, size_t len)
+{
+	off_t offset = 0;
+
+	while (size_t(offset) < len) {
+		ssize_t n = sendfile(fd, file_fd, &offset, len - offset);
+		if (n <= 0) {
+			throw ErrnoSysException("Error in sendfile()");
+		}
+	}
+}
+
 void HTTPClientHandler::loseConnection()
 {
 	if(fd) {
@@ -164,16 +252,6 @@ void HTTPClientHandler::loseConnection()
 
 void BaseHTTPServer::process(HTTPClientHandler& req)
 {
-
-	std::cout << "Method: " << req.method << " URI: " <<
-		req.uri << " version:" << req.proto_version << std::endl;
-	StrStrMap& headers = req.headers;
-	StrStrMap::const_iterator hdr;
-	for (hdr = headers.begin(); hdr != headers.end(); ++hdr){
-		std::cout << "\t" << hdr->first << " == " <<
-			hdr->second << std::endl;
-	}
-
 	// XXX HACK
 	// Just to force dot segment normalization in the request path.
 	// and avoid "path hacks" like "../../../../etc/passwd"
@@ -182,9 +260,6 @@ void BaseHTTPServer::process(HTTPClientHandler& req)
 	// Get the first path segment
 	std::vector<std::string> path_segs = split(uri.path,"/");
 	assert(path_segs.size() > 1);
-	
-	std::cout << "Requested path " << uri.path << " selector segment: "<<
-		path_segs[1] << std::endl; // FIXME
 
 	TReqHandlerMap::iterator han = handlers.find(path_segs[1]);
 	if (han == this->handlers.end()) {
@@ -192,10 +267,6 @@ void BaseHTTPServer::process(HTTPClientHandler& req)
 	} else {
 		han->second->process(req);
 	}
-
-
-
-	req.loseConnection();
 }
 
 
@@ -276,6 +347,230 @@ void BaseHTTPServer::putChild(std::string path, AbstractRequestHandler* handler)
 }
 
 
+/******************************************************************************
+			       ThreadedHTTPServer
+ ******************************************************************************/
+
+namespace {
+	//! Where the epoll events of the listening socket and of the
+	//! wake-up pipe point to. Connections point to themselves.
+	char LISTENER_EVENT;
+	char WAKE_EVENT;
+}
+
+ThreadedHTTPServer::ThreadedHTTPServer(uint16_t server_port, int n_workers,
+			int keep_alive_timeout, int backlog)
+: BaseHTTPServer(server_port, backlog),
+  n_workers(n_workers < 1 ? 1 : n_workers),
+  keep_alive_timeout(keep_alive_timeout),
+  epoll_fd(-1),
+  ready(),
+  idle(),
+  idle_lock()
+{
+	wake_fds[0] = wake_fds[1] = -1;
+
+	epoll_fd = epoll_create(n_workers + 2);
+	if (epoll_fd == -1) {
+		throw ErrnoSysException("Error in epoll_create()");
+	}
+	if (pipe(wake_fds) == -1) {
+		throw ErrnoSysException("Error creating wake-up pipe");
+	}
+
+	// accept() must not block when a client gives up before it
+	int flags = fcntl(server_fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(server_fd, F_SETFL, flags | O_NONBLOCK)) {
+		throw ErrnoSysException("Error configuring listening socket");
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &LISTENER_EVENT;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+		throw ErrnoSysException("Error in epoll_ctl()");
+	}
+	ev.data.ptr = &WAKE_EVENT;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fds[0], &ev) == -1) {
+		throw ErrnoSysException("Error in epoll_ctl()");
+	}
+}
+
+ThreadedHTTPServer::~ThreadedHTTPServer()
+{
+	closeIdle(std::numeric_limits<time_t>::max());
+	close(wake_fds[0]);
+	close(wake_fds[1]);
+	close(epoll_fd);
+}
+
+void ThreadedHTTPServer::run()
+{
+	const int MAX_EVENTS = 64;
+	struct epoll_event events[MAX_EVENTS];
+	bool running = true;
+	time_t last_sweep = time(0);
+
+	std::vector<Worker*> workers;
+	for(int i = 0; i < n_workers; ++i) {
+		workers.push_back(new Worker(*this));
+		workers.back()->start();
+	}
+
+	while (running) {
+		int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+		if (n == -1 && errno != EINTR) {
+			throw ErrnoSysException("Error in epoll_wait()");
+		}
+
+		for(int i = 0; i < n; ++i) {
+			void* ptr = events[i].data.ptr;
+			if (ptr == &LISTENER_EVENT) {
+				acceptClients();
+			} else if (ptr == &WAKE_EVENT) {
+				running = false;
+			} else {
+				Connection* conn = (Connection*) ptr;
+				{
+					AutoLock lock(idle_lock);
+					idle.erase(conn);
+				}
+				ready.put(conn);
+			}
+		}
+
+		time_t now = time(0);
+		if (now != last_sweep) {
+			closeIdle(now - keep_alive_timeout);
+			last_sweep = now;
+		}
+	}
+
+	// Workers leave after serving what was queued before
+	for(size_t i = 0; i < workers.size(); ++i) {
+		ready.put(0);
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		workers[i]->join();
+		delete workers[i];
+	}
+	closeIdle(std::numeric_limits<time_t>::max());
+}
+
+void ThreadedHTTPServer::stop()
+{
+	char c = 0;
+	if (::write(wake_fds[1], &c, 1) != 1) {
+		throw ErrnoSysException("Error waking the server up");
+	}
+}
+
+void ThreadedHTTPServer::acceptClients()
+{
+	int yes = 1;
+	struct timeval timeout = {keep_alive_timeout, 0};
+
+	while (true) {
+		int cli_fd = accept(server_fd, NULL, NULL);
+		if (cli_fd == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == ECONNABORTED || errno == EINTR) {
+				return;
+			}
+			throw ErrnoSysException("Error in accept.");
+		}
+
+		// Small responses go out at once, and a stalled client
+		// can't hold a worker forever
+		setsockopt(cli_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		setsockopt(cli_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+				sizeof(timeout));
+		setsockopt(cli_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+				sizeof(timeout));
+
+		watch(new Connection(cli_fd), EPOLL_CTL_ADD);
+	}
+}
+
+void ThreadedHTTPServer::watch(Connection* conn, int op)
+{
+	// Idle before epoll can see it: run() takes it out from there
+	{
+		AutoLock lock(idle_lock);
+		idle[conn] = time(0);
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = conn;
+	if (epoll_ctl(epoll_fd, op, conn->fd, &ev) == -1) {
+		{
+			AutoLock lock(idle_lock);
+			idle.erase(conn);
+		}
+		close(conn->fd);
+		delete conn;
+	}
+}
+
+void ThreadedHTTPServer::closeIdle(time_t limit)
+{
+	AutoLock lock(idle_lock);
+
+	idle_map_t::iterator i = idle.begin();
+	while (i != idle.end()) {
+		if (i->second < limit) {
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, i->first->fd, NULL);
+			close(i->first->fd);
+			delete i->first;
+			idle.erase(i++);
+		} else {
+			++i;
+		}
+	}
+}
+
+void ThreadedHTTPServer::serve(Connection* conn)
+{
+	bool keep = true;
+
+	// Pipelined requests already read are served right away: epoll
+	// won't tell about them
+	do {
+		try {
+			HTTPClientHandler client(this, conn->fd, true);
+			client.pending.swap(conn->pending);
+			client.go();
+			keep = client.keepConnection();
+			if (keep) {
+				conn->pending.swap(client.pending);
+				client.detach();
+			}
+		} catch (std::exception& e) {
+			std::cerr << "Error handling client: " << e.what() <<
+				std::endl;
+			keep = false;
+		}
+	} while (keep &&
+		 conn->pending.find(http::CRLF_CRLF) != std::string::npos);
+
+	if (keep) {
+		watch(conn, EPOLL_CTL_MOD);
+	} else {
+		delete conn; // The client handler closed the socket
+	}
+}
+
+void* ThreadedHTTPServer::Worker::run()
+{
+	Connection* conn;
+	while ( (conn = server.ready.get()) ) {
+		server.serve(conn);
+	}
+	return NULL;
+}
+
+
 /******************************************************************************
 			     Some Request Handlers
  ******************************************************************************/
@@ -288,11 +583,10 @@ void StaticFileHandler::process(HTTPClientHandler& req)
 	std::string response;
 
 	try {
-		response = mk_response_header("OK", 200, ctype);
 		ManagedFilePtr file(name.c_str());
+		response = req.mkResponseHeader(file.filesize(), ctype);
 		req.write(response);
-		sendfile( req.fd, file.getFileno(),
-			  NULL, file.filesize());
+		req.sendFile(file.getFileno(), file.filesize());
 	} catch (ErrnoSysException& e) {
 		throw InternalServerErrorHTTPException(e.what());
 	}
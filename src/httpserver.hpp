@@ -7,9 +7,11 @@
 
 #include <vector>
 #include <string>
+#include <map>
 #include <ext/hash_map>
 #include <tr1/functional>
 #include <stdexcept>
+#include <unistd.h>	// close
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -20,6 +22,7 @@
  * developers - i.e., my life
  */
 #include "mmapedfile.h"	
+#include "threadingutils.h"
 
 /******************************************************************************
 				    TypeDefs
@@ -54,6 +57,18 @@ std::string mk_response_header(std::string msg="OK", int code=200,
 		std::string type="text/html; charset=utf-8",
 		std::string extra_hdrs="");
 
+/**Make a "200 OK" HTTP/1.1 response header for a body of known length.
+ *
+ * Unlike mk_response_header()'s, these responses can be followed by
+ * others in the same connection.
+ *
+ * @param content_length The size of the response body.
+ * @param keep_alive Should the connection be kept open after it?
+ */
+std::string mk_framed_response_header(size_t content_length, bool keep_alive,
+		std::string type="text/html; charset=utf-8",
+		std::string extra_hdrs="");
+
 };
 
 
@@ -202,20 +217,37 @@ public:
 				   */
 	
 	StrStrMap headers;	  //!< HTTP request headers
+	std::string body;	  //!< The request body, if any
+
+	/**Data read from the client but not parsed yet.
+	 *
+	 * What comes after the request, i.e. the start of the next one in
+	 * a persistent connection.
+	 */
+	std::string pending;
 
 	AbstractRequestHandler* handler; /**< The request handler that will be
 					  *   used to handle this client
 					  *   request
 					  */
 
+	bool allow_keep_alive;	//!< May the connection outlive the request?
+	bool keep_alive;	//!< Does the client want it to?
+	bool framed;		//!< Was the response's length declared?
+
 	/**Constructor.
 	 *
 	 * @param handler The request handler for this client.
 	 * @param cli_fd  The client's connection socket.
+	 * @param allow_keep_alive Will the caller serve other requests in
+	 * 	  this connection? See keepConnection().
 	 *
 	 */
-	HTTPClientHandler(AbstractRequestHandler* handler, int cli_fd)
-	: fd(cli_fd) , handler(handler) 
+	HTTPClientHandler(AbstractRequestHandler* handler, int cli_fd,
+			bool allow_keep_alive = false)
+	: fd(cli_fd), body(), pending(), handler(handler),
+	  allow_keep_alive(allow_keep_alive), keep_alive(false),
+	  framed(false)
 	{}
 
 	~HTTPClientHandler()
@@ -238,8 +270,10 @@ public:
 	 * sent by the client. Invalid request will raise an 
 	 * @c BadRequestHTTPException()
 	 *
+	 * @return false if the client closed the connection without
+	 * 	   sending a thing.
 	 */
-	void parseRequest();
+	bool parseRequest();
 
 	/**Send data to the client.
 	 *
@@ -250,7 +284,47 @@ public:
 	 *
 	 */
 	void write(const std::string data);
-	
+
+	/**Make the response header for a body of @p content_length bytes.
+	 *
+	 * Handlers should prefer this to http::mk_response_header(): as the
+	 * body's length is known, the connection can be kept open.
+	 */
+	std::string mkResponseHeader(size_t content_length,
+			std::string type="text/html; charset=utf-8",
+			std::string extra_hdrs="");
+
+	//! Send a "200 OK" response with @p body.
+	void respond(const std::string& body,
+			std::string type="text/html; charset=utf-8",
+			std::string extra_hdrs="");
+
+	/**Send @p len bytes of a file, after a response header.
+	 *
+	 * @throw ErrnoSysException
+	 */
+	void sendFile(int file_fd, size_t len);
+
+	/**Can the connection serve another request?
+	 *
+	 * Only if the caller allows it, the client wants it, the response
+	 * had its length declared and the connection is still open.
+	 */
+	inline bool keepConnection() const
+	{
+		return fd && allow_keep_alive && keep_alive && framed;
+	}
+
+	/**Stop managing the client's socket, without closing it.
+	 *
+	 * @return the socket.
+	 */
+	inline int detach()
+	{
+		int cli_fd = fd;
+		fd = 0;
+		return cli_fd;
+	}
 
 	/**Close the connection.
 	 *
@@ -299,6 +373,7 @@ struct BaseHTTPServer : public AbstractRequestHandler {
 			i->second = 0;
 		}
 
+		close(server_fd);
 	}
 
 	static int setupServerSocket(uint16_t server_port, int backlog = 10);
@@ -315,7 +390,7 @@ struct BaseHTTPServer : public AbstractRequestHandler {
 	 * Can throw ErrnoSysException if an error happens while calling
 	 * @c accept().
 	 */
-	void run();
+	virtual void run();
 
 	/**Handle a new client.
 	 *
@@ -346,6 +421,94 @@ struct BaseHTTPServer : public AbstractRequestHandler {
 };
 
 
+/******************************************************************************
+			       ThreadedHTTPServer
+ ******************************************************************************/
+
+/**HTTP server with a pool of worker threads and persistent connections.
+ *
+ * The thread calling run() waits, with epoll, for new connections and for
+ * requests in the open ones. Connections with a request are queued to a
+ * fixed pool of workers, which parse it and call the request handlers.
+ * After the response, HTTP/1.1 keep-alive connections go back to epoll
+ * until they have been idle for longer than the keep-alive timeout.
+ *
+ * @warning Request handlers are called from several threads at once:
+ * 	    they must keep per-request state on the stack and guard
+ * 	    whatever they share.
+ */
+class ThreadedHTTPServer : public BaseHTTPServer {
+	//! A client connection between requests.
+	struct Connection {
+		int fd;
+		std::string pending;	//!< See HTTPClientHandler::pending
+
+		Connection(int fd) : fd(fd), pending() {}
+	};
+
+	struct Worker : public BaseThread {
+		ThreadedHTTPServer& server;
+
+		Worker(ThreadedHTTPServer& server) : server(server) {}
+
+		void* run();
+	};
+
+	typedef std::map<Connection*, time_t> idle_map_t;
+
+	int n_workers;
+	int keep_alive_timeout;	//!< In seconds
+	int epoll_fd;
+	int wake_fds[2];	//!< Pipe stop() wakes run() up with
+
+	BlockingQueue<Connection*> ready; //!< Connections with a request
+
+	//! Connections waiting for a request in epoll and since when
+	idle_map_t idle;
+	CatholicShameMutex idle_lock;
+
+	//!This class is non-copyable
+	ThreadedHTTPServer(const ThreadedHTTPServer&);
+	//!This class is non-copyable
+	ThreadedHTTPServer& operator=(const ThreadedHTTPServer&);
+
+	//! Accept every pending connection.
+	void acceptClients();
+
+	//! Wait, in epoll, for a request in @p conn.
+	void watch(Connection* conn, int op);
+
+	//! Close the connections idle since before @p limit.
+	void closeIdle(time_t limit);
+
+	//! Serve @p conn's requests. Called by the workers.
+	void serve(Connection* conn);
+
+public:
+	/**Constructor.
+	 *
+	 * @param n_workers Number of worker threads.
+	 * @param keep_alive_timeout Seconds idle connections are kept open.
+	 */
+	ThreadedHTTPServer(uint16_t server_port, int n_workers,
+			int keep_alive_timeout = 15, int backlog = 128);
+
+	virtual ~ThreadedHTTPServer();
+
+	/**Serve clients, until stop() is called.
+	 *
+	 * @throw ErrnoSysException
+	 */
+	void run();
+
+	/**Make run() return, once the requests being served are done.
+	 *
+	 * Can be called from any thread.
+	 */
+	void stop();
+};
+
+
 /******************************************************************************
 			     Some Request Handlers
  ******************************************************************************/
@@ -0,0 +1,123 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __HTTPSERVER_TEST_H
+#define __HTTPSERVER_TEST_H
+
+#include "httpserver.hpp"
+#include "cxxtest/TestSuite.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+//! Answers with the request's URI and body.
+struct EchoRequestHandler : public AbstractRequestHandler {
+	void process(HTTPClientHandler& req)
+	{
+		req.respond(req.uri + " " + req.body, "text/plain");
+	}
+};
+
+class HTTPClientHandlerTestSuit : public CxxTest::TestSuite {
+	//! Read until the peer closes the connection.
+	static std::string readAll(int fd)
+	{
+		std::string data;
+		char buf[1024];
+		ssize_t n;
+		while (0 < (n = recv(fd, buf, sizeof(buf), 0))) {
+			data.append(buf, n);
+		}
+		return data;
+	}
+
+public:
+	void testKeepAliveAndPipelining()
+	{
+		int fds[2];
+		TS_ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+		// Two pipelined requests, the first with a body
+		std::string requests =
+			"POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nxyz"
+			"GET /b HTTP/1.1\r\nConnection: close\r\n\r\n";
+		TS_ASSERT_EQUALS(send(fds[0], requests.data(), requests.size(),
+				0), ssize_t(requests.size()));
+
+		EchoRequestHandler handler;
+		std::string pending;
+		int fd;
+		{
+			HTTPClientHandler client(&handler, fds[1], true);
+			client.go();
+			TS_ASSERT_EQUALS(client.body, "xyz");
+			TS_ASSERT(client.keepConnection());
+			pending.swap(client.pending);
+			fd = client.detach();
+		}
+		TS_ASSERT_EQUALS(pending.find("GET /b"), 0U);
+		{
+			HTTPClientHandler client(&handler, fd, true);
+			client.pending.swap(pending);
+			client.go();
+			TS_ASSERT_EQUALS(client.uri, "/b");
+			TS_ASSERT(!client.keepConnection());
+		} // closes the connection
+
+		std::string responses = readAll(fds[0]);
+		close(fds[0]);
+
+		std::string first = "HTTP/1.1 200 OK\r\n";
+		TS_ASSERT_EQUALS(responses.find(first), 0U);
+		TS_ASSERT_DIFFERS(responses.find("Connection: keep-alive\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Length: 6\r\n\r\n/a xyz"),
+				std::string::npos);
+		TS_ASSERT_DIFFERS(responses.find("Connection: close\r\n"
+				"Content-Type: text/plain\r\n"
+				"Content-Length: 3\r\n\r\n/b "),
+				std::string::npos);
+	}
+
+	void testNoKeepAlive()
+	{
+		EchoRequestHandler handler;
+		// HTTP/1.0 closes unless asked not to, and so does a caller
+		// that doesn't allow keep-alive
+		const char* requests[] = {
+			"GET / HTTP/1.0\r\n\r\n",
+			"GET / HTTP/1.1\r\n\r\n" };
+		const bool allow[] = {true, false};
+
+		for(int i = 0; i < 2; ++i) {
+			int fds[2];
+			TS_ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0,
+					fds), 0);
+			std::string req(requests[i]);
+			send(fds[0], req.data(), req.size(), 0);
+
+			HTTPClientHandler client(&handler, fds[1], allow[i]);
+			client.go();
+			TS_ASSERT(!client.keepConnection());
+			client.loseConnection();
+
+			std::string response = readAll(fds[0]);
+			close(fds[0]);
+			TS_ASSERT_DIFFERS(response.find("Connection: close\r\n"),
+					std::string::npos);
+		}
+	}
+
+	void testClosedWithoutRequest()
+	{
+		int fds[2];
+		TS_ASSERT_EQUALS(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+		close(fds[0]);
+
+		EchoRequestHandler handler;
+		HTTPClientHandler client(&handler, fds[1], true);
+		TS_ASSERT(!client.parseRequest());
+	}
+};
+
+
+#endif // __HTTPSERVER_TEST_H
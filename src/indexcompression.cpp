@@ -0,0 +1,625 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "indexcompression.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <string.h>
+
+#ifdef INDEXCOMPRESSION_X86
+#include <immintrin.h>
+#endif
+
+
+/***********************************************************************
+		       Stream-VByte Compression Functions
+ ***********************************************************************/
+
+const uint32_t StreamVByteCompressor::BLOCK_SIZE;
+
+namespace {
+	/**Decoding tables, indexed by control byte.
+	 *
+	 * For each of the 256 possible control bytes we keep the number of
+	 * data bytes of its 4 integers and the byte shuffle that spreads
+	 * them in four 32 bit lanes.
+	 */
+	struct StreamVByteTables {
+		uint8_t length[256];
+		uint8_t shuffle[256][16];
+
+		StreamVByteTables()
+		{
+			for(int c = 0; c < 256; ++c) {
+				uint8_t src = 0;
+				for(int i = 0; i < 4; ++i) {
+					int len = ((c >> (2 * i)) & 3) + 1;
+					for(int b = 0; b < 4; ++b) {
+						// 0xff makes pshufb write a 0
+						shuffle[c][4 * i + b] =
+							(b < len) ? src++ : 0xff;
+					}
+				}
+				length[c] = src;
+			}
+		}
+	};
+
+	inline const StreamVByteTables& tables()
+	{
+		static const StreamVByteTables t;
+		return t;
+	}
+
+	//! Number of control bytes of a stream with @p n integers.
+	inline uint32_t controlLength(uint32_t n) { return (n + 3) / 4; }
+
+	/**Check a stream fits in <em>[in, end)</em>.
+	 *
+	 * @return the start of the stream's data bytes.
+	 */
+	inline const uint8_t* checkStream(const uint8_t* in, const uint8_t* end,
+					uint32_t n)
+	{
+		const uint32_t n_ctrl = controlLength(n);
+		if (in + n_ctrl > end) {
+			throw std::out_of_range("Stream-VByte stream truncated");
+		}
+
+		// Full control bytes; the last one may describe less than 4
+		// integers, but unused lengths are always encoded as 0 (1 byte)
+		size_t data_len = 0;
+		const uint8_t* length = tables().length;
+		for(uint32_t i = 0; i < n_ctrl; ++i) {
+			data_len += length[in[i]];
+		}
+		data_len -= 4 * n_ctrl - n;
+
+		if (in + n_ctrl + data_len > end) {
+			throw std::out_of_range("Stream-VByte stream truncated");
+		}
+
+		return in + n_ctrl;
+	}
+
+	//! Decode integers [i, n) of a checked stream, one at a time.
+	inline const uint8_t* decodeTail(const uint8_t* ctrl,
+				const uint8_t* data, uint32_t i, uint32_t n,
+				uint32_t* out)
+	{
+		for(; i < n; ++i) {
+			uint32_t len = ((ctrl[i >> 2] >> (2 * (i & 3))) & 3) + 1;
+			uint32_t value = 0;
+			for(uint32_t b = 0; b < len; ++b) {
+				value |= uint32_t(data[b]) << (8 * b);
+			}
+			out[i] = value;
+			data += len;
+		}
+		return data;
+	}
+}
+
+void StreamVByteCompressor::encode(const uint32_t* in, uint32_t n,
+					charvec_t& output)
+{
+	size_t ctrl = output.size();
+	output.resize(ctrl + controlLength(n), 0);
+
+	for(uint32_t i = 0; i < n; ++i) {
+		uint32_t value = in[i];
+		uint32_t len = (value < (1U << 8)) ? 1 :
+				(value < (1U << 16)) ? 2 :
+				(value < (1U << 24)) ? 3 : 4;
+
+		output[ctrl + (i >> 2)] |= (len - 1) << (2 * (i & 3));
+		for(uint32_t b = 0; b < len; ++b) {
+			output.push_back( (value >> (8 * b)) & 0xff);
+		}
+	}
+}
+
+const uint8_t* StreamVByteCompressor::decodeScalar(const uint8_t* in,
+				const uint8_t* end, uint32_t n, uint32_t* out)
+{
+	const uint8_t* data = checkStream(in, end, n);
+
+	return decodeTail(in, data, 0, n, out);
+}
+
+#ifdef INDEXCOMPRESSION_X86
+
+__attribute__((target("ssse3")))
+const uint8_t* StreamVByteCompressor::decodeSSSE3(const uint8_t* in,
+				const uint8_t* end, uint32_t n, uint32_t* out)
+{
+	const uint8_t* data = checkStream(in, end, n);
+	const StreamVByteTables& t = tables();
+
+	// Whole groups of 4, as long as a 16 byte load stays in bounds
+	uint32_t i = 0;
+	for(; i + 4 <= n && data + 16 <= end; i += 4) {
+		uint8_t c = in[i >> 2];
+		__m128i raw = _mm_loadu_si128((const __m128i*) data);
+		__m128i shuf = _mm_loadu_si128((const __m128i*) t.shuffle[c]);
+		_mm_storeu_si128((__m128i*) (out + i),
+				 _mm_shuffle_epi8(raw, shuf));
+		data += t.length[c];
+	}
+
+	return decodeTail(in, data, i, n, out);
+}
+
+#endif // INDEXCOMPRESSION_X86
+
+namespace {
+	struct Implementation {
+		StreamVByteCompressor::decode_fn decode;
+		const char* name;
+	};
+
+	Implementation selectImplementation()
+	{
+		Implementation impl = {StreamVByteCompressor::decodeScalar,
+					"scalar"};
+
+#ifdef INDEXCOMPRESSION_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("ssse3")) {
+			impl.decode = StreamVByteCompressor::decodeSSSE3;
+			impl.name = "ssse3";
+		}
+#endif
+
+		return impl;
+	}
+
+	inline const Implementation& bestImplementation()
+	{
+		static const Implementation impl = selectImplementation();
+		return impl;
+	}
+}
+
+const uint8_t* StreamVByteCompressor::decode(const uint8_t* in,
+				const uint8_t* end, uint32_t n, uint32_t* out)
+{
+	return bestImplementation().decode(in, end, n, out);
+}
+
+const char* StreamVByteCompressor::implementationName()
+{
+	return bestImplementation().name;
+}
+
+void StreamVByteCompressor::decompress(uint32_t count, filebuf in,
+					inverted_list_vec_t& out)
+{
+	out.reserve(out.size() + count);
+
+	uint32_t docids[BLOCK_SIZE];
+	uint32_t freqs[BLOCK_SIZE];
+	uint32_t last_docid = 0;
+	const uint8_t* p = (const uint8_t*) in.current;
+	const uint8_t* end = (const uint8_t*) in.end;
+
+	// Sequential decoding doesn't need the skip table
+	p += skipTableSize(count);
+
+	while (count > 0) {
+		uint32_t n = std::min(count, BLOCK_SIZE);
+		p = decodeBlock(p, end, n, last_docid, docids, freqs);
+		for(uint32_t i = 0; i < n; ++i) {
+			out.push_back(d_fdt_t(docids[i], freqs[i]));
+		}
+		count -= n;
+	}
+}
+
+
+/***********************************************************************
+			       InvertedListCodec
+ ***********************************************************************/
+
+const char* InvertedListCodec::name(format_t fmt)
+{
+	switch(fmt) {
+	case RAW:		return "raw";
+	case BYTEWISE:		return "bytewise";
+	case STREAMVBYTE:	return "streamvbyte";
+	}
+	return "unknown";
+}
+
+InvertedListCodec::format_t InvertedListCodec::fromName(
+					const std::string& fmt_name)
+{
+	if (fmt_name == "raw") {
+		return RAW;
+	} else if (fmt_name == "bytewise") {
+		return BYTEWISE;
+	} else if (fmt_name == "streamvbyte") {
+		return STREAMVBYTE;
+	}
+	throw std::runtime_error("Unknown inverted list format '" +
+				fmt_name + "'");
+}
+
+InvertedListCodec::format_t InvertedListCodec::readFormat(
+					const std::string& dir)
+{
+	std::ifstream in(std::string(dir + "/index.fmt").c_str());
+	std::string fmt_name;
+
+	if (! (in >> fmt_name)) {
+		// Older inverted files were always byte-wise compressed
+		return BYTEWISE;
+	}
+	return fromName(fmt_name);
+}
+
+void InvertedListCodec::writeFormat(const std::string& dir, format_t fmt)
+{
+	std::ofstream out;
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(std::string(dir + "/index.fmt").c_str());
+	out << name(fmt) << std::endl;
+}
+
+void InvertedListCodec::decompress(format_t fmt, uint32_t count, filebuf in,
+				inverted_list_vec_t& out)
+{
+	out.clear();
+
+	switch(fmt) {
+	case RAW:
+		{
+			const d_fdt_t* list = (const d_fdt_t*)
+					in.read(count * sizeof(d_fdt_t));
+			out.assign(list, list + count);
+		}
+		break;
+	case BYTEWISE:
+		ByteWiseCompressor::decompress(count, in, out);
+		break;
+	case STREAMVBYTE:
+		StreamVByteCompressor::decompress(count, in, out);
+		break;
+	}
+}
+
+
+/***********************************************************************
+				 DecodedPostings
+ ***********************************************************************/
+
+void DecodedPostings::decode(InvertedListCodec::format_t fmt, uint32_t count,
+				filebuf in)
+{
+	inverted_list_vec_t ilist;
+	InvertedListCodec::decompress(fmt, count, in, ilist);
+
+	docids.resize(ilist.size());
+	freqs.resize(ilist.size());
+	for(size_t i = 0; i < ilist.size(); ++i) {
+		docids[i] = ilist[i].first;
+		freqs[i] = ilist[i].second;
+	}
+}
+
+
+/***********************************************************************
+				 PostingCursor
+ ***********************************************************************/
+
+PostingCursor::PostingCursor()
+: ft(0),
+  n_blocks(0),
+  skips(0),
+  blocks(0),
+  end(0),
+  block(0),
+  n(0),
+  pos(0),
+  at_end(true),
+  blocks_decoded(0),
+  docids(),
+  freqs(),
+  ilist(),
+  block_docids(0),
+  block_freqs(0)
+{}
+
+PostingCursor::PostingCursor(InvertedListCodec::format_t fmt, uint32_t count,
+				filebuf in)
+: ft(0),
+  n_blocks(0),
+  skips(0),
+  blocks(0),
+  end(0),
+  block(0),
+  n(0),
+  pos(0),
+  at_end(true),
+  blocks_decoded(0),
+  docids(),
+  freqs(),
+  ilist(),
+  block_docids(0),
+  block_freqs(0)
+{
+	open(fmt, count, in);
+}
+
+PostingCursor::PostingCursor(const PostingCursor& other)
+: docids(),
+  freqs(),
+  ilist()
+{
+	copyFrom(other);
+}
+
+PostingCursor& PostingCursor::operator=(const PostingCursor& other)
+{
+	if (this != &other) {
+		copyFrom(other);
+	}
+	return *this;
+}
+
+void PostingCursor::copyFrom(const PostingCursor& other)
+{
+	ft = other.ft;
+	n_blocks = other.n_blocks;
+	skips = other.skips;
+	blocks = other.blocks;
+	end = other.end;
+	block = other.block;
+	n = other.n;
+	pos = other.pos;
+	at_end = other.at_end;
+	blocks_decoded = other.blocks_decoded;
+	docids = other.docids;
+	freqs = other.freqs;
+	ilist = other.ilist;
+
+	const bool own = !other.docids.empty() &&
+			other.block_docids == &other.docids[0];
+	block_docids = own ? &docids[0] : other.block_docids;
+	block_freqs = own ? &freqs[0] : other.block_freqs;
+}
+
+void PostingCursor::open(InvertedListCodec::format_t fmt, uint32_t count,
+				filebuf in)
+{
+	ft = count;
+	n_blocks = 0;
+	skips = 0;
+	blocks = 0;
+	end = (const uint8_t*) in.end;
+	block = 0;
+	n = 0;
+	pos = 0;
+	at_end = (count == 0);
+	blocks_decoded = 0;
+
+	if (count == 0) {
+		return;
+	}
+
+	if (fmt == InvertedListCodec::STREAMVBYTE) {
+		n_blocks = StreamVByteCompressor::nBlocks(count);
+		size_t table_size = StreamVByteCompressor::skipTableSize(count);
+		if (table_size > 0) {
+			skips = (const StreamVByteCompressor::skip_entry_t*)
+					in.read(table_size);
+		}
+		blocks = (const uint8_t*) in.current;
+		docids.resize(StreamVByteCompressor::BLOCK_SIZE);
+		freqs.resize(StreamVByteCompressor::BLOCK_SIZE);
+		loadBlock(0);
+	} else {
+		// No skip information: the whole list is a single block
+		InvertedListCodec::decompress(fmt, count, in, ilist);
+		docids.resize(count);
+		freqs.resize(count);
+		for(size_t i = 0; i < ilist.size(); ++i) {
+			docids[i] = ilist[i].first;
+			freqs[i] = ilist[i].second;
+		}
+		block_docids = &docids[0];
+		block_freqs = &freqs[0];
+		n_blocks = 1;
+		n = count;
+		++blocks_decoded;
+	}
+}
+
+void PostingCursor::open(const DecodedPostings& list)
+{
+	ft = list.docids.size();
+	skips = 0;
+	blocks = 0;
+	end = 0;
+	block = 0;
+	pos = 0;
+	at_end = (ft == 0);
+	blocks_decoded = 0;
+
+	// A single block, as other formats without skip information
+	n_blocks = at_end ? 0 : 1;
+	n = ft;
+	if (! at_end) {
+		block_docids = &list.docids[0];
+		block_freqs = &list.freqs[0];
+	}
+}
+
+void PostingCursor::loadBlock(uint32_t b)
+{
+	const uint32_t BLOCK_SIZE = StreamVByteCompressor::BLOCK_SIZE;
+
+	const uint8_t* start = blocks;
+	uint32_t base = 0;
+	if (skips) {
+		start += skips[b].offset;
+		base = (b > 0) ? skips[b - 1].last_docid : 0;
+	}
+
+	block = b;
+	n = std::min(BLOCK_SIZE, ft - b * BLOCK_SIZE);
+	pos = 0;
+	StreamVByteCompressor::decodeBlock(start, end, n, base, &docids[0],
+						&freqs[0]);
+	block_docids = &docids[0];
+	block_freqs = &freqs[0];
+	++blocks_decoded;
+}
+
+bool PostingCursor::nextGEQ(uint32_t target)
+{
+	if (at_end) {
+		return false;
+	} else if (block_docids[pos] >= target) {
+		return true;
+	}
+
+	if (blockLast(block) < target) {
+		if (block + 1 >= n_blocks) {
+			at_end = true;
+			return false;
+		}
+
+		// Gallop through the skip table for a block that ends at or
+		// after target...
+		uint32_t lo = block; // last block known to end before target
+		uint32_t step = 1;
+		uint32_t hi = block + step;
+		while (hi < n_blocks && skips[hi].last_docid < target) {
+			lo = hi;
+			step *= 2;
+			hi = block + step;
+		}
+		if (hi >= n_blocks) {
+			hi = n_blocks - 1;
+			if (skips[hi].last_docid < target) {
+				at_end = true;
+				return false;
+			}
+		}
+
+		// ... then binary search the first one in (lo, hi]
+		while (hi - lo > 1) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (skips[mid].last_docid < target) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		loadBlock(hi);
+	}
+
+	// The target is in the current block, if anywhere
+	pos = std::lower_bound(block_docids + pos, block_docids + n,
+				target) - block_docids;
+	assert(pos < n);
+
+	return true;
+}
+
+
+/***********************************************************************
+			    PositionListCompressor
+ ***********************************************************************/
+
+const uint32_t PositionListCompressor::BLOCK_SIZE;
+
+void PositionListCompressor::compress(const inverted_list_vec_t& ilist,
+			const std::vector<uint32_t>& positions,
+			charvec_t& output)
+{
+	const size_t table_start = output.size();
+	output.resize(table_start + skipTableSize(ilist.size()));
+	const size_t data_start = output.size();
+
+	size_t p = 0;
+	for(size_t i = 0; i < ilist.size(); ++i) {
+		if (i > 0 && i % BLOCK_SIZE == 0) {
+			uint32_t offset = output.size() - data_start;
+			memcpy(&output[table_start + (i / BLOCK_SIZE - 1) *
+					sizeof(uint32_t)],
+				&offset, sizeof(offset));
+		}
+
+		uint32_t last = uint32_t(-1);
+		for(uint32_t f = 0; f < ilist[i].second; ++f, ++p) {
+			ByteWiseCompressor::encode(positions[p] - last, output);
+			last = positions[p];
+		}
+	}
+	assert(p == positions.size());
+}
+
+/***********************************************************************
+				 PositionCursor
+ ***********************************************************************/
+
+PositionCursor::PositionCursor()
+: ft(0),
+  skips(0),
+  data(0),
+  end(0),
+  next_ordinal(0),
+  cur(0)
+{}
+
+void PositionCursor::open(uint32_t count, filebuf in)
+{
+	ft = count;
+	skips = 0;
+	size_t table_size = PositionListCompressor::skipTableSize(count);
+	if (table_size > 0) {
+		skips = (const uint32_t*) in.read(table_size);
+	}
+	data = (const uint8_t*) in.current;
+	end = (const uint8_t*) in.end;
+	next_ordinal = 0;
+	cur = data;
+}
+
+void PositionCursor::read(const PostingCursor& postings,
+			std::vector<uint32_t>& positions)
+{
+	const uint32_t BLOCK_SIZE = PositionListCompressor::BLOCK_SIZE;
+	const uint32_t o = postings.ordinal();
+	const uint32_t b = o / BLOCK_SIZE;
+
+	// Only postings of o's block can be skipped over: their
+	// frequencies are the only ones the cursor has.
+	if (next_ordinal > o || next_ordinal < b * BLOCK_SIZE) {
+		cur = data + ((b > 0) ? skips[b - 1] : 0);
+		next_ordinal = b * BLOCK_SIZE;
+	}
+	for(; next_ordinal < o; ++next_ordinal) {
+		skipValues(postings.freqAt(next_ordinal));
+	}
+
+	filebuf in((const char*) cur, (cur < end) ? end - cur : 0);
+	uint32_t last = uint32_t(-1);
+	uint32_t gap;
+
+	positions.clear();
+	for(uint32_t f = postings.freq(); f > 0; --f) {
+		ByteWiseCompressor::decode(in, gap);
+		last += gap;
+		positions.push_back(last);
+	}
+
+	cur = (const uint8_t*) in.current;
+	++next_ordinal;
+}
+
+
+// EOF
@@ -8,10 +8,20 @@
 #include "filebuf.h"	// We made this f*cker for byte processing, right?
 #include "indexerutils.hpp"
 
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
 /***********************************************************************
 			     Typedefs and constants
  ***********************************************************************/
 
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define INDEXCOMPRESSION_X86 1
+#endif
+
 /***********************************************************************
 			 ByteWise Compression Functions
  ***********************************************************************/
@@ -67,23 +77,28 @@ struct ByteWiseCompressor {
 
 
 	
-	/**Compress an inverted list.
+	/**Compress a range of an inverted list.
 	 *
 	 * Document id (stored as d-gaps) and term frequency in the documents
 	 * are  both stored using this class' byte-wise encoding method.
 	 *
+	 * Any input iterator over d_fdt_t will do, but this is meant to be
+	 * used on contiguous buffers (inverted_list_vec_t, d_fdt_t arrays).
+	 *
 	 * @note We expect to see ascending docids in the list.
 	 *
-	 * @param[in] in inverted list to compress
-	 * @param[out] out compressed output.
+	 * @param[in] begin start of the inverted list range to compress
+	 * @param[in] end end of the inverted list range to compress
+	 * @param[out] output compressed output. Data is appended to it.
 	 */
-	inline static void compress(const inverted_list_t& ilist, charvec_t& output)
+	template<class InputIterator>
+	inline static void compress(InputIterator begin, InputIterator end,
+					charvec_t& output)
 	{
-		inverted_list_t::const_iterator i = ilist.begin();
 		uint32_t last_doc = 0;
 		uint32_t dgap = 0;
 
-		for(i = ilist.begin(); i != ilist.end(); ++i){
+		for(InputIterator i = begin; i != end; ++i){
 			const d_fdt_t&  d_ft= *i;
 
 			dgap = d_ft.first - last_doc;
@@ -94,6 +109,27 @@ struct ByteWiseCompressor {
 		}
 	}
 
+	/**Compress an inverted list.
+	 *
+	 * @param[in] ilist inverted list to compress
+	 * @param[out] output compressed output.
+	 */
+	inline static void compress(const inverted_list_vec_t& ilist,
+					charvec_t& output)
+	{
+		compress(ilist.begin(), ilist.end(), output);
+	}
+
+	/**Compress an inverted list.
+	 *
+	 * Overloaded for std::list based inverted lists.
+	 */
+	inline static void compress(const inverted_list_t& ilist,
+					charvec_t& output)
+	{
+		compress(ilist.begin(), ilist.end(), output);
+	}
+
 	/**Decompres.
 	 *
 	 * @param count number of entries (tf)
@@ -117,8 +153,533 @@ struct ByteWiseCompressor {
 	}
 };
 
+/***********************************************************************
+		       Stream-VByte Compression Functions
+ ***********************************************************************/
+
+/**Block-based Stream-VByte compression routines for inverted lists.
+ *
+ * ByteWiseCompressor stores each integer with 1 to 5 bytes, continuation
+ * bits and data mixed, so decoding goes byte by byte with a branch (and a
+ * bounds check) per byte. Stream-VByte splits the lengths from the data:
+ * a control byte holds the lengths (1 to 4 bytes, 2 bits each) of 4
+ * integers, and all control bytes of a stream come before its data
+ * bytes. A whole control byte is decoded at once with a single SSSE3
+ * byte shuffle, picked from a 256-entry table.
+ *
+ * Inverted lists are stored as a sequence of blocks of BLOCK_SIZE
+ * postings - the last one may be shorter. Each block holds a stream of
+ * d-gaps followed by a stream of frequencies. Gaps are counted from the
+ * last docid of the previous block, so unlike ByteWiseCompressor a
+ * docid 0 is fine.
+ *
+ * Lists with more than one block start with a skip table: a skip_entry_t
+ * per block, with the block's last docid and its offset from the start
+ * of the first block. PostingCursor uses it to jump straight to the
+ * blocks that may hold a given docid.
+ *
+ * See Lemire, Kurz and Rupp, "Stream VByte: Faster Byte-Oriented Integer
+ * Compression", Information Processing Letters, 2018.
+ */
+struct StreamVByteCompressor {
+
+	typedef std::vector<uint8_t> charvec_t;
+
+	//! Number of postings per block.
+	static const uint32_t BLOCK_SIZE = 128;
+
+	//! Skip table entry.
+	struct skip_entry_t {
+		uint32_t last_docid;	//!< Docid of the block's last posting
+		uint32_t offset;	//!< Offset from the first block
+
+		skip_entry_t(uint32_t last = 0, uint32_t off = 0)
+		: last_docid(last), offset(off)
+		{}
+	} __attribute__((packed));
+
+	//! Number of blocks of a list with @p count postings.
+	inline static uint32_t nBlocks(uint32_t count)
+	{
+		return (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	}
+
+	//! Size of the skip table of a list with @p count postings.
+	inline static size_t skipTableSize(uint32_t count)
+	{
+		uint32_t n_blocks = nBlocks(count);
+		return (n_blocks > 1) ? n_blocks * sizeof(skip_entry_t) : 0;
+	}
+
+	//! Signature shared by all the integer stream decoders.
+	typedef const uint8_t* (*decode_fn)(const uint8_t* in,
+				const uint8_t* end, uint32_t n, uint32_t* out);
+
+	/**Encode a stream of @p n integers.
+	 *
+	 * @param[in] in The integers.
+	 * @param n Number of integers.
+	 * @param[out] output Encoded stream. Data is appended to it.
+	 */
+	static void encode(const uint32_t* in, uint32_t n, charvec_t& output);
+
+	/**Decode a stream of @p n integers.
+	 *
+	 * Uses the best implementation available in the running CPU.
+	 *
+	 * @param in Start of the encoded stream.
+	 * @param end End of the readable memory. Never read past it.
+	 * @param n Number of integers in the stream.
+	 * @param[out] out Room for @p n integers.
+	 *
+	 * @return The end of the encoded stream.
+	 *
+	 * @throw std::out_of_range if the stream goes beyond @p end.
+	 */
+	static const uint8_t* decode(const uint8_t* in, const uint8_t* end,
+					uint32_t n, uint32_t* out);
+
+	//!@name Implementations
+	//! Exposed for testing and benchmarking. Use decode instead.
+	//@{
+	static const uint8_t* decodeScalar(const uint8_t* in,
+				const uint8_t* end, uint32_t n, uint32_t* out);
+#ifdef INDEXCOMPRESSION_X86
+	static const uint8_t* decodeSSSE3(const uint8_t* in,
+				const uint8_t* end, uint32_t n, uint32_t* out);
+#endif
+	//@}
+
+	//! Name of the implementation decode uses in this CPU.
+	static const char* implementationName();
+
+	/**Decode a block of postings.
+	 *
+	 * @param in Start of the block.
+	 * @param end End of the readable memory.
+	 * @param n Number of postings in the block.
+	 * @param[in,out] last_docid Docid the block's gaps are counted from.
+	 * 			     Updated to the block's last docid.
+	 * @param[out] docids Room for @p n docids.
+	 * @param[out] freqs Room for @p n frequencies.
+	 *
+	 * @return The start of the next block.
+	 */
+	inline static const uint8_t* decodeBlock(const uint8_t* in,
+				const uint8_t* end, uint32_t n,
+				uint32_t& last_docid, uint32_t* docids,
+				uint32_t* freqs)
+	{
+		in = decode(in, end, n, docids);
+		in = decode(in, end, n, freqs);
+
+		uint32_t docid = last_docid;
+		for(uint32_t i = 0; i < n; ++i) {
+			docid += docids[i];
+			docids[i] = docid;
+		}
+		last_docid = docid;
+
+		return in;
+	}
+
+	/**Compress a range of an inverted list.
+	 *
+	 * @note We expect to see ascending docids in the list.
+	 *
+	 * @see ByteWiseCompressor::compress
+	 */
+	template<class InputIterator>
+	inline static void compress(InputIterator begin, InputIterator end,
+					charvec_t& output)
+	{
+		uint32_t gaps[BLOCK_SIZE];
+		uint32_t freqs[BLOCK_SIZE];
+		uint32_t last_doc = 0;
+		uint32_t n = 0;
+		const size_t start = output.size();
+		std::vector<skip_entry_t> skips;
+
+		for(InputIterator i = begin; i != end; ++i){
+			const d_fdt_t&  d_ft= *i;
+
+			gaps[n] = d_ft.first - last_doc;
+			freqs[n] = d_ft.second;
+			last_doc = d_ft.first;
+
+			if (++n == BLOCK_SIZE) {
+				skips.push_back(skip_entry_t(last_doc,
+							output.size() - start));
+				encode(gaps, n, output);
+				encode(freqs, n, output);
+				n = 0;
+			}
+		}
+		if (n > 0) {
+			skips.push_back(skip_entry_t(last_doc,
+						output.size() - start));
+			encode(gaps, n, output);
+			encode(freqs, n, output);
+		}
+
+		// The skip table goes before the blocks
+		if (skips.size() > 1) {
+			const uint8_t* table = (const uint8_t*) &skips[0];
+			output.insert(output.begin() + start, table,
+				table + skips.size() * sizeof(skip_entry_t));
+		}
+	}
+
+	//! Compress an inverted list.
+	inline static void compress(const inverted_list_vec_t& ilist,
+					charvec_t& output)
+	{
+		compress(ilist.begin(), ilist.end(), output);
+	}
+
+	//! Compress an inverted list. Overloaded for std::list based lists.
+	inline static void compress(const inverted_list_t& ilist,
+					charvec_t& output)
+	{
+		compress(ilist.begin(), ilist.end(), output);
+	}
+
+	/**Decompres.
+	 *
+	 * @param count number of entries (tf)
+	 * @param[in] in compressed list
+	 * @param[out] out decompressed list
+	 */
+	static void decompress(uint32_t count, filebuf in,
+				inverted_list_vec_t& out);
+};
+
+/***********************************************************************
+			       InvertedListCodec
+ ***********************************************************************/
+
+/**Inverted list formats, and reading lists in any of them.
+ *
+ * Dumpers record the format of the inverted lists they write in the
+ * @c index.fmt file of the inverted file's directory, as a single line
+ * with the format's name. Inverted files created before @c index.fmt
+ * existed are byte-wise compressed.
+ */
+struct InvertedListCodec {
+	enum format_t {
+		RAW,		//!< Uncompressed d_fdt_t arrays
+		BYTEWISE,	//!< ByteWiseCompressor
+		STREAMVBYTE	//!< StreamVByteCompressor
+	};
+
+	//! Name of format @p fmt, as stored in @c index.fmt.
+	static const char* name(format_t fmt);
+
+	//! Format named @p fmt_name. @throw std::runtime_error if unknown.
+	static format_t fromName(const std::string& fmt_name);
+
+	//! Format of the inverted file in @p dir.
+	static format_t readFormat(const std::string& dir);
+
+	//! Record the format of the inverted file in @p dir.
+	static void writeFormat(const std::string& dir, format_t fmt);
+
+	/**Decompress an inverted list in format @p fmt.
+	 *
+	 * @param fmt format of the list
+	 * @param count number of entries (tf)
+	 * @param[in] in compressed list
+	 * @param[out] out decompressed list. Cleared first.
+	 */
+	static void decompress(format_t fmt, uint32_t count, filebuf in,
+				inverted_list_vec_t& out);
+};
+
+
+/***********************************************************************
+				 PostingCursor
+ ***********************************************************************/
+
+/**An inverted list decoded into plain arrays.
+ *
+ * Walking it with a PostingCursor costs no decoding at all, so query
+ * resolvers may keep the popular ones around.
+ *
+ * @see PostingCursor::open(const DecodedPostings&)
+ */
+struct DecodedPostings {
+	std::vector<uint32_t> docids;
+	std::vector<uint32_t> freqs;
+
+	//! Decode a list, see InvertedListCodec::decompress().
+	void decode(InvertedListCodec::format_t fmt, uint32_t count,
+			filebuf in);
+
+	//! Memory taken by the list, in bytes.
+	inline size_t memory() const
+	{
+		return sizeof(*this) + sizeof(uint32_t) *
+			(docids.capacity() + freqs.capacity());
+	}
+};
+
+/**Forward cursor over an inverted list, in any format.
+ *
+ * Stream-VByte lists are decoded one block at a time and nextGEQ() uses
+ * their skip table to jump over the blocks that can't hold the docid
+ * being looked for, so intersecting a short list with a long one only
+ * decodes a few blocks of the long one. Lists in other formats have no
+ * skip information and are fully decoded upfront.
+ *
+ * @warning The cursor doesn't copy the list: its memory must outlive it.
+ */
+class PostingCursor {
+	uint32_t ft;		//!< Number of postings in the list
+	uint32_t n_blocks;	//!< Number of blocks in the list
+	const StreamVByteCompressor::skip_entry_t* skips; //!< If any
+	const uint8_t* blocks;	//!< Start of the first block
+	const uint8_t* end;	//!< End of the readable memory
+	uint32_t block;		//!< Current block
+	uint32_t n;		//!< Number of postings in the current block
+	uint32_t pos;		//!< Current posting in the current block
+	bool at_end;
+	uint32_t blocks_decoded;
+	std::vector<uint32_t> docids;	//!< Decoding buffer, for docids
+	std::vector<uint32_t> freqs;	//!< Decoding buffer, for frequencies
+	inverted_list_vec_t ilist;	//!< Decoding buffer, for other formats
+	const uint32_t* block_docids;	//!< The current block's docids
+	const uint32_t* block_freqs;	//!< The current block's frequencies
+
+	//! Copy @p other's state, pointing to our buffers where it has its own.
+	void copyFrom(const PostingCursor& other);
+
+	//! Decode Stream-VByte block @p b.
+	void loadBlock(uint32_t b);
+
+	//! Last docid of the current block.
+	inline uint32_t blockLast(uint32_t b) const
+	{
+		return skips ? skips[b].last_docid : block_docids[n - 1];
+	}
+
+public:
+	//! An empty cursor, at eof(). See open().
+	PostingCursor();
+
+	/**Constructor.
+	 *
+	 * @param fmt Format of the list.
+	 * @param count Number of postings in the list (ft).
+	 * @param in The compressed list.
+	 */
+	PostingCursor(InvertedListCodec::format_t fmt, uint32_t count,
+			filebuf in);
+
+	PostingCursor(const PostingCursor& other);
+
+	PostingCursor& operator=(const PostingCursor& other);
+
+	/**Move the cursor to the start of another list.
+	 *
+	 * Same parameters as the constructor. The cursor's buffers are
+	 * reused, so a cursor kept around doesn't allocate memory once it
+	 * has seen a list as long as the new one.
+	 */
+	void open(InvertedListCodec::format_t fmt, uint32_t count,
+			filebuf in);
+
+	/**Move the cursor to the start of an already decoded list.
+	 *
+	 * @warning @p list must outlive the cursor's use of it.
+	 */
+	void open(const DecodedPostings& list);
+
+	//! Are we past the last posting?
+	inline bool eof() const { return at_end; }
+
+	//! Current docid. Only valid if not eof().
+	inline uint32_t docid() const { return block_docids[pos]; }
+
+	//! Current frequency. Only valid if not eof().
+	inline uint32_t freq() const { return block_freqs[pos]; }
+
+	//! Number of postings in the list.
+	inline uint32_t size() const { return ft; }
+
+	//! Number of blocks decoded so far.
+	inline uint32_t getBlocksDecoded() const { return blocks_decoded; }
+
+	//! Position of the current posting in the list, from 0.
+	inline uint32_t ordinal() const
+	{
+		return block * StreamVByteCompressor::BLOCK_SIZE + pos;
+	}
+
+	/**Frequency of the posting at position @p o in the list.
+	 *
+	 * Only the postings of the current block, the ones whose ordinal()
+	 * lies in the same StreamVByteCompressor block as the current one,
+	 * can be read.
+	 */
+	inline uint32_t freqAt(uint32_t o) const
+	{
+		return block_freqs[o - block * StreamVByteCompressor::BLOCK_SIZE];
+	}
+
+	//! Move to the next posting.
+	inline void next()
+	{
+		if (++pos == n) {
+			if (block + 1 < n_blocks) {
+				loadBlock(block + 1);
+			} else {
+				at_end = true;
+			}
+		}
+	}
+
+	/**Move to the first posting with docid >= @p target.
+	 *
+	 * Never moves backwards.
+	 *
+	 * @return false if there is no such posting (eof).
+	 */
+	bool nextGEQ(uint32_t target);
+};
+
+
+/**Walk over several posting lists at once, in docid order.
+ *
+ * Calls @p visit(i, cursor) for every posting of every list, by increasing
+ * docid, where @p i is the index of the posting's list in @p cursors.
+ * Postings with the same docid are visited in a row. The cursors are kept
+ * in a heap, so this costs O(log n) per posting for n lists.
+ *
+ * Cursors are left at eof().
+ */
+template<class Visitor>
+void mergePostings(const std::vector<PostingCursor*>& cursors, Visitor& visit)
+{
+	typedef std::pair<uint32_t, uint32_t> docid_list_t;
+	std::greater<docid_list_t> after;
+	std::vector<docid_list_t> heap;
+
+	heap.reserve(cursors.size());
+	for(uint32_t i = 0; i < cursors.size(); ++i) {
+		if (! cursors[i]->eof()) {
+			heap.push_back(docid_list_t(cursors[i]->docid(), i));
+		}
+	}
+	std::make_heap(heap.begin(), heap.end(), after);
+
+	while (! heap.empty()) {
+		const uint32_t i = heap.front().second;
+		PostingCursor& cursor = *cursors[i];
+
+		visit(i, cursor);
+
+		std::pop_heap(heap.begin(), heap.end(), after);
+		cursor.next();
+		if (cursor.eof()) {
+			heap.pop_back();
+		} else {
+			heap.back().first = cursor.docid();
+			std::push_heap(heap.begin(), heap.end(), after);
+		}
+	}
+}
+
+
+/***********************************************************************
+			    PositionListCompressor
+ ***********************************************************************/
+
+/**Compression routines for the positions of a term in its documents.
+ *
+ * A term's positions are stored apart from its inverted list, in the same
+ * order as its postings: the f_dt positions of each posting, as
+ * ByteWiseCompressor codes of their gaps (the first one plus one, so all
+ * are greater than zero). Postings are split in the same blocks as
+ * StreamVByteCompressor's and lists with more than one block start with a
+ * table of where each block, but the first, starts, relative to the end of
+ * the table. So positions are only decoded for the postings asked for,
+ * and reaching them costs at most a block's worth of skipping.
+ *
+ * @see PositionCursor
+ */
+struct PositionListCompressor {
+
+	typedef std::vector<uint8_t> charvec_t;
+
+	static const uint32_t BLOCK_SIZE = StreamVByteCompressor::BLOCK_SIZE;
+
+	//! Size, in bytes, of the block table of a list with @p count postings.
+	inline static size_t skipTableSize(uint32_t count)
+	{
+		uint32_t n_blocks = StreamVByteCompressor::nBlocks(count);
+		return (n_blocks > 1) ? (n_blocks - 1) * sizeof(uint32_t) : 0;
+	}
+
+	/**Compress the positions of a term.
+	 *
+	 * @param[in] ilist the term's inverted list
+	 * @param[in] positions the positions of each posting of @p ilist,
+	 * 		in order: ilist[i].second ascending positions for the
+	 * 		i-th posting.
+	 * @param[out] output compressed output. Data is appended to it.
+	 */
+	static void compress(const inverted_list_vec_t& ilist,
+			const std::vector<uint32_t>& positions,
+			charvec_t& output);
+};
+
+/**Reads the positions of the postings a PostingCursor walks over.
+ *
+ * Open it with the term's positions list and ask for the positions of
+ * the cursor's current posting with read(). Going forward is cheap: only
+ * the positions of the postings in between are skipped, and whole blocks
+ * are jumped over.
+ */
+class PositionCursor {
+	uint32_t ft;
+	const uint32_t* skips;	//!< Block table, if any
+	const uint8_t* data;	//!< Start of the first block
+	const uint8_t* end;	//!< End of the readable memory
+	uint32_t next_ordinal;	//!< The posting whose positions are at cur
+	const uint8_t* cur;
+
+	//! Move cur past the positions of @p n postings.
+	inline void skipValues(uint32_t n)
+	{
+		while (n > 0 && cur < end) {
+			if (*cur++ < ByteWiseCompressor::bit_128) {
+				--n;
+			}
+		}
+	}
+
+public:
+	//! An empty cursor. See open().
+	PositionCursor();
 
+	/**Start reading a positions list.
+	 *
+	 * @param count Number of postings in the term's inverted list.
+	 * @param in The positions list.
+	 */
+	void open(uint32_t count, filebuf in);
 
+	/**Decode the positions of the current posting of @p postings.
+	 *
+	 * @p postings must be a cursor over the same term's inverted list,
+	 * not at eof(). Postings can be read in any order, but reading them
+	 * in the list's order is the cheapest.
+	 *
+	 * @param[out] positions Will be overwritten.
+	 */
+	void read(const PostingCursor& postings,
+			std::vector<uint32_t>& positions);
+};
 
 
 #endif // __INDEXCOMPRESSION_H__
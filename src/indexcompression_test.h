@@ -5,6 +5,7 @@
 #include "cxxtest/TestSuite.h"
 
 #include <algorithm>
+#include <stdlib.h>
 
 class ByteWiseCompressorParserTestSuit : public CxxTest::TestSuite {
 public:
@@ -89,6 +90,384 @@ public:
 
 	}
 
+	void test_CompressRanges()
+	{
+		const d_fdt_t postings[] = {d_fdt_t(3,1), d_fdt_t(4,300),
+				d_fdt_t(70000,2), d_fdt_t(70001,1)};
+		const size_t count = sizeof(postings)/sizeof(postings[0]);
+
+		inverted_list_t da_list(postings, postings + count);
+		inverted_list_vec_t da_vec(postings, postings + count);
+
+		ByteWiseCompressor::charvec_t from_list, from_vec, from_array;
+		ByteWiseCompressor::compress(da_list, from_list);
+		ByteWiseCompressor::compress(da_vec, from_vec);
+		ByteWiseCompressor::compress(postings, postings + count,
+						from_array);
+
+		// Every kind of range must yield the very same bytes
+		TS_ASSERT(from_list == from_vec);
+		TS_ASSERT(from_list == from_array);
+
+		// Compressing a sub-range restarts the d-gaps
+		ByteWiseCompressor::charvec_t tail;
+		ByteWiseCompressor::compress(postings + 2, postings + count,
+						tail);
+		filebuf buf((char*)&tail[0], tail.size());
+		inverted_list_vec_t res;
+		ByteWiseCompressor::decompress(2, buf, res);
+		TS_ASSERT_EQUALS(res.size(), 2u);
+		TS_ASSERT( std::equal(postings + 2, postings + count,
+						res.begin()));
+	}
+
+};
+
+class StreamVByteCompressorTestSuit : public CxxTest::TestSuite {
+
+	typedef std::vector<StreamVByteCompressor::decode_fn> ImplVec;
+
+	//! All the implementations the running CPU can use
+	ImplVec implementations()
+	{
+		ImplVec impls;
+		impls.push_back(StreamVByteCompressor::decodeScalar);
+		impls.push_back(StreamVByteCompressor::decode);
+#ifdef INDEXCOMPRESSION_X86
+		if (__builtin_cpu_supports("ssse3")) {
+			impls.push_back(StreamVByteCompressor::decodeSSSE3);
+		}
+#endif
+		return impls;
+	}
+
+public:
+	void test_EncodeLayout()
+	{
+		const uint32_t values[] = {1, 256, 65536, 16777216, 0};
+		StreamVByteCompressor::charvec_t out;
+
+		StreamVByteCompressor::encode(values, 5, out);
+
+		// 2 control bytes, then 1+2+3+4+1 data bytes
+		TS_ASSERT_EQUALS(out.size(), 2u + 11u);
+		TS_ASSERT_EQUALS(out[0], 0xe4); // 3,2,1,0
+		TS_ASSERT_EQUALS(out[1], 0x00);
+		TS_ASSERT_EQUALS(out[2], 1);
+		TS_ASSERT_EQUALS(out[3], 0);
+		TS_ASSERT_EQUALS(out[4], 1);
+	}
+
+	void test_DecodeAllSizesAndImplementations()
+	{
+		ImplVec impls = implementations();
+		srand(3);
+
+		for(uint32_t n = 1; n < 70; ++n) {
+			std::vector<uint32_t> values;
+			for(uint32_t i = 0; i < n; ++i) {
+				// Every length, at random
+				values.push_back(uint32_t(rand()) >>
+						 (8 * (rand() % 4)));
+			}
+			StreamVByteCompressor::charvec_t out;
+			StreamVByteCompressor::encode(&values[0], n, out);
+			const uint8_t* end = &out[0] + out.size();
+
+			for(size_t i = 0; i < impls.size(); ++i) {
+				std::vector<uint32_t> res(n);
+				const uint8_t* next = impls[i](&out[0], end, n,
+								&res[0]);
+				TS_ASSERT_EQUALS(next, end);
+				TS_ASSERT(res == values);
+
+				// Truncated streams are detected
+				TS_ASSERT_THROWS(impls[i](&out[0], end - 1, n,
+							&res[0]),
+						std::out_of_range);
+			}
+		}
+	}
+
+	void test_CompressDecompress()
+	{
+		// Lists longer than a block, with a docid 0 and big gaps
+		const uint32_t sizes[] = {1, 127, 128, 129, 1000};
+		for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s) {
+			inverted_list_vec_t ilist;
+			uint32_t docid = 0;
+			for(uint32_t i = 0; i < sizes[s]; ++i) {
+				ilist.push_back(d_fdt_t(docid, 1 + i % 300));
+				docid += 1 + (i % 17) * (i % 5 ? 3 : 100000);
+			}
+
+			StreamVByteCompressor::charvec_t out;
+			StreamVByteCompressor::compress(ilist, out);
+
+			filebuf buf((char*)&out[0], out.size());
+			inverted_list_vec_t res;
+			InvertedListCodec::decompress(
+					InvertedListCodec::STREAMVBYTE,
+					sizes[s], buf, res);
+			TS_ASSERT(res == ilist);
+		}
+	}
+
+	void test_FormatNames()
+	{
+		InvertedListCodec::format_t fmts[] = {InvertedListCodec::RAW,
+					InvertedListCodec::BYTEWISE,
+					InvertedListCodec::STREAMVBYTE};
+		for(int i = 0; i < 3; ++i) {
+			TS_ASSERT_EQUALS(InvertedListCodec::fromName(
+					InvertedListCodec::name(fmts[i])),
+					fmts[i]);
+		}
+		TS_ASSERT_THROWS(InvertedListCodec::fromName("gzip"),
+				std::runtime_error);
+	}
+};
+
+
+class PostingCursorTestSuit : public CxxTest::TestSuite {
+
+	//! Docids 1, 4, 7, ...
+	inverted_list_vec_t makeList(uint32_t n)
+	{
+		inverted_list_vec_t ilist;
+		for(uint32_t i = 0; i < n; ++i) {
+			ilist.push_back(d_fdt_t(1 + 3 * i, 1 + i % 7));
+		}
+		return ilist;
+	}
+
+	template<class Compressor>
+	void checkCursor(InvertedListCodec::format_t fmt, uint32_t n)
+	{
+		inverted_list_vec_t ilist = makeList(n);
+		std::vector<uint8_t> out;
+		Compressor::compress(ilist, out);
+		filebuf buf((char*)&out[0], out.size());
+
+		// Sequential scan
+		PostingCursor all(fmt, n, buf);
+		TS_ASSERT_EQUALS(all.size(), n);
+		for(uint32_t i = 0; i < n; ++i) {
+			TS_ASSERT(!all.eof());
+			TS_ASSERT_EQUALS(all.docid(), ilist[i].first);
+			TS_ASSERT_EQUALS(all.freq(), ilist[i].second);
+			all.next();
+		}
+		TS_ASSERT(all.eof());
+
+		// Skipping: hits, misses and never moving backwards
+		PostingCursor c(fmt, n, buf);
+		TS_ASSERT(c.nextGEQ(0));
+		TS_ASSERT_EQUALS(c.docid(), 1U);
+		if (n > 101) {
+			TS_ASSERT(c.nextGEQ(300));
+			TS_ASSERT_EQUALS(c.docid(), 301U);
+			TS_ASSERT(c.nextGEQ(302));
+			TS_ASSERT_EQUALS(c.docid(), 304U);
+			TS_ASSERT(c.nextGEQ(10));
+			TS_ASSERT_EQUALS(c.docid(), 304U);
+		}
+		TS_ASSERT(c.nextGEQ(3 * (n - 1)));
+		TS_ASSERT_EQUALS(c.docid(), 1 + 3 * (n - 1));
+		TS_ASSERT_EQUALS(c.freq(), ilist[n - 1].second);
+		TS_ASSERT(!c.nextGEQ(3 * n));
+		TS_ASSERT(c.eof());
+	}
+
+public:
+	void test_StreamVByteCursor()
+	{
+		const uint32_t sizes[] = {1, 127, 128, 129, 1000, 5000};
+		for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s) {
+			checkCursor<StreamVByteCompressor>(
+					InvertedListCodec::STREAMVBYTE,
+					sizes[s]);
+		}
+	}
+
+	void test_ByteWiseCursor()
+	{
+		checkCursor<ByteWiseCompressor>(InvertedListCodec::BYTEWISE,
+						1000);
+	}
+
+	void test_SkipTable()
+	{
+		typedef StreamVByteCompressor SVB;
+		TS_ASSERT_EQUALS(SVB::skipTableSize(128), 0U);
+		TS_ASSERT_EQUALS(SVB::skipTableSize(129),
+				2 * sizeof(SVB::skip_entry_t));
+
+		const uint32_t n = 100 * SVB::BLOCK_SIZE;
+		inverted_list_vec_t ilist = makeList(n);
+		SVB::charvec_t out;
+		SVB::compress(ilist, out);
+
+		const SVB::skip_entry_t* skips =
+				(const SVB::skip_entry_t*) &out[0];
+		for(uint32_t b = 0; b < 100; ++b) {
+			TS_ASSERT_EQUALS(skips[b].last_docid,
+				ilist[(b + 1) * SVB::BLOCK_SIZE - 1].first);
+		}
+		TS_ASSERT_EQUALS(skips[0].offset, 0U);
+
+		// A sparse probe only decodes the blocks it lands on
+		filebuf buf((char*)&out[0], out.size());
+		PostingCursor c(InvertedListCodec::STREAMVBYTE, n, buf);
+		for(uint32_t target = 1; target < 3 * n; target += 3 * n / 10) {
+			TS_ASSERT(c.nextGEQ(target));
+			TS_ASSERT_EQUALS(c.docid(), target);
+		}
+		TS_ASSERT(c.getBlocksDecoded() <= 11);
+	}
+
+	void test_DecodedPostingsCursor()
+	{
+		const uint32_t n = 1000;
+		inverted_list_vec_t ilist = makeList(n);
+		std::vector<uint8_t> out;
+		StreamVByteCompressor::compress(ilist, out);
+		filebuf buf((char*)&out[0], out.size());
+
+		DecodedPostings list;
+		list.decode(InvertedListCodec::STREAMVBYTE, n, buf);
+		TS_ASSERT_EQUALS(list.docids.size(), n);
+		TS_ASSERT(list.memory() >= 2 * n * sizeof(uint32_t));
+
+		PostingCursor c;
+		c.open(list);
+		TS_ASSERT_EQUALS(c.size(), n);
+		TS_ASSERT(c.nextGEQ(300));
+		TS_ASSERT_EQUALS(c.docid(), 301U);
+		TS_ASSERT_EQUALS(c.freq(), ilist[100].second);
+		TS_ASSERT_EQUALS(c.ordinal(), 100U);
+		TS_ASSERT(!c.nextGEQ(3 * n));
+		TS_ASSERT_EQUALS(c.getBlocksDecoded(), 0U);
+
+		PostingCursor empty;
+		empty.open(DecodedPostings());
+		TS_ASSERT(empty.eof());
+	}
+
+	void test_CopiedCursors()
+	{
+		// Copies of a cursor go on by themselves, as in a growing pool
+		const uint32_t n = 1000;
+		inverted_list_vec_t ilist = makeList(n);
+		std::vector<uint8_t> out;
+		StreamVByteCompressor::compress(ilist, out);
+		filebuf buf((char*)&out[0], out.size());
+
+		std::vector<PostingCursor> pool(1);
+		pool[0].open(InvertedListCodec::STREAMVBYTE, n, buf);
+		TS_ASSERT(pool[0].nextGEQ(301));
+		pool.resize(10);
+
+		PostingCursor copy;
+		copy = pool[0];
+		pool.clear();
+		for(uint32_t i = 100; i < n; ++i) {
+			TS_ASSERT_EQUALS(copy.docid(), ilist[i].first);
+			copy.next();
+		}
+		TS_ASSERT(copy.eof());
+	}
+
+	void test_PositionCursor()
+	{
+		// Posting i has positions 0, i+1, 2i+2, ... plus a far one
+		const uint32_t n = 1000;
+		inverted_list_vec_t ilist = makeList(n);
+		std::vector<uint32_t> positions;
+		for(uint32_t i = 0; i < n; ++i) {
+			for(uint32_t p = 0; p < ilist[i].second - 1; ++p) {
+				positions.push_back(p * (i + 1));
+			}
+			positions.push_back(1000000 + i);
+		}
+		PositionListCompressor::charvec_t out;
+		PositionListCompressor::compress(ilist, positions, out);
+		filebuf buf((char*)&out[0], out.size());
+
+		std::vector<uint8_t> list_out;
+		StreamVByteCompressor::compress(ilist, list_out);
+		filebuf list_buf((char*)&list_out[0], list_out.size());
+
+		// Sequential and skipping reads, across blocks
+		const uint32_t steps[] = {1, 7, 300};
+		for(size_t s = 0; s < sizeof(steps)/sizeof(steps[0]); ++s) {
+			PostingCursor c(InvertedListCodec::STREAMVBYTE, n,
+					list_buf);
+			PositionCursor pc;
+			pc.open(n, buf);
+			for(uint32_t i = 0; i < n; i += steps[s]) {
+				TS_ASSERT(c.nextGEQ(ilist[i].first));
+				std::vector<uint32_t> read;
+				pc.read(c, read);
+				TS_ASSERT_EQUALS(read.size(), ilist[i].second);
+				TS_ASSERT_EQUALS(read.back(), 1000000 + i);
+				if (read.size() > 3) {
+					TS_ASSERT_EQUALS(read[2], 2 * (i + 1));
+				}
+			}
+		}
+	}
+
+	//! mergePostings() visitor, records what it sees.
+	struct MergeRecorder {
+		std::vector<uint32_t> docids;
+		std::vector<uint32_t> lists;
+
+		void operator()(uint32_t i, const PostingCursor& c)
+		{
+			docids.push_back(c.docid());
+			lists.push_back(i);
+		}
+	};
+
+	void test_MergePostings()
+	{
+		// Docids 1, 4, 7, ... and 1, 6, 11, ... plus an empty list
+		inverted_list_vec_t a = makeList(300);
+		inverted_list_vec_t b;
+		for(uint32_t i = 0; i < 200; ++i) {
+			b.push_back(d_fdt_t(1 + 5 * i, 1));
+		}
+		std::vector<uint8_t> a_out, b_out;
+		StreamVByteCompressor::compress(a, a_out);
+		StreamVByteCompressor::compress(b, b_out);
+
+		PostingCursor ca(InvertedListCodec::STREAMVBYTE, a.size(),
+				filebuf((char*)&a_out[0], a_out.size()));
+		PostingCursor cb(InvertedListCodec::STREAMVBYTE, b.size(),
+				filebuf((char*)&b_out[0], b_out.size()));
+		PostingCursor empty;
+		std::vector<PostingCursor*> cursors;
+		cursors.push_back(&ca);
+		cursors.push_back(&empty);
+		cursors.push_back(&cb);
+
+		MergeRecorder rec;
+		mergePostings(cursors, rec);
+
+		TS_ASSERT_EQUALS(rec.docids.size(), a.size() + b.size());
+		TS_ASSERT(ca.eof());
+		TS_ASSERT(cb.eof());
+		size_t n_a = 0;
+		for(size_t i = 0; i < rec.docids.size(); ++i) {
+			TS_ASSERT(i == 0 || rec.docids[i - 1] <= rec.docids[i]);
+			TS_ASSERT(rec.lists[i] == 0 || rec.lists[i] == 2);
+			if (rec.lists[i] == 0) {
+				TS_ASSERT_EQUALS(rec.docids[i], a[n_a++].first);
+			}
+		}
+		TS_ASSERT_EQUALS(n_a, a.size());
+	}
 };
 
 
@@ -22,7 +22,8 @@ int main(int argc, char* argv[])
 
 	if(argc < 4) {
 		std::cerr << "wrong number of arguments" << std::endl;
-		std::cerr << "indexer store_dir docid_list output_dir" << std::endl;
+		std::cerr << "indexer store_dir docid_list output_dir "
+			"[n_threads] [positional]" << std::endl;
 		exit(1);
 	}
 
@@ -30,6 +31,25 @@ int main(int argc, char* argv[])
 	docid_list = argv[2];
 	output_dir = argv[3];
 
+	int n_threads = 1;
+	if (argc > 4) {
+		n_threads = atoi(argv[4]);
+		if (n_threads < 1) {
+			std::cerr << "invalid number of threads" << std::endl;
+			exit(1);
+		}
+	}
+
+	// Record term positions, for phrase queries
+	bool positional = false;
+	if (argc > 5) {
+		if (std::string(argv[5]) != "positional") {
+			std::cerr << "unknown option " << argv[5] << std::endl;
+			exit(1);
+		}
+		positional = true;
+	}
+
 	unsigned int run_size = 1<<28;
 
 	std::cout << "# Reading docid list ... "<< std::endl;
@@ -43,7 +63,9 @@ int main(int argc, char* argv[])
 	}
 	std::cout << "# Reading docid list ... done." << std::endl;
 
-	index_files(store_dir, ids, output_dir, run_size);
+	int n_runs = index_files(store_dir, ids, output_dir, run_size,
+				 n_threads, positional);
+	std::cout << "# Runs created: " << n_runs << std::endl;
 	exit(0);
 }
 
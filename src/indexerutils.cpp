@@ -5,8 +5,15 @@
 #include "htmliterators.hpp"
 #include "zfilebuf.h"
 #include "mmapedfile.h"
+#include "vocabulary.hpp"
 
 #include <fstream>
+#include <algorithm>
+#include <clocale>
+#include <cwctype>
+
+#include <fcntl.h>
+#include <unistd.h>
 #include "crawlerutils.hpp"
 
 
@@ -14,6 +21,67 @@
 				 RUN ITERATORS
  ***********************************************************************/
 
+void radix_sort_triples(run_triple* begin, run_triple* end,
+			run_triple* scratch)
+{
+	const size_t n = end - begin;
+	const int N_DIGITS = sizeof(uint64_t);
+
+	// Not worth the histograms. An insertion sort is stable too.
+	if (n < 64) {
+		for(run_triple* t = begin + 1; t < end; ++t) {
+			run_triple tmp = *t;
+			run_triple* hole = t;
+			for(; hole > begin and tmp < *(hole - 1); --hole) {
+				*hole = *(hole - 1);
+			}
+			*hole = tmp;
+		}
+		return;
+	}
+
+	// Byte counts for every digit, in a single pass. Digits 0-3 are
+	// the docid bytes, 4-7 the termid ones.
+	std::vector<size_t> counts(N_DIGITS * 256, 0);
+	for(const run_triple* t = begin; t < end; ++t) {
+		for(int d = 0; d < 4; ++d) {
+			++counts[d * 256 + ((t->docid >> (8 * d)) & 0xff)];
+			++counts[(d + 4) * 256 + ((t->termid >> (8 * d)) & 0xff)];
+		}
+	}
+
+	run_triple* src = begin;
+	run_triple* dst = scratch;
+	for(int d = 0; d < N_DIGITS; ++d) {
+		size_t* count = &counts[d * 256];
+		const uint32_t run_triple::* field =
+			(d < 4) ? &run_triple::docid : &run_triple::termid;
+		const int shift = 8 * (d % 4);
+
+		// All the triples share this byte: nothing to do
+		if (count[(src->*field >> shift) & 0xff] == n) {
+			continue;
+		}
+
+		// Bucket start positions
+		size_t pos = 0;
+		for(int b = 0; b < 256; ++b) {
+			size_t c = count[b];
+			count[b] = pos;
+			pos += c;
+		}
+
+		for(const run_triple* t = src; t < src + n; ++t) {
+			dst[count[(t->*field >> shift) & 0xff]++] = *t;
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != begin) {
+		memcpy(begin, src, n * sizeof(run_triple));
+	}
+}
+
 void run_inserter::flush()
 {
 
@@ -23,21 +91,44 @@ void run_inserter::flush()
 	}
 
 	// sort triples
-	std::sort(run_buf,cur_triple);
+	if (! scratch_buf) {
+		scratch_buf = new run_triple[ max_triples ];
+	}
+	radix_sort_triples(run_buf, cur_triple, scratch_buf);
 
 	// Ok. There are pending triples.
 	unsigned int n_triples_pending = cur_triple - run_buf;
 
-	// Let's write 'em to disk
-	// FIXME woudn't UNIX I/O rotines perform better?
-	std::ofstream out;
-	// Turn on exception reporting for file operations
-	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
-	out.open(make_run_filename(path_prefix, n_runs).c_str(),
-		 std::ios::binary | std::ios::out);
-	out.rdbuf()->pubsetbuf(0, 0); // unbuffering out
-	out.write( (char *)run_buf,
-		   n_triples_pending * sizeof(run_triple));
+	// Let's write 'em to disk, at once
+	// Shards take their run number from the shared counter
+	int run_number = counter ? counter->next() : n_runs;
+	std::string filename = make_run_filename(path_prefix, run_number);
+	int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw ErrnoSysException("Error creating RUN file " + filename);
+	}
+	const char* data = (const char*) run_buf;
+	size_t len = n_triples_pending * sizeof(run_triple);
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			close(fd);
+			throw ErrnoSysException("Error writing RUN file " +
+						filename);
+		}
+		data += n;
+		len -= n;
+	}
+	if (close(fd) != 0) {
+		throw ErrnoSysException("Error closing RUN file " + filename);
+	}
+
+	// ... and its sparse index
+	RunIndex index;
+	index.add(run_buf, cur_triple);
+	index.write(filename);
 
 	// Update the number of runs written
 	++n_runs;
@@ -46,10 +137,313 @@ void run_inserter::flush()
 }
 
 
+const uint32_t RunPositions::MAX_FREQ;
+const uint16_t RunPositions::MORE;
+const uint16_t RunPositions::CHUNK_BITS;
+const uint16_t RunPositions::CHUNK_MASK;
+
+const size_t RunIndex::STRIDE;
+
+RunIndex::RunIndex(const std::string& run_filename)
+: samples(), n_triples(0)
+{
+	std::ifstream in(make_filename(run_filename).c_str(),
+			 std::ios::binary | std::ios::in);
+	if (! in) {
+		return;
+	}
+
+	in.seekg(0, std::ios::end);
+	std::streamoff len = in.tellg();
+	in.seekg(0, std::ios::beg);
+
+	samples.resize(len / sizeof(uint32_t));
+	if (! samples.empty()) {
+		in.read((char*) &samples[0], samples.size() * sizeof(uint32_t));
+		if (! in) {
+			throw std::runtime_error("Error reading RUN index for " +
+						run_filename);
+		}
+	}
+	n_triples = samples.size() * STRIDE;
+}
+
+void RunIndex::add(const run_triple* begin, const run_triple* end)
+{
+	size_t n = end - begin;
+	// Position, in this chunk, of the next triple to be sampled
+	size_t i = (STRIDE - n_triples % STRIDE) % STRIDE;
+
+	for(; i < n; i += STRIDE) {
+		samples.push_back(begin[i].termid);
+	}
+	n_triples += n;
+}
+
+void RunIndex::write(const std::string& run_filename) const
+{
+	std::ofstream out;
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(make_filename(run_filename).c_str(),
+		 std::ios::binary | std::ios::out);
+	if (! samples.empty()) {
+		out.write((const char*) &samples[0],
+			  samples.size() * sizeof(uint32_t));
+	}
+}
+
+off_t RunIndex::startOffset(uint64_t t) const
+{
+	// First sample with termid >= t. Triples with termid t may
+	// only show up after the sample before it.
+	size_t k = std::lower_bound(samples.begin(), samples.end(), t) -
+			samples.begin();
+	size_t first = (k > 0) ? (k - 1) * STRIDE : 0;
+
+	return first * sizeof(run_triple);
+}
+
+off_t RunIndex::endOffset(uint64_t t) const
+{
+	// Every triple from the first sample with termid >= t on is out
+	size_t k = std::lower_bound(samples.begin(), samples.end(), t) -
+			samples.begin();
+	if (k == samples.size()) {
+		return -1;
+	}
+
+	return off_t(k * STRIDE) * sizeof(run_triple);
+}
+
+
 /***********************************************************************
 		     VOCABULARY RETRIEVAL AND NORMALIZATION
  ***********************************************************************/
 
+const size_t UTF8Tokenizer::LATIN1_SIZE;
+
+UTF8Tokenizer::UTF8Tokenizer(const std::string locale_name)
+: cur(0), end(0), word()
+{
+	// Classification and case conversion depend on LC_CTYPE
+	if (setlocale(LC_CTYPE, locale_name.c_str()) == NULL) {
+		throw std::runtime_error("Failed to set locale");
+	}
+
+	WIsalpha isalpha;
+	for(size_t c = 0; c < LATIN1_SIZE; ++c) {
+		is_word_char[c] = isalpha(wchar_t(c));
+		folded[c] = filter_accent(towlower(wchar_t(c)));
+	}
+
+	word.reserve(64);
+}
+
+bool UTF8Tokenizer::validate(const unsigned char* p,
+				const unsigned char*& _end)
+{
+	while(p < _end) {
+		unsigned char b = *p;
+		uint32_t cp;
+
+		if (b == 0) {
+			// mbstowcs would stop here
+			_end = p;
+			return true;
+		} else if (b < 0x80) {
+			++p;
+		} else if (b < 0xC2) {
+			// Stray continuation byte or overlong 2-byte sequence
+			return false;
+		} else if (b < 0xE0) {
+			if (_end - p < 2 || (p[1] & 0xC0) != 0x80) {
+				return false;
+			}
+			p += 2;
+		} else if (b < 0xF0) {
+			if (_end - p < 3 || (p[1] & 0xC0) != 0x80 ||
+			    (p[2] & 0xC0) != 0x80) {
+				return false;
+			}
+			cp = ((b & 0x0F) << 12) | ((p[1] & 0x3F) << 6) |
+				(p[2] & 0x3F);
+			if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF)) {
+				return false;
+			}
+			p += 3;
+		} else if (b < 0xF5) {
+			if (_end - p < 4 || (p[1] & 0xC0) != 0x80 ||
+			    (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80) {
+				return false;
+			}
+			cp = ((b & 0x07) << 18) | ((p[1] & 0x3F) << 12) |
+				((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+			if (cp < 0x10000 || cp > 0x10FFFF) {
+				return false;
+			}
+			p += 4;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+inline uint32_t UTF8Tokenizer::decode(const unsigned char*& p)
+{
+	uint32_t b = *p++;
+
+	if (b < 0x80) {
+		return b;
+	} else if (b < 0xE0) {
+		b = ((b & 0x1F) << 6) | (p[0] & 0x3F);
+		p += 1;
+	} else if (b < 0xF0) {
+		b = ((b & 0x0F) << 12) | ((p[0] & 0x3F) << 6) | (p[1] & 0x3F);
+		p += 2;
+	} else {
+		b = ((b & 0x07) << 18) | ((p[0] & 0x3F) << 12) |
+			((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+		p += 3;
+	}
+
+	return b;
+}
+
+inline void UTF8Tokenizer::append(uint32_t cp)
+{
+	if (cp < 0x80) {
+		word += char(cp);
+	} else if (cp < 0x800) {
+		word += char(0xC0 | (cp >> 6));
+		word += char(0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		word += char(0xE0 | (cp >> 12));
+		word += char(0x80 | ((cp >> 6) & 0x3F));
+		word += char(0x80 | (cp & 0x3F));
+	} else {
+		word += char(0xF0 | (cp >> 18));
+		word += char(0x80 | ((cp >> 12) & 0x3F));
+		word += char(0x80 | ((cp >> 6) & 0x3F));
+		word += char(0x80 | (cp & 0x3F));
+	}
+}
+
+inline bool UTF8Tokenizer::isWordChar(uint32_t cp) const
+{
+	if (cp < LATIN1_SIZE) {
+		return is_word_char[cp];
+	}
+
+	WIsalpha isalpha;
+	return isalpha(wchar_t(cp));
+}
+
+inline void UTF8Tokenizer::appendFolded(uint32_t cp)
+{
+	if (cp < LATIN1_SIZE) {
+		append(folded[cp]);
+	} else {
+		append(filter_accent(towlower(wchar_t(cp))));
+	}
+}
+
+void UTF8Tokenizer::reset(const filebuf text)
+{
+	const unsigned char* start = (const unsigned char*) text.current;
+	const unsigned char* text_end = start + text.len();
+
+	// Never leave a previous text behind, even if this one is invalid
+	cur = end = 0;
+	word.clear();
+
+	if (! validate(start, text_end)) {
+		throw WideCharConverter::ConversionError(
+			"UTF8Tokenizer: invalid UTF-8 sequence");
+	}
+
+	cur = start;
+	end = text_end;
+}
+
+bool UTF8Tokenizer::next()
+{
+	word.clear();
+
+	while(cur < end) {
+		uint32_t cp = *cur;
+
+		// ASCII fast path
+		if (cp < 0x80) {
+			++cur;
+		} else {
+			cp = decode(cur);
+		}
+
+		if (isWordChar(cp)) {
+			appendFolded(cp);
+		} else if (! word.empty()) {
+			// Grabbed a full word.
+			return true;
+		}
+	}
+
+	return ! word.empty();
+}
+
+void getWordFrequency(filebuf f, StrIntMap& wfreq,
+			UTF8Tokenizer& tokenizer, docid_t docid)
+{
+	HTMLContentIterator ci(f), ce;
+
+	// Clear word frequency
+	wfreq.clear();
+
+	// For each text node (text inside and between tags) content
+	for(; ci != ce; ++ci){
+		const std::string& text_node = *ci;
+		try{
+			tokenizer.reset(filebuf(text_node.data(),
+						text_node.size()));
+		} catch (WideCharConverter::ConversionError& conv){
+			std::cerr << " # ERR " << docid << " " <<
+				conv.what() << std::endl;
+			continue;
+		}
+
+		// Get all words from this text node
+		while(tokenizer.next()) {
+			++wfreq[tokenizer.term()];
+		}
+	}
+}
+
+void getWordPositions(filebuf f, StrPosMap& wpos,
+			UTF8Tokenizer& tokenizer, docid_t docid)
+{
+	HTMLContentIterator ci(f), ce;
+	uint32_t position = 0;
+
+	wpos.clear();
+
+	for(; ci != ce; ++ci){
+		const std::string& text_node = *ci;
+		try{
+			tokenizer.reset(filebuf(text_node.data(),
+						text_node.size()));
+		} catch (WideCharConverter::ConversionError& conv){
+			std::cerr << " # ERR " << docid << " " <<
+				conv.what() << std::endl;
+			continue;
+		}
+
+		while(tokenizer.next()) {
+			wpos[tokenizer.term()].push_back(position++);
+		}
+	}
+}
+
 void getWordFrequency(filebuf f, StrIntMap& wfreq,
 			const WideCharConverter& wconv, docid_t docid)
 {
@@ -158,6 +552,45 @@ void dump_vocabulary(const StrIntMap& vocabulary, const char* output_dir)
 		++expected_id;
 
 	}
+
+	header.close();
+	data.close();
+	MMapedVocabulary::buildHash(output_dir);
+	FrontCodedVocabulary::build(output_dir);
+}
+
+void dump_vocabulary(const TermDictionary& vocabulary, const char* output_dir)
+{
+	// Setup dump files' filename
+	std::string voc_prefix(output_dir);
+	voc_prefix += "/vocabulary";
+	std::string voc_hdr_filename =  voc_prefix + ".hdr";
+	std::string voc_data_filename =  voc_prefix + ".data";
+
+	// Create, turn exception reporting on and open the files
+	std::ofstream header;
+	std::ofstream data;
+	header.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	data.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	header.open(voc_hdr_filename.c_str(),std::ios::out | std::ios::binary);
+	data.open(voc_data_filename.c_str(), std::ios::out | std::ios::binary);
+
+	// Term ids are dense, so this covers the full [0,max_term_id] range
+	TermDictionary::TermRefVec id2term;
+	vocabulary.getTermsById(id2term);
+
+	uint32_t pos = 0;
+	TermDictionary::TermRefVec::const_iterator t;
+	for(t = id2term.begin(); t != id2term.end(); ++t){
+		header.write((char*)&pos, sizeof(pos));
+		data.write(t->str, t->len + 1); // account for \0
+		pos += t->len + 1; // next term start position in .data
+	}
+
+	header.close();
+	data.close();
+	MMapedVocabulary::buildHash(output_dir);
+	FrontCodedVocabulary::build(output_dir);
 }
 
 void load_vocabulary(StrIntMap& vocabulary, const char* store_dir)
@@ -185,87 +618,312 @@ void load_vocabulary(StrIntMap& vocabulary, const char* store_dir)
 }
 
 
-void index_files(const char* store_dir, const std::vector<docid_t> docids_list,
-		const char* output_dir, unsigned int run_size)
-{
-	docid_t docid;
+/***********************************************************************
+			     PARALLEL DOCUMENT PARSING
+ ***********************************************************************/
+
+/**State shared by all the indexing threads.
+ *
+ * Holds the queue of documents still to be parsed, the vocabulary and
+ * the statistics. Each of these has its own lock(s) so that threads only
+ * contend when they really have to.
+ */
+class IndexingContext {
+	//! Number of docids a thread grabs from the queue at once
+	static const unsigned int BATCH_SIZE = 64;
+
+	//! Interval, in documents, between statistics reports and prefetches
+	static const docid_t REPORT_INTERVAL = 1000;
+
+	CatholicShameMutex QUEUE_LOCK;
+	CatholicShameMutex STATS_LOCK;
+
+	const std::vector<docid_t>& docids_list;
+	size_t next_doc; //!< Position of the next unclaimed docid in the queue
 
 	// Statistics
-	docid_t d_count = 0;
-	uint64_t byte_count = 0;
-	uint64_t last_byte_count = 0;
-	time_t last_broadcast = time(NULL);
-	time_t time_started = time(NULL);
+	docid_t d_count;
+	docid_t error_count;
+	uint64_t byte_count;
+	uint64_t last_byte_count;
+	time_t last_broadcast;
+	time_t time_started;
+
+	//! Prevent Copying and assignment.
+	IndexingContext(const IndexingContext&);
+
+	//! Prevent Copying and assignment.
+	IndexingContext& operator=(const IndexingContext&);
+
+public:
+	const char* store_dir;
+	TermDictionary vocabulary; //!< term -> term_id. Thread-safe.
+	RunCounter runs_counter; //!< Run numbering shared by all shards
+
+	IndexingContext(const char* store, const std::vector<docid_t>& ids)
+	: docids_list(ids), next_doc(0), d_count(0), error_count(0),
+	  byte_count(0), last_byte_count(0), last_broadcast(time(NULL)),
+	  time_started(time(NULL)), store_dir(store)
+	{}
+
+	/**Claim the next batch of documents to be parsed.
+	 *
+	 * @param[out] batch_start position of the batch's first docid in
+	 * 		   the docid list.
+	 * @param[out] batch_end position just past the batch's last docid.
+	 *
+	 * @return false if there are no documents left to be parsed.
+	 *
+	 * @synchronized(QUEUE_LOCK)
+	 */
+	bool nextBatch(size_t& batch_start, size_t& batch_end)
+	{
+		AutoLock synchronized(QUEUE_LOCK);
+
+		if (next_doc >= docids_list.size()) {
+			return false;
+		}
 
-	run_inserter runs(output_dir, run_size );
+		batch_start = next_doc;
+		next_doc = std::min(next_doc + BATCH_SIZE, docids_list.size());
+		batch_end = next_doc;
+
+		return true;
+	}
+
+	const docid_t& getDocId(size_t pos) const { return docids_list[pos]; }
+
+	/**Account for a parsed document.
+	 *
+	 * Every REPORT_INTERVAL documents a progress line is printed and
+	 * the documents ahead in the queue are prefetched.
+	 *
+	 * @param len The size of the (decompressed) document.
+	 * @param failed Whether the document could not be parsed.
+	 *
+	 * @synchronized(STATS_LOCK)
+	 */
+	void documentDone(size_t len, bool failed = false)
+	{
+		size_t pref_start = 0;
+		bool should_prefetch = false;
+
+		{
+			AutoLock synchronized(STATS_LOCK);
+
+			++d_count;
+			byte_count += len;
+			if (failed) {
+				++error_count;
+			}
+
+			if (d_count  % REPORT_INTERVAL == 0) {
+				time_t now = time(NULL);
+				time_t interval = now - last_broadcast;
+				if (interval == 0) {
+					interval = 1;
+				}
+
+				uint64_t byte_amount = byte_count -
+							last_byte_count;
+				std::cout << "# docs: " << d_count <<
+					" bytes: " << byte_amount << " / " <<
+					byte_count << " bps: "<<
+					byte_amount/interval <<
+					" elapsed " << now - time_started <<
+					" errors " << error_count << std::endl;
+
+				last_broadcast = now;
+				last_byte_count = byte_count;
+
+				should_prefetch = true;
+			}
+		}
+
+		if (should_prefetch) {
+			{
+				AutoLock synchronized(QUEUE_LOCK);
+				pref_start = next_doc;
+			}
+
+			if( (pref_start + REPORT_INTERVAL) < docids_list.size()){
+				std::vector<docid_t> pref(
+					&docids_list[pref_start],
+					&docids_list[pref_start + REPORT_INTERVAL]);
+				prefetchDocs(store_dir, pref);
+			}
+		}
+	}
+};
+
+/**Document parsing thread.
+ *
+ * Pulls documents from the shared IndexingContext and writes their
+ * triples to its own run_inserter shard.
+ */
+class IndexerThread : public BaseThread {
+	IndexingContext& ctx;
+	run_inserter runs;
+	bool positional; //!< Write RunPositions too?
 
-	StrIntMap vocabulary; // term -> term_id
 	StrIntMap wfreq; // term -> frequency in current doc
-	WideCharConverter wcconv;
+	StrPosMap wpos; // term -> positions in current doc, if positional
+	UTF8Tokenizer tokenizer;
 
-	StrIntMap::const_iterator w; // intra-document word iterator
+	std::string error; //!< Why this thread stopped early, if it did
 
-	// For every docid / retrieved document
-	for(unsigned int i = 0; i < docids_list.size(); ++i){
-		docid = docids_list[i];
+public:
+	IndexerThread(IndexingContext& context, const char* output_dir,
+			size_t run_size, bool positional = false)
+	: BaseThread(), ctx(context),
+	  runs(output_dir, run_size, &context.runs_counter),
+	  positional(positional)
+	{}
 
-		std::string filename = make_filename(store_dir, docid);
+	/**Flush any pending triples of this shard.
+	 *
+	 * Must be called after join(), so that errors while writing runs
+	 * get reported in the calling thread.
+	 */
+	void flush()
+	{
+		if (!error.empty()) {
+			throw std::runtime_error(error);
+		}
+		runs.flush();
+	}
+
+	void* run()
+	{
+		size_t batch_start, batch_end;
+
+		try {
+			while(ctx.nextBatch(batch_start, batch_end)) {
+				for(size_t i = batch_start; i < batch_end; ++i){
+					parseDocument(ctx.getDocId(i));
+				}
+			}
+		} catch(std::exception& e) {
+			// Probably an error while writing a run. Report it
+			// back when the main thread calls flush()
+			error = e.what();
+		}
 
-		// read document (decompressing)
-		AutoFilebuf dec(decompres(filename.c_str()));
-		filebuf f = dec.getFilebuf();
+		return NULL;
+	}
 
-		// parse document and get intra-ducument term frequency
-		getWordFrequency(f, wfreq, wcconv, docid);
+protected:
+	void parseDocument(docid_t docid)
+	{
+		size_t len = 0;
+
+		try {
+			std::string filename = make_filename(ctx.store_dir,
+								docid);
+
+			// read document (decompressing)
+			AutoFilebuf dec(decompres(filename.c_str()));
+			filebuf f = dec.getFilebuf();
+			len = f.len();
+
+			// parse document and get intra-ducument term frequency
+			// (or positions)
+			if (positional) {
+				getWordPositions(f, wpos, tokenizer, docid);
+			} else {
+				getWordFrequency(f, wfreq, tokenizer, docid);
+			}
+		} catch(std::exception& e) {
+			std::cerr << "Error parsing docid " << docid << ": " <<
+				e.what() << std::endl;
+			ctx.documentDone(len, true);
+			return;
+		}
 
 		// For every term in the document
+		StrIntMap::const_iterator w;
 		for(w = wfreq.begin(); w != wfreq.end(); ++w){
-			const std::string& term = w->first;
-			const int& freq =  w->second;
-
-			// Add to vocabulary if this is an unknown term
-			if (vocabulary.find(term) == vocabulary.end()) {
-				// We MUST get the current number of elements
-				// inside the vocabulary separatly: assigning
-				// voc[term] = size() in a single statement
-				// would make termid start couting from 1
-				// what is something we *do not* want.
-				int len = vocabulary.size();
-				vocabulary[term] = len;
-			}
+			// Get the term id, adding the term to the
+			// vocabulary if this is an unknown term
+			int termid = ctx.vocabulary.getId(w->first);
 
 			// add this triple to the current run(s)
-			*runs++ = run_triple(	vocabulary[term],
-						docid,
-						freq);
-		} // end for each word in document
-
-		// Statistics and prefetching
-		++d_count;
-		byte_count += f.len();
-		if (d_count  % 1000 == 0) {
-			time_t now = time(NULL);
-
-			uint64_t byte_amount = byte_count - last_byte_count;
-			std::cout << "# docs: " << d_count << " bytes: " <<
-				byte_amount << " / " << byte_count << " bps: "<<
-				byte_amount/(now - last_broadcast) << 
-				" elapsed " << now - time_started << std::endl;
-
-			last_broadcast = now;
-			last_byte_count = byte_count;
-
-			if( (i + 1000) < docids_list.size()){
-				std::vector<docid_t> pref(&docids_list[i],
-							&docids_list[i+1000]);
-				prefetchDocs(store_dir,pref);
-			}
+			*runs++ = run_triple(termid, docid, w->second);
+		}
+
+		StrPosMap::const_iterator p;
+		for(p = wpos.begin(); p != wpos.end(); ++p){
+			int termid = ctx.vocabulary.getId(p->first);
+
+			// The positions must go in the same run as the triple
+			runs.reserve(RunPositions::nTriples(p->second));
+			RunPositions::encode<run_inserter&>(termid, docid,
+					p->second, runs);
 		}
 
+		ctx.documentDone(len);
+	}
+};
+
+
+int index_files(const char* store_dir, const std::vector<docid_t>& docids_list,
+		const char* output_dir, unsigned int run_size, int n_threads,
+		bool positional)
+{
+	if (n_threads < 1) {
+		n_threads = 1;
+	}
+
+	// Tell the merger what kind of runs it will find here
+	std::string marker = RunPositions::mk_marker_filename(output_dir);
+	if (positional) {
+		std::ofstream touch(marker.c_str());
+		if (! touch) {
+			throw std::runtime_error("Error creating " + marker);
+		}
+	} else {
+		unlink(marker.c_str());
+	}
+
+	IndexingContext ctx(store_dir, docids_list);
+
+	// Each thread gets an equal share of the run memory
+	std::vector<IndexerThread*> threads;
+	size_t shard_size = run_size / n_threads;
+
+	try {
+		for(int t = 0; t < n_threads; ++t) {
+			threads.push_back(new IndexerThread(ctx, output_dir,
+							shard_size, positional));
+		}
+
+		for(int t = 0; t < n_threads; ++t) {
+			threads[t]->start();
+		}
+
+		for(int t = 0; t < n_threads; ++t) {
+			threads[t]->join();
+		}
+
+		// Flush remaining triples outside the threads, so errors
+		// are not silently ignored by run_inserter's destructor
+		for(int t = 0; t < n_threads; ++t) {
+			threads[t]->flush();
+		}
+	} catch(...) {
+		for(size_t t = 0; t < threads.size(); ++t) {
+			delete threads[t];
+		}
+		throw;
+	}
+
+	for(size_t t = 0; t < threads.size(); ++t) {
+		delete threads[t];
+	}
 
-	} // end for each document
+	dump_vocabulary(ctx.vocabulary, output_dir);
 
-	dump_vocabulary(vocabulary, output_dir);
+	return ctx.runs_counter.count();
 }
 
 /***********************************************************************
@@ -9,6 +9,8 @@
 
 #include "common.h"
 #include "strmisc.h"
+#include "threadingutils.h"
+#include "termdictionary.hpp"
 
 #include "htmliterators.hpp"
 
@@ -20,6 +22,9 @@
 #include <map>
 #include <string>
 #include <list>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <iomanip> // for make_run_filename
 
 /***********************************************************************
@@ -29,6 +34,10 @@
 typedef __gnu_cxx::hash_map < std::string, int,
                         std::tr1::hash<std::string> > StrIntMap;
 
+//! term -> its positions in a document
+typedef __gnu_cxx::hash_map < std::string, std::vector<uint32_t>,
+                        std::tr1::hash<std::string> > StrPosMap;
+
 typedef std::map<int,std::string> IntStrMap;
 
 /*We could have used a uint16_t for freq. but this would not matter anyway as
@@ -90,12 +99,224 @@ struct run_triple{
 	
 } __attribute__((packed));
 
+/**Carries the positions of a term in a document through runs.
+ *
+ * In positional runs, the triple of a term in a document is followed by
+ * triples with the same termid and docid holding its positions in their
+ * @c freq fields: the gap to the previous position (the first one plus
+ * one) split in 15 bit chunks, least significant first, with MORE set in
+ * all chunks of a gap but the last. As the triple's @c freq tells how
+ * many positions follow, only the first MAX_FREQ positions are kept.
+ *
+ * Runs are sorted with a stable sort and the triples of a term in a
+ * document are never split between runs (see run_inserter::reserve()),
+ * so they stay together and in order all the way to the inverted file
+ * dumper.
+ *
+ * Positional runs are flagged by an empty file in the runs' directory,
+ * named by mk_marker_filename().
+ */
+struct RunPositions {
+	static const uint32_t MAX_FREQ = 0xffff;
+	static const uint16_t MORE = 0x8000;	//!< More chunks follow
+	static const uint16_t CHUNK_BITS = 15;
+	static const uint16_t CHUNK_MASK = 0x7fff;
+
+	//! Name of the file flagging the runs in @p dir as positional.
+	static std::string mk_marker_filename(const std::string& dir)
+	{
+		return dir + "/runs.positional";
+	}
+
+	//! Number of triples encode() writes for @p positions.
+	static size_t nTriples(const std::vector<uint32_t>& positions)
+	{
+		size_t n = std::min<size_t>(positions.size(), MAX_FREQ);
+		size_t count = 1 + n;
+		uint32_t last = uint32_t(-1);
+		for(size_t i = 0; i < n; ++i) {
+			for(uint32_t gap = positions[i] - last;
+			    gap > CHUNK_MASK; gap >>= CHUNK_BITS) {
+				++count;
+			}
+			last = positions[i];
+		}
+		return count;
+	}
+
+	/**Write the triple of a term in a document and its positions.
+	 *
+	 * @param positions The term's positions in the document, ascending.
+	 * @param out Where the triples are written to.
+	 */
+	template<class OutputIterator>
+	static void encode(uint32_t termid, uint32_t docid,
+			const std::vector<uint32_t>& positions,
+			OutputIterator out)
+	{
+		size_t n = std::min<size_t>(positions.size(), MAX_FREQ);
+		uint32_t last = uint32_t(-1);
+
+		*out++ = run_triple(termid, docid, n);
+		for(size_t i = 0; i < n; ++i) {
+			uint32_t gap = positions[i] - last;
+			while (gap > CHUNK_MASK) {
+				*out++ = run_triple(termid, docid,
+						MORE | (gap & CHUNK_MASK));
+				gap >>= CHUNK_BITS;
+			}
+			*out++ = run_triple(termid, docid, gap);
+			last = positions[i];
+		}
+	}
+
+	//! Decodes the positions written by encode(), a chunk at a time.
+	class Decoder {
+		uint32_t last;
+		uint32_t gap;
+		int shift;
+	public:
+		Decoder() : last(uint32_t(-1)), gap(0), shift(0) {}
+
+		//! Start decoding the positions of another document.
+		inline void reset()
+		{
+			last = uint32_t(-1);
+			gap = 0;
+			shift = 0;
+		}
+
+		/**Decode the next chunk.
+		 *
+		 * @param[out] position Set if the chunk completes a position.
+		 * @return whether the chunk completes a position.
+		 */
+		inline bool add(uint16_t chunk, uint32_t& position)
+		{
+			gap |= uint32_t(chunk & CHUNK_MASK) << shift;
+			if (chunk & MORE) {
+				shift += CHUNK_BITS;
+				return false;
+			}
+			last += gap;
+			position = last;
+			gap = 0;
+			shift = 0;
+			return true;
+		}
+	};
+};
+
 
 
 /***********************************************************************
 				 RUN ITERATORS
  ***********************************************************************/
 
+/**Hands out run numbers to a group of run_inserter shards.
+ *
+ * When several run_inserter instances write runs to the same directory
+ * (one per indexing thread, for instance) they must agree on the run
+ * numbering, otherwise they would overwrite each other's runs and the
+ * merger would not find a contiguous <em>[0, n_runs)</em> range of runs.
+ */
+class RunCounter {
+	CatholicShameMutex RUNS_LOCK;
+	int n_runs; //!< Number of run numbers handed out so far
+
+	//! Prevent Copying and assignment.
+	RunCounter(const RunCounter&);
+
+	//! Prevent Copying and assignment.
+	RunCounter& operator=(const RunCounter&);
+public:
+	RunCounter() : n_runs(0) {}
+
+	//! Reserve a new run number.
+	//! @synchronized(RUNS_LOCK)
+	int next()
+	{
+		AutoLock synchronized(RUNS_LOCK);
+		return n_runs++;
+	}
+
+	//! Number of run numbers handed out so far.
+	//! @synchronized(RUNS_LOCK)
+	int count()
+	{
+		AutoLock synchronized(RUNS_LOCK);
+		return n_runs;
+	}
+};
+
+/**Sort triples in run_triple::operator< order with a LSD radix sort.
+ *
+ * Triples are sorted by their 64 bit <em>(termid, docid)</em> key, a
+ * byte at a time, from the least to the most significant one. Bytes
+ * shared by all triples (the upper bytes of termids and docids, most of
+ * the time) are skipped. This is stable and takes O(n) time.
+ *
+ * @param scratch A buffer with room for <em>end - begin</em> triples.
+ */
+void radix_sort_triples(run_triple* begin, run_triple* end,
+			run_triple* scratch);
+
+/**Sparse index of a run file.
+ *
+ * Holds the termid of every STRIDE-th triple of a run. Since runs are
+ * sorted, this is enough to find, reading at most STRIDE extra triples,
+ * where the triples of any term range start and end in the run. It is
+ * also a sample of the run's termid distribution, with each entry
+ * standing for STRIDE triples.
+ *
+ * The index of a run is stored alongside it, as a raw array of uint32_t,
+ * in a file named by make_filename().
+ *
+ * @see run_inserter::flush
+ */
+class RunIndex {
+	std::vector<uint32_t> samples;	//!< Termid of every STRIDE-th triple
+	size_t n_triples;		//!< Triples seen while building
+public:
+	//! Distance, in triples, between two samples.
+	static const size_t STRIDE = 1024;
+
+	RunIndex() : samples(), n_triples(0) {}
+
+	/**Load the index of a run.
+	 *
+	 * A missing index is not an error: it just yields an empty index,
+	 * whose offsets cover the whole run.
+	 */
+	explicit RunIndex(const std::string& run_filename);
+
+	/**Account the next triples written to a run.
+	 *
+	 * Call it for every chunk of triples written, in order.
+	 */
+	void add(const run_triple* begin, const run_triple* end);
+
+	//! Write this index for run @p run_filename.
+	void write(const std::string& run_filename) const;
+
+	//! Byte offset from where the triples with termid >= @p t start.
+	off_t startOffset(uint64_t t) const;
+
+	/**Byte offset past the last triple with termid < @p t.
+	 *
+	 * @return -1 if every triple of the run must be read.
+	 */
+	off_t endOffset(uint64_t t) const;
+
+	const std::vector<uint32_t>& getSamples() const { return samples; }
+
+	//! Make the filename of the index of run @p run_filename.
+	static std::string make_filename(const std::string& run_filename)
+	{
+		return run_filename + ".idx";
+	}
+};
+
 /**Inserter or output interator for runs.
  *
  * This is just syntatic sugar for writing runs to disk.
@@ -111,11 +332,13 @@ private:
 	size_t max_triples; //!< Max number of tripes we hold in memory
 	
 	run_triple* run_buf; //!< Triples buffer
+	run_triple* scratch_buf; //!< Radix sort buffer, allocated on demand
 	run_triple* cur_triple; //!< The position of the next triple writing pos
 	run_triple* end; //!< Past-the-last-triple-in-buffer position
 
 	int n_runs; //!< Number of runs flushed to disk so far
 
+	RunCounter* counter; //!< Shared run numbering, if we are a shard
 
 	//! Not default constructible
 	run_inserter();
@@ -132,16 +355,22 @@ public:
 	 *        It can include a full path.
 	 * @param length max ammount in bytes of memory will be used to hold
 	 * 		 a run in memory before flushing it to a run file.
+	 * @param shared_counter If not null, run numbers will be taken from
+	 * 		 this counter instead of being local to this instance.
+	 * 		 Use this when several inserters share @p prefix.
 	 *
 	 */
-	run_inserter(const std::string prefix, size_t length)
+	run_inserter(const std::string prefix, size_t length,
+			RunCounter* shared_counter = 0)
 	: path_prefix(prefix),
 	  max_length(length),
 	  max_triples( max_length / sizeof(run_triple)),
 	  run_buf( new run_triple[ max_triples ]),
+	  scratch_buf(0),
 	  cur_triple(run_buf),
 	  end(&cur_triple[max_triples]),
-	  n_runs(0)
+	  n_runs(0),
+	  counter(shared_counter)
 	{}
 
 	~run_inserter()
@@ -154,6 +383,7 @@ public:
 		}
 
 		delete[] run_buf;
+		delete[] scratch_buf;
 	}
 
 	inline run_inserter& operator=(const run_triple& val)
@@ -168,11 +398,32 @@ public:
 		return *this;
 	}
 
+	/**Make room for @p n triples in the current run.
+	 *
+	 * The run is flushed if the next @p n triples wouldn't fit in it, so
+	 * that they all end up in the same run.
+	 *
+	 * @throw std::length_error if @p n triples don't fit in a run.
+	 */
+	inline void reserve(size_t n)
+	{
+		if (n > max_triples) {
+			throw std::length_error("Too many triples for a run");
+		}
+		if (size_t(end - cur_triple) < n) {
+			flush();
+		}
+	}
+
 	inline run_inserter& operator*() {return *this;}	// deref
 	inline run_inserter& operator++() {return *this;}	// prefix
 	inline run_inserter& operator++(int) {return *this;}	// postfix
 
 	/** Write the current pending/remaining triples to disk.
+	 *
+	 * Triples are sorted with radix_sort_triples, that needs a scratch
+	 * buffer as large as the run buffer, and written with a single
+	 * write(). Along with the run, its RunIndex is written too.
 	 *
 	 * You should call this function before instance desctruction.
 	 * Although this class destructor calls flush any possible
@@ -195,6 +446,7 @@ public:
 
 
 	
+	//! Number of runs flushed to disk by this instance.
 	int getNRuns() const {return n_runs;}
 
 };
@@ -219,6 +471,23 @@ struct WIsalpha : std::unary_function<wchar_t, bool> {
 	}
 };
 
+/**Remove the accent of a lowercase Latin-1 letter.
+ *
+ * @see normalize_term
+ */
+inline wchar_t filter_accent(wchar_t c)
+{
+	if (c >= 224 && c <= 230 ) { return L'a';}
+	if (c == 231 ) { return L'c';}
+	if (c >= 232 && c <= 235 ) { return L'e';}
+	if (c >= 236 && c <= 239 ) { return L'i';}
+	if (c == 241 ) { return L'n';}
+	if (c >= 242 && c <= 248 ) { return L'o';}
+	if (c >= 249 && c <= 252 ) { return L'u';}
+	if (c >= 253 && c <= 255 ) { return L'y';}
+	return c;
+}
+
 /**Normalize a term or word.
  *
  * For now, normalization means:
@@ -237,15 +506,7 @@ inline std::wstring& normalize_term(std::wstring& word)
 	to_lower(word);
 	//filter_accents(word);
 	for(size_t i = 0; i < word.size(); ++i){
-		wchar_t& c = word[i];
-		if (c >= 224 && c <= 230 ) { c = L'a';}
-		if (c == 231 ) { c = L'c';}
-		if (c >= 232 && c <= 235 ) { c = L'e';}
-		if (c >= 236 && c <= 239 ) { c = L'i';}
-		if (c == 241 ) { c = L'n';}
-		if (c >= 242 && c <= 248 ) { c = L'o';}
-		if (c >= 249 && c <= 252 ) { c = L'u';}
-		if (c >= 253 && c <= 255 ) { c = L'y';}
+		word[i] = filter_accent(word[i]);
 	}
 	return word;
 }
@@ -270,13 +531,100 @@ inline std::string& normalize_term(std::string& word)
 
 
 
+/**Splits UTF-8 text into normalized terms.
+ *
+ * This is equivalent to splitting a wide-string with WIsalpha and passing
+ * each word through normalize_term(), but works directly on the UTF-8
+ * bytes: there is no conversion to and from wide-strings and, once the
+ * term buffer has grown, no memory allocation at all.
+ *
+ * Character classification and normalization of the Latin-1 range (the
+ * bulk of our pages) are table-driven. The tables are built, at
+ * construction, from WIsalpha and normalize_term() themselves. Other
+ * code points fall back to the same library calls the wide-string code
+ * uses.
+ *
+ * Usage:
+ * @code
+ * tokenizer.reset(text);
+ * while(tokenizer.next()) {
+ * 	do_something(tokenizer.term());
+ * }
+ * @endcode
+ *
+ * @warning Like WideCharConverter, this sets the process' LC_CTYPE locale.
+ */
+class UTF8Tokenizer {
+	static const size_t LATIN1_SIZE = 256;
+
+	bool is_word_char[LATIN1_SIZE];	//!< WIsalpha for U+0000 - U+00FF
+	uint32_t folded[LATIN1_SIZE];	//!< normalized U+0000 - U+00FF
+
+	const unsigned char* cur; //!< Current position in the text
+	const unsigned char* end; //!< Text end (or its first NUL)
+
+	std::string word;	//!< Current term, as UTF-8
+
+	//! Decode a code point from a (validated) UTF-8 sequence.
+	static inline uint32_t decode(const unsigned char*& p);
+
+	//! Append a code point to word, as UTF-8.
+	inline void append(uint32_t cp);
+
+	//! Normalize and append a word character to word.
+	inline void appendFolded(uint32_t cp);
+
+	//! WIsalpha
+	inline bool isWordChar(uint32_t cp) const;
+
+public:
+	UTF8Tokenizer(const std::string locale_name = "pt_BR.UTF-8");
+
+	/**Start tokenizing a new text.
+	 *
+	 * As with mbstowcs, the text ends at its first NUL byte, if any.
+	 *
+	 * @throw WideCharConverter::ConversionError if the text is not
+	 * 	  valid UTF-8. No term will be returned for such a text.
+	 */
+	void reset(const filebuf text);
+
+	/**Advance to the next term.
+	 *
+	 * @return false if there are no more terms in the text.
+	 */
+	bool next();
+
+	/**The current term.
+	 *
+	 * @warning The returned reference is only valid until the next call
+	 * 	    to next() or reset().
+	 */
+	const std::string& term() const { return word; }
+
+	//! The current term, as a view into the tokenizer's buffer.
+	filebuf view() const { return filebuf(word.data(), word.size()); }
+
+	/**Check whether a UTF-8 sequence is valid.
+	 *
+	 * Overlong encodings, surrogates and code points above U+10FFFF
+	 * are rejected.
+	 *
+	 * @param[in,out] _end The end of the text. Will be moved to the
+	 * 		       text's first NUL byte, if any.
+	 */
+	static bool validate(const unsigned char* start,
+				const unsigned char*& _end);
+};
+
+
 /**Retrieve the term or word frequency for a given document.
  *
  * @param f The HTML file from which the term frequency will be extracted.
  * @param[out] wfreq The term frequency dictionary. Will be cleared upon
  * 			function start.
- * @param wconv	wide-string converter. Used only for caching and
- * 		performance purposes.
+ * @param tokenizer UTF-8 tokenizer. Used only for caching and
+ * 		    performance purposes.
  *
  * @param docid is used just for error reporting and can be ignored in commom
  * 		usage.
@@ -284,9 +632,34 @@ inline std::string& normalize_term(std::string& word)
  *
  * wfreq is cleared at every function call.
  */
+void getWordFrequency(filebuf f, StrIntMap& wfreq,
+			UTF8Tokenizer& tokenizer, docid_t docid=0);
+
+/**Retrieve the term or word frequency for a given document.
+ *
+ * Wide-string based version. Slower, but kept as the reference the
+ * UTF8Tokenizer based version is checked against.
+ *
+ * @param wconv	wide-string converter. Used only for caching and
+ * 		performance purposes.
+ *
+ * @see getWordFrequency(filebuf, StrIntMap&, UTF8Tokenizer&, docid_t)
+ */
 void getWordFrequency(filebuf f, StrIntMap& wfreq,
 			const WideCharConverter& wconv, docid_t docid=0);
 
+/**Retrieve the positions of the terms of a given document.
+ *
+ * Positions count terms from the start of the document, across text
+ * nodes, starting at 0. Parameters as in
+ * getWordFrequency(filebuf, StrIntMap&, UTF8Tokenizer&, docid_t).
+ *
+ * @param[out] wpos term -> its positions, ascending. Will be cleared
+ * 		    upon function start.
+ */
+void getWordPositions(filebuf f, StrPosMap& wpos,
+			UTF8Tokenizer& tokenizer, docid_t docid=0);
+
 
 /***********************************************************************
 			       INDEXING FUNCTIONS
@@ -317,7 +690,7 @@ void mapIdToTerms(const StrIntMap& term2id, IntStrMap& id2term);
 
 /**Write the contents of a vocabulary dict/map to disc.
  *
- * The vocabulary constents is stored as in two files:
+ * The vocabulary constents is stored as in four files:
  * - @c vocabulary.data
  *
  *   	This files holds the concatenation of all terms in the vocabulary,
@@ -330,6 +703,16 @@ void mapIdToTerms(const StrIntMap& term2id, IntStrMap& id2term);
  *       the the position of this term as a string inside the file
  *       @c vocabulary.data
  *
+ * - @c vocabulary.mph
+ *
+ *       A perfect hash function over the terms, so MMapedVocabulary can
+ *       look terms up without loading the vocabulary.
+ *
+ * - @c vocabulary.fc
+ *
+ *       The terms sorted and front-coded, so FrontCodedVocabulary can
+ *       find the terms starting with a prefix.
+ *
  *
  * @param[in] vocabulary The map holding the "term -> id " mapping.
  * @param[in] output_dir Path to the directory where the dump of the
@@ -339,8 +722,21 @@ void mapIdToTerms(const StrIntMap& term2id, IntStrMap& id2term);
  */
 void dump_vocabulary(const StrIntMap& vocabulary, const char* output_dir);
 
+/**Dump a TermDictionary.
+ *
+ * Same file format as dump_vocabulary(const StrIntMap&, const char*), but
+ * terms are written straight from the dictionary's arenas, in id order,
+ * without building an intermediate IntStrMap.
+ *
+ * @warning Must not be called while other threads use @p vocabulary.
+ */
+void dump_vocabulary(const TermDictionary& vocabulary, const char* output_dir);
+
 
 /**Load a dumped vocabulary.
+ *
+ * Query resolvers should use MMapedVocabulary instead: it needs no
+ * loading.
  *
  * @see dump_vocabulary
  *
@@ -356,17 +752,31 @@ void load_vocabulary(StrIntMap& vocabulary, const char* store_dir);
  *
  * Actually, we only create the runs...
  *
+ * Documents can be parsed by several threads at once. Each thread pulls
+ * docids from a shared queue and writes its triples to its own
+ * run_inserter "shard". All shards share the vocabulary, so term ids are
+ * the same no matter which thread saw a term first, and the run numbering,
+ * so the runs left in @p output_dir can be merged as usual.
+ *
  * @param store_dir Path where the crawler saved the pages to be indexed.
  *
- * @param docids_list 	Full path to a file holding an ordered list of valid
- * 			docids and theirs corresponing urls, as saved by the
- * 			crawler.
+ * @param docids_list 	The docids of the documents to be indexed.
  *
  * @param output_dir Path where the indexing "runs" will be created.
  *
+ * @param run_size Total ammount of memory used to hold runs in memory. It
+ * 		   is evenly divided among the indexing threads.
+ *
+ * @param n_threads Number of indexing threads.
+ *
+ * @param positional Record the terms' positions in the runs too, see
+ * 		     RunPositions.
+ *
+ * @return The number of runs created.
  */
-void index_files(const char* store_dir, std::vector<docid_t> docids_list,
-		const char* output_dir, unsigned int run_size= 100*1024);
+int index_files(const char* store_dir, const std::vector<docid_t>& docids_list,
+		const char* output_dir, unsigned int run_size= 100*1024,
+		int n_threads = 1, bool positional = false);
 
 
 void prefetchDocs(const char* store_dir, std::vector<docid_t>& ids);
@@ -4,11 +4,14 @@
 
 #include "indexerutils.hpp"
 #include "mergerutils.hpp"
+#include "mmapedfile.h"
 #include "cxxtest/TestSuite.h"
 
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <string.h>
+#include <unistd.h>
 
 /**
  * @todo better tests.
@@ -91,6 +94,94 @@ public:
 		TS_ASSERT( merger.eof());
 	}
 
+	void test_ShardedInsertAndMerging()
+	{
+		const int KB = 1<<10;
+		const int n_runs = 3;
+
+		// Two shards sharing the run numbering must not overwrite
+		// each other's runs
+		RunCounter counter;
+		run_inserter shard_a(INDEXER_SANDBOX_DIR, 2*sizeof(run_triple),
+					&counter);
+		run_inserter shard_b(INDEXER_SANDBOX_DIR, 2*sizeof(run_triple),
+					&counter);
+
+		*shard_a++ = run_triple(1,0,0);
+		*shard_b++ = run_triple(2,1,0);
+		*shard_a++ = run_triple(5,0,0);
+		*shard_b++ = run_triple(4,1,0);
+		*shard_a++ = run_triple(3,0,0);
+
+		shard_a.flush();
+		shard_b.flush();
+		TS_ASSERT_EQUALS(shard_a.getNRuns(), 2);
+		TS_ASSERT_EQUALS(shard_b.getNRuns(), 1);
+		TS_ASSERT_EQUALS(counter.count(), n_runs);
+
+		RunMerger merger(n_runs, INDEXER_SANDBOX_DIR.c_str(),1*KB);
+
+		TS_ASSERT( ! merger.eof());
+		TS_ASSERT_EQUALS( merger.getNext(), run_triple(1,0,0));
+		TS_ASSERT_EQUALS( merger.getNext(), run_triple(2,1,0));
+		TS_ASSERT_EQUALS( merger.getNext(), run_triple(3,0,0));
+		TS_ASSERT_EQUALS( merger.getNext(), run_triple(4,1,0));
+		TS_ASSERT_EQUALS( merger.getNext(), run_triple(5,0,0));
+		TS_ASSERT( merger.eof());
+	}
+
+	void testRadixSortTriples()
+	{
+		srand(7);
+		const size_t sizes[] = {1, 2, 63, 64, 1000, 50000};
+
+		for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s) {
+			const size_t n = sizes[s];
+			std::vector<run_triple> triples, scratch(n + 1);
+			for(size_t i = 0; i < n; ++i) {
+				// Mix small and full range keys, with
+				// duplicates
+				uint32_t termid = (i % 3) ? rand() % 100 :
+						  rand() * 65537u;
+				uint32_t docid = (i % 5) ? rand() % 1000 :
+						 rand() * 31u;
+				triples.push_back(run_triple(termid, docid, i));
+			}
+			std::vector<run_triple> expected(triples);
+			std::stable_sort(expected.begin(), expected.end());
+
+			radix_sort_triples(&triples[0], &triples[0] + n,
+						&scratch[0]);
+			TS_ASSERT(triples == expected);
+		}
+
+		// Few keys, many duplicates: equal keys keep their order
+		for(size_t n = 2; n <= 100; n += 7) {
+			std::vector<run_triple> triples, scratch(n);
+			for(size_t i = 0; i < n; ++i) {
+				triples.push_back(run_triple(rand() % 2,
+							rand() % 3, i));
+			}
+			std::vector<run_triple> expected(triples);
+			std::stable_sort(expected.begin(), expected.end());
+
+			radix_sort_triples(&triples[0], &triples[0] + n,
+						&scratch[0]);
+			TS_ASSERT(triples == expected);
+		}
+
+		// All keys but one byte are the same
+		std::vector<run_triple> triples, scratch(300);
+		for(uint32_t i = 300; i > 0; --i) {
+			triples.push_back(run_triple(7, i << 16, 1));
+		}
+		radix_sort_triples(&triples[0], &triples[0] + triples.size(),
+					&scratch[0]);
+		for(uint32_t i = 0; i < 300; ++i) {
+			TS_ASSERT_EQUALS(triples[i], run_triple(7, (i + 1) << 16, 1));
+		}
+	}
+
 	void testTripleInserterAndMerger()
 	{
 		const int KB = 1<<10;
@@ -128,6 +219,475 @@ public:
 		TS_ASSERT_EQUALS(processed_triples , n_triples);
 
 	}
+
+	void testLoserTreeRunMerger()
+	{
+		const int KB = 1<<10;
+
+		// Runs of different lengths, duplicated triples across runs
+		// and an odd number of runs
+		RunCounter counter;
+		for(int r = 0; r < 5; ++r) {
+			run_inserter run(INDEXER_SANDBOX_DIR, 64*KB, &counter);
+			for(int i = 0; i < 100 * r + 1; ++i) {
+				*run++ = run_triple((i * 7 + r) % 53, i % 11, r);
+			}
+			run.flush();
+		}
+		const int n_runs = counter.count();
+		TS_ASSERT_EQUALS(n_runs, 5);
+
+		// Tiny memory budget, to force many refills
+		RunMerger reference(n_runs, INDEXER_SANDBOX_DIR.c_str(), 1*KB);
+		LoserTreeRunMerger merger(n_runs, INDEXER_SANDBOX_DIR.c_str(),
+						1*KB);
+
+		run_triple block[7];
+		size_t n;
+		size_t total = 0;
+		while( (n = merger.getBlock(block, 7)) > 0) {
+			for(size_t i = 0; i < n; ++i) {
+				TS_ASSERT( ! reference.eof());
+				run_triple expected = reference.getNext();
+				TS_ASSERT_EQUALS(block[i].termid,
+						expected.termid);
+				TS_ASSERT_EQUALS(block[i].docid,
+						expected.docid);
+			}
+			total += n;
+		}
+		TS_ASSERT(merger.eof());
+		TS_ASSERT(reference.eof());
+		TS_ASSERT_EQUALS(total, 1u + 101 + 201 + 301 + 401);
+	}
+
+	void testLoserTreeRunMergerSyncAndAsync()
+	{
+		const int KB = 1<<10;
+		const int n_triples = 20000;
+
+		RunCounter counter;
+		for(int r = 0; r < 3; ++r) {
+			run_inserter run(INDEXER_SANDBOX_DIR, 256*KB, &counter);
+			for(int i = r; i < n_triples; i += 3) {
+				*run++ = run_triple(i / 10, i, 1);
+			}
+		}
+
+		// Small blocks: many background reads per run
+		LoserTreeRunMerger async(3, INDEXER_SANDBOX_DIR.c_str(), 0,
+						true, 100 * sizeof(run_triple));
+		LoserTreeRunMerger sync(3, INDEXER_SANDBOX_DIR.c_str(), 0,
+						false, 100 * sizeof(run_triple));
+
+		for(int i = 0; i < n_triples; ++i) {
+			TS_ASSERT( ! async.eof());
+			TS_ASSERT( ! sync.eof());
+			run_triple a = async.getNext();
+			run_triple s = sync.getNext();
+			TS_ASSERT_EQUALS(a, run_triple(i / 10, i, 1));
+			TS_ASSERT_EQUALS(s, run_triple(i / 10, i, 1));
+		}
+		TS_ASSERT(async.eof());
+		TS_ASSERT(sync.eof());
+		TS_ASSERT(async.getStallTime() >= 0);
+	}
+
+	void testLoserTreeRunMergerSingleAndEmptyRuns()
+	{
+		const int KB = 1<<10;
+
+		{
+			run_inserter run(INDEXER_SANDBOX_DIR, KB);
+			*run++ = run_triple(2,0,0);
+			*run++ = run_triple(1,0,0);
+		}
+
+		LoserTreeRunMerger single(1, INDEXER_SANDBOX_DIR.c_str(), KB);
+		TS_ASSERT( ! single.eof());
+		TS_ASSERT_EQUALS( single.getNext(), run_triple(1,0,0));
+		TS_ASSERT_EQUALS( single.getNext(), run_triple(2,0,0));
+		TS_ASSERT( single.eof());
+
+		LoserTreeRunMerger none(0, INDEXER_SANDBOX_DIR.c_str(), KB);
+		run_triple t;
+		TS_ASSERT( none.eof());
+		TS_ASSERT_EQUALS( none.getBlock(&t, 1), 0u);
+	}
+
+	void testLoserTreeRunMergerTruncatedRun()
+	{
+		const int KB = 1<<10;
+
+		{
+			run_inserter run(INDEXER_SANDBOX_DIR, KB);
+			for(int i = 0; i < 10; ++i) {
+				*run++ = run_triple(i,0,0);
+			}
+		}
+		std::string filename = run_inserter::make_run_filename(
+					INDEXER_SANDBOX_DIR.c_str(), 0);
+		TS_ASSERT_EQUALS(truncate(filename.c_str(),
+					5 * sizeof(run_triple) + 1), 0);
+
+		TS_ASSERT_THROWS(LoserTreeRunMerger(1,
+					INDEXER_SANDBOX_DIR.c_str(), KB, false),
+				std::runtime_error);
+		TS_ASSERT_THROWS(LoserTreeRunMerger(1,
+					INDEXER_SANDBOX_DIR.c_str(), KB, true),
+				std::runtime_error);
+	}
+
+	void testMultiPassMerger()
+	{
+		const int KB = 1<<10;
+		const int n_triples = 5000;
+		const int n_created = 11;
+
+		RunCounter counter;
+		for(int r = 0; r < n_created; ++r) {
+			run_inserter run(INDEXER_SANDBOX_DIR, 64*KB, &counter);
+			for(int i = r; i < n_triples; i += n_created) {
+				*run++ = run_triple(i % 97, i, 1);
+			}
+		}
+
+		// Budget for at most 2 runs per merge: 11 -> 6 -> 3 -> 2
+		MultiPassMerger planner(n_created, INDEXER_SANDBOX_DIR.c_str(),
+					4*KB, 2, KB);
+		TS_ASSERT_EQUALS(planner.fanIn(), 2u);
+		TS_ASSERT_EQUALS(planner.finalFanIn(), 2u);
+
+		std::vector<std::string> runs = planner.reduce();
+		TS_ASSERT_EQUALS(planner.getNPasses(), 3);
+		TS_ASSERT_EQUALS(runs.size(), 2u);
+
+		LoserTreeRunMerger merger(runs, 4*KB);
+		run_triple prev(0,0,0);
+		for(int i = 0; i < n_triples; ++i) {
+			TS_ASSERT( ! merger.eof());
+			run_triple t = merger.getNext();
+			TS_ASSERT( i == 0 || prev < t);
+			prev = t;
+		}
+		TS_ASSERT(merger.eof());
+
+		// Intermediate runs are gone, the original ones are untouched
+		planner.cleanup();
+		struct stat st;
+		TS_ASSERT_EQUALS(stat(runs[0].c_str(), &st), -1);
+		TS_ASSERT_EQUALS(stat(run_inserter::make_run_filename(
+				INDEXER_SANDBOX_DIR, 0).c_str(), &st), 0);
+	}
+
+	void testMultiPassMergerFanIns()
+	{
+		const size_t MB = 1<<20;
+		const char* dir = INDEXER_SANDBOX_DIR.c_str();
+
+		// Two 1MB blocks per reader
+		MultiPassMerger small(100, dir, 64*MB, 1);
+		TS_ASSERT_EQUALS(small.fanIn(), 32u);
+		TS_ASSERT_EQUALS(small.finalFanIn(), 32u);
+
+		// Bigger blocks, fewer runs at once
+		MultiPassMerger big(100, dir, 64*MB, 2, 4*MB);
+		TS_ASSERT_EQUALS(big.fanIn(), 4u);
+		TS_ASSERT_EQUALS(big.finalFanIn(), 8u);
+
+		// Each term range of the final merge reads every run
+		MultiPassMerger ranges(100, dir, 64*MB, 1, 4*MB, 4);
+		TS_ASSERT_EQUALS(ranges.fanIn(), 8u);
+		TS_ASSERT_EQUALS(ranges.finalFanIn(), 2u);
+	}
+
+	void testCompressedInvertedFileDump()
+	{
+		const int KB = 1<<10;
+		const uint32_t n_terms = 50;
+
+		// Term t appears in documents 1, t+2, 2t+3, ...
+		// (byte-wise coding can't store a 0 docid)
+		run_inserter run(INDEXER_SANDBOX_DIR, 4*KB);
+		for(uint32_t t = 0; t < n_terms; ++t) {
+			for(uint32_t d = 1; d < 1000; d += t + 1) {
+				*run++ = run_triple(t, d, 1 + d % 7);
+			}
+		}
+		run.flush();
+
+		{
+			LoserTreeRunMerger merger(run.getNRuns(),
+					INDEXER_SANDBOX_DIR.c_str(), 4*KB);
+			ByteWiseCompressedInvertedFileDumper dumper(
+					INDEXER_SANDBOX_DIR, merger, 1*KB);
+			dumper.dump();
+		}
+
+		MMapedFile hdr_file(INDEXER_SANDBOX_DIR + "/index.hdr");
+		const hdr_entry_t* hdr =
+			(const hdr_entry_t*) hdr_file.getBuf().start;
+		TS_ASSERT_EQUALS(hdr_file.getBuf().len(),
+				n_terms * sizeof(hdr_entry_t));
+
+		for(uint32_t t = 0; t < n_terms; ++t) {
+			MMapedFile data(BaseInvertedFileDumper::mk_data_filename(
+					INDEXER_SANDBOX_DIR, hdr[t].fileno));
+			filebuf list = data.getBuf();
+			list += hdr[t].pos;
+
+			inverted_list_vec_t ilist;
+			ByteWiseCompressor::decompress(hdr[t].ft, list, ilist);
+
+			inverted_list_vec_t expected;
+			for(uint32_t d = 1; d < 1000; d += t + 1) {
+				expected.push_back(d_fdt_t(d, 1 + d % 7));
+			}
+			TS_ASSERT_EQUALS(hdr[t].ft, expected.size());
+			TS_ASSERT(ilist == expected);
+		}
+	}
+
+	void testPartitionedIndexBuilder()
+	{
+		const int KB = 1<<10;
+		const uint32_t n_terms = 300;
+		const uint32_t n_docs = 2000;
+
+		// Term t appears in documents 1, 1 + (t%7 + 1), ...
+		RunCounter counter;
+		for(uint32_t r = 0; r < 3; ++r) {
+			run_inserter run(INDEXER_SANDBOX_DIR, 256*KB, &counter);
+			for(uint32_t t = 0; t < n_terms; ++t) {
+				for(uint32_t d = 1; d < n_docs; d += t % 7 + 1) {
+					if (d % 3 == r) {
+						*run++ = run_triple(t, d, 1 + d % 5);
+					}
+				}
+			}
+		}
+
+		std::vector<std::string> runs;
+		for(int i = 0; i < counter.count(); ++i) {
+			runs.push_back(run_inserter::make_run_filename(
+					INDEXER_SANDBOX_DIR, i));
+		}
+
+		// Small data files, so segments have to be renumbered
+		PartitionedIndexBuilder builder(runs, INDEXER_SANDBOX_DIR,
+						64*KB, 16*KB, 4);
+		TS_ASSERT_EQUALS(builder.getNPartitions(), 4);
+		TS_ASSERT_EQUALS(builder.getBounds().front(), 0u);
+		TS_ASSERT_EQUALS(builder.getBounds().back(), 1ULL << 32);
+		builder.build();
+
+		MMapedFile hdr_file(INDEXER_SANDBOX_DIR + "/index.hdr");
+		const hdr_entry_t* hdr =
+			(const hdr_entry_t*) hdr_file.getBuf().start;
+		TS_ASSERT_EQUALS(hdr_file.getBuf().len(),
+				n_terms * sizeof(hdr_entry_t));
+
+		for(uint32_t t = 0; t < n_terms; ++t) {
+			MMapedFile data(BaseInvertedFileDumper::mk_data_filename(
+					INDEXER_SANDBOX_DIR, hdr[t].fileno));
+			filebuf list = data.getBuf();
+			list += hdr[t].pos;
+
+			inverted_list_vec_t ilist;
+			ByteWiseCompressor::decompress(hdr[t].ft, list, ilist);
+
+			inverted_list_vec_t expected;
+			for(uint32_t d = 1; d < n_docs; d += t % 7 + 1) {
+				expected.push_back(d_fdt_t(d, 1 + d % 5));
+			}
+			TS_ASSERT_EQUALS(hdr[t].ft, expected.size());
+			TS_ASSERT(ilist == expected);
+		}
+
+		// Segment directories are gone
+		struct stat st;
+		TS_ASSERT_EQUALS(stat(PartitionedIndexBuilder::
+				make_partition_dirname(INDEXER_SANDBOX_DIR,
+							0).c_str(), &st), -1);
+	}
+
+	void testStreamVByteInvertedFileDump()
+	{
+		const int KB = 1<<10;
+		const uint32_t n_terms = 20;
+
+		// Term t appears in documents 0, t+1, 2t+2, ...
+		run_inserter run(INDEXER_SANDBOX_DIR, 4*KB);
+		for(uint32_t t = 0; t < n_terms; ++t) {
+			for(uint32_t d = 0; d < 3000; d += t + 1) {
+				*run++ = run_triple(t, d, 1 + d % 7);
+			}
+		}
+		run.flush();
+
+		{
+			LoserTreeRunMerger merger(run.getNRuns(),
+					INDEXER_SANDBOX_DIR.c_str(), 4*KB);
+			std::auto_ptr<BaseInvertedFileDumper> dumper(
+				make_inverted_file_dumper(
+					InvertedListCodec::STREAMVBYTE,
+					INDEXER_SANDBOX_DIR, merger, 1*KB));
+			dumper->dump();
+		}
+
+		InvertedListCodec::format_t format =
+			InvertedListCodec::readFormat(INDEXER_SANDBOX_DIR);
+		TS_ASSERT_EQUALS(format, InvertedListCodec::STREAMVBYTE);
+
+		MMapedFile hdr_file(INDEXER_SANDBOX_DIR + "/index.hdr");
+		const hdr_entry_t* hdr =
+			(const hdr_entry_t*) hdr_file.getBuf().start;
+		for(uint32_t t = 0; t < n_terms; ++t) {
+			MMapedFile data(BaseInvertedFileDumper::mk_data_filename(
+					INDEXER_SANDBOX_DIR, hdr[t].fileno));
+			filebuf list = data.getBuf();
+			list += hdr[t].pos;
+
+			inverted_list_vec_t ilist;
+			InvertedListCodec::decompress(format, hdr[t].ft, list,
+							ilist);
+
+			inverted_list_vec_t expected;
+			for(uint32_t d = 0; d < 3000; d += t + 1) {
+				expected.push_back(d_fdt_t(d, 1 + d % 7));
+			}
+			TS_ASSERT(ilist == expected);
+		}
+	}
+
+	void testMappedInvertedFile()
+	{
+		const int KB = 1<<10;
+		const uint32_t n_terms = 50;
+
+		// Small data files, so the lists span a few of them
+		run_inserter run(INDEXER_SANDBOX_DIR, 4*KB);
+		for(uint32_t t = 0; t < n_terms; ++t) {
+			for(uint32_t d = 1; d < 2000; d += t + 1) {
+				*run++ = run_triple(t, d, 1 + d % 3);
+			}
+		}
+		run.flush();
+
+		int n_data_files = 0;
+		{
+			LoserTreeRunMerger merger(run.getNRuns(),
+					INDEXER_SANDBOX_DIR.c_str(), 4*KB);
+			std::auto_ptr<BaseInvertedFileDumper> dumper(
+				make_inverted_file_dumper(
+					InvertedListCodec::BYTEWISE,
+					INDEXER_SANDBOX_DIR, merger, 1*KB));
+			dumper->dump();
+			n_data_files = dumper->getNDataFiles();
+		}
+		TS_ASSERT_LESS_THAN(1, n_data_files);
+
+		MMapedFile hdr_file(INDEXER_SANDBOX_DIR + "/index.hdr");
+		const hdr_entry_t* hdr =
+			(const hdr_entry_t*) hdr_file.getBuf().start;
+
+		const MappedInvertedFile::load_t loads[] = {
+					MappedInvertedFile::LAZY,
+					MappedInvertedFile::WILLNEED,
+					MappedInvertedFile::POPULATE};
+		for(int l = 0; l < 3; ++l) {
+			MappedInvertedFile ifile(INDEXER_SANDBOX_DIR, loads[l]);
+			TS_ASSERT_EQUALS(ifile.getNDataFiles(),
+					 size_t(n_data_files));
+
+			for(uint32_t t = 0; t < n_terms; ++t) {
+				inverted_list_vec_t ilist;
+				InvertedListCodec::decompress(
+					InvertedListCodec::BYTEWISE, hdr[t].ft,
+					ifile.getList(hdr[t]), ilist);
+
+				inverted_list_vec_t expected;
+				for(uint32_t d = 1; d < 2000; d += t + 1) {
+					expected.push_back(d_fdt_t(d, 1 + d % 3));
+				}
+				TS_ASSERT(ilist == expected);
+			}
+
+			hdr_entry_t bogus(hdr[0]);
+			bogus.fileno = n_data_files;
+			TS_ASSERT_THROWS(ifile.getList(bogus), std::out_of_range);
+		}
+	}
+
+	void testUTF8Tokenizer()
+	{
+		UTF8Tokenizer tokenizer;
+		std::string text("AÇÃO, weißBIER 1ªcolocada\tpalavra«PERDIDA» "
+				 "Ÿ ĀB");
+		std::vector<std::string> terms;
+
+		tokenizer.reset(filebuf(text.c_str(), text.size()));
+		while(tokenizer.next()) {
+			terms.push_back(tokenizer.term());
+		}
+
+		TS_ASSERT_EQUALS(terms.size(), 7u);
+		TS_ASSERT_EQUALS(terms[0], "acao");
+		TS_ASSERT_EQUALS(terms[1], "weißbier");
+		TS_ASSERT_EQUALS(terms[2], "1ªcolocada");
+		TS_ASSERT_EQUALS(terms[3], "palavra");
+		TS_ASSERT_EQUALS(terms[4], "perdida");
+		TS_ASSERT_EQUALS(terms[5], "y");
+		TS_ASSERT_EQUALS(terms[6], "āb");
+
+		// Each result must match the wide-string normalization
+		for(size_t i = 0; i < terms.size(); ++i) {
+			std::string w(terms[i]);
+			TS_ASSERT_EQUALS(normalize_term(w), terms[i]);
+		}
+
+		// Text ends at the first NUL
+		std::string with_nul("abc def\0ghi", 11);
+		tokenizer.reset(filebuf(with_nul.c_str(), with_nul.size()));
+		TS_ASSERT(tokenizer.next());
+		TS_ASSERT(tokenizer.next());
+		TS_ASSERT_EQUALS(tokenizer.term(), "def");
+		TS_ASSERT(! tokenizer.next());
+
+		// Invalid sequences: latin1, overlong, surrogate, truncated
+		const char* invalid[] = {"a\xe7\xe3o", "\xc0\xaf", "\xed\xa0\x80",
+					 "abc\xc3"};
+		for(size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); ++i){
+			TS_ASSERT_THROWS(tokenizer.reset(filebuf(invalid[i],
+					strlen(invalid[i]))),
+				WideCharConverter::ConversionError);
+			TS_ASSERT(! tokenizer.next());
+		}
+	}
+
+	void testUTF8TokenizerMatchesWideChar()
+	{
+		const char* pages[] = {"../html_tests/teste.html",
+			"../html_tests/xx.html", "../html_tests/xy.xhtml",
+			"../html_tests/slashdot.html",
+			"../html_tests/uol.frag.html"};
+		UTF8Tokenizer tokenizer;
+		WideCharConverter wconv;
+
+		for(size_t i = 0; i < sizeof(pages)/sizeof(pages[0]); ++i){
+			MMapedFile page(pages[i]);
+			StrIntMap expected, wfreq;
+
+			getWordFrequency(page.getBuf(), expected, wconv);
+			getWordFrequency(page.getBuf(), wfreq, tokenizer);
+
+			TS_ASSERT_EQUALS(wfreq.size(), expected.size());
+			StrIntMap::const_iterator w;
+			for(w = expected.begin(); w != expected.end(); ++w){
+				TS_ASSERT_EQUALS(wfreq[w->first], w->second);
+			}
+		}
+	}
 	
 
 };
@@ -316,7 +316,7 @@ filebuf& dumpToFilebuf(_T t, filebuf& out)
 	return out;
 }
 
-filebuf& dumpStrToFilebuf(const std::string& t, filebuf& out)
+inline filebuf& dumpStrToFilebuf(const std::string& t, filebuf& out)
 {
 	size_t len = t.size();
 	void* pos = (void*) out.read(len);
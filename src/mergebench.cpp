@@ -0,0 +1,142 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+/**@file mergebench.cpp
+ * @brief Run merging micro-benchmark.
+ *
+ * Creates a set of synthetic runs and reports how fast RunMerger and
+ * LoserTreeRunMerger, with and without read-ahead, drain them. Time the
+ * loser tree mergers spent waiting for run data is reported too.
+ *
+ * Usage: mergebench [n_runs] [triples_per_run] [work_dir]
+ *
+ * Runs are created in @c work_dir (default: @c _mergebench_dir), which
+ * is removed at the end.
+ */
+
+#include "mergerutils.hpp"
+#include "strmisc.h"
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+
+/***********************************************************************
+				    HELPERS
+ ***********************************************************************/
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**Create @p n_runs runs with @p run_len triples each.
+ *
+ * Triples are spread over a vocabulary with a skewed (roughly Zipfian)
+ * term distribution, as in a real collection.
+ */
+void make_runs(const std::string& dir, int n_runs, size_t run_len)
+{
+	std::vector<run_triple> run(run_len);
+	RunCounter counter;
+	run_inserter inserter(dir, run_len * sizeof(run_triple), &counter);
+	uint32_t docid = 1;
+
+	srand(42);
+	for(int r = 0; r < n_runs; ++r) {
+		for(size_t i = 0; i < run_len; ++i) {
+			// Skewed term ids: small ids are far more common
+			uint32_t termid = uint32_t(rand() % 1000) *
+					  uint32_t(rand() % 1000) / 37;
+			*inserter++ = run_triple(termid, docid + i % 5000,
+						 1 + rand() % 10);
+		}
+		docid += 5000;
+	}
+	inserter.flush();
+}
+
+//! Drain a merger, block by block, and report its throughput.
+void drain(const std::string& name, AbstractRunMerger& merger,
+		size_t expected)
+{
+	std::vector<run_triple> block(4096);
+	run_triple last;
+	size_t count = 0;
+	size_t n;
+	bool ordered = true;
+
+	double start = now();
+	while( (n = merger.getBlock(&block[0], block.size())) > 0 ) {
+		for(size_t i = 0; i < n; ++i) {
+			ordered = ordered && !(block[i] < last);
+			last = block[i];
+		}
+		count += n;
+	}
+	double elapsed = now() - start;
+
+	std::cout << "  " << std::setw(24) << std::left << name <<
+		std::setw(10) << std::right << std::fixed <<
+		std::setprecision(2) << count / elapsed / 1e6 <<
+		" Mtriples/s" << (ordered && count == expected ? "" :
+		"  ** WRONG OUTPUT **") << std::endl;
+}
+
+
+/***********************************************************************
+				      MAIN
+ ***********************************************************************/
+
+int main(int argc, char* argv[])
+{
+	const size_t MB = 1<<20;
+
+	int n_runs = 256;
+	size_t run_len = 1<<16;
+	std::string dir = "_mergebench_dir";
+	size_t max_mem = 64 * MB;
+
+	if (argc > 1) { n_runs = fromString<int>(argv[1]); }
+	if (argc > 2) { run_len = fromString<size_t>(argv[2]); }
+	if (argc > 3) { dir = argv[3]; }
+
+	mkdir(dir.c_str(), S_IRWXU);
+
+	std::cout << "# Creating " << n_runs << " runs with " << run_len <<
+		" triples each in " << dir << std::endl;
+	make_runs(dir, n_runs, run_len);
+
+	size_t expected = n_runs * run_len;
+	{
+		RunMerger merger(n_runs, dir.c_str(), max_mem);
+		drain("RunMerger", merger, expected);
+	}
+	{
+		LoserTreeRunMerger merger(n_runs, dir.c_str(), max_mem, false);
+		drain("LoserTree (sync)", merger, expected);
+		std::cout << "    stalled " << merger.getStallTime() << "s" <<
+			std::endl;
+	}
+	{
+		LoserTreeRunMerger merger(n_runs, dir.c_str(), max_mem, true);
+		drain("LoserTree (read-ahead)", merger, expected);
+		std::cout << "    stalled " << merger.getStallTime() << "s" <<
+			std::endl;
+	}
+
+	std::string cmd_line("rm -rf ");
+	cmd_line += dir;
+	system(cmd_line.c_str());
+
+	return 0;
+}
+
+//EOF
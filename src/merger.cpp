@@ -5,11 +5,30 @@
 
 #include <iostream>
 #include <queue>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//! Total size of the files named by @p mk_filename, 0, 1, ... in @p dir.
+off_t files_size(const std::string& dir,
+		MappedInvertedFile::mk_filename_fn mk_filename)
+{
+	off_t total = 0;
+	struct stat st;
+	for(int n = 0; stat(mk_filename(dir, n).c_str(), &st) == 0; ++n) {
+		total += st.st_size;
+	}
+	return total;
+}
 
 void show_usage()
 {
 	std::cout << 	"Usage:\n"
-			"merger n_runs run_dir" << std::endl;
+			"merger n_runs run_dir [run_buffer_kb] [n_threads] "
+			"[n_partitions] [format]\n"
+			"\tformat\tbytewise (default) or streamvbyte\n"
+			"Runs made by a positional indexer yield a positional "
+			"index." << std::endl;
 }
 
 int main(int argc, char* argv[])
@@ -21,17 +40,95 @@ int main(int argc, char* argv[])
 	/*
 	 * parse comand line
 	 */
-	if (argc != 3) {
+	if (argc < 3 || argc > 7) {
 		show_usage();
 		exit(EXIT_FAILURE);
 	}
 	int n_runs = fromString<int>(argv[1]);
 	const char* output_dir = argv[2];
 
+	// Size of each of the two read-ahead buffers of a run. By default
+	// it is derived from max_mem.
+	size_t block_size = 0;
+	if (argc >= 4) {
+		block_size = fromString<size_t>(argv[3]) * 1024;
+	}
+
+	// Number of concurrent merges in intermediate passes
+	int n_threads = 1;
+	if (argc >= 5) {
+		n_threads = fromString<int>(argv[4]);
+	}
+
+	// Number of term ranges merged concurrently in the final merge
+	int n_partitions = 1;
+	if (argc >= 6) {
+		n_partitions = fromString<int>(argv[5]);
+	}
+
+	// Inverted list compression
+	InvertedListCodec::format_t format = InvertedListCodec::BYTEWISE;
+	if (argc == 7) {
+		format = InvertedListCodec::fromName(argv[6]);
+	}
+
+	// Positional runs must be dumped as such
+	bool positional = (access(RunPositions::mk_marker_filename(
+					output_dir).c_str(), R_OK) == 0);
+
 	// Create index
-	RunMerger merger(n_runs, output_dir, max_mem);
-	ByteWiseCompressedInvertedFileDumper ifile(output_dir, merger, 256*MB);
-	std::cout << "Setup complete. Staring the merging process." <<std::endl;
-	ifile.dump();
+	time_t start = time(NULL);
+	// Fan-ins must leave room for the blocks the final merge will use,
+	// one set per term range
+	size_t min_block_size = block_size ? block_size : MB;
+	MultiPassMerger planner(n_runs, output_dir, max_mem, n_threads,
+				min_block_size, n_partitions);
+	std::cout << "Merging " << n_runs << " runs. Fan-in: " <<
+		planner.fanIn() << " per pass, " << planner.finalFanIn() <<
+		" in the final merge." << std::endl;
+	const std::vector<std::string>& runs = planner.reduce();
+
+	time_t final_start = time(NULL);
+	if (n_partitions > 1) {
+		PartitionedIndexBuilder builder(runs, output_dir, max_mem,
+						256*MB, n_partitions, format,
+						positional, block_size);
+		std::cout << "Setup complete. Merging " <<
+			builder.getNPartitions() << " term ranges." <<
+			std::endl;
+		builder.build();
+
+		std::cout << "Final merge of " << runs.size() <<
+			" runs done in " << time(NULL) - final_start <<
+			"s." << std::endl;
+	} else {
+		LoserTreeRunMerger merger(runs, max_mem, true, block_size);
+		std::auto_ptr<BaseInvertedFileDumper> ifile(
+			make_inverted_file_dumper(format, output_dir, merger,
+							256*MB, positional));
+		std::cout << "Setup complete. Staring the merging process." <<
+			std::endl;
+		ifile->dump();
+
+		std::cout << "Final merge of " << runs.size() <<
+			" runs done in " << time(NULL) - final_start << "s. " <<
+			"Stalled waiting for run data for " <<
+			merger.getStallTime() << "s." << std::endl;
+	}
+	std::cout << "Merge done in " << time(NULL) - start << "s, " <<
+		planner.getNPasses() << " intermediate passes." << std::endl;
+
+	planner.cleanup();
+
+	if (positional) {
+		off_t postings = files_size(output_dir,
+				BaseInvertedFileDumper::mk_data_filename);
+		off_t positions = files_size(output_dir,
+				BaseInvertedFileDumper::mk_positions_filename);
+		std::cout << "Inverted lists: " << postings / MB << "MB, " <<
+			"positions: " << positions / MB << "MB (+" <<
+			(postings ? 100 * positions / postings : 0) << "%)." <<
+			std::endl;
+	}
 
 }
@@ -3,6 +3,361 @@
 #include "mergerutils.hpp"
 
 #include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <iostream>
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+/***********************************************************************
+			       LoserTreeRunMerger
+ ***********************************************************************/
+
+const uint64_t LoserTreeRunMerger::EXHAUSTED;
+
+LoserTreeRunMerger::LoserTreeRunMerger(int n_runs, const char* run_store_dir,
+				size_t max_memory, bool read_ahead,
+				size_t block_size)
+: io(0), runs(), keys(), k(0), tree(), first_term(0), end_term(1ULL << 32)
+{
+	std::vector<std::string> run_files;
+	for (int i = 0; i < n_runs; ++i) {
+		run_files.push_back(
+			run_inserter::make_run_filename(run_store_dir, i));
+	}
+
+	init(run_files, max_memory, read_ahead, block_size);
+}
+
+LoserTreeRunMerger::LoserTreeRunMerger(
+				const std::vector<std::string>& run_files,
+				size_t max_memory, bool read_ahead,
+				size_t block_size)
+: io(0), runs(), keys(), k(0), tree(), first_term(0), end_term(1ULL << 32)
+{
+	init(run_files, max_memory, read_ahead, block_size);
+}
+
+LoserTreeRunMerger::LoserTreeRunMerger(
+				const std::vector<std::string>& run_files,
+				uint64_t first, uint64_t end,
+				size_t max_memory, bool read_ahead,
+				size_t block_size)
+: io(0), runs(), keys(), k(0), tree(), first_term(first), end_term(end)
+{
+	init(run_files, max_memory, read_ahead, block_size);
+}
+
+void LoserTreeRunMerger::init(const std::vector<std::string>& run_files,
+			size_t max_memory, bool read_ahead, size_t block_size)
+{
+	int n_runs = run_files.size();
+
+	if (block_size == 0) {
+		block_size = max_memory / std::max(n_runs, 1);
+		if (read_ahead) {
+			block_size /= 2;
+		}
+	}
+
+	try {
+		if (read_ahead && n_runs > 0) {
+			io = new ReadAheadThread();
+			io->start();
+		}
+
+		bool whole_runs = (first_term == 0 && end_term > 0xFFFFFFFFULL);
+		for (int i = 0; i < n_runs; ++i) {
+			off_t start = 0;
+			off_t end = -1;
+			if (! whole_runs) {
+				RunIndex index(run_files[i]);
+				start = index.startOffset(first_term);
+				end = index.endOffset(end_term);
+			}
+			runs.push_back(new BatchRunReader(run_files[i].c_str(),
+							block_size, io,
+							start, end));
+			// Skip what the index could not
+			BatchRunReader* r = runs.back();
+			while (! r->eof() && r->head().termid < first_term) {
+				r->advance();
+			}
+		}
+	} catch(...) {
+		releaseRuns();
+		throw;
+	}
+
+	k = runs.size();
+	for(int i = 0; i < k; ++i) {
+		keys.push_back(headKey(i));
+	}
+	if (k > 0) {
+		tree.resize(k);
+		tree[0] = build(1);
+	}
+}
+
+LoserTreeRunMerger::~LoserTreeRunMerger()
+{
+	releaseRuns();
+}
+
+void LoserTreeRunMerger::releaseRuns()
+{
+	// Readers must go before the thread serving them
+	for(size_t i = 0; i < runs.size(); ++i) {
+		delete runs[i];
+	}
+	runs.clear();
+
+	if (io) {
+		io->stop();
+		delete io;
+		io = 0;
+	}
+}
+
+double LoserTreeRunMerger::getStallTime() const
+{
+	double total = 0;
+	for(size_t i = 0; i < runs.size(); ++i) {
+		total += runs[i]->getStallTime();
+	}
+	return total;
+}
+
+int LoserTreeRunMerger::build(int node)
+{
+	// Leaves are the nodes k..2k-1
+	if (node >= k) {
+		return node - k;
+	}
+
+	int a = build(2 * node);
+	int b = build(2 * node + 1);
+
+	if (beats(a, b)) {
+		tree[node] = b;
+		return a;
+	} else {
+		tree[node] = a;
+		return b;
+	}
+}
+
+size_t LoserTreeRunMerger::getBlock(run_triple* out, size_t max_triples)
+{
+	size_t n = 0;
+
+	while(n < max_triples && !eof()) {
+		out[n++] = getNext();
+	}
+
+	return n;
+}
+
+
+/***********************************************************************
+				MultiPassMerger
+ ***********************************************************************/
+
+namespace {
+	/**A merge pass: a list of batches, merged by a few threads.
+	 *
+	 * Threads pick the next batch to be merged until there's none
+	 * left.
+	 */
+	struct MergePass {
+		const std::vector< std::vector<std::string> >& batches;
+		const std::vector<std::string>& outputs;
+		size_t mem_per_merge;
+
+		CatholicShameMutex PASS_LOCK;
+		size_t next_batch;	//!< @synchronized(PASS_LOCK)
+		std::string error;	//!< @synchronized(PASS_LOCK)
+
+		MergePass(const std::vector< std::vector<std::string> >& b,
+			  const std::vector<std::string>& o, size_t mem)
+		: batches(b), outputs(o), mem_per_merge(mem), PASS_LOCK(),
+		  next_batch(0), error()
+		{}
+
+		//! @return false if there are no batches left.
+		bool nextBatch(size_t& batch)
+		{
+			AutoLock synchronized(PASS_LOCK);
+			if (next_batch >= batches.size() || !error.empty()) {
+				return false;
+			}
+			batch = next_batch++;
+			return true;
+		}
+
+		void setError(const std::string& msg)
+		{
+			AutoLock synchronized(PASS_LOCK);
+			error = msg;
+		}
+	};
+
+	class MergeThread : public BaseThread {
+		MergePass& pass;
+	public:
+		MergeThread(MergePass& p) : BaseThread(), pass(p) {}
+
+		void* run()
+		{
+			size_t b;
+			try {
+				while(pass.nextBatch(b)) {
+					MultiPassMerger::mergeRuns(
+						pass.batches[b],
+						pass.outputs[b],
+						pass.mem_per_merge);
+				}
+			} catch(std::exception& e) {
+				pass.setError(e.what());
+			}
+			return NULL;
+		}
+	};
+
+	void removeRuns(const std::vector<std::string>& files)
+	{
+		for(size_t i = 0; i < files.size(); ++i) {
+			unlink(files[i].c_str());
+			unlink(RunIndex::make_filename(files[i]).c_str());
+		}
+	}
+}
+
+MultiPassMerger::MultiPassMerger(int n_runs, const char* run_store_dir,
+			size_t _max_memory, int threads,
+			size_t min_block_size, int final_readers)
+: run_dir(run_store_dir),
+  max_memory(_max_memory),
+  n_threads(std::max(threads, 1)),
+  fan_in(0),
+  final_fan_in(0),
+  n_passes(0),
+  runs(),
+  intermediate(false)
+{
+	// Each run reader holds two blocks (read-ahead)
+	size_t reader_mem = 2 * std::max(min_block_size, sizeof(run_triple));
+
+	fan_in = std::max( (max_memory / n_threads) / reader_mem, size_t(2));
+	final_fan_in = std::max( max_memory /
+			(reader_mem * std::max(final_readers, 1)), size_t(2));
+
+	for (int i = 0; i < n_runs; ++i) {
+		runs.push_back(run_inserter::make_run_filename(run_dir, i));
+	}
+}
+
+std::string MultiPassMerger::make_pass_run_filename(std::string path_prefix,
+						int pass, int n)
+{
+	std::ostringstream filename_stream;
+	filename_stream << path_prefix << "/run_p" <<
+		std::hex <<  std::setw(2) << std::setfill('0') << pass <<
+		"_" << std::setw(4) << n; //"%s/run_p%02x_%04x"
+	return filename_stream.str();
+}
+
+void MultiPassMerger::mergeRuns(const std::vector<std::string>& inputs,
+			const std::string& output, size_t max_memory)
+{
+	const size_t BLOCK_SIZE = 1<<16; // triples
+
+	LoserTreeRunMerger merger(inputs, max_memory);
+
+	std::ofstream out;
+	// Turn on exception reporting for file operations
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(output.c_str(), std::ios::binary | std::ios::out);
+	out.rdbuf()->pubsetbuf(0, 0); // unbuffering out - we write blocks
+
+	std::vector<run_triple> block(BLOCK_SIZE);
+	RunIndex index;
+	size_t n;
+	while( (n = merger.getBlock(&block[0], block.size())) > 0) {
+		out.write( (char*) &block[0], n * sizeof(run_triple));
+		index.add(&block[0], &block[0] + n);
+	}
+	index.write(output);
+}
+
+const std::vector<std::string>& MultiPassMerger::reduce()
+{
+	while (runs.size() > final_fan_in) {
+		time_t start = time(NULL);
+		++n_passes;
+
+		// Split runs evenly in as few batches as possible
+		size_t n_batches = (runs.size() + fan_in - 1) / fan_in;
+		std::vector< std::vector<std::string> > batches(n_batches);
+		std::vector<std::string> outputs;
+		for(size_t b = 0; b < n_batches; ++b) {
+			size_t first = b * runs.size() / n_batches;
+			size_t last = (b + 1) * runs.size() / n_batches;
+			batches[b].assign(runs.begin() + first,
+					  runs.begin() + last);
+			outputs.push_back(make_pass_run_filename(run_dir,
+							n_passes, b));
+		}
+
+		// Merge the batches concurrently
+		size_t n_workers = std::min(size_t(n_threads), n_batches);
+		MergePass pass(batches, outputs, max_memory / n_workers);
+		std::vector<MergeThread*> workers;
+		for(size_t t = 0; t < n_workers; ++t) {
+			workers.push_back(new MergeThread(pass));
+			workers.back()->start();
+		}
+		for(size_t t = 0; t < n_workers; ++t) {
+			workers[t]->join();
+			delete workers[t];
+		}
+		if (! pass.error.empty()) {
+			removeRuns(outputs);
+			throw std::runtime_error("Merge pass failed: " +
+						pass.error);
+		}
+
+		// Runs created by previous passes are no longer needed
+		if (intermediate) {
+			removeRuns(runs);
+		}
+
+		std::cout << "Pass " << n_passes << ": merged " <<
+			runs.size() << " runs into " << outputs.size() <<
+			" (fan-in " << fan_in << ", " << n_workers <<
+			" threads) in " << time(NULL) - start << "s" <<
+			std::endl;
+
+		runs = outputs;
+		intermediate = true;
+	}
+
+	return runs;
+}
+
+void MultiPassMerger::cleanup()
+{
+	if (intermediate) {
+		removeRuns(runs);
+		runs.clear();
+		intermediate = false;
+	}
+}
 
 
 /***********************************************************************
@@ -10,7 +365,7 @@
  ***********************************************************************/
 
 BaseInvertedFileDumper::BaseInvertedFileDumper(std::string output_path,
-		RunMerger& m, size_t _max_data_size, size_t header_reserve)
+		AbstractRunMerger& m, size_t _max_data_size, size_t header_reserve)
 : output_dir(output_path),
   merger(m),
   n_index(0),
@@ -18,7 +373,8 @@ BaseInvertedFileDumper::BaseInvertedFileDumper(std::string output_path,
   hdr_file(std::string(output_path + "/index.hdr").c_str(),
   		std::ios::binary | std::ios::out),
   data_file( mk_data_filename(output_path,n_index).c_str(),
-  		std::ios::binary | std::ios::out)
+  		std::ios::binary | std::ios::out),
+  positional(false)
 {
 	// Turn on exceptions
 	hdr_file.exceptions( std::ios_base::badbit|
@@ -39,21 +395,68 @@ std::string BaseInvertedFileDumper::mk_data_filename(std::string path_prefix, in
 	return filename_stream.str();
 }
 
-void BaseInvertedFileDumper::dump()
+std::string BaseInvertedFileDumper::mk_positions_filename(
+					std::string path_prefix, int n)
 {
-	uint32_t term = 0; // Terms start couting on 0
+	std::ostringstream filename_stream;
+	filename_stream << path_prefix << "/index.pos_" <<
+		std::hex <<  std::setw(4) << std::setfill('0') <<
+		n; //"%s/index.pos_%04x"
+	return filename_stream.str();
+}
+
+void BaseInvertedFileDumper::enablePositions()
+{
+	positional = true;
+	pos_file.exceptions( std::ios_base::badbit|
+				std::ios_base::failbit);
+	pos_file.open(mk_positions_filename(output_dir, n_index).c_str(),
+			std::ios::binary | std::ios::out);
+	pos_header_data.reserve(header_data.capacity());
+}
+
+void BaseInvertedFileDumper::dump(uint32_t first_term)
+{
+	uint32_t term = first_term; // Terms start couting on 0
 	run_triple tdf;
 	uint32_t tf = 0; // # documents with a given term
-	inverted_list_t ilist;
 
-	while( !merger.eof() ) {
-		tdf = merger.getNext();
+	// Positions of the last posting still to be read from the runs
+	uint32_t pending = 0;
+	RunPositions::Decoder decoder;
+	uint32_t position;
+
+	ilist.clear();
+	positions.clear();
+
+	std::vector<run_triple> block(MERGE_BLOCK_SIZE);
+	size_t n_triples;
+
+	while( (n_triples = merger.getBlock(&block[0], block.size())) > 0 ) {
+	    for(size_t i = 0; i < n_triples; ++i) {
+		tdf = block[i];
+
+		if (pending > 0) {
+			// A chunk of the last posting's positions
+			if (tdf.termid != term ||
+			    tdf.docid != ilist.back().first) {
+				throw std::runtime_error("Positions out of "
+							 "place in the runs");
+			}
+			if (decoder.add(tdf.freq, position)) {
+				positions.push_back(position);
+				--pending;
+			}
+			continue;
+		}
 
 		if (tdf.termid != term) {
 			// Gotta dump the list we have so far
 			storeTerm(term, tf,ilist);
-			// Clean things up for a new inverted list/term
+			// Clean things up for a new inverted list/term.
+			// Clearing keeps ilist's capacity.
 			ilist.clear();
+			positions.clear();
 			term = tdf.termid;
 			tf=0;
 		} 			
@@ -61,6 +464,15 @@ void BaseInvertedFileDumper::dump()
 		// Account this <doc,freq> pair
 		++tf;
 		ilist.push_back(d_fdt_t(tdf.docid, tdf.freq));
+
+		if (positional) {
+			pending = tdf.freq;
+			decoder.reset();
+		}
+	    }
+	}
+	if (pending > 0) {
+		throw std::runtime_error("Positions missing from the runs");
 	}
 
 	// Is there something left in ilist? If so, dump it too!
@@ -73,6 +485,22 @@ void BaseInvertedFileDumper::dump()
 	size_t len = header_data.size() * sizeof(hdr_entry_t);
 	hdr_file.write(	data, len);
 	hdr_file.flush();
+
+	if (positional) {
+		std::ofstream pos_hdr_file;
+		pos_hdr_file.exceptions( std::ios_base::badbit|
+					std::ios_base::failbit);
+		pos_hdr_file.open(mk_positions_hdr_filename(output_dir).c_str(),
+				std::ios::binary | std::ios::out);
+		if (! pos_header_data.empty()) {
+			pos_hdr_file.write((const char*) &pos_header_data[0],
+				pos_header_data.size() * sizeof(uint32_t));
+		}
+		pos_file.flush();
+	}
+
+	// ... and tell readers how to read the lists
+	InvertedListCodec::writeFormat(output_dir, getFormat());
 }
 
 
@@ -81,7 +509,9 @@ void BaseInvertedFileDumper::dump()
 void BaseInvertedFileDumper::rotateDataFile()
 {
 	// If the index file is too big it will be rotated
-	if (data_file.tellp() > max_data_size) {
+	const std::streamoff max_size = std::streamoff(max_data_size);
+	if (data_file.tellp() > max_size ||
+	    (positional && pos_file.tellp() > max_size)) {
 		data_file.close();
 		// New index file in the house!
 		++n_index; 
@@ -90,11 +520,18 @@ void BaseInvertedFileDumper::rotateDataFile()
 		// Turning exceptions - again... better safe then sorry
 		data_file.exceptions( std::ios_base::badbit|
 					std::ios_base::failbit);
+
+		if (positional) {
+			pos_file.close();
+			pos_file.open(mk_positions_filename(output_dir,
+							n_index).c_str(),
+				std::ios::binary | std::ios::out);
+		}
 	}
 }
 
 void BaseInvertedFileDumper::storeTerm(uint32_t termid, uint32_t doc_count,
-				const inverted_list_t& ilist)
+				const inverted_list_vec_t& ilist)
 {
 	// Always rotate before dumping
 	rotateDataFile();
@@ -105,16 +542,22 @@ void BaseInvertedFileDumper::storeTerm(uint32_t termid, uint32_t doc_count,
 
 	// write ilist do data file
 	dumpInvertedList(doc_count, ilist);
+
+	if (positional) {
+		pos_header_data.push_back(pos_file.tellp());
+		pos_buffer.clear();
+		PositionListCompressor::compress(ilist, positions, pos_buffer);
+		pos_file.write((const char*) &pos_buffer[0], pos_buffer.size());
+	}
 }
 
 
 void BaseInvertedFileDumper::dumpInvertedList(uint32_t tf,
-					const inverted_list_t& ilist)
+					const inverted_list_vec_t& ilist)
 {
-	inverted_list_vec_t list_dump(ilist.begin(), ilist.end());
-	assert(tf == list_dump.size());
+	assert(tf == ilist.size());
 
-	data_file.write( (char*) &list_dump[0], tf*sizeof(d_fdt_t));
+	data_file.write( (char*) &ilist[0], tf*sizeof(d_fdt_t));
 
 }
 
@@ -123,7 +566,7 @@ void BaseInvertedFileDumper::dumpInvertedList(uint32_t tf,
  ***********************************************************************/
 
 void ByteWiseCompressedInvertedFileDumper::dumpInvertedList(uint32_t tf,
-					const inverted_list_t& ilist)
+					const inverted_list_vec_t& ilist)
 {
 	// Clear previous invocations
 	out_buffer.clear();
@@ -140,5 +583,362 @@ void ByteWiseCompressedInvertedFileDumper::dumpInvertedList(uint32_t tf,
 	data_file.write( (char*) &out_buffer[0], out_buffer.size());
 }
 
+/***********************************************************************
+		    StreamVByteCompressedInvertedFileDumper
+ ***********************************************************************/
+
+void StreamVByteCompressedInvertedFileDumper::dumpInvertedList(uint32_t tf,
+					const inverted_list_vec_t& ilist)
+{
+	assert(tf == ilist.size());
+
+	// Clear previous invocations, keeping the capacity
+	out_buffer.clear();
+
+	StreamVByteCompressor::compress(ilist,out_buffer);
+	if ( ! out_buffer.empty()) {
+		data_file.write( (char*) &out_buffer[0], out_buffer.size());
+	}
+}
+
+BaseInvertedFileDumper* make_inverted_file_dumper(
+			InvertedListCodec::format_t fmt,
+			std::string output_path, AbstractRunMerger& m,
+			size_t max_data_size, bool positional)
+{
+	BaseInvertedFileDumper* dumper = 0;
+
+	switch(fmt) {
+	case InvertedListCodec::RAW:
+		dumper = new BaseInvertedFileDumper(output_path, m,
+						max_data_size);
+		break;
+	case InvertedListCodec::BYTEWISE:
+		dumper = new ByteWiseCompressedInvertedFileDumper(output_path, m,
+						max_data_size);
+		break;
+	case InvertedListCodec::STREAMVBYTE:
+		dumper = new StreamVByteCompressedInvertedFileDumper(output_path,
+						m, max_data_size);
+		break;
+	default:
+		throw std::runtime_error("Unknown inverted list format");
+	}
+
+	if (positional) {
+		try {
+			dumper->enablePositions();
+		} catch(...) {
+			delete dumper;
+			throw;
+		}
+	}
+	return dumper;
+}
+
+/***********************************************************************
+			    PartitionedIndexBuilder
+ ***********************************************************************/
+
+namespace {
+	//! Builds the segment of a single term range.
+	class PartitionThread : public BaseThread {
+		PartitionedIndexBuilder& builder;
+		int partition;
+	public:
+		int n_data_files;
+		std::string error;
+
+		PartitionThread(PartitionedIndexBuilder& b, int p)
+		: BaseThread(), builder(b), partition(p), n_data_files(0),
+		  error()
+		{}
+
+		void* run()
+		{
+			try {
+				n_data_files = builder.buildPartition(partition);
+			} catch(std::exception& e) {
+				error = e.what();
+			}
+			return NULL;
+		}
+	};
+}
+
+PartitionedIndexBuilder::PartitionedIndexBuilder(
+			const std::vector<std::string>& runs,
+			std::string output_path, size_t _max_memory,
+			size_t _max_data_size, int n_partitions,
+			InvertedListCodec::format_t fmt, bool _positional,
+			size_t _block_size)
+: run_files(runs),
+  output_dir(output_path),
+  max_memory(_max_memory),
+  max_data_size(_max_data_size),
+  block_size(_block_size),
+  format(fmt),
+  positional(_positional),
+  bounds(splitTermSpace(runs, n_partitions))
+{}
+
+std::vector<uint64_t> PartitionedIndexBuilder::splitTermSpace(
+				const std::vector<std::string>& runs,
+				int n_partitions)
+{
+	// Every sample stands for the same number of triples, so the
+	// quantiles of all samples split the triples evenly.
+	std::vector<uint32_t> samples;
+	for(size_t i = 0; i < runs.size(); ++i) {
+		RunIndex index(runs[i]);
+		samples.insert(samples.end(), index.getSamples().begin(),
+				index.getSamples().end());
+	}
+	std::sort(samples.begin(), samples.end());
+
+	std::vector<uint64_t> b;
+	b.push_back(0);
+	for(int p = 1; p < n_partitions && !samples.empty(); ++p) {
+		uint64_t bound = samples[p * samples.size() / n_partitions];
+		// Very frequent terms may take several quantiles
+		if (bound > b.back()) {
+			b.push_back(bound);
+		}
+	}
+	b.push_back(1ULL << 32);
+
+	return b;
+}
+
+std::string PartitionedIndexBuilder::make_partition_dirname(
+				std::string path_prefix, int p)
+{
+	std::ostringstream dirname_stream;
+	dirname_stream << path_prefix << "/part_" <<
+		std::hex <<  std::setw(2) << std::setfill('0') <<
+		p; //"%s/part_%02x"
+	return dirname_stream.str();
+}
+
+BaseInvertedFileDumper* PartitionedIndexBuilder::makeDumper(
+				const std::string& path, AbstractRunMerger& m)
+{
+	return make_inverted_file_dumper(format, path, m, max_data_size,
+					positional);
+}
+
+int PartitionedIndexBuilder::buildPartition(int p)
+{
+	std::string dir = make_partition_dirname(output_dir, p);
+	if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+		throw ErrnoSysException("Error creating " + dir);
+	}
+
+	LoserTreeRunMerger merger(run_files, bounds[p], bounds[p + 1],
+					max_memory / getNPartitions(), true,
+					block_size);
+	std::auto_ptr<BaseInvertedFileDumper> dumper(makeDumper(dir, merger));
+	dumper->dump(bounds[p]);
+
+	return dumper->getNDataFiles();
+}
+
+void PartitionedIndexBuilder::build()
+{
+	const int n_partitions = getNPartitions();
+
+	std::vector<PartitionThread*> workers;
+	for(int p = 0; p < n_partitions; ++p) {
+		workers.push_back(new PartitionThread(*this, p));
+		workers.back()->start();
+	}
+
+	std::string error;
+	std::vector<int> n_data_files;
+	for(int p = 0; p < n_partitions; ++p) {
+		workers[p]->join();
+		if (error.empty()) {
+			error = workers[p]->error;
+		}
+		n_data_files.push_back(workers[p]->n_data_files);
+		delete workers[p];
+	}
+	if (! error.empty()) {
+		throw std::runtime_error("Partitioned merge failed: " + error);
+	}
+
+	stitch(n_data_files);
+}
+
+void PartitionedIndexBuilder::stitch(const std::vector<int>& n_data_files)
+{
+	std::ofstream hdr_file;
+	hdr_file.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	hdr_file.open(std::string(output_dir + "/index.hdr").c_str(),
+			std::ios::binary | std::ios::out);
+
+	std::ofstream pos_hdr_file;
+	if (positional) {
+		pos_hdr_file.exceptions( std::ios_base::badbit|
+					std::ios_base::failbit);
+		pos_hdr_file.open(BaseInvertedFileDumper::
+				mk_positions_hdr_filename(output_dir).c_str(),
+				std::ios::binary | std::ios::out);
+	}
+
+	int base = 0; // Global number of the segment's first data file
+	std::vector<hdr_entry_t> entries;
+	for(size_t p = 0; p < n_data_files.size(); ++p) {
+		std::string dir = make_partition_dirname(output_dir, p);
+
+		// hdr_entry_t::fileno is just a byte
+		if (base + n_data_files[p] > 256) {
+			throw std::runtime_error("Too many data files");
+		}
+
+		for(int i = 0; i < n_data_files[p]; ++i) {
+			std::string from =
+				BaseInvertedFileDumper::mk_data_filename(dir, i);
+			std::string to = BaseInvertedFileDumper::mk_data_filename(
+						output_dir, base + i);
+			if (rename(from.c_str(), to.c_str()) != 0) {
+				throw ErrnoSysException("Error renaming " +
+							from);
+			}
+
+			if (! positional) {
+				continue;
+			}
+			from = BaseInvertedFileDumper::mk_positions_filename(
+						dir, i);
+			to = BaseInvertedFileDumper::mk_positions_filename(
+						output_dir, base + i);
+			if (rename(from.c_str(), to.c_str()) != 0) {
+				throw ErrnoSysException("Error renaming " +
+							from);
+			}
+		}
+
+		// Positions offsets are relative to their own file: the
+		// segment's positions header can be copied as it is
+		if (positional) {
+			std::string pos_hdr_name = BaseInvertedFileDumper::
+					mk_positions_hdr_filename(dir);
+			std::ifstream pos_in(pos_hdr_name.c_str(),
+					std::ios::binary | std::ios::in);
+			if (! pos_in) {
+				throw std::runtime_error("Error opening " +
+							pos_hdr_name);
+			}
+			if (pos_in.peek() != EOF) {
+				pos_hdr_file << pos_in.rdbuf();
+			}
+			pos_in.close();
+			unlink(pos_hdr_name.c_str());
+		}
+
+		std::string hdr_name = dir + "/index.hdr";
+		std::ifstream in(hdr_name.c_str(),
+				 std::ios::binary | std::ios::in);
+		if (! in) {
+			throw std::runtime_error("Error opening " + hdr_name);
+		}
+		in.seekg(0, std::ios::end);
+		entries.resize(in.tellg() / std::streamoff(sizeof(hdr_entry_t)));
+		in.seekg(0, std::ios::beg);
+		if (! entries.empty()) {
+			in.read((char*) &entries[0],
+				entries.size() * sizeof(hdr_entry_t));
+		}
+		if (! in) {
+			throw std::runtime_error("Error reading " + hdr_name);
+		}
+
+		for(size_t e = 0; e < entries.size(); ++e) {
+			entries[e].fileno += base;
+		}
+		if (! entries.empty()) {
+			hdr_file.write((const char*) &entries[0],
+				       entries.size() * sizeof(hdr_entry_t));
+		}
+
+		unlink(hdr_name.c_str());
+		unlink(std::string(dir + "/index.fmt").c_str());
+		rmdir(dir.c_str());
+		base += n_data_files[p];
+	}
+
+	InvertedListCodec::writeFormat(output_dir, format);
+}
+
+
+/***********************************************************************
+			      MappedInvertedFile
+ ***********************************************************************/
+
+MappedInvertedFile::MappedInvertedFile(const std::string& path, load_t load,
+					bool huge_pages,
+					mk_filename_fn mk_filename)
+: data_files()
+{
+	try {
+		for(int n = 0; ; ++n) {
+			std::string name = mk_filename(path, n);
+			if (access(name.c_str(), R_OK) != 0) {
+				break;
+			}
+
+			data_files.push_back(0);
+			data_files.back() = new MMapedFile(name,
+							   load == POPULATE);
+			MMapedFile& data = *data_files.back();
+#ifdef MADV_HUGEPAGE
+			if (huge_pages) {
+				// Best effort: not every filesystem can
+				if (madvise((void*) data.getBuf().start,
+					    data.getBuf().len(),
+					    MMapedFile::hugepage) != 0) {
+					huge_pages = false;
+				}
+			}
+#endif
+			if (load == WILLNEED) {
+				data.advise(MMapedFile::willneed);
+			}
+		}
+	} catch(...) {
+		for(size_t i = 0; i < data_files.size(); ++i) {
+			delete data_files[i];
+		}
+		throw;
+	}
+}
+
+MappedInvertedFile::~MappedInvertedFile()
+{
+	for(size_t i = 0; i < data_files.size(); ++i) {
+		delete data_files[i];
+	}
+}
+
+/***********************************************************************
+			      MappedPositionsFile
+ ***********************************************************************/
+
+bool MappedPositionsFile::exists(const std::string& path)
+{
+	std::string name =
+		BaseInvertedFileDumper::mk_positions_hdr_filename(path);
+	return access(name.c_str(), R_OK) == 0;
+}
+
+MappedPositionsFile::MappedPositionsFile(const std::string& path,
+				MappedInvertedFile::load_t load)
+: hdr_file(BaseInvertedFileDumper::mk_positions_hdr_filename(path)),
+  offsets((const uint32_t*) hdr_file.getBuf().start),
+  n_terms(hdr_file.getBuf().len() / sizeof(uint32_t)),
+  pos_files(path, load, false,
+	    BaseInvertedFileDumper::mk_positions_filename)
+{}
 
 // EOF
@@ -11,6 +11,7 @@
 
 #include <queue>
 #include <vector>
+#include <stdexcept>
 
 
 /***********************************************************************
@@ -47,6 +48,34 @@ struct hdr_entry_t {
 	{}
 } __attribute__((packed));
 
+/***********************************************************************
+			       AbstractRunMerger
+ ***********************************************************************/
+
+/**Interface shared by all run mergers.
+ *
+ * Run mergers yield, in run_triple::operator< order, all the triples
+ * stored in a set of runs. Consumers should prefer getBlock(), that
+ * amortizes the cost of the virtual call over many triples.
+ */
+class AbstractRunMerger {
+public:
+	virtual ~AbstractRunMerger() {}
+
+	//! Are all runs exhausted?
+	virtual bool eof() const = 0;
+
+	/**Get the next smallest triples availiable in all runs.
+	 *
+	 * @param[out] out Where the triples will be stored.
+	 * @param max_triples Maximum number of triples to be stored in @p out.
+	 *
+	 * @return The number of triples stored in @p out. Zero means all the
+	 * 	   runs were exhausted.
+	 */
+	virtual size_t getBlock(run_triple* out, size_t max_triples) = 0;
+};
+
 /***********************************************************************
 				   RunMerger
  ***********************************************************************/
@@ -83,7 +112,7 @@ struct hdr_entry_t {
  *  - Adding the run reader back to the priority_queue if it non-empty.
  *
  */
-class RunMerger {
+class RunMerger : public AbstractRunMerger {
 
 	int n_runs;		//!< Number of runs that will be merged
 	size_t mem_per_run;	//!< Max memory allocated per run reader
@@ -145,6 +174,15 @@ public:
 
 	inline bool eof() const {return run_merger.empty();}
 
+	size_t getBlock(run_triple* out, size_t max_triples)
+	{
+		size_t n = 0;
+		while(n < max_triples && !eof()) {
+			out[n++] = getNext();
+		}
+		return n;
+	}
+
 	/**Get the next smallest triple availiable in all runs.
 	 *
 	 * This functio will  advance the reading position of the merger.
@@ -202,6 +240,278 @@ public:
 
 };
 
+/***********************************************************************
+			       LoserTreeRunMerger
+ ***********************************************************************/
+
+/**Run merger based on a tournament tree of losers.
+ *
+ * RunMerger keeps its (virtual) run readers in a priority_queue, so each
+ * triple costs a pop and a push - about 2 log(k) comparisons for k runs -
+ * plus a handful of virtual calls. Here the runs are the leaves of a
+ * tournament tree where each internal node remembers the @e loser of the
+ * match played there, and the root remembers the overall winner. After
+ * the winner's run advances only the matches in its leaf-to-root path
+ * are replayed, against the stored losers: exactly log(k) comparisons
+ * and no virtual call. Readers are BatchRunReader instances, refilled a
+ * block at a time.
+ *
+ * Triples come out in run_triple::operator< order, just as with
+ * RunMerger. Ties are won by the run with the smallest number.
+ *
+ * See Knuth, TAOCP vol. 3, sec. 5.4.1.
+ */
+class LoserTreeRunMerger : public AbstractRunMerger {
+	ReadAheadThread* io;		//!< Background reader, if any
+	std::vector<BatchRunReader*> runs; //!< The leaves of the tree
+	std::vector<uint64_t> keys;	/**< Sort key of each run's head, so
+					 *   matches don't have to touch the
+					 *   readers at all.
+					 */
+	int k;				//!< Number of runs
+	std::vector<int> tree;		/**< tree[0] is the winner's run,
+					 *   tree[1..k-1] are the losers of
+					 *   each match.
+					 */
+	uint64_t first_term;		//!< Smallest termid to be merged
+	uint64_t end_term;		//!< Termids from here on are ignored
+
+	//! Not Default Constructible.
+	LoserTreeRunMerger();
+
+	//! Prevent Copying and assignment.
+	LoserTreeRunMerger(const LoserTreeRunMerger& );
+
+	//! Prevent Copying and assignment.
+	LoserTreeRunMerger& operator=(const LoserTreeRunMerger&);
+
+	//! Key of exhausted runs. Only a <max, max> triple shares it.
+	static const uint64_t EXHAUSTED = ~uint64_t(0);
+
+	/**Sort key of a run's head.
+	 *
+	 * Comparing keys is the same as comparing triples with
+	 * run_triple::operator<.
+	 */
+	inline uint64_t headKey(int run) const
+	{
+		if (exhausted(run)) {
+			return EXHAUSTED;
+		}
+		const BatchRunReader* r = runs[run];
+		return (uint64_t(r->head().termid) << 32) | r->head().docid;
+	}
+
+	//! Has run @p run nothing left in the term range?
+	inline bool exhausted(int run) const
+	{
+		const BatchRunReader* r = runs[run];
+		return r->eof() || r->head().termid >= end_term;
+	}
+
+	/**Does run @p a beat run @p b?
+	 *
+	 * Exhausted runs lose to anyone.
+	 */
+	inline bool beats(int a, int b) const
+	{
+		uint64_t ka = keys[a];
+		uint64_t kb = keys[b];
+
+		if (ka != kb) {
+			return ka < kb;
+		} else if (ka == EXHAUSTED) {
+			if (exhausted(a)) {
+				return false;
+			} else if (exhausted(b)) {
+				return true;
+			}
+		}
+		return a < b;
+	}
+
+	//! Open the runs and play the initial tournament.
+	void init(const std::vector<std::string>& run_files,
+			size_t max_memory, bool read_ahead, size_t block_size);
+
+	//! Delete the run readers and stop the I/O thread.
+	void releaseRuns();
+
+	//! Play the matches of the subtree rooted in @p node.
+	//! @return the subtree's winner.
+	int build(int node);
+
+	//! Replay the matches from run @p w's leaf up to the root.
+	inline void replay(int w)
+	{
+		for(int node = (w + k) >> 1; node > 0; node >>= 1) {
+			if (beats(tree[node], w)) {
+				std::swap(tree[node], w);
+			}
+		}
+		tree[0] = w;
+	}
+
+public:
+	/**Constructor.
+	 *
+	 * @param n_runs Number of runs to merge.
+	 * @param run_store_dir Location of the runs.
+	 * @param max_memory Maximum memory to be distributed between all the
+	 * 		     run readers.
+	 * @param read_ahead Whether run blocks should be read in the
+	 * 		     background, by a dedicated I/O thread, while the
+	 * 		     previous ones are merged. Each reader then keeps
+	 * 		     two blocks in memory.
+	 * @param block_size Size in bytes of each run reader block. If 0,
+	 * 		     it is derived from @p max_memory.
+	 */
+	LoserTreeRunMerger(int n_runs, const char* run_store_dir,
+				size_t max_memory, bool read_ahead = true,
+				size_t block_size = 0);
+
+	/**Constructor.
+	 *
+	 * Merge an arbitrary list of run files.
+	 *
+	 * @param run_files The filenames of the runs to merge.
+	 *
+	 * Other parameters as above.
+	 */
+	LoserTreeRunMerger(const std::vector<std::string>& run_files,
+				size_t max_memory, bool read_ahead = true,
+				size_t block_size = 0);
+
+	/**Constructor.
+	 *
+	 * Merge only the triples with termid in <em>[first, end)</em>. Each
+	 * run's RunIndex is used to read just the needed part of it.
+	 *
+	 * @param first Smallest termid to be merged.
+	 * @param end   Termid past the last one to be merged.
+	 *
+	 * Other parameters as above.
+	 */
+	LoserTreeRunMerger(const std::vector<std::string>& run_files,
+				uint64_t first, uint64_t end,
+				size_t max_memory, bool read_ahead = true,
+				size_t block_size = 0);
+
+	~LoserTreeRunMerger();
+
+	/**Seconds spent waiting for run data so far, summed over all runs.
+	 *
+	 * With read-ahead enabled this is the time the merger was actually
+	 * stalled on I/O.
+	 */
+	double getStallTime() const;
+
+	inline bool eof() const
+	{
+		return k == 0 || (keys[tree[0]] == EXHAUSTED &&
+					exhausted(tree[0]));
+	}
+
+	/**Get the next smallest triple availiable in all runs.
+	 *
+	 * @warning Only valid if not eof().
+	 */
+	inline run_triple getNext()
+	{
+		int w = tree[0];
+		run_triple t = runs[w]->head();
+		runs[w]->advance();
+		keys[w] = headKey(w);
+		replay(w);
+		return t;
+	}
+
+	size_t getBlock(run_triple* out, size_t max_triples);
+};
+
+/***********************************************************************
+				MultiPassMerger
+ ***********************************************************************/
+
+/**Multi-pass merge planner.
+ *
+ * Merging hundreds of runs at once gives each run reader a tiny slice of
+ * the memory budget, and the merge degenerates into small, random reads.
+ * This class reduces the number of runs beforehand: runs are grouped in
+ * batches of at most fanIn() runs, and each batch is merged into a new,
+ * intermediate run. Batches of a pass are merged concurrently, by up to
+ * @c n_threads threads. Passes are repeated until no more than
+ * finalFanIn() runs are left, which are then merged by the caller
+ * straight into the inverted file.
+ *
+ * Fan-ins are chosen so that every run reader gets two (read-ahead)
+ * blocks of at least @c min_block_size bytes - @c final_readers of them
+ * per run in the final merge, if it is split in term ranges (see
+ * PartitionedIndexBuilder).
+ *
+ * Usage:
+ * @code
+ * MultiPassMerger planner(n_runs, run_dir, max_mem, n_threads);
+ * LoserTreeRunMerger merger(planner.reduce(), max_mem);
+ * dumper(output_dir, merger, ...).dump();
+ * planner.cleanup();
+ * @endcode
+ */
+class MultiPassMerger {
+	std::string run_dir;
+	size_t max_memory;
+	int n_threads;
+	size_t fan_in;		//!< Max runs per batch in intermediate passes
+	size_t final_fan_in;	//!< Max runs for the final merge
+	int n_passes;		//!< Intermediate passes done so far
+	std::vector<std::string> runs; //!< Current run files
+	bool intermediate;	//!< Are the current runs ours to delete?
+
+public:
+	/**Constructor.
+	 *
+	 * @param n_runs Number of runs created by the indexer.
+	 * @param run_store_dir Location of the runs. Intermediate runs are
+	 * 			created there too.
+	 * @param max_memory Total memory budget for run readers.
+	 * @param threads Max number of concurrent merges in a pass.
+	 * @param min_block_size Minimum size of a run reader block.
+	 * @param final_readers Number of readers of each run in the final
+	 * 			merge.
+	 */
+	MultiPassMerger(int n_runs, const char* run_store_dir,
+			size_t max_memory, int threads = 1,
+			size_t min_block_size = 1<<20, int final_readers = 1);
+
+	size_t fanIn() const { return fan_in; }
+	size_t finalFanIn() const { return final_fan_in; }
+	int getNPasses() const { return n_passes; }
+
+	/**Do as many intermediate passes as needed.
+	 *
+	 * Per-pass timings are reported in the standard output.
+	 *
+	 * @return The runs left to be merged. At most finalFanIn() runs.
+	 */
+	const std::vector<std::string>& reduce();
+
+	//! Remove the intermediate runs left by reduce(), if any.
+	void cleanup();
+
+	/**Merge a set of runs into a new run.
+	 *
+	 * @param inputs Runs to be merged.
+	 * @param output Filename of the resulting run.
+	 * @param max_memory Memory budget for the input readers.
+	 */
+	static void mergeRuns(const std::vector<std::string>& inputs,
+			const std::string& output, size_t max_memory);
+
+	//! Make the filename of the @p n-th run created in pass @p pass.
+	static std::string make_pass_run_filename(std::string path_prefix,
+						int pass, int n);
+};
+
 /***********************************************************************
 				BaseIndexDumper
  ***********************************************************************/
@@ -241,6 +551,14 @@ public:
  * 	too much troublesome for this assignment. For this reason, an index
  * 	file may be splitted in more then one data file.
  *
+ * - index.pos_xxxx and index.poshdr
+ *
+ * 	Only in positional inverted files, see enablePositions(). The
+ * 	positions of a term's postings, compressed by
+ * 	PositionListCompressor, are in the @c index.pos_xxxx file with the
+ * 	same number as the data file of its inverted list. @c index.poshdr
+ * 	holds, for each term, their position (uint32_t) in that file.
+ *
  * @warning This whole thing assume that all terms in the vocabulary appear at
  * 	    least once in the indexed documents and, thus, that all the terms
  * 	    in the vocabulary *will* appear and appear sequentially in ascening
@@ -249,10 +567,13 @@ public:
  */
 class BaseInvertedFileDumper {
 protected:
+	//! Number of triples requested from the merger at once
+	static const size_t MERGE_BLOCK_SIZE = 4096;
+
 	std::string output_dir;	/**< Output directory where inverted-file file's
 				 *   will be written.
 				 */
-	RunMerger& merger;	//!< The run merger
+	AbstractRunMerger& merger;	//!< The run merger
 	int n_index;		//!< Number of data files issued so far.
 	size_t max_data_size;	//!< A suggestion of how big a data file should be
 	std::vector<hdr_entry_t> header_data;	/**< Storage for header data.
@@ -262,13 +583,27 @@ protected:
 						 */
 	std::ofstream hdr_file;	//!< The inverted  list index writer
 	std::ofstream data_file;//!< Data file writer
+	inverted_list_vec_t ilist; /**< Postings of the term being dumped.
+				    *   Reused for every term, so it only
+				    *   allocates when a list longer than
+				    *   any previous one shows up.
+				    */
+
+	/**@name Positional inverted files.*/
+	//!@{
+	bool positional;	//!< Are we writing positions?
+	std::ofstream pos_file;	//!< Positions file writer
+	std::vector<uint32_t> pos_header_data; //!< Storage for index.poshdr
+	std::vector<uint32_t> positions; //!< Positions of the term's postings
+	PositionListCompressor::charvec_t pos_buffer;
+	//!@}
 public:
 	/**Constructor.
 	 *
 	 * @param output_path Output directory where inverted-file file's
 	 * 		      will be written.
 	 *
-	 * @param m	      A reference to a RunMerger instance ready to be
+	 * @param m	      A reference to a run merger instance ready to be
 	 * 		      used and already setup with all the runs need to
 	 * 		      create this inverted file.
 	 *
@@ -283,7 +618,7 @@ public:
 	 * 			 content is not written in a buffered fashion.
 	 *
 	 */
-	BaseInvertedFileDumper(std::string output_path, RunMerger& m,
+	BaseInvertedFileDumper(std::string output_path, AbstractRunMerger& m,
 			size_t _max_data_size, size_t header_reserve=1<<22);
 
 
@@ -291,16 +626,33 @@ public:
 	{
 		if( hdr_file.is_open() ) { hdr_file.flush(); hdr_file.close() ;}
 		if( data_file.is_open() ) { data_file.flush(); data_file.close() ;}
+		if( pos_file.is_open() ) { pos_file.flush(); pos_file.close() ;}
 	}
 
+	/**Write the positions of the postings too.
+	 *
+	 * The runs must be positional, see RunPositions. Call it before
+	 * dump().
+	 */
+	void enablePositions();
+
+
+	/**Generate the inverted index.
+	 *
+	 * @param first_term The termid of the first header entry. Only
+	 * 		     needed when the merger yields a term range that
+	 * 		     does not start at termid 0.
+	 */
+	void dump(uint32_t first_term = 0);
 
-	//! Generate the inverted index.
-	void dump();
+	//! Number of data files issued so far.
+	int getNDataFiles() const { return n_index + 1; }
 
 	/**Rotate index data files if needed.
 	 * 
 	 * This only happens if the current data file's length is greater than
-	 * max_data_size.
+	 * max_data_size. Positions files, if any, are rotated along, as do
+	 * data files whose positions file grows past max_data_size.
 	 *
 	 */
 	void rotateDataFile();
@@ -325,10 +677,18 @@ public:
 	 * @see rotateDataFile
 	 */
 	void storeTerm(uint32_t termid, uint32_t doc_count,
-			const inverted_list_t& ilist);
+			const inverted_list_vec_t& ilist);
 	
 	static std::string mk_data_filename(std::string path_prefix, int n);
 
+	static std::string mk_positions_filename(std::string path_prefix,
+						int n);
+
+	static std::string mk_positions_hdr_filename(std::string path_prefix)
+	{
+		return path_prefix + "/index.poshdr";
+	}
+
 	/**Dump a inverted list to disk.
 	 *
 	 * This method can be redefined in sub-classes to add compression
@@ -336,10 +696,19 @@ public:
 	 * just writes the inverted lists as <code>d_fdt_t[]</code> dumps.
 	 *
 	 * @param tf Number of entries in the inverted list.
-	 * @param list The inverted list.
+	 * @param ilist The inverted list.
 	 */
-	virtual void dumpInvertedList(uint32_t tf, const inverted_list_t& ilist);
+	virtual void dumpInvertedList(uint32_t tf,
+					const inverted_list_vec_t& ilist);
 
+	/**Format of the inverted lists written by dumpInvertedList.
+	 *
+	 * Recorded in @c index.fmt by dump().
+	 */
+	virtual InvertedListCodec::format_t getFormat() const
+	{
+		return InvertedListCodec::RAW;
+	}
 };
 
 /***********************************************************************
@@ -364,7 +733,7 @@ class ByteWiseCompressedInvertedFileDumper: public BaseInvertedFileDumper {
 public:
 
 	ByteWiseCompressedInvertedFileDumper(std::string output_path,
-			RunMerger& m, size_t _max_data_size,
+			AbstractRunMerger& m, size_t _max_data_size,
 			size_t header_reserve=1<<22)
 	: BaseInvertedFileDumper(output_path, m, _max_data_size,
 				header_reserve=1<<22)
@@ -374,10 +743,270 @@ public:
 	/**Dump an inverted list compressed using byte-wise coding to disk.
 	 *
 	 */
-	void dumpInvertedList(uint32_t tf, const inverted_list_t& ilist);
+	void dumpInvertedList(uint32_t tf, const inverted_list_vec_t& ilist);
+
+	InvertedListCodec::format_t getFormat() const
+	{
+		return InvertedListCodec::BYTEWISE;
+	}
+};
+
+/***********************************************************************
+		    StreamVByteCompressedInvertedFileDumper
+ ***********************************************************************/
+
+/**A index dumper that compresses its output in Stream-VByte blocks.
+ *
+ * Just like ByteWiseCompressedInvertedFileDumper, but lists are much
+ * faster to decode.
+ *
+ * @see StreamVByteCompressor
+ */
+class StreamVByteCompressedInvertedFileDumper: public BaseInvertedFileDumper {
+	StreamVByteCompressor::charvec_t out_buffer;
+public:
+
+	StreamVByteCompressedInvertedFileDumper(std::string output_path,
+			AbstractRunMerger& m, size_t _max_data_size,
+			size_t header_reserve=1<<22)
+	: BaseInvertedFileDumper(output_path, m, _max_data_size,
+				header_reserve)
+	{}
+
+	//! Dump an inverted list compressed in Stream-VByte blocks to disk.
+	void dumpInvertedList(uint32_t tf, const inverted_list_vec_t& ilist);
+
+	InvertedListCodec::format_t getFormat() const
+	{
+		return InvertedListCodec::STREAMVBYTE;
+	}
+};
+
+/**Create a dumper that writes inverted lists in format @p fmt.
+ *
+ * Parameters as in the BaseInvertedFileDumper constructor.
+ */
+BaseInvertedFileDumper* make_inverted_file_dumper(
+			InvertedListCodec::format_t fmt,
+			std::string output_path, AbstractRunMerger& m,
+			size_t max_data_size, bool positional = false);
+
+/***********************************************************************
+			    PartitionedIndexBuilder
+ ***********************************************************************/
+
+/**Builds an inverted file with several threads, one per term range.
+ *
+ * Since runs are sorted by termid, the termid space can be split in
+ * ranges that are merged and dumped independently. The ranges are the
+ * quantiles of the termid samples in the runs' RunIndex files, so each
+ * range holds about the same number of triples.
+ *
+ * Each range is merged from all the runs by its own thread, into a
+ * segment - an inverted file in a @c part_xx sub-directory of the output
+ * directory. Once all of them are done, segments are stitched together:
+ * their data files are renamed into the output directory, with a global
+ * numbering, and their headers are concatenated into a single
+ * @c index.hdr, with data file numbers rebased. Positions files and
+ * headers, if any, get the same treatment. The result is the very
+ * same inverted file a single BaseInvertedFileDumper would create.
+ *
+ * Subclasses may redefine makeDumper() to change the dumper used.
+ */
+class PartitionedIndexBuilder {
+protected:
+	std::vector<std::string> run_files;
+	std::string output_dir;
+	size_t max_memory;	//!< Memory budget for all run readers
+	size_t max_data_size;	//!< Data file size suggestion
+	size_t block_size;	//!< Run reader block size, or 0
+	InvertedListCodec::format_t format; //!< Format of the segments
+	bool positional;	//!< Do the segments have positions?
+	std::vector<uint64_t> bounds;	/**< Range @c i covers the termids
+					 *   in <em>[bounds[i],
+					 *   bounds[i+1])</em>.
+					 */
+
+	//! Stitch the segments in the output directory.
+	void stitch(const std::vector<int>& n_data_files);
+
+public:
+	/**Constructor.
+	 *
+	 * @param runs The runs to merge.
+	 * @param output_path Output directory of the inverted file.
+	 * @param max_memory Memory to be shared by all the run readers.
+	 * @param _max_data_size A suggestion of how big a data file should
+	 * 			 be.
+	 * @param n_partitions Number of term ranges. Fewer may be used if
+	 * 		       runs are too small to be split that much.
+	 * @param fmt Format of the inverted lists.
+	 * @param positional Are the runs positional? See
+	 * 		     BaseInvertedFileDumper::enablePositions().
+	 * @param block_size Size in bytes of each run reader block. If 0,
+	 * 		     it is derived from @p max_memory.
+	 */
+	PartitionedIndexBuilder(const std::vector<std::string>& runs,
+			std::string output_path, size_t max_memory,
+			size_t _max_data_size, int n_partitions,
+			InvertedListCodec::format_t fmt =
+				InvertedListCodec::BYTEWISE,
+			bool positional = false, size_t block_size = 0);
+
+	virtual ~PartitionedIndexBuilder() {}
+
+	//! Number of term ranges actually used.
+	int getNPartitions() const { return bounds.size() - 1; }
+
+	//! Term range boundaries. See @c bounds.
+	const std::vector<uint64_t>& getBounds() const { return bounds; }
+
+	//! Merge and dump all ranges, then stitch them.
+	void build();
+
+	//! Merge and dump range @p p into its segment.
+	//! @return the number of data files of the segment.
+	int buildPartition(int p);
+
+	//! Create the dumper for a segment.
+	virtual BaseInvertedFileDumper* makeDumper(const std::string& path,
+						AbstractRunMerger& m);
+
+	/**Split the termid space in about evenly loaded ranges.
+	 *
+	 * @return the @c bounds of at most @p n_partitions ranges. The
+	 * 	   first starts at 0 and the last one ends at 2^32.
+	 */
+	static std::vector<uint64_t> splitTermSpace(
+				const std::vector<std::string>& runs,
+				int n_partitions);
+
+	//! Make the directory name of the segment of range @p p.
+	static std::string make_partition_dirname(std::string path_prefix,
+						int p);
+};
+
+
+/***********************************************************************
+			      MappedInvertedFile
+ ***********************************************************************/
+
+/**The data files of an inverted file, mmaped once and for all.
+ *
+ * Query resolvers used to mmap a whole data file for each query term
+ * they looked up. This class maps all the data files of an inverted file
+ * when it is built, so getting to an inverted list is just a pointer
+ * offset.
+ *
+ * @see BaseInvertedFileDumper for the inverted file layout.
+ */
+class MappedInvertedFile {
+public:
+	//! How the data files are brought into memory.
+	enum load_t {
+		LAZY,		//!< On page faults, as lists are read
+		WILLNEED,	//!< Read ahead in the background
+		POPULATE	//!< Read in before the constructor returns
+	};
+
+	//! Makes the name of the n-th data file of an inverted file.
+	typedef std::string (*mk_filename_fn)(std::string path_prefix, int n);
+
+private:
+	std::vector<MMapedFile*> data_files;
+
+	//!This class is non-copyable
+	MappedInvertedFile(const MappedInvertedFile&);
+	//!This class is non-copyable
+	MappedInvertedFile& operator=(const MappedInvertedFile&);
+
+public:
+	/**Constructor.
+	 *
+	 * @param path Directory of the inverted file.
+	 * @param load How to bring the data files into memory.
+	 * @param huge_pages Ask for the mappings to be backed by huge
+	 * 		     pages. Ignored if the system can't do it.
+	 * @param mk_filename Names of the files to be mapped, the inverted
+	 * 		      lists' data files by default.
+	 */
+	MappedInvertedFile(const std::string& path, load_t load = WILLNEED,
+			bool huge_pages = true,
+			mk_filename_fn mk_filename =
+				BaseInvertedFileDumper::mk_data_filename);
+
+	~MappedInvertedFile();
+
+	//! Number of data files.
+	inline size_t getNDataFiles() const { return data_files.size(); }
+
+	/**The inverted list of a term.
+	 *
+	 * @param entry The term's entry in the inverted file header.
+	 *
+	 * @return A buffer starting at the term's inverted list and going
+	 * 	   up to the end of its data file.
+	 */
+	inline filebuf getList(const hdr_entry_t& entry) const
+	{
+		if (entry.fileno >= data_files.size()) {
+			throw std::out_of_range("Inverted list in a missing "
+						"data file");
+		}
+		filebuf list = data_files[entry.fileno]->getBuf();
+		list.read(entry.pos);
+		return list;
+	}
 };
 
 
+/***********************************************************************
+			      MappedPositionsFile
+ ***********************************************************************/
+
+/**The positions files of a positional inverted file, mmaped.
+ *
+ * Positions are only read for the few documents a phrase query
+ * verifies, so they are mapped lazily by default.
+ *
+ * @see BaseInvertedFileDumper::enablePositions
+ */
+class MappedPositionsFile {
+	MMapedFile hdr_file;
+	const uint32_t* offsets;	//!< index.poshdr
+	size_t n_terms;
+	MappedInvertedFile pos_files;
+
+	//!This class is non-copyable
+	MappedPositionsFile(const MappedPositionsFile&);
+	//!This class is non-copyable
+	MappedPositionsFile& operator=(const MappedPositionsFile&);
+
+public:
+	//! Does the inverted file in @p path have positions?
+	static bool exists(const std::string& path);
+
+	MappedPositionsFile(const std::string& path,
+		MappedInvertedFile::load_t load = MappedInvertedFile::LAZY);
+
+	/**The positions of the postings of a term.
+	 *
+	 * @param termid The term.
+	 * @param entry The term's entry in the inverted file header.
+	 *
+	 * @return A buffer starting at the term's positions, for
+	 * 	   PositionCursor::open(), and going up to the end of its
+	 * 	   positions file.
+	 */
+	inline filebuf getList(uint32_t termid, const hdr_entry_t& entry) const
+	{
+		if (termid >= n_terms) {
+			throw std::out_of_range("Term without positions");
+		}
+		hdr_entry_t pos_entry(entry.ft, offsets[termid], entry.fileno);
+		return pos_files.getList(pos_entry);
+	}
+};
 
 
 #endif // __MERGERUTILS_H__
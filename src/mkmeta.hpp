@@ -90,12 +90,13 @@ public:
 	TUrlTitle getMetaData(docid_t id)
 	{
 		// Unknown id?
-		if (metamap.find(id) == metamap.end()) {
+		TMetaMap::const_iterator entry = metamap.find(id);
+		if (entry == metamap.end()) {
 			return TUrlTitle();
 		}
 
 		// Open the data store for this entry and retrieve it
-		const meta_hdr_entry_t* hdr = metamap[id];
+		const meta_hdr_entry_t* hdr = entry->second;
 		std::string store_name = mk_isam_data_filename( path, 
 								name,
 								hdr->fileno);
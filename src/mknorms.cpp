@@ -8,6 +8,7 @@
 #include "isamutils.hpp"
 #include "crawlerutils.hpp"
 #include "vectorial.hpp"
+#include "topk.hpp"
 
 
 
@@ -17,6 +18,11 @@
  ***********************************************************************/
 
 struct InvertedFileDumper{
+	InvertedListCodec::format_t format;
+
+	InvertedFileDumper(InvertedListCodec::format_t fmt)
+	: format(fmt)
+	{}
 
 	inline void operator()(uint32_t tid, const hdr_entry_t* i_entry, filebuf data )
 	{
@@ -26,7 +32,7 @@ struct InvertedFileDumper{
 		inverted_list_vec_t ilist;
 		inverted_list_vec_t::const_iterator doc;
 
-		ByteWiseCompressor::decompress(i_entry->ft,data,ilist);
+		InvertedListCodec::decompress(format, i_entry->ft, data, ilist);
 		for(doc = ilist.begin(); doc != ilist.end(); ++doc){
 			std::cout << "<" << doc->first << "," << doc->second << "> ";
 		}
@@ -48,6 +54,7 @@ public:
 
 	uint32_t N; //!< Number of documents in the colection
 	wdmfdt_map_t& WdMfreq;
+	InvertedListCodec::format_t format; //!< Format of the inverted lists
 
 	/*
 	 *  Methods
@@ -56,15 +63,17 @@ public:
 	/**Constructor.
 	 *
 	 * @param N Number of documents in the collection.
+	 * @param fmt Format of the inverted lists.
 	 *
 	 */
-	GetNormsVisitor(uint32_t collention_size, wdmfdt_map_t& Wd_Mfdt)
-	: N(collention_size), WdMfreq(Wd_Mfdt)
+	GetNormsVisitor(uint32_t collention_size, wdmfdt_map_t& Wd_Mfdt,
+			InvertedListCodec::format_t fmt)
+	: N(collention_size), WdMfreq(Wd_Mfdt), format(fmt)
 	{}
 
 	//! Copy constructor
 	GetNormsVisitor(const GetNormsVisitor& other)
-	: N(other.N), WdMfreq(other.WdMfreq)
+	: N(other.N), WdMfreq(other.WdMfreq), format(other.format)
 	{}
 
 
@@ -77,7 +86,7 @@ public:
 		inverted_list_vec_t ilist;
 		inverted_list_vec_t::const_iterator doc;
 
-		ByteWiseCompressor::decompress(i_entry->ft,data,ilist);
+		InvertedListCodec::decompress(format, i_entry->ft, data, ilist);
 		for(doc = ilist.begin(); doc != ilist.end(); ++doc){
 			// Syntatic sugar
 			const uint32_t& d = doc->first;
@@ -105,6 +114,61 @@ public:
 	}
 };
 
+/**Computes the per-term max-score bounds used by WandTopKScorer.
+ *
+ * Must visit the inverted file after the norms are known.
+ */
+class MaxScoreVisitor{
+
+	//!Assignment operator doesn't make sense!
+	MaxScoreVisitor& operator=(const MaxScoreVisitor&);
+
+public:
+	uint32_t N; //!< Number of documents in the colection
+	wdmfdt_map_t& WdMfreq;
+	std::vector<double>& max_scores;
+	InvertedListCodec::format_t format; //!< Format of the inverted lists
+
+	MaxScoreVisitor(uint32_t collention_size, wdmfdt_map_t& Wd_Mfdt,
+			std::vector<double>& scores,
+			InvertedListCodec::format_t fmt)
+	: N(collention_size), WdMfreq(Wd_Mfdt), max_scores(scores),
+	  format(fmt)
+	{}
+
+	//! Copy constructor
+	MaxScoreVisitor(const MaxScoreVisitor& other)
+	: N(other.N), WdMfreq(other.WdMfreq), max_scores(other.max_scores),
+	  format(other.format)
+	{}
+
+	inline void operator()(uint32_t tid, const hdr_entry_t* i_entry, filebuf data )
+	{
+		double idf_t = log(double(N)/double(i_entry->ft));
+
+		inverted_list_vec_t ilist;
+		inverted_list_vec_t::const_iterator doc;
+
+		double max_score = 0.0;
+		InvertedListCodec::decompress(format, i_entry->ft, data, ilist);
+		for(doc = ilist.begin(); doc != ilist.end(); ++doc){
+			const wdmaxfdt_t& wf = WdMfreq[doc->first];
+
+			// Documents made only of terms in every document
+			// have no weight at all
+			if (wf.wd > 0.0) {
+				max_score = std::max(max_score,
+					term_doc_weight(doc->second, idf_t, wf));
+			}
+		}
+
+		if (max_scores.size() <= tid) {
+			max_scores.resize(tid + 1, 0.0);
+		}
+		max_scores[tid] = max_score;
+	}
+};
+
 
 
 void show_usage()
@@ -130,14 +194,32 @@ int main(int argc, char* argv[])
 
 	read_docid_list(docid_list, docids);
 	const uint32_t N = docids.size();
-	GetNormsVisitor visitor(N, WFMap);
+	GetNormsVisitor visitor(N, WFMap,
+				InvertedListCodec::readFormat(list_dir));
 
 	VisitIndexedStore<hdr_entry_t>(list_dir, "index", visitor);
 	visitor.finishWdCalc();
 
+	std::vector<double> max_scores;
+	MaxScoreVisitor max_score_visitor(N, WFMap, max_scores,
+					  visitor.format);
+	VisitIndexedStore<hdr_entry_t>(list_dir, "index", max_score_visitor);
+	write_max_scores(list_dir, max_scores);
+
 	uint32_t pos;
 	uint16_t fileno;
 	docid_vec_t::const_iterator d;
+
+	// Flat, docid-indexed, copy for the query resolvers
+	std::vector<wdmaxfdt_t> flat_norms;
+	for(d = docids.begin(); d != docids.end(); ++d){
+		if (flat_norms.size() <= *d) {
+			flat_norms.resize(*d + 1);
+		}
+		flat_norms[*d] = WFMap[*d];
+	}
+	NormTable::write(list_dir, flat_norms, N);
+
 	IndexedStoreOutputer<norm_hdr_entry_t> normout(list_dir, "norm", N);
 	for(d = docids.begin(); d != docids.end(); ++d){
 		filebuf out = normout.getDataOutputBuffer( sizeof(wdmaxfdt_t),
@@ -62,6 +62,26 @@ MMapedFile::MMapedFile(std::string filename)
 	buf = filebuf((const char*)mmap_start_pos, filesize);
 }
 
+MMapedFile::MMapedFile(std::string filename, bool populate)
+	: file(filename.c_str()), buf()
+{
+	size_t filesize = file.filesize();
+	int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	if (populate) {
+		flags |= MAP_POPULATE;
+	}
+#endif
+
+	void* mmap_start_pos = mmap(0, filesize, PROT_READ, flags,
+					file.getFileno(), 0);
+	if (mmap_start_pos == MAP_FAILED) {
+		 throw MMapedFileException("in mmap");
+	}
+
+	buf = filebuf((const char*)mmap_start_pos, filesize);
+}
+
 
 MMapedFile::MMapedFile(std::string filename, size_t length, off_t offset)
 	: file(filename.c_str()), buf()
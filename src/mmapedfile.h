@@ -104,9 +104,24 @@ private:
 public:
 	enum advice_t {
 		sequential = MADV_SEQUENTIAL,
-		random = MADV_RANDOM};
+		random = MADV_RANDOM,
+#ifdef MADV_HUGEPAGE
+		hugepage = MADV_HUGEPAGE,	//!< Back it with huge pages
+#endif
+		willneed = MADV_WILLNEED	//!< Start reading it in now
+	};
 
 	MMapedFile(std::string filename);
+
+	/**Constructor.
+	 *
+	 * @param filename Name of the file to mmap.
+	 *
+	 * @param populate If true, the whole file is read in before the
+	 * 		constructor returns (MAP_POPULATE), so no page faults
+	 * 		happen later on.
+	 */
+	MMapedFile(std::string filename, bool populate);
 	
 	/**Constructor.
 	 *
@@ -23,6 +23,7 @@
 #include <map>
 
 #include "queryvec_logic.hpp"
+#include "cacheutils.hpp"
 
 #include <valarray>
 
@@ -99,12 +100,7 @@ struct MatchLiOuputter {
 struct IndexHandler : public AbstractRequestHandler {
 	void process(HTTPClientHandler& req)
 	{
-		std::string response;
-		
-		response = http::mk_response_header();
-		response += "Hi /";
-
-		req.write(response);
+		req.respond("Hi /");
 	}
 };
 
@@ -121,7 +117,7 @@ struct CachedCrawledDataHandler : public AbstractRequestHandler {
 			/* Parse request */
 			BaseURLParser uri(req.uri);
 			std::vector<std::string> pathc = split(uri.path,"/");
-			if (pathc.size() < 1){
+			if (pathc.size() < 3){
 				throw NotFoundHTTPException();
 			}
 			uint32_t docid = fromString<uint32_t>(pathc[2]);
@@ -131,13 +127,12 @@ struct CachedCrawledDataHandler : public AbstractRequestHandler {
 			/* Prepare resonse */
 			std::string response;
 			std::string extra_hdr = "Content-Encoding: gzip" + http::CRLF;
-			response = http::mk_response_header("OK", 200, "text/html",
-					extra_hdr);
 			ManagedFilePtr file(name.c_str());
+			response = req.mkResponseHeader(file.filesize(),
+					"text/html", extra_hdr);
 
 			req.write(response);
-			sendfile( req.fd, file.getFileno(),
-					NULL, file.filesize());
+			req.sendFile(file.getFileno(), file.filesize());
 		} catch (ErrnoSysException& e) {
 			throw NotFoundHTTPException();
 		}
@@ -153,20 +148,38 @@ struct CachedCrawledDataHandler : public AbstractRequestHandler {
 struct PageRankQueryHandler : public AbstractRequestHandler {
 	typedef std::map<std::string, std::string> TQueryMap;
 
+	typedef BlockingQueue<VectorialQueryResolver*> resolver_pool_t;
+	typedef PooledItem<VectorialQueryResolver*> pooled_resolver_t;
+
 	std::string index_dir;
-	VectorialQueryResolver resolver;
-	vec_res_vec_t vs_matches;	//!< Vector-Space results
-	pr_res_vec_t matches;		//!< The result of a query
-	TPageRankMap pagerank;
 
-	TQueryMap _GET;
+	/**Query resolvers, one per HTTP worker.
+	 *
+	 * Resolvers keep per-query state, so each request borrows one.
+	 */
+	resolver_pool_t resolvers;
+	size_t n_resolvers;
+	TPageRankMap pagerank;
 	TMetaBase metabase;
 
+	//! Results fragments, by normalized query
+	LRUCache<std::string, std::string> result_cache;
+	CatholicShameMutex result_cache_lock;
+
+	//! Only one writeStats() can take all the resolvers at a time
+	CatholicShameMutex stats_lock;
+
 	PageRankQueryHandler(std::string dir)
 	: index_dir(dir),
-	  resolver(index_dir.c_str()),
-	  metabase(index_dir)
+	  resolvers(),
+	  n_resolvers(HTTP_WORKERS),
+	  metabase(index_dir),
+	  result_cache(RESULT_CACHE_SIZE),
+	  result_cache_lock(),
+	  stats_lock()
 	{
+		createResolvers();
+
 		// Load PageRank
 		MMapedFile prfile(index_dir + PAGERANK_HDR_SUFIX);
 		filebuf prdata = prfile.getBuf();
@@ -178,31 +191,45 @@ struct PageRankQueryHandler : public AbstractRequestHandler {
 		}
 	}
 
+	~PageRankQueryHandler()
+	{
+		deleteResolvers();
+	}
+
+	//! Open a resolver per HTTP worker, sharing the list cache budget.
+	void createResolvers()
+	{
+		size_t list_cache_size = LIST_CACHE_SIZE / n_resolvers;
+		for(size_t i = 0; i < n_resolvers; ++i) {
+			resolvers.put(new VectorialQueryResolver(
+						index_dir.c_str(), true,
+						list_cache_size));
+		}
+	}
+
+	void deleteResolvers()
+	{
+		for(size_t i = 0; i < n_resolvers; ++i) {
+			delete resolvers.get();
+		}
+	}
+
 	void process(HTTPClientHandler& req)
 	{
 		std::string results;
+		TQueryMap _GET;
 
 		BaseURLParser uri(req.uri);
-		parse_GET(uri.query);
-
-		matches.clear();
-		vs_matches.clear();
+		parse_GET(uri.query, _GET);
 
 		// Process Query
-		if (_GET["q"] != "") {
-			resolver.processQuery(_GET["q"],vs_matches);
-			combinePRandVSM(vs_matches, matches);
-			mkResultsFragment(matches,results);
+		std::string query = _GET["q"];
+		if (query != "") {
+			getResultsFragment(query, results);
 		}
 
 		// Make response page
-		std::string response = http::mk_response_header();
-
-		response += mkResultPage(results);
-
-
-		req.write(response);
-
+		req.respond(mkResultPage(query, results));
 	}
 
 	//!Combine Vector-Space and PageRank
@@ -226,7 +253,12 @@ struct PageRankQueryHandler : public AbstractRequestHandler {
 		for(size_t i = 0; i < n; ++i){
 			pagerank_res_t page(vs_result[i]);
 
-			float prval = pagerank[page.docid];
+			TPageRankMap::const_iterator pr_entry =
+						pagerank.find(page.docid);
+			float prval = 0.0;
+			if (pr_entry != pagerank.end()) {
+				prval = pr_entry->second;
+			}
 			vs[i] = page.similarity;
 			pr[i] = page.pagerank = prval;
 
@@ -255,11 +287,70 @@ struct PageRankQueryHandler : public AbstractRequestHandler {
 	}
 
 
-	void parse_GET(std::string query)
+	/**Get the results fragment of a query, from the cache if possible.
+	 *
+	 * Repeated queries are served without touching the index. The cache
+	 * isn't locked while the query is processed, so concurrent misses
+	 * of the same query may both compute it.
+	 */
+	void getResultsFragment(const std::string& query,
+				std::string& results)
 	{
-		typedef std::vector<std::string> strvec_t;
+		std::string key = VectorialQueryResolver::normalizeQuery(query);
+
+		{
+			AutoLock lock(result_cache_lock);
+			const std::string* cached = result_cache.find(key);
+			if (cached) {
+				results = *cached;
+				return;
+			}
+		}
+
+		vec_res_vec_t vs_matches;	// Vector-Space results
+		pr_res_vec_t matches;		// The result of the query
+		{
+			pooled_resolver_t resolver(resolvers);
+			resolver.item()->processQuery(query, vs_matches);
+		}
+		combinePRandVSM(vs_matches, matches);
+		mkResultsFragment(matches, results);
+
+		AutoLock lock(result_cache_lock);
+		result_cache.put(key, results, key.size() + results.size());
+	}
+
+	/**Write the caches' statistics.
+	 *
+	 * The list caches' are summed over all the resolvers, which are
+	 * taken out of the pool meanwhile.
+	 */
+	void writeStats(std::ostream& out)
+	{
+		CacheStats results;
+		{
+			AutoLock lock(result_cache_lock);
+			results = result_cache.getStats();
+		}
+
+		AutoLock lock(stats_lock);
+		std::vector<VectorialQueryResolver*> taken;
+		CacheStats lists;
+		for(size_t i = 0; i < n_resolvers; ++i) {
+			taken.push_back(resolvers.get());
+			lists += taken.back()->getListCacheStats();
+		}
+		for(size_t i = 0; i < taken.size(); ++i) {
+			resolvers.put(taken[i]);
+		}
+
+		write_cache_stats(out, "results", results);
+		write_cache_stats(out, "lists", lists);
+	}
 
-		_GET.clear();
+	static void parse_GET(std::string query, TQueryMap& _GET)
+	{
+		typedef std::vector<std::string> strvec_t;
 
 		strvec_t tuples = split(query,"&");
 		for(size_t i = 0; i < tuples.size(); ++i) {
@@ -311,14 +402,15 @@ struct PageRankQueryHandler : public AbstractRequestHandler {
 		return result;
 	}
 
-	std::string mkResultPage(std::string results = "")
+	std::string mkResultPage(const std::string& query,
+				 std::string results = "")
 	{
 		std::string title;
 		std::string q_val;
 
-		if (_GET["q"] != "") {
-			title = "Busca por \"" + _GET["q"] + "\" - ";
-			q_val = _GET["q"];
+		if (query != "") {
+			title = "Busca por \"" + query + "\" - ";
+			q_val = query;
 		}
 
 
@@ -367,6 +459,23 @@ struct PageRankQueryHandler : public AbstractRequestHandler {
 	}
 };
 
+//! Serves the query handler's caches statistics, as plain text.
+struct StatsHandler : public AbstractRequestHandler {
+	PageRankQueryHandler& handler;
+
+	StatsHandler(PageRankQueryHandler& h)
+	: handler(h)
+	{}
+
+	void process(HTTPClientHandler& req)
+	{
+		std::ostringstream out;
+		handler.writeStats(out);
+
+		req.respond(out.str(), "text/plain");
+	}
+};
+
 void show_usage()
 {
 	std::cout << 	"Usage:\t myserver store_dir index_dir\n"
@@ -389,9 +498,12 @@ int main(int argc, char* argv[])
 	std::string index_dir(argv[2]);
 
 	/* Setup server */
-	BaseHTTPServer server(SERVER_PORT);
+	ThreadedHTTPServer server(SERVER_PORT, HTTP_WORKERS);
 
-	server.putChild("", new PageRankQueryHandler(index_dir));
+	PageRankQueryHandler* query_handler =
+		new PageRankQueryHandler(index_dir);
+	server.putChild("", query_handler);
+	server.putChild("stats", new StatsHandler(*query_handler));
 	server.putChild( "source",
 		new StaticFileHandler("myserver.cpp", "text/plain"));
 	server.putChild( "err",
@@ -19,6 +19,7 @@
 #include <map>
 
 #include "queryvec_logic.hpp"
+#include "cacheutils.hpp"
 
 
 #include <iostream>
@@ -60,12 +61,7 @@ struct MatchLiOuputter {
 struct IndexHandler : public AbstractRequestHandler {
 	void process(HTTPClientHandler& req)
 	{
-		std::string response;
-		
-		response = http::mk_response_header();
-		response += "Hi /";
-
-		req.write(response);
+		req.respond("Hi /");
 	}
 };
 
@@ -82,7 +78,7 @@ struct CachedCrawledDataHandler : public AbstractRequestHandler {
 			/* Parse request */
 			BaseURLParser uri(req.uri);
 			std::vector<std::string> pathc = split(uri.path,"/");
-			if (pathc.size() < 1){
+			if (pathc.size() < 3){
 				throw NotFoundHTTPException();
 			}
 			uint32_t docid = fromString<uint32_t>(pathc[2]);
@@ -92,13 +88,12 @@ struct CachedCrawledDataHandler : public AbstractRequestHandler {
 			/* Prepare resonse */
 			std::string response;
 			std::string extra_hdr = "Content-Encoding: gzip" + http::CRLF;
-			response = http::mk_response_header("OK", 200, "text/html",
-					extra_hdr);
 			ManagedFilePtr file(name.c_str());
+			response = req.mkResponseHeader(file.filesize(),
+					"text/html", extra_hdr);
 
 			req.write(response);
-			sendfile( req.fd, file.getFileno(),
-					NULL, file.filesize());
+			req.sendFile(file.getFileno(), file.filesize());
 		} catch (ErrnoSysException& e) {
 			throw NotFoundHTTPException();
 		}
@@ -109,43 +104,141 @@ struct CachedCrawledDataHandler : public AbstractRequestHandler {
 struct VectorialQueryHandler : public AbstractRequestHandler {
 	typedef std::map<std::string, std::string> TQueryMap;
 
+	typedef BlockingQueue<VectorialQueryResolver*> resolver_pool_t;
+	typedef PooledItem<VectorialQueryResolver*> pooled_resolver_t;
+
 	std::string index_dir;
-	VectorialQueryResolver resolver;
-	vec_res_vec_t matches;
 
-	TQueryMap _GET;
+	/**Query resolvers, one per HTTP worker.
+	 *
+	 * Resolvers keep per-query state, so each request borrows one.
+	 */
+	resolver_pool_t resolvers;
+	size_t n_resolvers;
 	TMetaBase metabase;
 
+	//! Results fragments, by normalized query
+	LRUCache<std::string, std::string> result_cache;
+	CatholicShameMutex result_cache_lock;
+
+	//! Only one writeStats() can take all the resolvers at a time
+	CatholicShameMutex stats_lock;
+
 	VectorialQueryHandler(std::string dir)
 	: index_dir(dir),
-	  resolver(index_dir.c_str()),
-	  metabase(index_dir)
-	{}
+	  resolvers(),
+	  n_resolvers(HTTP_WORKERS),
+	  metabase(index_dir),
+	  result_cache(RESULT_CACHE_SIZE),
+	  result_cache_lock(),
+	  stats_lock()
+	{
+		createResolvers();
+	}
+
+	~VectorialQueryHandler()
+	{
+		deleteResolvers();
+	}
+
+	//! Open a resolver per HTTP worker, sharing the list cache budget.
+	void createResolvers()
+	{
+		size_t list_cache_size = LIST_CACHE_SIZE / n_resolvers;
+		for(size_t i = 0; i < n_resolvers; ++i) {
+			resolvers.put(new VectorialQueryResolver(
+						index_dir.c_str(), true,
+						list_cache_size));
+		}
+	}
+
+	void deleteResolvers()
+	{
+		for(size_t i = 0; i < n_resolvers; ++i) {
+			delete resolvers.get();
+		}
+	}
 
 	void process(HTTPClientHandler& req)
 	{
 		std::string results;
+		TQueryMap _GET;
 
 		BaseURLParser uri(req.uri);
-		parse_GET(uri.query);
+		parse_GET(uri.query, _GET);
 
-		matches.clear();
-		if (_GET["q"] != "") {
-			resolver.processQuery(_GET["q"],matches);
-			mkResultsFragment(matches,results);
+		// Process Query
+		std::string query = _GET["q"];
+		if (query != "") {
+			getResultsFragment(query, results);
 		}
 
-		std::string response = http::mk_response_header();
+		// Make response page
+		req.respond(mkResultPage(query, results));
+	}
 
-		response += mkResultPage(results);
 
+	/**Get the results fragment of a query, from the cache if possible.
+	 *
+	 * Repeated queries are served without touching the index. The cache
+	 * isn't locked while the query is processed, so concurrent misses
+	 * of the same query may both compute it.
+	 */
+	void getResultsFragment(const std::string& query,
+				std::string& results)
+	{
+		std::string key = VectorialQueryResolver::normalizeQuery(query);
+
+		{
+			AutoLock lock(result_cache_lock);
+			const std::string* cached = result_cache.find(key);
+			if (cached) {
+				results = *cached;
+				return;
+			}
+		}
 
-		req.write(response);
+		vec_res_vec_t matches;
+		{
+			pooled_resolver_t resolver(resolvers);
+			resolver.item()->processQueryTopK(query,
+						VECTORIAL_TOP_K, matches);
+		}
+		mkResultsFragment(matches, results);
 
+		AutoLock lock(result_cache_lock);
+		result_cache.put(key, results, key.size() + results.size());
 	}
 
+	/**Write the caches' statistics.
+	 *
+	 * The list caches' are summed over all the resolvers, which are
+	 * taken out of the pool meanwhile.
+	 */
+	void writeStats(std::ostream& out)
+	{
+		CacheStats results;
+		{
+			AutoLock lock(result_cache_lock);
+			results = result_cache.getStats();
+		}
+
+		AutoLock lock(stats_lock);
+		std::vector<VectorialQueryResolver*> taken;
+		CacheStats lists;
+		for(size_t i = 0; i < n_resolvers; ++i) {
+			taken.push_back(resolvers.get());
+			lists += taken.back()->getListCacheStats();
+		}
+		for(size_t i = 0; i < taken.size(); ++i) {
+			resolvers.put(taken[i]);
+		}
+
+		write_cache_stats(out, "results", results);
+		write_cache_stats(out, "lists", lists);
+	}
 
-	void parse_GET(std::string query)
+	static void parse_GET(std::string query, TQueryMap& _GET)
 	{
 		typedef std::vector<std::string> strvec_t;
 
@@ -199,14 +292,15 @@ struct VectorialQueryHandler : public AbstractRequestHandler {
 		return result;
 	}
 
-	std::string mkResultPage(std::string results = "")
+	std::string mkResultPage(const std::string& query,
+				 std::string results = "")
 	{
 		std::string title;
 		std::string q_val;
 
-		if (_GET["q"] != "") {
-			title = "Busca por \"" + _GET["q"] + "\" - ";
-			q_val = _GET["q"];
+		if (query != "") {
+			title = "Busca por \"" + query + "\" - ";
+			q_val = query;
 		}
 
 
@@ -239,7 +333,7 @@ struct VectorialQueryHandler : public AbstractRequestHandler {
 		if (matches.empty()) {
 			out << "No matches" << std::endl;
 		} else {
-			out << "# matches: " << matches.size() << "<br />\n"; 
+			out << "Top " << matches.size() << " matches<br />\n";
 			out << "<ol>";
 			MatchLiOuputter li(out, metabase);
 			std::for_each(matches.begin(),matches.end(),li);
@@ -250,6 +344,23 @@ struct VectorialQueryHandler : public AbstractRequestHandler {
 	}
 };
 
+//! Serves the query handler's caches statistics, as plain text.
+struct StatsHandler : public AbstractRequestHandler {
+	VectorialQueryHandler& handler;
+
+	StatsHandler(VectorialQueryHandler& h)
+	: handler(h)
+	{}
+
+	void process(HTTPClientHandler& req)
+	{
+		std::ostringstream out;
+		handler.writeStats(out);
+
+		req.respond(out.str(), "text/plain");
+	}
+};
+
 void show_usage()
 {
 	std::cout << 	"Usage:\t myserver store_dir index_dir\n"
@@ -272,9 +383,12 @@ int main(int argc, char* argv[])
 	std::string index_dir(argv[2]);
 
 	/* Setup server */
-	BaseHTTPServer server(SERVER_PORT);
+	ThreadedHTTPServer server(SERVER_PORT, HTTP_WORKERS);
 
-	server.putChild("", new VectorialQueryHandler(index_dir));
+	VectorialQueryHandler* query_handler =
+		new VectorialQueryHandler(index_dir);
+	server.putChild("", query_handler);
+	server.putChild("stats", new StatsHandler(*query_handler));
 	server.putChild( "source",
 		new StaticFileHandler("myserver.cpp", "text/plain"));
 	server.putChild( "err",
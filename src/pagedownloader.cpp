@@ -13,9 +13,15 @@ PageDownloader&  PageDownloader::get()
 
 PageDownloader&  PageDownloader::download()
 {
-	BaseURLParser original_url = url;
 	URLRetriever page(url.str());
 	page.go();
+
+	return readResponse(page);
+}
+
+PageDownloader&  PageDownloader::readResponse(URLRetriever& page)
+{
+	BaseURLParser original_url = url;
 	BaseURLParser redirected_url;
 
 	std::string ct; // Content-Type
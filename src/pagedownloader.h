@@ -143,6 +143,13 @@ public:
 
 	PageDownloader& download();
 
+	/**Take this page's contents and HTTP information from a finished
+	 * download.
+	 *
+	 * @throw NotHTMLException
+	 */
+	PageDownloader& readResponse(URLRetriever& page);
+
 	/**Does URL normalization and sanitization.
 	 *
 	 * Remove query and fragments from a URL.
@@ -37,18 +37,18 @@ void ParanoidAndroid::savePageAndMetadata(docid_t docid, PageDownloader& d)
 	data.close();
 }
 
-bool ParanoidAndroid::downloadRobots(const std::string& url, Domain* dom)
+bool ParanoidAndroid::processRobots(FetchJob& job)
 {
+	Domain* dom = job.robots_for;
 	assert(dom);
 
-	URLRetriever ret(url, false);
 	try {
-		ret.go();
-		filebuf robots_data = ret.getData();
+		job.retriever.finish(job.result);
+		filebuf robots_data = job.retriever.getData();
 		// Our robot-speak speking robot
 		RobotsParser r2d2(robots_data);
 		r2d2.parse();
-		dom->setRobotsRules(r2d2.getRules());
+		dom->setRobotsRules(r2d2.getRules(), r2d2.getCrawlDelay());
 	} catch(UndeterminedURLRetrieverException) {
 		// Well, we did our best to get the robots
 		// file. Let's just pretend we couldn't find one.
@@ -60,10 +60,12 @@ bool ParanoidAndroid::downloadRobots(const std::string& url, Domain* dom)
 	return true;
 }
 
-bool ParanoidAndroid::downloadPage(const std::string& url, docid_t docid)
+bool ParanoidAndroid::processPage(const std::string& url, docid_t docid,
+				URLRetriever& page)
 {
 	PageDownloader d(url);
-	d.get();
+	d.readResponse(page);
+	d.parse();
 	if (d.follow) {
 		manager.addPages(d.links);
 	}
@@ -73,61 +75,44 @@ bool ParanoidAndroid::downloadPage(const std::string& url, docid_t docid)
 	return true;
 }
 
-void* ParanoidAndroid::run()
+void ParanoidAndroid::process(FetchJob& job)
 {
-	bool successfuly_parsed;
-	bool is_a_robot_txt;
-	PageRef page;
-	Domain* dom;
-#define TRACE std::cout << t_id << " "; BEEN_HERE
-
-	while (manager.running) {
-		// Set defaults for this iteration
-		successfuly_parsed = false;
-		is_a_robot_txt = false;
-		dom = NULL;
-
-		try {
-			page = manager.popPage();
-		} catch (GetRobotsForMePlzException& e) {
-			is_a_robot_txt = true;
-			page = e.page;
-			dom = e.domain;
-		}
-		//TRACE;
-
-		std::string& url = page.first;
-		docid_t& docid = page.second;
-
-		if ( docid ) {	// cuz He can return None...
-			try {
-				if (is_a_robot_txt) {
-					successfuly_parsed=downloadRobots(url,
-							dom);
-				} else {
-					successfuly_parsed = downloadPage(url,
-							docid);
-				}
-			} catch (NotSupportedSchemeException) {
-				// Seems like we got redirected to a
-				// not-supported URL
-				manager.reportBadCrawling(docid, url,
-							"BAD REDIRECT ");
-				// FIXME We used to grab urlib2 errors...
-				// FIXME shouldn't we do the same for libcurl?
-			} catch (std::runtime_error& e) {
-				manager.reportBadCrawling(docid, url,e.what());
-			} catch (...) {
-				manager.reportBadCrawling(docid, url,
-							"UNKNOWN EXCEPTION");
-			}
-
-			// Report the we crawled this page
-			manager.incCrawled(successfuly_parsed, docid, url);
+	bool successfuly_parsed = false;
+
+	std::string& url = job.page.first;
+	docid_t& docid = job.page.second;
+
+	try {
+		if (job.isRobots()) {
+			successfuly_parsed = processRobots(job);
+		} else {
+			job.retriever.finish(job.result);
+			successfuly_parsed = processPage(url, docid,
+						job.retriever);
 		}
+	} catch (NotSupportedSchemeException) {
+		// Seems like we got redirected to a
+		// not-supported URL
+		manager.reportBadCrawling(docid, url, "BAD REDIRECT ");
+	} catch (std::runtime_error& e) {
+		manager.reportBadCrawling(docid, url,e.what());
+	} catch (...) {
+		manager.reportBadCrawling(docid, url, "UNKNOWN EXCEPTION");
+	}
+
+	// Report the we crawled this page
+	manager.incCrawled(successfuly_parsed, docid, url);
+}
+
+void* ParanoidAndroid::run()
+{
+	FetchJob* job;
+
+	while ( (job = engine.nextFetched()) ) {
+		process(*job);
+		engine.release(job);
 	}
 	return (void*)this;
-	//print currentThread(), "exiting..."
 }
 
 
@@ -11,8 +11,12 @@
 #include "threadingutils.h"
 #include "deepthought.h"
 #include "pagedownloader.h"
+#include "fetchengine.h"
 
 /**Our depressed crawling unit.
+ *
+ * Marvins no longer download anything themselves: they take the pages
+ * and robots.txt files FetchEngine downloaded, parse and store them.
  *
  * "Life? Don't talk about life!" - Marvin, our memorable Para. Andr.
  */
@@ -22,22 +26,30 @@ class ParanoidAndroid: public BaseThread{
 	 */
 	DeepThought& manager;
 
+	//! Where our downloads come from.
+	FetchEngine& engine;
+
 	//!Turn on exceptions and disables buffering
 	void setupOfstream(std::ostream& stream);
 	void savePageAndMetadata(docid_t docid, PageDownloader& d);
 
-	bool downloadPage(const std::string& url, docid_t docid);
+	bool processPage(const std::string& url, docid_t docid,
+			URLRetriever& page);
 
-	/**Try download a robots.txt file.
+	/**Process a downloaded robots.txt file.
 	 *
-	 * We ignore UndeterminedURLRetrieverException: probably
-	 * there was no robots.txt to download, anyway...
+	 * If the download failed, there probably was no robots.txt to
+	 * download, anyway... The domain gets no rules, but the error is
+	 * still reported.
 	 */
-	bool downloadRobots(const std::string& url, Domain* dom);
+	bool processRobots(FetchJob& job);
+
+	//! Process a finished download and report it to the manager.
+	void process(FetchJob& job);
 public:
 
-	ParanoidAndroid(DeepThought& manager):
-	BaseThread(), manager(manager) {}
+	ParanoidAndroid(DeepThought& manager, FetchEngine& engine):
+	BaseThread(), manager(manager), engine(engine) {}
 
 	void* run();
 };
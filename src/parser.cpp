@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "htmlscanner.h"
 #include <sstream>
 
 /* **********************************************************************
@@ -25,6 +26,10 @@ void BaseParser::consumeToken(const std::string& token)
 
 filebuf BaseParser::readUntilDelimiter(const std::string& delimiters)
 {
+	if (delimiters.size() == 1) {
+		return readUntilDelimiter(delimiters[0]);
+	}
+
 	int length = 0;
 	const char* data_start = text.current;
 
@@ -40,13 +45,12 @@ filebuf BaseParser::readUntilDelimiter(const std::string& delimiters)
 
 filebuf BaseParser::readUntilDelimiter(char delimiter)
 {
-	int length = 0;
 	const char* data_start = text.current;
+	const char* found = HTMLScanner::findChar(data_start, text.end,
+						delimiter);
+	int length = found - data_start;
 
-	while( (not text.eof()) and not (*text == delimiter) ) {
-		++text;
-		++length;
-	}
+	text.current = found;
         // Parsing restart after the end of this rule
 
 	// remember: data doesn't include the delimiter
@@ -56,12 +60,11 @@ filebuf BaseParser::readUntilDelimiter(char delimiter)
     
 filebuf BaseParser::readUntilDelimiterMark(const std::string& mark)
 {
-	std::string::size_type where = 0;
-	const std::string find_bitch(text.current, text.len());
 	filebuf data;
+	const char* found = HTMLScanner::findMark(text.current, text.end,
+						mark.data(), mark.size());
 
-        where = find_bitch.find(mark);
-        if (where == std::string::npos){
+        if (found == text.end && ! mark.empty()){
 		//Not found?
 			std::string msg ("While looking for delimiter mark '");
 			msg += mark;
@@ -70,6 +73,7 @@ filebuf BaseParser::readUntilDelimiterMark(const std::string& mark)
 
         } else {
 		// where == length of the text before the mark
+		size_t where = found - text.current;
 		data = filebuf(text.current, where);
 		// Parsing restart after the mark
 		text += where + mark.size();
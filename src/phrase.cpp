@@ -0,0 +1,205 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "phrase.hpp"
+#include "strmisc.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+
+/***********************************************************************
+				 Query parsing
+ ***********************************************************************/
+
+std::vector<std::string> split_query(const std::string& query)
+{
+	std::vector<std::string> words;
+	std::string word;
+	bool quoted = false;
+
+	for(size_t i = 0; i < query.size(); ++i) {
+		const char c = query[i];
+		if (c == '"') {
+			quoted = !quoted;
+		} else if (c == ' ' && !quoted) {
+			if (! word.empty()) {
+				words.push_back(word);
+				word.clear();
+			}
+			continue;
+		}
+		word += c;
+	}
+	if (! word.empty()) {
+		words.push_back(word);
+	}
+
+	return words;
+}
+
+void parse_phrase(const std::string& phrase, std::vector<std::string>& words,
+			uint32_t& slop)
+{
+	words.clear();
+	slop = 0;
+
+	if (! is_phrase(phrase)) {
+		throw std::runtime_error("Not a phrase: " + phrase);
+	}
+
+	// An unterminated phrase goes up to the end of the query
+	std::string::size_type close = phrase.find('"', 1);
+	std::string text = phrase.substr(1, close == std::string::npos ?
+						std::string::npos : close - 1);
+	if (close != std::string::npos && close + 1 < phrase.size()) {
+		std::string suffix = phrase.substr(close + 1);
+		if (suffix.size() < 2 || suffix[0] != '~' ||
+		    suffix.find_first_not_of("0123456789", 1) !=
+							std::string::npos) {
+			throw std::runtime_error("Malformed phrase: " + phrase);
+		}
+		slop = fromString<uint32_t>(suffix.substr(1));
+	}
+
+	std::vector<std::string> pieces = split(text, " ");
+	for(size_t i = 0; i < pieces.size(); ++i) {
+		if (! pieces[i].empty()) {
+			words.push_back(pieces[i]);
+		}
+	}
+	if (words.empty()) {
+		throw std::runtime_error("Empty phrase: " + phrase);
+	}
+}
+
+
+/***********************************************************************
+				 PhraseMatcher
+ ***********************************************************************/
+
+namespace {
+	//! Orders term indexes by the number of documents they appear in.
+	struct ByDocumentCount {
+		const std::vector<PostingCursor>& postings;
+
+		ByDocumentCount(const std::vector<PostingCursor>& p)
+		: postings(p)
+		{}
+
+		inline bool operator()(size_t a, size_t b) const
+		{
+			return postings[a].size() < postings[b].size();
+		}
+	};
+}
+
+PhraseMatcher::PhraseMatcher(const hdr_entry_t* idx,
+			InvertedListCodec::format_t fmt,
+			const MappedInvertedFile& data_files,
+			const MappedPositionsFile& pos_files)
+: idx(idx),
+  format(fmt),
+  data_files(data_files),
+  pos_files(pos_files),
+  postings(),
+  positions(),
+  term_positions(),
+  reach(),
+  next_reach()
+{}
+
+bool PhraseMatcher::matchPositions(size_t n, uint32_t slop)
+{
+	reach = term_positions[0];
+
+	// Keep the positions of each term that are at most slop + 1
+	// positions after a reachable position of the previous term.
+	for(size_t t = 1; t < n && !reach.empty(); ++t) {
+		const std::vector<uint32_t>& cur = term_positions[t];
+		std::vector<uint32_t>::const_iterator r = reach.begin();
+
+		next_reach.clear();
+		for(size_t i = 0; i < cur.size(); ++i) {
+			const uint32_t q = cur[i];
+			while (r != reach.end() && uint64_t(*r) + slop + 1 < q) {
+				++r;
+			}
+			if (r == reach.end()) {
+				break;
+			} else if (*r < q) {
+				next_reach.push_back(q);
+			}
+		}
+		reach.swap(next_reach);
+	}
+
+	return !reach.empty();
+}
+
+void PhraseMatcher::match(const std::vector<uint32_t>& termids, uint32_t slop,
+			std::vector<uint32_t>& docids,
+			std::vector<uint32_t>* freqs)
+{
+	const size_t n = termids.size();
+
+	docids.clear();
+	if (freqs) {
+		freqs->clear();
+	}
+	if (n == 0) {
+		return;
+	}
+
+	if (postings.size() < n) {
+		postings.resize(n);
+		positions.resize(n);
+		term_positions.resize(n);
+	}
+
+	std::vector<size_t> order(n);
+	for(size_t i = 0; i < n; ++i) {
+		const hdr_entry_t& entry = idx[termids[i]];
+		postings[i].open(format, entry.ft, data_files.getList(entry));
+		positions[i].open(entry.ft,
+				pos_files.getList(termids[i], entry));
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), ByDocumentCount(postings));
+
+	PostingCursor& lead = postings[order[0]];
+	while (! lead.eof()) {
+		const uint32_t doc = lead.docid();
+
+		// Leapfrog: every list must get to doc
+		size_t i;
+		for(i = 1; i < n; ++i) {
+			PostingCursor& other = postings[order[i]];
+			if (! other.nextGEQ(doc)) {
+				return;
+			} else if (other.docid() != doc) {
+				lead.nextGEQ(other.docid());
+				break;
+			}
+		}
+		if (i < n) {
+			continue;
+		}
+
+		// All the terms are in doc. Are they in the right places?
+		for(i = 0; i < n; ++i) {
+			positions[i].read(postings[i], term_positions[i]);
+		}
+		if (matchPositions(n, slop)) {
+			docids.push_back(doc);
+			if (freqs) {
+				for(i = 0; i < n; ++i) {
+					freqs->push_back(postings[i].freq());
+				}
+			}
+		}
+		lead.next();
+	}
+}
+
+
+// EOF
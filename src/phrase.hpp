@@ -0,0 +1,124 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __PHRASE_H__
+#define __PHRASE_H__
+/**@file phrase.hpp
+ * @brief Phrase and proximity queries over positional inverted files.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "mergerutils.hpp"
+#include "indexcompression.hpp"
+
+
+/***********************************************************************
+				 Query parsing
+ ***********************************************************************/
+
+/**Split a query in words, keeping phrases together.
+ *
+ * Words are separated by spaces, but a double-quoted phrase, with its
+ * quotes and whatever follows the closing quote, is a single word:
+ * @code
+ * split_query("a \"new york\"~2 b") -> ["a", "\"new york\"~2", "b"]
+ * @endcode
+ * Empty words are dropped.
+ */
+std::vector<std::string> split_query(const std::string& query);
+
+//! Is this query word a phrase? See split_query().
+inline bool is_phrase(const std::string& word)
+{
+	return !word.empty() && word[0] == '"';
+}
+
+/**Parse a phrase query word.
+ *
+ * A phrase is written as @c "w1 w2 ... wn" for an exact phrase or as
+ * @c "w1 w2 ... wn"~slop for a proximity query, where each word may be up
+ * to @c slop words away from the previous one. See PhraseMatcher.
+ *
+ * @param[out] words The phrase's words, as they are. Will be overwritten.
+ * @param[out] slop The phrase's slop, 0 if none.
+ *
+ * @throw std::runtime_error if the phrase is malformed.
+ */
+void parse_phrase(const std::string& phrase, std::vector<std::string>& words,
+			uint32_t& slop);
+
+
+/***********************************************************************
+				 PhraseMatcher
+ ***********************************************************************/
+
+/**Finds the documents where a phrase appears.
+ *
+ * The phrase's inverted lists are intersected first, leapfrogging with
+ * PostingCursor::nextGEQ() from the rarest one. Positions are only
+ * decoded for the documents with all the terms. A document matches if
+ * the terms appear in it in the phrase's order, each one at most
+ * <em>slop + 1</em> positions after the previous one: with @c slop 0 it
+ * must be right after it, an exact phrase.
+ *
+ * Query resolvers keep one around, so its buffers get reused from query
+ * to query.
+ *
+ * @see BaseInvertedFileDumper::enablePositions
+ */
+class PhraseMatcher {
+	const hdr_entry_t* idx;
+	InvertedListCodec::format_t format;
+	const MappedInvertedFile& data_files;
+	const MappedPositionsFile& pos_files;
+
+	/**@name Per phrase term state, reused between queries.*/
+	//!@{
+	std::vector<PostingCursor> postings;
+	std::vector<PositionCursor> positions;
+	std::vector<std::vector<uint32_t> > term_positions;
+	//!@}
+
+	//! Phrase starts reachable so far, for matchPositions().
+	std::vector<uint32_t> reach;
+	std::vector<uint32_t> next_reach;
+
+	//!This class is non-copyable
+	PhraseMatcher(const PhraseMatcher&);
+	//!This class is non-copyable
+	PhraseMatcher& operator=(const PhraseMatcher&);
+
+	//! Do the first @p n term_positions make a match?
+	bool matchPositions(size_t n, uint32_t slop);
+
+public:
+	/**Constructor.
+	 *
+	 * @param idx The inverted file header.
+	 * @param fmt Format of the inverted lists.
+	 */
+	PhraseMatcher(const hdr_entry_t* idx, InvertedListCodec::format_t fmt,
+			const MappedInvertedFile& data_files,
+			const MappedPositionsFile& pos_files);
+
+	/**Find the documents where a phrase appears.
+	 *
+	 * @param termids The phrase's terms, in order.
+	 * @param slop How far apart consecutive terms may be.
+	 * @param[out] docids The matching documents, sorted. Will be
+	 * 		      overwritten.
+	 * @param[out] freqs If not null, the frequency in each matching
+	 * 		     document of each of the phrase's terms:
+	 * 		     <em>termids.size()</em> entries per document.
+	 * 		     Will be overwritten.
+	 */
+	void match(const std::vector<uint32_t>& termids, uint32_t slop,
+			std::vector<uint32_t>& docids,
+			std::vector<uint32_t>* freqs = 0);
+};
+
+
+#endif // __PHRASE_H__
+
+//EOF
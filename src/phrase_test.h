@@ -0,0 +1,303 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __PHRASE_TEST_H
+#define __PHRASE_TEST_H
+
+#include "phrase.hpp"
+#include "indexerutils.hpp"
+#include "mergerutils.hpp"
+#include "mmapedfile.h"
+#include "cxxtest/TestSuite.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <memory>
+
+
+class PhraseParsingTestSuit : public CxxTest::TestSuite {
+public:
+	void testSplitQuery()
+	{
+		std::vector<std::string> words;
+
+		words = split_query("  a \"new york\"~2  b ");
+		TS_ASSERT_EQUALS(words.size(), 3U);
+		TS_ASSERT_EQUALS(words[0], "a");
+		TS_ASSERT_EQUALS(words[1], "\"new york\"~2");
+		TS_ASSERT_EQUALS(words[2], "b");
+
+		words = split_query("\"a b\"\"c d\" e*");
+		TS_ASSERT_EQUALS(words.size(), 2U);
+		TS_ASSERT_EQUALS(words[0], "\"a b\"\"c d\"");
+		TS_ASSERT_EQUALS(words[1], "e*");
+
+		TS_ASSERT(split_query("   ").empty());
+		TS_ASSERT(is_phrase("\"x\""));
+		TS_ASSERT(!is_phrase("x\""));
+	}
+
+	void testParsePhrase()
+	{
+		std::vector<std::string> words;
+		uint32_t slop;
+
+		parse_phrase("\"New  York city\"", words, slop);
+		TS_ASSERT_EQUALS(words.size(), 3U);
+		TS_ASSERT_EQUALS(words[0], "New");
+		TS_ASSERT_EQUALS(words[2], "city");
+		TS_ASSERT_EQUALS(slop, 0U);
+
+		parse_phrase("\"a b\"~12", words, slop);
+		TS_ASSERT_EQUALS(words.size(), 2U);
+		TS_ASSERT_EQUALS(slop, 12U);
+
+		// Unterminated: up to the end of the query
+		parse_phrase("\"a b", words, slop);
+		TS_ASSERT_EQUALS(words.size(), 2U);
+
+		TS_ASSERT_THROWS(parse_phrase("a b", words, slop),
+				std::runtime_error);
+		TS_ASSERT_THROWS(parse_phrase("\"  \"", words, slop),
+				std::runtime_error);
+		TS_ASSERT_THROWS(parse_phrase("\"a b\"~", words, slop),
+				std::runtime_error);
+		TS_ASSERT_THROWS(parse_phrase("\"a b\"x2", words, slop),
+				std::runtime_error);
+	}
+};
+
+
+class PhraseMatcherTestSuit : public CxxTest::TestSuite {
+	static const std::string PHRASE_SANDBOX_DIR;
+
+	static const uint32_t N_DOCS = 600;
+	static const uint32_t N_TERMS = 6;
+	static const uint32_t RARE_TERM = N_TERMS; //!< Only in a few docs
+
+	//! A document: its terms and their positions, in order.
+	struct Doc {
+		std::vector<uint32_t> terms;
+		std::vector<uint32_t> positions;
+	};
+	std::vector<Doc> docs; //!< Document d is docs[d-1]
+
+	void makeDocs()
+	{
+		srand(42);
+		docs.resize(N_DOCS);
+		for(uint32_t d = 1; d <= N_DOCS; ++d) {
+			Doc& doc = docs[d - 1];
+			const uint32_t len = 50 + d % 40;
+			for(uint32_t p = 0; p < len; ++p) {
+				uint32_t t = rand() % N_TERMS;
+				if (d % 9 == 0 && p == 3) {
+					t = RARE_TERM;
+				}
+				doc.terms.push_back(t);
+				// Some documents have large position gaps
+				doc.positions.push_back((d % 50 == 0 && p >= 20) ?
+							100000 + p : p);
+			}
+		}
+	}
+
+	//! Positions of term @p t in @p doc.
+	static std::vector<uint32_t> positionsOf(const Doc& doc, uint32_t t)
+	{
+		std::vector<uint32_t> res;
+		for(size_t p = 0; p < doc.terms.size(); ++p) {
+			if (doc.terms[p] == t) {
+				res.push_back(doc.positions[p]);
+			}
+		}
+		return res;
+	}
+
+	//! The obvious way of matching a phrase.
+	static bool bruteMatch(const Doc& doc,
+			const std::vector<uint32_t>& phrase, uint32_t slop)
+	{
+		std::vector<uint32_t> reach = positionsOf(doc, phrase[0]);
+		for(size_t i = 1; i < phrase.size(); ++i) {
+			std::vector<uint32_t> next;
+			std::vector<uint32_t> pos = positionsOf(doc, phrase[i]);
+			for(size_t q = 0; q < pos.size(); ++q) {
+				for(size_t r = 0; r < reach.size(); ++r) {
+					if (pos[q] > reach[r] &&
+					    pos[q] - reach[r] <= slop + 1) {
+						next.push_back(pos[q]);
+						break;
+					}
+				}
+			}
+			reach.swap(next);
+		}
+		return !reach.empty();
+	}
+
+	//! Index docs, positions included, in small runs and data files.
+	void buildIndex()
+	{
+		const int KB = 1<<10;
+
+		run_inserter run(PHRASE_SANDBOX_DIR, 4*KB);
+		for(uint32_t d = 1; d <= N_DOCS; ++d) {
+			for(uint32_t t = 0; t <= RARE_TERM; ++t) {
+				std::vector<uint32_t> pos =
+					positionsOf(docs[d - 1], t);
+				if (pos.empty()) {
+					continue;
+				}
+				run.reserve(RunPositions::nTriples(pos));
+				RunPositions::encode<run_inserter&>(t, d, pos,
+									run);
+			}
+		}
+		run.flush();
+		TS_ASSERT_LESS_THAN(1, run.getNRuns());
+
+		LoserTreeRunMerger merger(run.getNRuns(),
+				PHRASE_SANDBOX_DIR.c_str(), 4*KB);
+		std::auto_ptr<BaseInvertedFileDumper> dumper(
+			make_inverted_file_dumper(
+				InvertedListCodec::STREAMVBYTE,
+				PHRASE_SANDBOX_DIR, merger, 4*KB, true));
+		dumper->dump();
+		TS_ASSERT_LESS_THAN(1, dumper->getNDataFiles());
+	}
+
+	void checkPhrase(PhraseMatcher& matcher,
+			const std::vector<uint32_t>& phrase, uint32_t slop)
+	{
+		std::vector<uint32_t> docids, freqs;
+		matcher.match(phrase, slop, docids, &freqs);
+
+		std::vector<uint32_t> expected;
+		for(uint32_t d = 1; d <= N_DOCS; ++d) {
+			if (bruteMatch(docs[d - 1], phrase, slop)) {
+				expected.push_back(d);
+			}
+		}
+		TS_ASSERT(docids == expected);
+		TS_ASSERT_EQUALS(freqs.size(), docids.size() * phrase.size());
+
+		for(size_t i = 0; i < docids.size() && i < expected.size(); ++i){
+			const Doc& doc = docs[docids[i] - 1];
+			for(size_t t = 0; t < phrase.size(); ++t) {
+				TS_ASSERT_EQUALS(freqs[i * phrase.size() + t],
+					positionsOf(doc, phrase[t]).size());
+			}
+		}
+	}
+
+public:
+	/*
+	 * Test Fixures setup
+	 */
+	void setUp()
+	{
+		mkdir(PHRASE_SANDBOX_DIR.c_str(),S_IRWXU);
+	}
+
+	void tearDown()
+	{
+		std::string cmd_line("rm -rf ");
+		cmd_line += PHRASE_SANDBOX_DIR;
+
+		system(cmd_line.c_str());
+	}
+
+	/*
+	 * Tests
+	 */
+
+	void testPhraseMatcher()
+	{
+		makeDocs();
+		buildIndex();
+
+		TS_ASSERT(MappedPositionsFile::exists(PHRASE_SANDBOX_DIR));
+		MMapedFile hdr_file(PHRASE_SANDBOX_DIR + "/index.hdr");
+		const hdr_entry_t* hdr =
+			(const hdr_entry_t*) hdr_file.getBuf().start;
+		MappedInvertedFile data_files(PHRASE_SANDBOX_DIR);
+		MappedPositionsFile pos_files(PHRASE_SANDBOX_DIR);
+		PhraseMatcher matcher(hdr, InvertedListCodec::STREAMVBYTE,
+					data_files, pos_files);
+
+		const uint32_t phrases[][5] = {
+			{1, 0},			// a single term
+			{2, 0, 1},
+			{2, 3, 3},		// a repeated term
+			{3, 1, 2, 4},
+			{3, RARE_TERM, 0, 5},	// leapfrogs from the rare one
+			{4, 5, 4, 3, 2},
+		};
+		for(size_t p = 0; p < sizeof(phrases)/sizeof(phrases[0]); ++p) {
+			std::vector<uint32_t> phrase(phrases[p] + 1,
+					phrases[p] + 1 + phrases[p][0]);
+			for(uint32_t slop = 0; slop < 4; ++slop) {
+				checkPhrase(matcher, phrase, slop);
+			}
+		}
+	}
+
+	//! A single run shorter than radix_sort_triples' histograms pay for.
+	void testSmallPositionalRun()
+	{
+		const int KB = 1<<10;
+		const uint32_t N_TERMS = 4;
+		const uint32_t N_POS = 10;
+
+		// Terms in reverse order, so sorting the run moves them
+		run_inserter run(PHRASE_SANDBOX_DIR, 4*KB);
+		for(uint32_t t = N_TERMS; t-- > 0;) {
+			std::vector<uint32_t> pos;
+			for(uint32_t k = 0; k < N_POS; ++k) {
+				pos.push_back(t + N_TERMS * k);
+			}
+			run.reserve(RunPositions::nTriples(pos));
+			RunPositions::encode<run_inserter&>(t, 1, pos, run);
+		}
+		run.flush();
+		TS_ASSERT_EQUALS(run.getNRuns(), 1);
+
+		{
+			LoserTreeRunMerger merger(run.getNRuns(),
+					PHRASE_SANDBOX_DIR.c_str(), 4*KB);
+			std::auto_ptr<BaseInvertedFileDumper> dumper(
+				make_inverted_file_dumper(
+					InvertedListCodec::STREAMVBYTE,
+					PHRASE_SANDBOX_DIR, merger, 4*KB, true));
+			TS_ASSERT_THROWS_NOTHING(dumper->dump());
+		}
+
+		MMapedFile hdr_file(PHRASE_SANDBOX_DIR + "/index.hdr");
+		const hdr_entry_t* hdr =
+			(const hdr_entry_t*) hdr_file.getBuf().start;
+		MappedInvertedFile data_files(PHRASE_SANDBOX_DIR);
+		MappedPositionsFile pos_files(PHRASE_SANDBOX_DIR);
+		PhraseMatcher matcher(hdr, InvertedListCodec::STREAMVBYTE,
+					data_files, pos_files);
+
+		std::vector<uint32_t> phrase;
+		for(uint32_t t = 0; t < N_TERMS; ++t) {
+			phrase.push_back(t);
+		}
+		std::vector<uint32_t> docids, freqs;
+		matcher.match(phrase, 0, docids, &freqs);
+		TS_ASSERT_EQUALS(docids, std::vector<uint32_t>(1, 1));
+		TS_ASSERT_EQUALS(freqs, std::vector<uint32_t>(N_TERMS, N_POS));
+
+		// Out of order, it is not there
+		std::swap(phrase[0], phrase[1]);
+		matcher.match(phrase, 0, docids, &freqs);
+		TS_ASSERT(docids.empty());
+	}
+};
+
+const std::string PhraseMatcherTestSuit::PHRASE_SANDBOX_DIR("_phrase_test_dir");
+
+
+#endif // __PHRASE_TEST_H
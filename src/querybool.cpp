@@ -10,7 +10,10 @@
  * classes.
  */
 
+#include <sys/time.h>
+
 #include <iostream>
+#include <memory>
 #include <map>
 #include <iterator>
 #include <algorithm>
@@ -18,7 +21,10 @@
 #include "mergerutils.hpp"
 #include "indexerutils.hpp"
 #include "indexcompression.hpp"
+#include "vocabulary.hpp"
+#include "phrase.hpp"
 #include "strmisc.h"
+#include "config.h"
 
 // ASSUMING COMPRESSED INVERTED FILES
 
@@ -38,6 +44,9 @@ typedef std::set<uint32_t> docset;
 //!Vector of docids
 typedef std::vector<uint32_t> docvet;
 
+//!Vector of term ids
+typedef std::vector<uint32_t> termvet;
+
 /***********************************************************************
 				      BLAH
  ***********************************************************************/
@@ -45,10 +54,16 @@ typedef std::vector<uint32_t> docvet;
 
 struct QueryResolver {
 	std::string store_dir;
-	StrIntMap voc;
+	MMapedVocabulary voc;
+	FrontCodedVocabulary sorted_voc; //!< For prefix terms
 	MMapedFile idx_file;
 	ifile_idx idx;
+	MappedInvertedFile data_files;
+	InvertedListCodec::format_t format; //!< Format of the inverted lists
 	bool conjunctive;
+	std::vector<PostingCursor> cursors; //!< Reused by prefix terms
+	std::auto_ptr<MappedPositionsFile> pos_files; //!< If there are any
+	std::auto_ptr<PhraseMatcher> phrases; //!< Only if pos_files
 
 	/**Constructor.
 	 *
@@ -60,11 +75,151 @@ struct QueryResolver {
 	 */
 	QueryResolver(const char* dir, bool conjunctive=true)
 	: store_dir(dir),
+	  voc(store_dir),
+	  sorted_voc(store_dir),
 	  idx_file( store_dir + "/index.hdr"),
 	  idx((hdr_entry_t*)idx_file.getBuf().start),
-	  conjunctive(conjunctive)
+	  data_files(store_dir),
+	  format(InvertedListCodec::readFormat(store_dir)),
+	  conjunctive(conjunctive),
+	  cursors(),
+	  pos_files(),
+	  phrases()
 	{
-		load_vocabulary(voc,store_dir.c_str());
+		if (MappedPositionsFile::exists(store_dir)) {
+			pos_files.reset(new MappedPositionsFile(store_dir));
+			phrases.reset(new PhraseMatcher(idx, format, data_files,
+							*pos_files));
+		}
+	}
+
+	/**Is this a prefix term, as "univers*"?
+	 *
+	 * Prefix terms match documents with any term starting with the
+	 * prefix.
+	 */
+	static bool isPrefixTerm(const std::string& term)
+	{
+		return term.size() > 1 && term[term.size() - 1] == '*';
+	}
+
+	/**Get the term ids a query term stands for.
+	 *
+	 * Just the term's own term id, unless it is a prefix term: in that
+	 * case, the term ids of up to PREFIX_EXPANSION_LIMIT terms starting
+	 * with the prefix - maybe none.
+	 *
+	 * @param[out] termids Will be overwritten.
+	 */
+	void expandTerm(const std::string& term, termvet& termids)
+	{
+		termids.clear();
+		if (isPrefixTerm(term)) {
+			std::string prefix(term, 0, term.size() - 1);
+			normalize_term(prefix);
+			sorted_voc.findPrefix(prefix, termids,
+					PREFIX_EXPANSION_LIMIT);
+		} else {
+			termids.push_back(getTermId(term));
+		}
+	}
+
+	//! Number of documents a query term appears in, at most.
+	uint32_t getDocumentCount(const std::string& term)
+	{
+		termvet termids;
+		uint32_t ft = 0;
+
+		if (is_phrase(term)) {
+			// As many as its rarest term
+			uint32_t slop;
+			getPhraseTermIds(term, termids, slop);
+			ft = idx[termids[0]].ft;
+			for(size_t i = 1; i < termids.size(); ++i) {
+				ft = std::min(ft, idx[termids[i]].ft);
+			}
+			return ft;
+		}
+
+		expandTerm(term, termids);
+		for(size_t i = 0; i < termids.size(); ++i) {
+			ft += idx[termids[i]].ft;
+		}
+		return ft;
+	}
+
+	//! Get the term ids of a phrase's words and the phrase's slop.
+	void getPhraseTermIds(const std::string& phrase, termvet& termids,
+				uint32_t& slop)
+	{
+		std::vector<std::string> words;
+		parse_phrase(phrase, words, slop);
+
+		termids.clear();
+		for(size_t i = 0; i < words.size(); ++i) {
+			termids.push_back(getTermId(words[i]));
+		}
+	}
+
+	/**Get the documents where a phrase appears.
+	 *
+	 * @param[out] docs Sorted docids. Will be overwritten.
+	 *
+	 * @see PhraseMatcher
+	 */
+	void getPhraseDocvet(const std::string& phrase, docvet& docs)
+	{
+		if (! phrases.get()) {
+			throw std::runtime_error("Phrase queries need an inverted "
+						 "file with positions");
+		}
+
+		termvet termids;
+		uint32_t slop;
+		getPhraseTermIds(phrase, termids, slop);
+		phrases->match(termids, slop, docs);
+	}
+
+	//! mergePostings() visitor, collects each docid once.
+	struct DocidCollector {
+		docvet& docs;
+
+		DocidCollector(docvet& docs)
+		: docs(docs)
+		{}
+
+		inline void operator()(uint32_t i, const PostingCursor& c)
+		{
+			if (docs.empty() || docs.back() != c.docid()) {
+				docs.push_back(c.docid());
+			}
+		}
+	};
+
+	/**Get the documents where any of the given terms appear.
+	 *
+	 * The terms' inverted lists are merged with a heap, so this costs
+	 * O(log n) per posting for n terms.
+	 *
+	 * @param[out] docs Sorted docids. Will be overwritten.
+	 */
+	void unionTermIdsDocvet(const termvet& termids, docvet& docs)
+	{
+		docs.clear();
+		if (cursors.size() < termids.size()) {
+			cursors.resize(termids.size());
+		}
+
+		std::vector<PostingCursor*> open;
+		for(size_t i = 0; i < termids.size(); ++i) {
+			hdr_entry_t& entry = idx[termids[i]];
+			cursors[i].open(format, entry.ft,
+					data_files.getList(entry));
+			open.push_back(&cursors[i]);
+		}
+
+		DocidCollector collect(docs);
+		mergePostings(open, collect);
 	}
 
 	/**Get the set of documents where a given term appears.
@@ -102,6 +257,16 @@ struct QueryResolver {
 	{
 		docs.clear();
 
+		if (is_phrase(term)) {
+			getPhraseDocvet(term, docs);
+			return;
+		} else if (isPrefixTerm(term)) {
+			termvet termids;
+			expandTerm(term, termids);
+			unionTermIdsDocvet(termids, docs);
+			return;
+		}
+
 		inverted_list_vec_t ilist;
 		inverted_list_vec_t::const_iterator d;
 
@@ -113,22 +278,67 @@ struct QueryResolver {
 		}
 	}
 
-	void getWordInvertedList(std::string term, inverted_list_vec_t& ilist)
+	/**Intersect a list of documents with the documents where a given
+	 * term appears.
+	 *
+	 * The term's inverted list is not decoded as a whole: we just skip
+	 * to each docid in @p docs, so the cost is proportional to the
+	 * size of @p docs, not to the size of the list.
+	 *
+	 * Prefix terms and phrases are solved as in getTermDocvet() first.
+	 *
+	 * @param[in,out] docs Sorted docids. Only those where @p term
+	 * 		       appears are kept.
+	 */
+	void intersectTermDocvet(const std::string& term, docvet& docs)
+	{
+		if (isPrefixTerm(term) || is_phrase(term)) {
+			docvet cur;		// Current term's matches
+			docvet prev(docs);	// previous result
+			docs.clear();
+
+			getTermDocvet(term, cur);
+			std::set_intersection(prev.begin(), prev.end(),
+					cur.begin(), cur.end(),
+					std::back_inserter(docs));
+			return;
+		}
+
+		hdr_entry_t& entry = idx[getTermId(term)];
+
+		filebuf data = data_files.getList(entry);
+
+		PostingCursor cursor(format, entry.ft, data);
+		docvet::iterator out = docs.begin();
+		docvet::const_iterator d;
+		for(d = docs.begin(); d != docs.end(); ++d) {
+			if (! cursor.nextGEQ(*d)) {
+				break;
+			} else if (cursor.docid() == *d) {
+				*out++ = *d;
+			}
+		}
+		docs.erase(out, docs.end());
+	}
+
+	uint32_t getTermId(std::string term)
 	{
 		std::string word = normalize_term(term);
 
-		StrIntMap::const_iterator wpos = voc.find(word);
-		if (wpos == voc.end()){
+		uint32_t termid = voc.find(word);
+		if (termid == MMapedVocabulary::NOT_FOUND){
 			std::string err_msg("Term '");
 			err_msg +=  term + "' (" +  word +
 				") not in vocabulary";
 			throw std::runtime_error(err_msg);
 		}
 
-		uint32_t termid = wpos->second;
-
-		getTermIdInvertedList(termid,ilist);
+		return termid;
+	}
 
+	void getWordInvertedList(std::string term, inverted_list_vec_t& ilist)
+	{
+		getTermIdInvertedList(getTermId(term),ilist);
 	}
 
 	void getTermIdInvertedList(uint32_t termid, inverted_list_vec_t& ilist)
@@ -137,14 +347,9 @@ struct QueryResolver {
 
 		ilist.clear();
 
-		std::string data_filename = 
-			BaseInvertedFileDumper::mk_data_filename(store_dir,
-								entry.fileno);
-		MMapedFile data_file(data_filename);
-		filebuf data = data_file.getBuf();
-		data.read(entry.pos);
+		filebuf data = data_files.getList(entry);
 
-		ByteWiseCompressor::decompress(entry.ft, data,ilist);
+		InvertedListCodec::decompress(format, entry.ft, data, ilist);
 	}
 
 	void ilist2docset(const inverted_list_vec_t& ilist, docset& ids )
@@ -174,10 +379,19 @@ struct QueryResolver {
 		std::vector<std::string>::const_iterator w;
 
 		result.clear();
-		words = split(query," ");
+		words = split_query(query);
 
 		if(words.empty()) return;
 
+		// Pure conjunctive queries can be solved in any order. Starting
+		// with the rarest term keeps every intersection as small as
+		// it can be.
+		if (conjunctive &&
+		    std::find(words.begin(), words.end(), "OR") == words.end())
+		{
+			sortByDocumentCount(words);
+		}
+
 		// We populate the result with the hits for the first query
 		// term and we add/remove docids to it as we iterate over
 		// the other query terms
@@ -196,17 +410,15 @@ struct QueryResolver {
 			}
 
 			// Not an operator? Process this query term
-			docvet cur;		// Current term's matches
-			docvet prev(result);	// previous result
-			result.clear();
-
-			getTermDocvet(*w, cur);
-
 			if (conjunctive) {
-				std::set_intersection(prev.begin(), prev.end(),
-					cur.begin(), cur.end(),
-				 	std::inserter(result,result.begin()));
+				intersectTermDocvet(*w, result);
 			} else {
+				docvet cur;		// Current term's matches
+				docvet prev(result);	// previous result
+				result.clear();
+
+				getTermDocvet(*w, cur);
+
 				std::set_union(prev.begin(), prev.end(),
 					cur.begin(), cur.end(),
 				 	std::inserter(result,result.begin()));
@@ -214,6 +426,29 @@ struct QueryResolver {
 		} //end for
 	}
 
+	/**Sort query terms by the number of documents they appear in.
+	 *
+	 * AND operators are dropped.
+	 */
+	void sortByDocumentCount(std::vector<std::string>& words)
+	{
+		typedef std::pair<uint32_t, std::string> ft_word_t;
+		std::vector<ft_word_t> by_ft;
+		std::vector<std::string>::const_iterator w;
+
+		for(w = words.begin(); w != words.end(); ++w) {
+			if (*w != "AND") {
+				uint32_t ft = getDocumentCount(*w);
+				by_ft.push_back(ft_word_t(ft, *w));
+			}
+		}
+		std::sort(by_ft.begin(), by_ft.end());
+
+		words.clear();
+		for(size_t i = 0; i < by_ft.size(); ++i) {
+			words.push_back(by_ft[i].second);
+		}
+	}
 
 };
 
@@ -222,10 +457,19 @@ struct QueryResolver {
 				      MAIN
  ***********************************************************************/
 
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 void do_query(QueryResolver& resolver, std::string query)
 {
 	docvet d_ids;
+	double start = now();
 	resolver.processQuery(query,d_ids);
+	double elapsed = now() - start;
 
 
 	if (d_ids.empty()) {
@@ -240,6 +484,8 @@ void do_query(QueryResolver& resolver, std::string query)
 		}
 		std::cout << std::endl;
 	}
+	std::cout << "# " << d_ids.size() << " documents in " <<
+		elapsed * 1000 << "ms" << std::endl;
 
 }
 
@@ -272,6 +518,8 @@ int main(int argc, char* argv[])
 	std::cout <<"Type your query using AND, OR and spaces to split terms."<<std::endl;
 	std::cout <<"Default operation is AND (conjunctive)."<<std::endl;
 	std::cout <<"Notice: a AND b c OR d == (((a AND b) AND c) OR d )"<<std::endl;
+	std::cout <<"Terms ending in * match any term starting with them."<<std::endl;
+	std::cout <<"\"a b\" matches a phrase, \"a b\"~N allows N words between terms."<<std::endl;
 
 	// Prompt
 	std::cout << "> ";
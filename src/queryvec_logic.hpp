@@ -13,6 +13,9 @@
 #include <map>
 #include <iterator>
 #include <algorithm>
+#include <limits>
+#include <memory>
+#include <tr1/memory>
 
 #include "mergerutils.hpp"
 #include "indexerutils.hpp"
@@ -20,43 +23,15 @@
 #include "strmisc.h"
 #include "isamutils.hpp"
 #include "vectorial.hpp"
+#include "topk.hpp"
+#include "vocabulary.hpp"
+#include "phrase.hpp"
+#include "cacheutils.hpp"
+#include "config.h"
 
 // ASSUMING COMPRESSED INVERTED FILES
 
 
-/***********************************************************************
-			     Typedefs and constants
- ***********************************************************************/
-
-
-//!A vectorial query result entry
-typedef std::pair<docid_t,double> vec_res_t;
-
-//! In descending order.
-inline bool VecResComparator(const vec_res_t& a, const vec_res_t& b)
-{
-	return (a.second > b.second);
-}
-
-//!Vector of results of a vectorial query
-typedef std::vector<vec_res_t> vec_res_vec_t;
-
-struct NormLoadingVisitor {
-	wdmfdt_map_t& WFMap;
-
-	NormLoadingVisitor(wdmfdt_map_t& m)
-	: WFMap(m)
-	{}
-
-	inline
-	void operator()(uint32_t id, const norm_hdr_entry_t* entry, filebuf data)
-	{
-		wdmaxfdt_t* val = (wdmaxfdt_t* ) data.read(sizeof(wdmaxfdt_t));
-		WFMap[entry->docid] = *val;
-	}
-};
-
-
 /***********************************************************************
 			     VectorialQueryResolver
  ***********************************************************************/
@@ -64,8 +39,17 @@ struct NormLoadingVisitor {
 
 struct VectorialQueryResolver {
 	typedef hdr_entry_t*	ifile_idx;
-	typedef __gnu_cxx::hash_map < docid_t, double> accumulator_t;
 	typedef std::vector<uint32_t> termvec_t;
+
+	//! The terms a query word stands for, see word2group().
+	struct termgroup_t {
+		termvec_t termids;
+		bool phrase;	//!< Are termids a phrase's terms, in order?
+		uint32_t slop;	//!< The phrase's slop
+
+		termgroup_t() : termids(), phrase(false), slop(0) {}
+	};
+	typedef std::vector<termgroup_t> termgroupvec_t;
 	typedef std::vector<uint32_t> docidvec_t;
 
 	std::string store_dir;
@@ -75,32 +59,87 @@ struct VectorialQueryResolver {
 	 * This is the stuff we kepp in the memory for answering queries.
 	 */
 	//!@{
-	StrIntMap voc;		//!< Vocabulary
-	wdmfdt_map_t WFMap;	//!< Document norms / weights
+	MMapedVocabulary voc;	//!< Vocabulary
+	FrontCodedVocabulary sorted_voc; //!< Vocabulary, for prefix terms
+	NormTable norms;	//!< Document norms / weights
 	uint32_t N;		//!< Number of documents indexed.
 	//!@}
 
 	MMapedFile idx_file;
 	ifile_idx idx;
+	MappedInvertedFile data_files;
+	InvertedListCodec::format_t format; //!< Format of the inverted lists
+	std::auto_ptr<MappedPositionsFile> pos_files; //!< If there are any
+
+	/**Per-term max-score bounds, for top-k queries.
+	 *
+	 * Empty if the inverted file has none, what disables skipping.
+	 */
+	std::vector<double> max_scores;
+
+	/**@name Query processing state.
+	 *
+	 * Kept between queries so their memory gets reused.
+	 */
+	//!@{
+	std::vector<PostingCursor> cursors; //!< One per query term
+	WandTopKScorer scorer;
+	std::auto_ptr<PhraseMatcher> phrases; //!< Only if pos_files
+	std::vector<uint32_t> phrase_docs;
+	std::vector<uint32_t> phrase_freqs;
+	//! A phrase term's matches in processQueryTopK(), one per term
+	std::vector<DecodedPostings> phrase_lists;
+	//!@}
+
+	/**@name Decoded inverted lists cache.
+	 *
+	 * A list is decoded and cached the second time it is read in a
+	 * short while, so lists read just once don't push the popular ones
+	 * out. See openCursor().
+	 */
+	//!@{
+	typedef std::tr1::shared_ptr<const DecodedPostings> decoded_ptr_t;
+	LRUCache<uint32_t, decoded_ptr_t> list_cache;
+	LRUCache<uint32_t, bool> list_misses; //!< Lists read recently
+	std::vector<decoded_ptr_t> pinned; //!< Lists the query's cursors use
+	//!@}
 
 	/**Constructor.
 	 *
 	 * @param dir Directory where inverted file and vocabulary data
 	 * 	      files are.
+	 * @param list_cache_size Memory budget for decoded inverted
+	 * 	      lists, in bytes. 0 disables their caching.
 	 */
-	VectorialQueryResolver(const char* dir, bool conjunctive=true)
+	VectorialQueryResolver(const char* dir, bool conjunctive=true,
+				size_t list_cache_size=LIST_CACHE_SIZE)
 	: store_dir(dir),
+	  voc(store_dir),
+	  sorted_voc(store_dir),
 	  idx_file( store_dir + "/index.hdr"),
-	  idx((hdr_entry_t*)idx_file.getBuf().start)
+	  idx((hdr_entry_t*)idx_file.getBuf().start),
+	  data_files(store_dir),
+	  format(InvertedListCodec::readFormat(store_dir)),
+	  pos_files(),
+	  cursors(),
+	  scorer(norms, 0),
+	  phrases(),
+	  phrase_lists(),
+	  list_cache(list_cache_size),
+	  list_misses(LIST_CACHE_ADMISSION_WINDOW),
+	  pinned()
 	{
-		load_vocabulary(voc,store_dir.c_str());
-
 		// Load Document norms/weights
-		NormLoadingVisitor norm_loader(WFMap);
-		VisitIndexedStore<norm_hdr_entry_t>( store_dir.c_str(),
-						     "norm",
-						     norm_loader);
-		N = WFMap.size();
+		norms.load(store_dir);
+		N = norms.getNDocs();
+
+		read_max_scores(store_dir, max_scores);
+
+		if (MappedPositionsFile::exists(store_dir)) {
+			pos_files.reset(new MappedPositionsFile(store_dir));
+			phrases.reset(new PhraseMatcher(idx, format, data_files,
+							*pos_files));
+		}
 	}
 
 	//!@name Query and vocabulary conversion methods and utils
@@ -129,15 +168,56 @@ struct VectorialQueryResolver {
 	{
 		std::string word = normalize_term(term);
 
-		StrIntMap::const_iterator wpos = voc.find(word);
-		if (wpos == voc.end()){
+		uint32_t termid = voc.find(word);
+		if (termid == MMapedVocabulary::NOT_FOUND){
 			throw NotInVocabulary(term);
 		}
 
-		return wpos->second;
+		return termid;
 	}
 
-	/**Functor to word2termid.
+	/**Return the TermIDs a query word stands for.
+	 *
+	 * Just word2termid(), unless the word is:
+	 * - a prefix term, as "univers*": then the term ids of up to
+	 *   PREFIX_EXPANSION_LIMIT terms starting with the (normalized)
+	 *   prefix;
+	 * - a phrase, see parse_phrase(): then the term ids of its words.
+	 *
+	 * @throw std::runtime_error if the word is a malformed phrase or the
+	 * 	  index has no positions.
+	 */
+	inline termgroup_t word2group(std::string term)
+	{
+		termgroup_t res;
+
+		if (is_phrase(term)) {
+			if (! phrases.get()) {
+				throw std::runtime_error("Phrase queries need an "
+						"inverted file with positions");
+			}
+			std::vector<std::string> words;
+			parse_phrase(term, words, res.slop);
+			res.phrase = true;
+			for(size_t i = 0; i < words.size(); ++i) {
+				res.termids.push_back(word2termid(words[i]));
+			}
+		} else if (term.size() > 1 && term[term.size() - 1] == '*') {
+			std::string prefix(term, 0, term.size() - 1);
+			normalize_term(prefix);
+			sorted_voc.findPrefix(prefix, res.termids,
+					PREFIX_EXPANSION_LIMIT);
+			if (res.termids.empty()) {
+				throw NotInVocabulary(term);
+			}
+		} else {
+			res.termids.push_back(word2termid(term));
+		}
+
+		return res;
+	}
+
+	/**Functor to word2group.
 	 *
 	 * All the work you have to do just to use C++
 	 * as a functional language (map ptr_method list)
@@ -150,16 +230,17 @@ struct VectorialQueryResolver {
 		: v(v)
 		{}
 
-		uint32_t operator()(std::string w)
+		termgroup_t operator()(std::string w)
 		{
-			return v.word2termid(w);
+			return v.word2group(w);
 		}
 	};
 
-	inline termvec_t query2termids(std::string query)
+	//! The TermIDs of each query word, see word2group().
+	inline termgroupvec_t query2termgroups(std::string query)
 	{
-		std::vector<std::string> terms( split(query," ") );
-		termvec_t res(terms.size());
+		std::vector<std::string> terms( split_query(query) );
+		termgroupvec_t res(terms.size());
 
 		std::transform( terms.begin(), terms.end(),
 				res.begin(),
@@ -167,6 +248,20 @@ struct VectorialQueryResolver {
 
 		return res;
 	}
+
+	//! The TermIDs of all query words, see word2group().
+	inline termvec_t query2termids(std::string query)
+	{
+		termgroupvec_t groups( query2termgroups(query) );
+		termvec_t res;
+
+		for(size_t g = 0; g < groups.size(); ++g) {
+			res.insert(res.end(), groups[g].termids.begin(),
+				   groups[g].termids.end());
+		}
+
+		return res;
+	}
 	//!@}
 
 	void getTermIdInvertedList(uint32_t termid, inverted_list_vec_t& ilist)
@@ -175,14 +270,9 @@ struct VectorialQueryResolver {
 
 		ilist.clear();
 
-		std::string data_filename = 
-			BaseInvertedFileDumper::mk_data_filename(store_dir,
-								entry.fileno);
-		MMapedFile data_file(data_filename);
-		filebuf data = data_file.getBuf();
-		data.read(entry.pos);
+		filebuf data = data_files.getList(entry);
 
-		ByteWiseCompressor::decompress(entry.ft, data,ilist);
+		InvertedListCodec::decompress(format, entry.ft, data, ilist);
 	}
 
 	/**Processes a query.
@@ -201,56 +291,91 @@ struct VectorialQueryResolver {
 	{
 
 		result.clear();
+		pinned.clear();
 
-		// Convert the query to term-ids
-		termvec_t terms;
-		termvec_t::const_iterator t;
+		// Convert the query to term-ids, one group per query word
+		termgroupvec_t groups;
+		termgroupvec_t::const_iterator g;
 		try {
-			terms = query2termids(query);
-		} catch (NotInVocabulary& e) {
+			groups = query2termgroups(query);
+		} catch (std::runtime_error& e) {
+			// Unknown words and malformed phrases alike
 			std::cerr << e.what();
-			terms.clear();
+			groups.clear();
 		};
 
 		// We may end with an empty term list either due to
 		// a empty query or to words that were not found.
-		if(terms.empty()) return;
+		if(groups.empty()) return;
 
-		accumulator_t acc;
-		accumulator_t::iterator acc_d;
-		inverted_list_vec_t ilist;
-		inverted_list_vec_t::const_iterator d;
+		// Start with the rarest term: with "AND" semmantics the
+		// candidate set only shrinks, so the longer lists are only
+		// probed at the candidates' docids.
+		std::sort(groups.begin(), groups.end(), ByDocumentCount(idx));
 
-		// For "AND" semmantics
-		bool first_list = true;
+		// Candidate documents and their accumulated weight, sorted
+		// by docid.
+		vec_res_vec_t& acc = result;
+		vec_res_vec_t::iterator acc_d;
+		vec_res_vec_t group_acc; // a prefix term's weights
 
 		// Variables used for calculating per-document
 		// and per-term weight
 		double idf;		// term weight
-		uint32_t ft;		// n documents w/ term
 
-		for(t = terms.begin(); t != terms.end(); ++t) {
-
-			getTermIdInvertedList(*t, ilist);
-			ft = ilist.size();
-			idf = log(double(N)/double(ft));
+		for(g = groups.begin(); g != groups.end(); ++g) {
+			if (g == groups.begin()) {
+				getGroupWeights(*g, acc);
+				continue;
+			}
 
-			// Apply "AND" semmantics
-			if (first_list) {
-				first_list = false;
-			} else {
-				pruneToIntersection(acc,ilist);
+			vec_res_vec_t::iterator out = acc.begin();
+
+			if (g->phrase || g->termids.size() > 1) {
+				// A prefix term or a phrase: the group's
+				// documents are solved apart.
+				getGroupWeights(*g, group_acc);
+				vec_res_vec_t::const_iterator gd;
+				gd = group_acc.begin();
+				for(acc_d = acc.begin(); acc_d != acc.end();
+				    ++acc_d) {
+					const docid_t& doc = acc_d->first;
+					while (gd != group_acc.end() &&
+					       gd->first < doc) {
+						++gd;
+					}
+					if (gd == group_acc.end()) {
+						break;
+					} else if (gd->first == doc) {
+						out->first = doc;
+						out->second = acc_d->second +
+							gd->second;
+						++out;
+					}
+				}
+				acc.erase(out, acc.end());
+				continue;
 			}
 
-			for(d=ilist.begin(); d != ilist.end(); ++d) {
-				// Syntatic sugar - cause you known
-				// you will need it later, don't ya?
-				const d_fdt_t& d_fdt = *d;
-				const uint32_t& doc = d_fdt.first;
-				const uint32_t& fdt = d_fdt.second;
+			hdr_entry_t& entry = idx[g->termids.front()];
+			idf = log(double(N)/double(entry.ft));
+
+			PostingCursor& cursor = getCursor(0);
+			openCursor(cursor, g->termids.front());
 
-				acc[doc] = acc[doc] + (float(fdt)*idf);
-			}// end for each document
+			// Apply "AND" semmantics
+			for(acc_d = acc.begin(); acc_d != acc.end(); ++acc_d) {
+				const docid_t& doc = acc_d->first;
+				if (! cursor.nextGEQ(doc)) {
+					break;
+				} else if (cursor.docid() == doc) {
+					out->first = doc;
+					out->second = acc_d->second +
+						(float(cursor.freq())*idf);
+					++out;
+				}
+			}
+			acc.erase(out, acc.end());
 		} //end for each term
 
 		// Normalize all the matches
@@ -258,82 +383,328 @@ struct VectorialQueryResolver {
 			const docid_t& doc = acc_d->first;
 			double& doc_weight = acc_d->second;
 
-			const wdmaxfdt_t& wf = WFMap[doc];
+			const wdmaxfdt_t& wf = norms[doc];
 
 			doc_weight /= (double(wf.maxfdt) * wf.wd);
 		}
 
-
-		// Copy result to output
-		result.reserve(acc.size());
-		result.assign(acc.begin(), acc.end());
 		std::stable_sort(result.begin(), result.end(), VecResComparator); // FIXME
 	}
 
-	/**Prune ilist and accummulators to the intersection of current and
-	 * new docids.
+	/**Processes a query, retrieving only the k most similar documents.
 	 *
-	 * It will obtain the intersectino between previously known docids
-	 * and the new ones in @p ilist. After that it will prune the list
-	 * in @p ilist and the accumulators @p acc to match this intersection.
+	 * Unlike processQuery(), documents need not have all the query
+	 * terms ("OR" semmantics): they are just ranked by similarity.
+	 * Documents are scored one at a time with WandTopKScorer, using the
+	 * max-score bounds written by mknorms to skip those that can't make
+	 * into the result.
 	 *
-	 * We assume that @p ilist is sorted and have no duplicates.
+	 * Phrases are matched upfront. Each of their terms is then scored
+	 * as a term whose inverted list holds just the phrase's documents,
+	 * with the term's frequency in each: the same weight processQuery()
+	 * gives phrases. Words not in the vocabulary, and phrases with any,
+	 * are ignored.
 	 *
-	 * @param[in,out] acc The current accumulators.
-	 * @param[in,out] ilist The list of new docids. It will be pruned to
-	 * 			match the intersection between its contents and
-	 * 			@p acc contents.
+	 * @param query A string with the query terms separated
+	 * 		by space.
+	 * @param k Number of documents to retrieve.
+	 * @param[out] result The best @p k matches, best first. Will be
+	 * 		      overwritten by this method.
+	 */
+	void processQueryTopK(std::string query, size_t k,
+				vec_res_vec_t& result)
+	{
+		result.clear();
+		pinned.clear();
+
+		// With "OR" semmantics, unknown words just match nothing
+		std::vector<std::string> words( split_query(query) );
+		termgroupvec_t groups;
+		try {
+			for(size_t w = 0; w < words.size(); ++w) {
+				try {
+					groups.push_back(word2group(words[w]));
+				} catch (NotInVocabulary& e) {
+					std::cerr << e.what();
+				}
+			}
+		} catch (std::runtime_error& e) {
+			// Malformed phrases
+			std::cerr << e.what();
+			groups.clear();
+		};
+
+		size_t n_terms = 0;
+		size_t n_phrase_terms = 0;
+		for(size_t g = 0; g < groups.size(); ++g) {
+			n_terms += groups[g].termids.size();
+			if (groups[g].phrase) {
+				n_phrase_terms += groups[g].termids.size();
+			}
+		}
+		if(n_terms == 0) return;
+
+		// Repeated terms count once per occurrence, as in
+		// processQuery(): each gets its own cursor. The pools must
+		// grow before the scorer gets pointers into them.
+		getCursor(n_terms - 1);
+		if (phrase_lists.size() < n_phrase_terms) {
+			phrase_lists.resize(n_phrase_terms);
+		}
+
+		scorer.reset(k);
+		size_t c = 0;
+		size_t p = 0;
+		for(size_t g = 0; g < groups.size(); ++g) {
+			const termgroup_t& group = groups[g];
+			const size_t n = group.termids.size();
+
+			if (group.phrase) {
+				phrases->match(group.termids, group.slop,
+						phrase_docs, &phrase_freqs);
+			}
+
+			for(size_t i = 0; i < n; ++i, ++c) {
+				const uint32_t termid = group.termids[i];
+
+				if (group.phrase) {
+					DecodedPostings& list = phrase_lists[p++];
+					list.docids = phrase_docs;
+					list.freqs.resize(phrase_docs.size());
+					for(size_t d = 0; d < phrase_docs.size();
+					    ++d) {
+						list.freqs[d] = phrase_freqs[d*n + i];
+					}
+					cursors[c].open(list);
+				} else {
+					openCursor(cursors[c], termid);
+				}
+
+				// A term's frequencies in a phrase's documents
+				// are its own, so its bound holds
+				scorer.addTerm(&cursors[c],
+					log(double(N)/double(idx[termid].ft)),
+					maxScore(termid));
+			}
+		}
+
+		scorer.run(result);
+	}
+
+	/**Open @p cursor over a term's inverted list.
 	 *
-	 * @todo Do it properly! This code is an ugly hack!
+	 * From the decoded lists cache, if the list is there. The lists the
+	 * cursors use are pinned until the next query starts, so evictions
+	 * don't pull them from under the cursors.
 	 */
-	void pruneToIntersection(accumulator_t& acc,
-			inverted_list_vec_t& ilist)
+	void openCursor(PostingCursor& cursor, uint32_t termid)
 	{
-		// Current set of document ids
-		docidvec_t cur;
-		cur.reserve(acc.size());
-		accumulator_t::iterator a;
-		for (a = acc.begin(); a != acc.end(); ++a){
-			cur.push_back(a->first);
+		const hdr_entry_t& entry = idx[termid];
+
+		if (list_cache.getStats().max_bytes == 0) {
+			cursor.open(format, entry.ft, data_files.getList(entry));
+			return;
 		}
-		std::sort(cur.begin(), cur.end());
-
-		// list of new document ids
-		docidvec_t new_ids;
-		ilist2docvet(ilist, new_ids);
-
-		// The resulting intersection
-		std::set<uint32_t> inter;
-
-		std::set_intersection(cur.begin(), cur.end(),
-                                        new_ids.begin(), new_ids.end(),
-                                        std::inserter(inter,inter.begin()));
-
-		// Prune the inverted list - the lazy way FIXME
-		inverted_list_vec_t result_ilist;
-		result_ilist.reserve(new_ids.size());
-		inverted_list_vec_t::iterator i;
-		for(i = ilist.begin(); i != ilist.end(); ++i) {
-			// If it is in inter, add to the results..
-			if ( inter.find(i->first) != inter.end() ) {
-				result_ilist.push_back(*i);
+
+		const decoded_ptr_t* cached = list_cache.find(termid);
+		if (cached) {
+			pinned.push_back(*cached);
+			cursor.open(**cached);
+			return;
+		}
+
+		if (! list_misses.find(termid)) {
+			list_misses.put(termid, true, 1);
+			cursor.open(format, entry.ft, data_files.getList(entry));
+			return;
+		}
+
+		// Read again in a short while: a popular list
+		list_misses.erase(termid);
+		DecodedPostings* list = new DecodedPostings();
+		decoded_ptr_t decoded(list);
+		list->decode(format, entry.ft, data_files.getList(entry));
+		list_cache.put(termid, decoded, list->memory());
+		pinned.push_back(decoded);
+		cursor.open(*decoded);
+	}
+
+	//! Upper bound of a term's term_doc_weight(), if mknorms wrote it.
+	inline double maxScore(uint32_t termid) const
+	{
+		return (termid < max_scores.size()) ? max_scores[termid] :
+			std::numeric_limits<double>::infinity();
+	}
+
+	//! Usage of the decoded inverted lists cache.
+	inline const CacheStats& getListCacheStats() const
+	{
+		return list_cache.getStats();
+	}
+
+	/**Canonical form of a query, to cache its results by.
+	 *
+	 * Queries with the same normalized words, in any order and with any
+	 * spacing, have the same results and the same canonical form.
+	 * Phrases keep their words' order.
+	 */
+	static std::string normalizeQuery(const std::string& query)
+	{
+		std::vector<std::string> words( split_query(query) );
+
+		for(size_t i = 0; i < words.size(); ++i) {
+			std::string& w = words[i];
+			if (is_phrase(w)) {
+				std::vector<std::string> pwords;
+				uint32_t slop;
+				try {
+					parse_phrase(w, pwords, slop);
+				} catch (std::runtime_error& e) {
+					continue; // Fails later, as is
+				}
+				for(size_t j = 0; j < pwords.size(); ++j) {
+					normalize_term(pwords[j]);
+				}
+				w = "\"" + join(std::string(" "), pwords) + "\"";
+				if (slop > 0) {
+					w += "~" + toString(slop);
+				}
+			} else if (w.size() > 1 && w[w.size() - 1] == '*') {
+				std::string prefix(w, 0, w.size() - 1);
+				w = normalize_term(prefix) + "*";
+			} else {
+				normalize_term(w);
 			}
 		}
-		ilist = result_ilist;
-
-		// Prune the accumulators
-		accumulator_t result_acc;
-		for(a = acc.begin(); a!= acc.end(); ++a) {
-			// If it is in inter, add to the results..
-			if( inter.find(a->first) != inter.end()) {
-				// XXX Silly but erase was causing problems
-				result_acc[a->first] = a->second;
+		std::sort(words.begin(), words.end());
+
+		return join(std::string(" "), words);
+	}
+
+	/**Get the i-th query term cursor.
+	 *
+	 * The cursor pool only grows, so their buffers are reused from
+	 * query to query. Growing it invalidates references to cursors.
+	 */
+	inline PostingCursor& getCursor(size_t i)
+	{
+		if (cursors.size() <= i) {
+			cursors.resize(i + 1);
+		}
+		return cursors[i];
+	}
+
+	//! mergePostings() visitor, sums the weights of each document.
+	struct WeightAccumulator {
+		vec_res_vec_t& acc;
+		const std::vector<double>& idfs;
+
+		WeightAccumulator(vec_res_vec_t& acc,
+				const std::vector<double>& idfs)
+		: acc(acc), idfs(idfs)
+		{}
+
+		inline void operator()(uint32_t i, const PostingCursor& c)
+		{
+			if (acc.empty() || acc.back().first != c.docid()) {
+				acc.push_back(vec_res_t(c.docid(), 0));
 			}
+			acc.back().second += float(c.freq())*idfs[i];
 		}
-		acc = result_acc;
+	};
 
+	/**Get the documents where a group of terms appear and their
+	 * (not normalized) weight for the group's terms.
+	 *
+	 * The terms' inverted lists are merged with a heap, so this costs
+	 * O(log n) per posting for n terms. A phrase's documents are the
+	 * ones PhraseMatcher finds, weighted by all its terms.
+	 *
+	 * @param[out] acc Matches, sorted by docid. Will be overwritten.
+	 */
+	void getGroupWeights(const termgroup_t& g, vec_res_vec_t& acc)
+	{
+		const termvec_t& group = g.termids;
+		std::vector<PostingCursor*> open;
+		std::vector<double> idfs;
+		uint32_t ft = 0;
+
+		acc.clear();
+		if (g.phrase) {
+			getPhraseWeights(g, acc);
+			return;
+		}
+
+		getCursor(group.size() - 1);
+		for(size_t i = 0; i < group.size(); ++i) {
+			hdr_entry_t& entry = idx[group[i]];
+			openCursor(cursors[i], group[i]);
+			open.push_back(&cursors[i]);
+			idfs.push_back(log(double(N)/double(entry.ft)));
+			ft += entry.ft;
+		}
+
+		acc.reserve(ft);
+		WeightAccumulator accumulate(acc, idfs);
+		mergePostings(open, accumulate);
 	}
 
+	//! getGroupWeights() for phrases.
+	void getPhraseWeights(const termgroup_t& g, vec_res_vec_t& acc)
+	{
+		const termvec_t& group = g.termids;
+		const size_t n = group.size();
+
+		std::vector<double> idfs(n);
+		for(size_t i = 0; i < n; ++i) {
+			idfs[i] = log(double(N)/double(idx[group[i]].ft));
+		}
+
+		phrases->match(group, g.slop, phrase_docs, &phrase_freqs);
+
+		acc.reserve(phrase_docs.size());
+		for(size_t d = 0; d < phrase_docs.size(); ++d) {
+			double weight = 0;
+			for(size_t i = 0; i < n; ++i) {
+				weight += float(phrase_freqs[d*n + i])*idfs[i];
+			}
+			acc.push_back(vec_res_t(phrase_docs[d], weight));
+		}
+	}
+
+	/**Orders groups of term ids by the number of documents their terms
+	 * appear in, at most.
+	 */
+	struct ByDocumentCount {
+		ifile_idx idx;
+
+		ByDocumentCount(ifile_idx idx)
+		: idx(idx)
+		{}
+
+		inline uint32_t count(const termgroup_t& g) const
+		{
+			const termvec_t& group = g.termids;
+			uint32_t ft = 0;
+			for(size_t i = 0; i < group.size(); ++i) {
+				const uint32_t term_ft = idx[group[i]].ft;
+				if (! g.phrase) {
+					ft += term_ft;
+				} else if (i == 0 || term_ft < ft) {
+					// All of a phrase's terms are in its docs
+					ft = term_ft;
+				}
+			}
+			return ft;
+		}
+
+		inline bool operator()(const termgroup_t& a,
+					const termgroup_t& b) const
+		{
+			return count(a) < count(b);
+		}
+	};
+
 	inline void ilist2docvet(const inverted_list_vec_t& ilist, docidvec_t& ids)
 	{
 		inverted_list_vec_t::const_iterator d;
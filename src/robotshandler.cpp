@@ -1,6 +1,11 @@
 #include "robotshandler.h"
 #include "strmisc.h"
 
+#include <stdlib.h>
+#include <math.h>
+
+#include <algorithm>
+
 static char CRLF[] = "\x0D\x0A";
 
 typedef RobotsParser::key_val_t key_val_t;
@@ -143,6 +148,16 @@ bool RobotsParser::parseRecord()
 		std::string& value = kv.second;
 
 		strip(value);
+		if (key == "crawl-delay") {
+			// It may be fractional. Bogus values are ignored.
+			double delay = strtod(value.c_str(), NULL);
+			if (delay > 0) {
+				// A day is as good as forever
+				crawl_delay = int(ceil(std::min(delay, 86400.0)));
+			}
+			continue;
+		}
+
 		if (value.empty() or value[0] != '/'){
 			// Ignore this line
 			continue;
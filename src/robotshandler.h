@@ -34,7 +34,7 @@ public:
  * ending in CR only, with LF, only and with CRLF,
  * just as the specs require.
  *
- * It can also handle "Allow" rules, although they
+ * It can also handle "Allow" and "Crawl-delay" rules, although they
  * are not part of the old spec, but seems to be
  * supported by a proposed RFC and being in wide use.
  *
@@ -49,6 +49,8 @@ public:
 protected:
 	std::string linedelimiter;
 	robots_rules_t rules;
+	//! Seconds asked between requests, rounded up. 0 if not given.
+	int crawl_delay;
 
 
 	key_val_t getKeyValue();
@@ -59,7 +61,7 @@ protected:
 	bool parseRecord();
 public:
 	RobotsParser(const filebuf& text)
-	: BaseParser(text)
+	: BaseParser(text), rules(), crawl_delay(0)
 	{ 
 		findLineDelimiter();
 	}
@@ -67,6 +69,8 @@ public:
 	void parse();
 
 	robots_rules_t getRules() const{return rules;}
+
+	int getCrawlDelay() const{return crawl_delay;}
 };
 
 
@@ -19,6 +19,15 @@ static char robots_test1[] =
 	"\n"
 	"";
 
+static char robots_delay[] =
+	"User-agent: blah\n"
+	"Crawl-delay: 1000\n"
+	"\n"
+	"User-agent: *\n"
+	"Disallow: /private\n"
+	"Crawl-delay: 2.5\n"
+	"";
+
 static char robots_ufmg[] = {0x55,0x73,0x65,0x72,0x2d,0x61,0x67,0x65,0x6e,0x74,0x3a,0x20,0x2a,0x0d,0x0a,0x44,0x69,0x73,0x61,0x6c,0x6c,0x6f,0x77,0x3a,0x20,0x2f,0x6f,0x6e,0x6c,0x69,0x6e,0x65,0x2f,0x76,0x65,0x73,0x74,0x69,0x62,0x75,0x6c,0x61,0x72,0x32,0x30,0x30,0x36,0x2f};
 
 
@@ -52,6 +61,21 @@ public:
 		TS_ASSERT_EQUALS(rules.front().first ,"/online/vestibular2006/");
 		TS_ASSERT_EQUALS(rules.front().second , false);
 	}
+
+	void test_CrawlDelay()
+	{
+		filebuf  file(robots_delay, sizeof(robots_delay));
+		RobotsParser r(file);
+		r.parse();
+
+		TS_ASSERT_EQUALS(r.getRules().size(), 1);
+		TS_ASSERT_EQUALS(r.getCrawlDelay(), 3);
+
+		filebuf  nodelay(robots_test1, sizeof(robots_test1));
+		RobotsParser r2(nodelay);
+		r2.parse();
+		TS_ASSERT_EQUALS(r2.getCrawlDelay(), 0);
+	}
 };
 
 #endif // __ROBOTSHANDLER_TEST_H
@@ -0,0 +1,137 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+/**@file runbench.cpp
+ * @brief Run generation micro-benchmark.
+ *
+ * Generates synthetic triples, with the same skewed term distribution
+ * used by mergebench, and reports:
+ * - how fast std::sort and radix_sort_triples sort a run buffer;
+ * - the overall run generation throughput of run_inserter, sorting and
+ *   writing included.
+ *
+ * Usage: runbench [run_buffer_mb] [n_runs] [work_dir]
+ *
+ * Runs are created in @c work_dir (default: @c _runbench_dir), which
+ * is removed at the end.
+ */
+
+#include "indexerutils.hpp"
+#include "strmisc.h"
+
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+
+/***********************************************************************
+				    HELPERS
+ ***********************************************************************/
+
+inline double now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//! Synthetic triple generator: documents of ~300 skewed terms each.
+class TripleGenerator {
+	uint32_t docid;
+	int left; //!< Triples left in the current document
+public:
+	TripleGenerator() : docid(0), left(0) { srand(42); }
+
+	run_triple next()
+	{
+		if (left-- == 0) {
+			++docid;
+			left = 300;
+		}
+		// Skewed term ids: small ids are far more common
+		uint32_t termid = uint32_t(rand() % 1000) *
+				  uint32_t(rand() % 1000) / 37;
+		return run_triple(termid, docid, 1 + rand() % 10);
+	}
+};
+
+void report(const std::string& what, size_t n_triples, double elapsed)
+{
+	std::cout << "  " << std::setw(24) << std::left << what <<
+		std::setw(10) << std::right << std::fixed <<
+		std::setprecision(2) << n_triples / elapsed / 1e6 <<
+		" Mtriples/s" << std::endl;
+}
+
+
+/***********************************************************************
+				      MAIN
+ ***********************************************************************/
+
+int main(int argc, char* argv[])
+{
+	const size_t MB = 1<<20;
+
+	size_t run_size = 64 * MB;
+	int n_runs = 4;
+	std::string dir = "_runbench_dir";
+
+	if (argc > 1) { run_size = fromString<size_t>(argv[1]) * MB; }
+	if (argc > 2) { n_runs = fromString<int>(argv[2]); }
+	if (argc > 3) { dir = argv[3]; }
+
+	const size_t run_len = run_size / sizeof(run_triple);
+
+	mkdir(dir.c_str(), S_IRWXU);
+
+	// Sorting alone
+	std::cout << "# Sorting " << run_len << " triples" << std::endl;
+	TripleGenerator gen;
+	std::vector<run_triple> triples(run_len);
+	for(size_t i = 0; i < run_len; ++i) {
+		triples[i] = gen.next();
+	}
+	std::random_shuffle(triples.begin(), triples.end());
+
+	std::vector<run_triple> buf(triples);
+	double start = now();
+	std::sort(buf.begin(), buf.end());
+	report("std::sort", run_len, now() - start);
+
+	std::vector<run_triple> scratch(run_len);
+	buf = triples;
+	start = now();
+	radix_sort_triples(&buf[0], &buf[0] + run_len, &scratch[0]);
+	report("radix_sort_triples", run_len, now() - start);
+	for(size_t i = 1; i < run_len; ++i) {
+		if (buf[i] < buf[i - 1]) {
+			std::cout << "  ** WRONG OUTPUT **" << std::endl;
+			break;
+		}
+	}
+
+	// Whole run generation: generating, sorting and writing
+	std::cout << "# Creating " << n_runs << " runs of " <<
+		run_size / MB << "MB in " << dir << std::endl;
+	start = now();
+	{
+		run_inserter inserter(dir, run_size);
+		for(size_t i = 0; i < n_runs * run_len; ++i) {
+			*inserter++ = gen.next();
+		}
+		inserter.flush();
+	}
+	report("run_inserter", n_runs * run_len, now() - start);
+
+	std::string cmd_line("rm -rf ");
+	cmd_line += dir;
+	system(cmd_line.c_str());
+
+	return 0;
+}
+
+//EOF
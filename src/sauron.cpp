@@ -38,6 +38,7 @@ void* Sauron::run()
 			" i " << stats.n_idle <<
 			" a " << stats.n_active <<
 			std::endl;
+		manager.flushLogs();
 		sleep(SLEEP_TIME);
 	}
 	return (void*)this;
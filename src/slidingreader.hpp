@@ -15,6 +15,15 @@
 #include <iterator>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 /**Reads a file in blocks.
  *
@@ -200,6 +209,334 @@ public:
 	}
 };
 
+/**Background reader thread.
+ *
+ * Serves read requests, in submission order, on behalf of run readers,
+ * so that reading the next block of a run overlaps with the merging of
+ * the current one.
+ *
+ * @see BatchRunReader
+ */
+class ReadAheadThread : public BaseThread {
+public:
+	//! A pending or completed read.
+	struct Request {
+		int fd;
+		off_t offset;
+		char* buf;
+		size_t len;
+		ssize_t result;	//!< Bytes read or -1 on error
+		int error;	//!< errno, if result is -1
+		bool done;	//!< @synchronized(QUEUE_COND)
+
+		Request() : fd(-1), offset(0), buf(0), len(0), result(0),
+			    error(0), done(true) {}
+	};
+
+private:
+	BigBangBabyConditional QUEUE_COND;
+	std::deque<Request*> pending;	//!< @synchronized(QUEUE_COND)
+	bool stopping;			//!< @synchronized(QUEUE_COND)
+
+	//! Prevent Copying and assignment.
+	ReadAheadThread(const ReadAheadThread&);
+
+	//! Prevent Copying and assignment.
+	ReadAheadThread& operator=(const ReadAheadThread&);
+
+public:
+	ReadAheadThread() : BaseThread(), QUEUE_COND(), pending(),
+			    stopping(false) {}
+
+	//! Queue a read. @synchronized(QUEUE_COND)
+	void submit(Request* req)
+	{
+		AutoLock synchronized(QUEUE_COND);
+		pending.push_back(req);
+		// Only once it is queued, or waitFor() would never return
+		req->done = false;
+		QUEUE_COND.notifyAll();
+	}
+
+	//! Wait until a submitted read is done. @synchronized(QUEUE_COND)
+	void waitFor(Request* req)
+	{
+		AutoLock synchronized(QUEUE_COND);
+		while (! req->done) {
+			QUEUE_COND.wait();
+		}
+	}
+
+	//! Finish the pending reads and stop. @synchronized(QUEUE_COND)
+	void stop()
+	{
+		{
+			AutoLock synchronized(QUEUE_COND);
+			stopping = true;
+			QUEUE_COND.notifyAll();
+		}
+		join();
+	}
+
+	/**Read up to @p len bytes at @p offset, retrying short reads.
+	 *
+	 * @return the number of bytes read, less than @p len only at EOF,
+	 * 	   or -1 on error.
+	 */
+	static ssize_t readFully(int fd, char* buf, size_t len, off_t offset)
+	{
+		size_t total = 0;
+		while (total < len) {
+			ssize_t n = pread(fd, buf + total, len - total,
+					offset + total);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			} else if (n == 0) {
+				break;
+			}
+			total += n;
+		}
+		return total;
+	}
+
+	void* run()
+	{
+		while(true) {
+			Request* req;
+			{
+				AutoLock synchronized(QUEUE_COND);
+				while (pending.empty() && !stopping) {
+					QUEUE_COND.wait();
+				}
+				if (pending.empty()) {
+					break;
+				}
+				req = pending.front();
+				pending.pop_front();
+			}
+
+			req->result = readFully(req->fd, req->buf, req->len,
+						req->offset);
+			req->error = errno;
+
+			{
+				AutoLock synchronized(QUEUE_COND);
+				req->done = true;
+				QUEUE_COND.notifyAll();
+			}
+		}
+		return NULL;
+	}
+};
+
+/**Non-virtual, block-refilled run reader.
+ *
+ * Unlike the BaseSlidingReader family, this reader has no virtual methods
+ * and exposes its head triple by reference, so merging code can compare
+ * and advance readers without any indirect call. Triples are read from
+ * disk @c block_size bytes at a time.
+ *
+ * If a ReadAheadThread is given, the reader is double-buffered: while
+ * one block is being merged the next one is read in the background, and
+ * the merger only stalls if it drains a block before the next one
+ * arrives. Otherwise blocks are read synchronously, when needed.
+ *
+ * The time spent waiting for data is accounted in getStallTime().
+ *
+ * Readers may be restricted to a byte range of the run, so that several
+ * mergers can share the same runs, each one reading just its part.
+ *
+ * @see LoserTreeRunMerger
+ */
+class BatchRunReader {
+	size_t max_elements;		//!< Max number of triples in a block
+	const ArrDelAdapter<run_triple> front; //!< Block being consumed
+	const ArrDelAdapter<run_triple> back;  //!< Block being read ahead
+	run_triple* front_buf;		//!< Current roles of the buffers
+	run_triple* back_buf;
+	int fd;				//!< Run file
+	off_t offset;			//!< Offset of the next read
+	off_t limit;			//!< Offset past the last byte to read
+	ReadAheadThread* io;		//!< Background reader, if any
+	ReadAheadThread::Request req;	//!< The read-ahead request
+	double stall_time;		//!< Seconds spent waiting for data
+	const run_triple* cur_pos;	//!< Current reading position
+	const run_triple* end_pos;	//!< End of the triples in memory
+
+	//! Prevent Copying and assignment.
+	BatchRunReader(const BatchRunReader&);
+
+	//! Prevent Copying and assignment.
+	BatchRunReader& operator=(const BatchRunReader&);
+
+	//! Number of triples that fit in @p max_mem bytes - at least one.
+	static size_t blockElements(size_t max_mem)
+	{
+		return std::max(max_mem / sizeof(run_triple), size_t(1));
+	}
+
+	static double now()
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec / 1e6;
+	}
+
+	//! Size of the next read - zero past the limit.
+	size_t nextReadLen() const
+	{
+		if (offset >= limit) {
+			return 0;
+		}
+		return std::min(off_t(max_elements * sizeof(run_triple)),
+				limit - offset);
+	}
+
+	//! Queue the read of the block after the current one.
+	void readAhead()
+	{
+		req.fd = fd;
+		req.offset = offset;
+		req.buf = (char*) back_buf;
+		req.len = nextReadLen();
+		if (req.len == 0) {
+			// Nothing left: complete the request right away
+			req.result = 0;
+			req.error = 0;
+			return;
+		}
+		io->submit(&req);
+	}
+
+	/**Make the triples just read the current block.
+	 *
+	 * @throw ErrnoSysException if the read failed.
+	 * @throw std::runtime_error if the block ends in a partial triple.
+	 */
+	void useBlock(run_triple* buf, ssize_t n)
+	{
+		if (n < 0) {
+			throw ErrnoSysException("Error reading RUN file");
+		}
+		if (n % sizeof(run_triple) != 0) {
+			throw std::runtime_error("Truncated RUN file");
+		}
+
+		offset += n;
+		cur_pos = buf;
+		end_pos = &buf[n / sizeof(run_triple)];
+	}
+
+	//! Get the next block of triples. Leaves cur_pos == end_pos on EOF.
+	void refill()
+	{
+		double start = now();
+
+		if (io) {
+			io->waitFor(&req);
+			errno = req.error;
+			std::swap(front_buf, back_buf);
+			useBlock(front_buf, req.result);
+			// Don't bother reading past the end
+			if (cur_pos != end_pos) {
+				readAhead();
+			}
+		} else {
+			ssize_t n = ReadAheadThread::readFully(fd,
+					(char*) front_buf, nextReadLen(),
+					offset);
+			useBlock(front_buf, n);
+		}
+
+		stall_time += now() - start;
+	}
+
+public:
+	/**Constructor.
+	 *
+	 * @param filename The run file.
+	 * @param block_size Size in bytes of each block. The reader uses
+	 * 		     twice that if @p read_ahead is given.
+	 * @param read_ahead Background reader thread. If null, blocks are
+	 * 		     read synchronously.
+	 * @param start Byte offset of the first triple to read.
+	 * @param end Byte offset past the last triple to read. If negative,
+	 * 	      the run is read up to its end.
+	 */
+	BatchRunReader(const char* filename, size_t block_size,
+			ReadAheadThread* read_ahead = 0, off_t start = 0,
+			off_t end = -1)
+	: max_elements( blockElements(block_size) ),
+	  front(new run_triple[ max_elements ]),
+	  back(read_ahead ? new run_triple[ max_elements ] : 0),
+	  front_buf(front.get()),
+	  back_buf(back.get()),
+	  fd(open(filename, O_RDONLY)),
+	  offset(start),
+	  limit(end < 0 ? std::numeric_limits<off_t>::max() : end),
+	  io(read_ahead),
+	  req(),
+	  stall_time(0),
+	  cur_pos(0),
+	  end_pos(0)
+	{
+		if (fd < 0) {
+			std::string msg("Error opening RUN file ");
+			msg +=filename;
+			throw ErrnoSysException(msg);
+		}
+		// Runs are read from start to end, once.
+		posix_fadvise(fd, start, end < 0 ? 0 : end - start,
+				POSIX_FADV_SEQUENTIAL);
+
+		try {
+			if (io) {
+				// Prime the pipeline: read the first block
+				// into "back", refill() will swap it to the
+				// front.
+				readAhead();
+			}
+			refill();
+		} catch(...) {
+			// No destructor to do this for us: the buffers go
+			// away with this exception.
+			if (io) {
+				io->waitFor(&req);
+			}
+			close(fd);
+			throw;
+		}
+	}
+
+	~BatchRunReader()
+	{
+		// Never free a buffer the I/O thread may be writing to
+		if (io) {
+			io->waitFor(&req);
+		}
+		close(fd);
+	}
+
+	inline bool eof() const { return cur_pos == end_pos; }
+
+	//! The current (smallest unread) triple. Only valid if not eof().
+	inline const run_triple& head() const { return *cur_pos; }
+
+	//! Move to the next triple, reading a new block if needed.
+	inline void advance()
+	{
+		if (++cur_pos == end_pos) {
+			refill();
+		}
+	}
+
+	//! Seconds spent waiting for data so far.
+	double getStallTime() const { return stall_time; }
+};
+
 #endif // __SLIDINGREADER_H
 
 
@@ -0,0 +1,193 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "termdictionary.hpp"
+
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+
+
+/***********************************************************************
+				 STRING ARENA
+ ***********************************************************************/
+
+const size_t StringArena::CHUNK_SIZE;
+
+StringArena::~StringArena()
+{
+	std::vector<char*>::iterator i;
+	for(i = chunks.begin(); i != chunks.end(); ++i){
+		delete[] *i;
+	}
+}
+
+const char* StringArena::store(const char* str, size_t len)
+{
+	size_t needed = len + 1; // account for \0
+
+	if (cur == 0 || size_t(end - cur) < needed) {
+		// Huge strings get a chunk of their own
+		size_t chunk_size = std::max(needed, CHUNK_SIZE);
+		cur = new char[chunk_size];
+		end = cur + chunk_size;
+		chunks.push_back(cur);
+	}
+
+	char* copy = cur;
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	cur += needed;
+
+	return copy;
+}
+
+
+/***********************************************************************
+				TERM DICTIONARY
+ ***********************************************************************/
+
+namespace {
+	//! Round @p n up to a power of 2.
+	inline size_t roundUpPow2(size_t n)
+	{
+		size_t p = 1;
+		while (p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+}
+
+TermDictionary::TermDictionary(unsigned int n_stripes_hint,
+			size_t stripe_capacity)
+: stripes(0), stripe_shift(64), n_stripes(1), next_id(0)
+{
+	// Use the upper bits of the hash to select the stripe
+	while (n_stripes < n_stripes_hint) {
+		n_stripes <<= 1;
+		--stripe_shift;
+	}
+
+	size_t capacity = roundUpPow2(std::max(stripe_capacity, size_t(2)));
+
+	stripes = new Stripe[n_stripes];
+	for(unsigned int i = 0; i < n_stripes; ++i) {
+		stripes[i].table = new Slot[capacity];
+		memset(stripes[i].table, 0, capacity * sizeof(Slot));
+		stripes[i].mask = capacity - 1;
+	}
+}
+
+TermDictionary::~TermDictionary()
+{
+	for(unsigned int i = 0; i < n_stripes; ++i) {
+		delete[] stripes[i].table;
+	}
+	delete[] stripes;
+}
+
+TermDictionary::Slot* TermDictionary::lookup(const Stripe& s, uint64_t hash,
+				const char* term, size_t len)
+{
+	size_t pos = hash & s.mask;
+
+	// The table is never full, so this will stop
+	while(true) {
+		Slot* slot = &s.table[pos];
+
+		if (slot->term == 0 ||
+		    (slot->hash == hash && slot->len == len &&
+		     memcmp(slot->term, term, len) == 0)) {
+			return slot;
+		}
+
+		pos = (pos + 1) & s.mask;
+	}
+}
+
+void TermDictionary::grow(Stripe& s)
+{
+	size_t old_capacity = s.mask + 1;
+	size_t new_capacity = old_capacity << 1;
+	Slot* old_table = s.table;
+
+	s.table = new Slot[new_capacity];
+	memset(s.table, 0, new_capacity * sizeof(Slot));
+	s.mask = new_capacity - 1;
+
+	// Reinsert using the stored hashes - no string is touched
+	for(size_t i = 0; i < old_capacity; ++i) {
+		const Slot& old = old_table[i];
+		if (old.term) {
+			size_t pos = old.hash & s.mask;
+			while (s.table[pos].term) {
+				pos = (pos + 1) & s.mask;
+			}
+			s.table[pos] = old;
+		}
+	}
+
+	delete[] old_table;
+}
+
+int TermDictionary::getId(const char* term, size_t len)
+{
+	uint64_t hash = FNV::hash64(term, len);
+	Stripe& s = stripeFor(hash);
+
+	AutoLock synchronized(s.LOCK);
+
+	Slot* slot = lookup(s, hash, term, len);
+	if (slot->term) {
+		return slot->id;
+	}
+
+	// New term. Keep the load factor under 1/2.
+	if ( 2 * (s.used + 1) > s.mask + 1) {
+		grow(s);
+		slot = lookup(s, hash, term, len);
+	}
+
+	slot->hash = hash;
+	slot->term = s.arena.store(term, len);
+	slot->len = len;
+	slot->id = __sync_fetch_and_add(&next_id, 1);
+	++s.used;
+
+	return slot->id;
+}
+
+int TermDictionary::find(const char* term, size_t len)
+{
+	uint64_t hash = FNV::hash64(term, len);
+	Stripe& s = stripeFor(hash);
+
+	AutoLock synchronized(s.LOCK);
+
+	Slot* slot = lookup(s, hash, term, len);
+
+	return slot->term ? slot->id : -1;
+}
+
+void TermDictionary::getTermsById(TermRefVec& id2term) const
+{
+	id2term.resize(next_id);
+
+	for(unsigned int i = 0; i < n_stripes; ++i) {
+		const Stripe& s = stripes[i];
+		for(size_t pos = 0; pos <= s.mask; ++pos) {
+			const Slot& slot = s.table[pos];
+			if (slot.term) {
+				if (slot.id < 0 || size_t(slot.id) >= id2term.size()) {
+					throw std::runtime_error("TermDictionary:"
+						" term id out of range");
+				}
+				id2term[slot.id].str = slot.term;
+				id2term[slot.id].len = slot.len;
+			}
+		}
+	}
+}
+
+
+// EOF
@@ -0,0 +1,178 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __TERMDICTIONARY_H__
+#define __TERMDICTIONARY_H__
+/**@file termdictionary.hpp
+ * @brief Concurrent term -> term id dictionary used while indexing.
+ */
+
+#include "threadingutils.h"
+#include "fnv1hash.hpp"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/***********************************************************************
+				 STRING ARENA
+ ***********************************************************************/
+
+/**Append-only storage for NUL-terminated strings.
+ *
+ * Strings are copied into large chunks and never moved or freed until
+ * the arena is destroyed, so pointers returned by store() remain valid
+ * for the arena's whole life.
+ */
+class StringArena {
+	static const size_t CHUNK_SIZE = 64*1024;
+
+	std::vector<char*> chunks;
+	char* cur;	//!< Free space start in the current chunk
+	char* end;	//!< End of the current chunk
+
+	//! Prevent Copying and assignment.
+	StringArena(const StringArena&);
+
+	//! Prevent Copying and assignment.
+	StringArena& operator=(const StringArena&);
+public:
+	StringArena() : chunks(), cur(0), end(0) {}
+
+	~StringArena();
+
+	/**Copy a string into the arena.
+	 *
+	 * @return A pointer to the NUL-terminated copy of @p str.
+	 */
+	const char* store(const char* str, size_t len);
+};
+
+
+/***********************************************************************
+				TERM DICTIONARY
+ ***********************************************************************/
+
+/**Concurrent term dictionary.
+ *
+ * Maps terms to term ids, assigning a new id, in the [0, size()) range,
+ * to every term seen for the first time. It can be shared by several
+ * indexing threads.
+ *
+ * Terms are distributed among a fixed number of stripes by their hash.
+ * Each stripe is an open addressing (linear probing) table with its own
+ * lock and its own string arena, so threads only contend when they look
+ * up terms in the same stripe. Hashes are computed once per lookup and
+ * stored in the table, so growing a stripe does not rehash any string
+ * and most failed comparisons are settled without a memcmp.
+ *
+ * Term ids come from a single atomic counter, so they are dense and
+ * unique across stripes.
+ */
+class TermDictionary {
+public:
+	//! A term, as stored in the dictionary.
+	struct TermRef {
+		const char* str;	//!< NUL-terminated term
+		uint32_t len;		//!< Term length, without the NUL
+	};
+
+	typedef std::vector<TermRef> TermRefVec;
+
+	/**Constructor.
+	 *
+	 * @param n_stripes Number of stripes. Rounded up to a power of 2.
+	 * @param stripe_capacity Initial number of slots in each stripe.
+	 * 			  Rounded up to a power of 2.
+	 */
+	TermDictionary(unsigned int n_stripes = 64,
+			size_t stripe_capacity = 1024);
+
+	~TermDictionary();
+
+	/**Get the id of a term, adding it to the dictionary if needed.
+	 *
+	 * @synchronized(the term's stripe lock)
+	 */
+	int getId(const char* term, size_t len);
+
+	inline int getId(const std::string& term)
+	{
+		return getId(term.c_str(), term.size());
+	}
+
+	/**Get the id of a term, without adding it.
+	 *
+	 * @return the term id or -1 if the term is not in the dictionary.
+	 *
+	 * @synchronized(the term's stripe lock)
+	 */
+	int find(const char* term, size_t len);
+
+	inline int find(const std::string& term)
+	{
+		return find(term.c_str(), term.size());
+	}
+
+	//! Number of terms in the dictionary.
+	size_t size() const { return next_id; }
+
+	/**List all the terms, in term id order.
+	 *
+	 * @param[out] id2term Entry @e i will hold the term whose id is @e i.
+	 *
+	 * @warning Not synchronized. Call this only after all the threads
+	 * 	    using the dictionary are done.
+	 */
+	void getTermsById(TermRefVec& id2term) const;
+
+private:
+	struct Slot {
+		uint64_t hash;
+		const char* term;	//!< null if the slot is empty
+		uint32_t len;
+		int id;
+	};
+
+	struct Stripe {
+		CatholicShameMutex LOCK;
+		Slot* table;
+		size_t mask;	//!< Number of slots - 1
+		size_t used;	//!< Number of non-empty slots
+		StringArena arena;
+
+		Stripe() : LOCK(), table(0), mask(0), used(0), arena() {}
+	};
+
+	Stripe* stripes;
+	unsigned int stripe_shift; //!< Hash bits not used to select a stripe
+	unsigned int n_stripes;
+	volatile int next_id;
+
+	//! Select the stripe for a hash. Uses the hash's upper bits.
+	inline Stripe& stripeFor(uint64_t hash) const
+	{
+		return stripes[ stripe_shift < 64 ? hash >> stripe_shift : 0];
+	}
+
+	/**Find the slot holding a term or the empty slot where it should
+	 * be stored.
+	 *
+	 * Caller must hold the stripe's lock.
+	 */
+	static Slot* lookup(const Stripe& s, uint64_t hash, const char* term,
+				size_t len);
+
+	//! Double a stripe's capacity. Caller must hold the stripe's lock.
+	static void grow(Stripe& s);
+
+	//! Prevent Copying and assignment.
+	TermDictionary(const TermDictionary&);
+
+	//! Prevent Copying and assignment.
+	TermDictionary& operator=(const TermDictionary&);
+};
+
+
+#endif // __TERMDICTIONARY_H__
+
+// EOF
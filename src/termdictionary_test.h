@@ -0,0 +1,157 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __TERMDICTIONARY_TEST_H
+#define __TERMDICTIONARY_TEST_H
+
+#include "termdictionary.hpp"
+#include "indexerutils.hpp"
+#include "cxxtest/TestSuite.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <sstream>
+#include <set>
+
+
+/**Inserts the same terms as its siblings, in a different order.*/
+class TermInserterThread : public BaseThread {
+	TermDictionary& dict;
+	int n_terms;
+public:
+	TermInserterThread(TermDictionary& d, int n) : dict(d), n_terms(n) {}
+
+	void* run()
+	{
+		for(int i = 0; i < n_terms; ++i) {
+			std::ostringstream term;
+			term << "term" << ((i * 7919 + t_id) % n_terms);
+			dict.getId(term.str());
+		}
+		return NULL;
+	}
+};
+
+
+class TermDictionaryTestSuit : public CxxTest::TestSuite {
+	static const std::string SANDBOX_DIR;
+public:
+
+	/*
+	 * Test Fixures setup
+	 */
+	void setUp()
+	{
+		mkdir(SANDBOX_DIR.c_str(),S_IRWXU);
+	}
+
+	void tearDown()
+	{
+		std::string cmd_line("rm -rf ");
+		cmd_line += SANDBOX_DIR;
+
+		system(cmd_line.c_str());
+	}
+
+	/*
+	 * Tests
+	 */
+
+	void testSequentialIds()
+	{
+		TermDictionary dict;
+
+		TS_ASSERT_EQUALS(dict.size(), 0u);
+		TS_ASSERT_EQUALS(dict.find("casa"), -1);
+
+		TS_ASSERT_EQUALS(dict.getId("casa"), 0);
+		TS_ASSERT_EQUALS(dict.getId("ação"), 1);
+		TS_ASSERT_EQUALS(dict.getId("casa"), 0);
+		TS_ASSERT_EQUALS(dict.getId("cas"), 2);
+
+		TS_ASSERT_EQUALS(dict.find("ação"), 1);
+		TS_ASSERT_EQUALS(dict.find("casas"), -1);
+		TS_ASSERT_EQUALS(dict.size(), 3u);
+	}
+
+	void testGrowthAndIdOrder()
+	{
+		// Small stripes, so they must grow many times
+		TermDictionary dict(4, 2);
+		const int n_terms = 5000;
+
+		for(int i = 0; i < n_terms; ++i) {
+			std::ostringstream term;
+			term << "t" << i;
+			TS_ASSERT_EQUALS(dict.getId(term.str()), i);
+		}
+		TS_ASSERT_EQUALS(dict.size(), size_t(n_terms));
+
+		TermDictionary::TermRefVec id2term;
+		dict.getTermsById(id2term);
+		TS_ASSERT_EQUALS(id2term.size(), size_t(n_terms));
+		for(int i = 0; i < n_terms; ++i) {
+			std::ostringstream term;
+			term << "t" << i;
+			TS_ASSERT_EQUALS(std::string(id2term[i].str,
+						id2term[i].len), term.str());
+		}
+	}
+
+	void testConcurrentInsertion()
+	{
+		TermDictionary dict;
+		const int n_terms = 2000;
+		const int n_threads = 4;
+
+		std::vector<TermInserterThread*> threads;
+		for(int t = 0; t < n_threads; ++t) {
+			threads.push_back(new TermInserterThread(dict, n_terms));
+		}
+		for(int t = 0; t < n_threads; ++t) {
+			threads[t]->start();
+		}
+		for(int t = 0; t < n_threads; ++t) {
+			threads[t]->join();
+			delete threads[t];
+		}
+
+		// Every term got a single, unique id in [0, n_terms)
+		TS_ASSERT_EQUALS(dict.size(), size_t(n_terms));
+		std::set<int> ids;
+		for(int i = 0; i < n_terms; ++i) {
+			std::ostringstream term;
+			term << "term" << i;
+			int id = dict.find(term.str());
+			TS_ASSERT(id >= 0 && id < n_terms);
+			ids.insert(id);
+		}
+		TS_ASSERT_EQUALS(ids.size(), size_t(n_terms));
+	}
+
+	void testDumpAndLoad()
+	{
+		TermDictionary dict;
+		dict.getId("zebra");
+		dict.getId("abacate");
+		dict.getId("");
+		dict.getId("çedilha");
+
+		dump_vocabulary(dict, SANDBOX_DIR.c_str());
+
+		StrIntMap voc;
+		load_vocabulary(voc, SANDBOX_DIR.c_str());
+
+		TS_ASSERT_EQUALS(voc.size(), 4u);
+		TS_ASSERT_EQUALS(voc["zebra"], 0);
+		TS_ASSERT_EQUALS(voc["abacate"], 1);
+		TS_ASSERT_EQUALS(voc[""], 2);
+		TS_ASSERT_EQUALS(voc["çedilha"], 3);
+	}
+};
+
+const std::string TermDictionaryTestSuit::SANDBOX_DIR = "_termdict_test_dir";
+
+#endif // __TERMDICTIONARY_TEST_H
+
+// EOF
@@ -10,6 +10,8 @@
  */
 #include "common.h"
 #include <pthread.h>
+#include <time.h>
+#include <deque>
 #include "mmapedfile.h" // For ErrnoSysException
 
 /* ********************************************************************** *
@@ -78,6 +80,17 @@ public:
 	//!@name Conditional specific methods
 	//!@{
 	void wait() { pthread_cond_wait(&_cond, & (CondLock._lock) ); }
+
+	/**Wait until notified or until @p deadline, whichever comes first.
+	 *
+	 * @return false if the deadline was reached.
+	 */
+	bool timedWait(time_t deadline)
+	{
+		struct timespec ts = {deadline, 0};
+		return pthread_cond_timedwait(&_cond, &(CondLock._lock),
+						&ts) == 0;
+	}
 	void notify() { pthread_cond_signal(&_cond); }
 	void notifyAll() { pthread_cond_broadcast(&_cond); }
 	//!@}
@@ -132,6 +145,77 @@ public:
 };
 
 
+/* ********************************************************************** *
+				    QUEUES
+ * ********************************************************************** */
+
+/**A FIFO queue threads can wait on.
+ *
+ * Producers put() items, consumers get() them, waiting while the queue is
+ * empty. With the items put in it upfront, it also works as a pool of
+ * objects threads take turns using. See PooledItem.
+ */
+template<class T>
+class BlockingQueue {
+	std::deque<T> items;
+	BigBangBabyConditional cond;
+
+	//! Prevent Copying and assignment.
+	BlockingQueue(const BlockingQueue&);
+	//! Prevent Copying and assignment.
+	BlockingQueue& operator=(const BlockingQueue&);
+public:
+	BlockingQueue() : items(), cond() {}
+
+	void put(const T& item)
+	{
+		AutoLock lock(cond);
+		items.push_back(item);
+		cond.notify();
+	}
+
+	//! Remove the oldest item, waiting for one if the queue is empty.
+	T get()
+	{
+		AutoLock lock(cond);
+		while (items.empty()) {
+			cond.wait();
+		}
+		T item = items.front();
+		items.pop_front();
+		return item;
+	}
+
+	size_t size()
+	{
+		AutoLock lock(cond);
+		return items.size();
+	}
+};
+
+/**Scoped use of an item of a BlockingQueue used as a pool.
+ *
+ * The item is taken from the pool on construction, waiting for one if
+ * needed, and given back on destruction.
+ */
+template<class T>
+class PooledItem {
+	BlockingQueue<T>& pool;
+	T _item;
+
+	//! Prevent Copying and assignment.
+	PooledItem(const PooledItem&);
+	//! Prevent Copying and assignment.
+	PooledItem& operator=(const PooledItem&);
+public:
+	PooledItem(BlockingQueue<T>& pool) : pool(pool), _item(pool.get()) {}
+
+	~PooledItem() { pool.put(_item); }
+
+	inline T& item() { return _item; }
+};
+
+
 /* ********************************************************************** *
 			     THREADING ABSTRACTIONS
  * ********************************************************************** */
@@ -0,0 +1,194 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "topk.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+
+/***********************************************************************
+			     Max-score bounds file
+ ***********************************************************************/
+
+void write_max_scores(const std::string& dir,
+			const std::vector<double>& max_scores)
+{
+	std::ofstream out;
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(std::string(dir + MAXSCORE_SUFIX).c_str(),
+		 std::ios_base::binary);
+	if (! max_scores.empty()) {
+		out.write((const char*) &max_scores[0],
+			  max_scores.size() * sizeof(double));
+	}
+}
+
+bool read_max_scores(const std::string& dir, std::vector<double>& max_scores)
+{
+	max_scores.clear();
+
+	std::ifstream in(std::string(dir + MAXSCORE_SUFIX).c_str(),
+			 std::ios_base::binary);
+	if (! in) {
+		return false;
+	}
+
+	in.seekg(0, std::ios_base::end);
+	size_t len = in.tellg();
+	in.seekg(0, std::ios_base::beg);
+
+	max_scores.resize(len / sizeof(double));
+	if (! max_scores.empty()) {
+		in.read((char*) &max_scores[0],
+			max_scores.size() * sizeof(double));
+	}
+	if (! in) {
+		throw std::runtime_error("Error reading " + dir +
+					 MAXSCORE_SUFIX);
+	}
+
+	return true;
+}
+
+
+/***********************************************************************
+				 WandTopKScorer
+ ***********************************************************************/
+
+namespace {
+	//! Orders terms by their cursors' current docid.
+	inline bool by_docid(const WandTopKScorer::term_t* a,
+			     const WandTopKScorer::term_t* b)
+	{
+		return a->cursor->docid() < b->cursor->docid();
+	}
+
+	inline bool at_eof(const WandTopKScorer::term_t* t)
+	{
+		return t->cursor->eof();
+	}
+
+	/**Restore the docid order of terms after some cursors moved.
+	 *
+	 * Only a few terms move at each step, so an insertion sort
+	 * beats std::sort here.
+	 */
+	inline void resort(std::vector<WandTopKScorer::term_t*>& live)
+	{
+		for(size_t i = 1; i < live.size(); ++i) {
+			WandTopKScorer::term_t* t = live[i];
+			size_t j = i;
+			for(; j > 0 && by_docid(t, live[j - 1]); --j) {
+				live[j] = live[j - 1];
+			}
+			live[j] = t;
+		}
+	}
+}
+
+WandTopKScorer::WandTopKScorer(const NormTable& norms, size_t k)
+: norms(norms),
+  k(k),
+  terms(),
+  live(),
+  n_scored(0)
+{}
+
+void WandTopKScorer::reset(size_t new_k)
+{
+	k = new_k;
+	terms.clear();
+	n_scored = 0;
+}
+
+void WandTopKScorer::addTerm(PostingCursor* cursor, double idf,
+				double max_score)
+{
+	terms.push_back(term_t(cursor, idf, max_score));
+}
+
+void WandTopKScorer::offer(vec_res_vec_t& heap, docid_t doc, double score)
+{
+	vec_res_t match(doc, score);
+
+	// heap.front() is the worst of the k best so far
+	if (heap.size() < k) {
+		heap.push_back(match);
+		std::push_heap(heap.begin(), heap.end(), better);
+	} else if (better(match, heap.front())) {
+		std::pop_heap(heap.begin(), heap.end(), better);
+		heap.back() = match;
+		std::push_heap(heap.begin(), heap.end(), better);
+	}
+}
+
+void WandTopKScorer::run(vec_res_vec_t& result)
+{
+	result.clear();
+	n_scored = 0;
+	if (k == 0) {
+		return;
+	}
+	result.reserve(k);
+
+	live.clear();
+	for(size_t i = 0; i < terms.size(); ++i) {
+		if (! terms[i].cursor->eof()) {
+			live.push_back(&terms[i]);
+		}
+	}
+
+	std::sort(live.begin(), live.end(), by_docid);
+	while (! live.empty()) {
+
+		// Until the heap is full, anything goes
+		double threshold = (result.size() < k) ? -1.0 :
+							 result.front().second;
+
+		// The pivot is the first list where the bounds of the lists
+		// up to it beat the threshold: no document before the pivot's
+		// current one can enter the heap.
+		double bound = 0.0;
+		size_t p = 0;
+		for(; p < live.size(); ++p) {
+			bound += live[p]->max_score;
+			if (bound > threshold) {
+				break;
+			}
+		}
+		if (p == live.size()) {
+			break;	// Nothing left can beat the k-th best
+		}
+		const docid_t pivot = live[p]->cursor->docid();
+
+		if (live[0]->cursor->docid() == pivot) {
+			// All the lists up to the pivot are at its document
+			const wdmaxfdt_t& wf = norms[pivot];
+			double score = 0.0;
+			for(size_t i = 0; i < live.size() &&
+					live[i]->cursor->docid() == pivot; ++i) {
+				PostingCursor* c = live[i]->cursor;
+				score += term_doc_weight(c->freq(), live[i]->idf,
+							 wf);
+				c->next();
+			}
+			++n_scored;
+			offer(result, pivot, score);
+		} else {
+			// Skip the lists before the pivot straight to it
+			for(size_t i = 0; i < p; ++i) {
+				live[i]->cursor->nextGEQ(pivot);
+			}
+		}
+
+		live.erase(std::remove_if(live.begin(), live.end(), at_eof),
+			   live.end());
+		resort(live);
+	}
+
+	std::sort_heap(result.begin(), result.end(), better);
+}
+
+
+// EOF
@@ -0,0 +1,134 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __TOPK_H__
+#define __TOPK_H__
+/**@file topk.hpp
+ * @brief Document-at-a-time top-k retrieval for the vector-space model.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include "vectorial.hpp"
+#include "indexcompression.hpp"
+
+
+/***********************************************************************
+			     Max-score bounds file
+ ***********************************************************************/
+
+/**Name of the per-term max-score bounds file of an inverted file.
+ *
+ * It's a plain array of doubles, indexed by termid. The value of a term is
+ * the biggest term_doc_weight() it has in any document. It is written by
+ * mknorms, as it depends on the document's norms.
+ */
+const std::string MAXSCORE_SUFIX = "/index.maxscore";
+
+//! Write the max-score bounds of the inverted file in @p dir.
+void write_max_scores(const std::string& dir,
+			const std::vector<double>& max_scores);
+
+/**Read the max-score bounds of the inverted file in @p dir.
+ *
+ * @return false if there is no such file.
+ */
+bool read_max_scores(const std::string& dir, std::vector<double>& max_scores);
+
+
+/***********************************************************************
+				 WandTopKScorer
+ ***********************************************************************/
+
+/**Top-k retrieval with WAND.
+ *
+ * Documents are scored one at a time, in docid order, over the lists of
+ * all the query terms ("OR" semmantics), and only the best k are kept, in
+ * a bounded heap.
+ *
+ * Each term comes with an upper bound of its contribution to the
+ * similarity of any document. A document that appears only in lists whose
+ * bounds add up to less than the k-th best similarity found so far can't
+ * make into the result, so those lists are just skipped past it. Once the
+ * heap fills up with good matches most of the postings of common terms
+ * are never even decoded.
+ *
+ * See Broder et al., "Efficient Query Evaluation using a Two-Level
+ * Retrieval Process", CIKM 2003.
+ *
+ * @warning The cursors aren't owned by the scorer.
+ */
+class WandTopKScorer {
+public:
+	//! A query term.
+	struct term_t {
+		PostingCursor* cursor;
+		double idf;
+		double max_score;	//!< Upper bound of its contribution
+
+		term_t(PostingCursor* c, double i, double m)
+		: cursor(c), idf(i), max_score(m)
+		{}
+	};
+
+	/**Result ordering: by similarity, descending, then by docid.
+	 *
+	 * Breaking ties by docid makes the result independent of how
+	 * documents were skipped.
+	 */
+	inline static bool better(const vec_res_t& a, const vec_res_t& b)
+	{
+		return (a.second > b.second) ||
+			(a.second == b.second && a.first < b.first);
+	}
+
+private:
+	const NormTable& norms;
+	size_t k;
+	std::vector<term_t> terms;
+	std::vector<term_t*> live;	//!< Terms not at eof, by docid
+	uint32_t n_scored;
+
+	//!Assignment operator doesn't make sense!
+	WandTopKScorer& operator=(const WandTopKScorer&);
+
+	//! Add a document to the heap if it is among the k best so far.
+	void offer(vec_res_vec_t& heap, docid_t doc, double score);
+
+public:
+	/**Constructor.
+	 *
+	 * @param norms Document norms, as loaded from mknorms's output.
+	 * @param k Number of documents to retrieve.
+	 */
+	WandTopKScorer(const NormTable& norms, size_t k);
+
+	/**Start a new query, retrieving @p k documents.
+	 *
+	 * Forgets all terms. Memory is kept for the next query.
+	 */
+	void reset(size_t k);
+
+	/**Add a query term.
+	 *
+	 * @param cursor The term's inverted list.
+	 * @param idf The term's \f$\log\frac{N}{f_{t}}\f$.
+	 * @param max_score Upper bound of term_doc_weight() for this term.
+	 * 		    Infinity disables skipping for this term.
+	 */
+	void addTerm(PostingCursor* cursor, double idf, double max_score);
+
+	/**Retrieve the best k documents.
+	 *
+	 * @param[out] result The documents, best first. Overwritten.
+	 */
+	void run(vec_res_vec_t& result);
+
+	//! Number of documents fully scored by run().
+	inline uint32_t getNScored() const { return n_scored; }
+};
+
+
+#endif // __TOPK_H__
+
+//EOF
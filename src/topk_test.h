@@ -0,0 +1,165 @@
+#ifndef __TOPK_TEST_H
+#define __TOPK_TEST_H
+
+#include "cxxtest/TestSuite.h"
+#include "topk.hpp"
+
+#include <stdlib.h>
+#include <math.h>
+#include <limits>
+#include <map>
+
+
+class WandTopKScorerTestSuit : public CxxTest::TestSuite {
+
+	static const uint32_t N = 20000;
+
+	std::vector<wdmaxfdt_t> flat_norms;
+	NormTable norms;
+	std::vector<inverted_list_vec_t> lists;
+	std::vector<StreamVByteCompressor::charvec_t> compressed;
+	std::vector<double> idfs;
+	std::vector<double> max_scores;
+
+	//! A list with about @p ft postings, spread over the collection.
+	void addList(uint32_t ft)
+	{
+		inverted_list_vec_t ilist;
+		for(uint32_t d = 0; d < N; ++d) {
+			if (uint32_t(rand()) % N < ft) {
+				ilist.push_back(d_fdt_t(d, 1 + rand() % 10));
+			}
+		}
+
+		double idf = log(double(N)/double(ilist.size()));
+		double max_score = 0.0;
+		for(size_t i = 0; i < ilist.size(); ++i) {
+			max_score = std::max(max_score, term_doc_weight(
+				ilist[i].second, idf, norms[ilist[i].first]));
+		}
+
+		StreamVByteCompressor::charvec_t out;
+		StreamVByteCompressor::compress(ilist, out);
+
+		lists.push_back(ilist);
+		compressed.push_back(out);
+		idfs.push_back(idf);
+		max_scores.push_back(max_score);
+	}
+
+	//! The best @p k documents, scoring every one of them.
+	void exhaustive(size_t k, vec_res_vec_t& result)
+	{
+		std::map<docid_t, double> acc;
+		for(size_t t = 0; t < lists.size(); ++t) {
+			for(size_t i = 0; i < lists[t].size(); ++i) {
+				const d_fdt_t& p = lists[t][i];
+				acc[p.first] += term_doc_weight(p.second, idfs[t],
+								norms[p.first]);
+			}
+		}
+		result.assign(acc.begin(), acc.end());
+		std::sort(result.begin(), result.end(), WandTopKScorer::better);
+		result.resize(std::min(k, result.size()));
+	}
+
+	uint32_t wand(size_t k, bool use_bounds, vec_res_vec_t& result)
+	{
+		std::vector<PostingCursor> cursors;
+		cursors.reserve(lists.size());
+
+		WandTopKScorer scorer(norms, k);
+		for(size_t t = 0; t < lists.size(); ++t) {
+			filebuf buf((char*)&compressed[t][0], compressed[t].size());
+			cursors.push_back(PostingCursor(
+					InvertedListCodec::STREAMVBYTE,
+					lists[t].size(), buf));
+			scorer.addTerm(&cursors.back(), idfs[t], use_bounds ?
+				max_scores[t] :
+				std::numeric_limits<double>::infinity());
+		}
+		scorer.run(result);
+
+		return scorer.getNScored();
+	}
+
+public:
+	void setUp()
+	{
+		srand(7);
+		flat_norms.resize(N);
+		for(uint32_t d = 0; d < N; ++d) {
+			flat_norms[d] = wdmaxfdt_t(
+					1.0 + (rand() % 1000) / 500.0,
+					1 + rand() % 10);
+		}
+		norms.assign(flat_norms, N);
+		// A rare term and two common ones
+		addList(40);
+		addList(N / 2);
+		addList(N / 3);
+	}
+
+	void tearDown()
+	{
+		flat_norms.clear();
+		lists.clear();
+		compressed.clear();
+		idfs.clear();
+		max_scores.clear();
+	}
+
+	void testSameAsExhaustive()
+	{
+		const size_t ks[] = {1, 10, 100, 5000, 3 * N};
+		for(size_t i = 0; i < sizeof(ks)/sizeof(ks[0]); ++i) {
+			vec_res_vec_t expected, with_bounds, without_bounds;
+			exhaustive(ks[i], expected);
+			wand(ks[i], true, with_bounds);
+			wand(ks[i], false, without_bounds);
+
+			TS_ASSERT_EQUALS(with_bounds.size(), expected.size());
+			TS_ASSERT_EQUALS(without_bounds.size(), expected.size());
+			for(size_t j = 0; j < expected.size() &&
+					j < with_bounds.size(); ++j) {
+				TS_ASSERT_EQUALS(with_bounds[j].first,
+						 expected[j].first);
+				TS_ASSERT_DELTA(with_bounds[j].second,
+						expected[j].second, 1e-9);
+				TS_ASSERT_EQUALS(without_bounds[j].first,
+						 expected[j].first);
+			}
+		}
+	}
+
+	void testSkipsDocuments()
+	{
+		vec_res_vec_t all, top;
+		size_t n_matches = 0;
+		{
+			vec_res_vec_t tmp;
+			exhaustive(3 * N, tmp);
+			n_matches = tmp.size();
+		}
+
+		// Without bounds every matching document gets scored...
+		TS_ASSERT_EQUALS(wand(10, false, all), n_matches);
+		// ... with them, only a fraction
+		TS_ASSERT_LESS_THAN(wand(10, true, top), n_matches / 2);
+	}
+
+	void testEmpty()
+	{
+		vec_res_vec_t result;
+		WandTopKScorer scorer(norms, 10);
+		scorer.run(result);
+		TS_ASSERT(result.empty());
+
+		wand(0, true, result);
+		TS_ASSERT(result.empty());
+	}
+};
+
+
+#endif // __TOPK_TEST_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
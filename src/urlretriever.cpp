@@ -139,11 +139,16 @@ size_t URLRetriever::headerCallback(void* data, size_t realsize)
 }
 
 void URLRetriever::go()
+{
+	finish(curl_easy_perform(_handle));
+}
+
+void URLRetriever::finish(CURLcode result)
 {
 	char* _ct;
 	long _code;
 
-	if ( CURLE_OK != curl_easy_perform(_handle) ) {
+	if ( CURLE_OK != result ) {
 		std::string reason = "perform: ";
 		reason += curlerrbuf;
 		throw UndeterminedURLRetrieverException(reason);
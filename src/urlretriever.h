@@ -75,6 +75,19 @@ public:
 	//! Perform page download.
 	void go();
 
+	/**Check the result of a download performed elsewhere.
+	 *
+	 * For transfers driven by a curl multi handle, such as FetchEngine's,
+	 * instead of go().
+	 *
+	 * @param result The transfer's result code.
+	 * @throw UndeterminedURLRetrieverException
+	 */
+	void finish(CURLcode result);
+
+	//! The libcurl easy handle of this download.
+	CURL* getHandle() {return this->_handle; }
+
 
 	headers_t& getHeaders() {return this->headers; }
 	std::string getContentType() {return this->content_type; }
@@ -0,0 +1,166 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#include "urlseenset.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+
+/* ********************************************************************** *
+				    HELPERS
+ * ********************************************************************** */
+
+//! Orders indexes into a vector of fingerprints by fingerprint.
+struct FingerprintIndexLess {
+	const std::vector<URLSeenSet::fingerprint_t>& fps;
+
+	FingerprintIndexLess(const std::vector<URLSeenSet::fingerprint_t>& fps)
+	: fps(fps)
+	{}
+
+	inline bool operator()(size_t a, size_t b) const
+	{
+		return fps[a] < fps[b];
+	}
+};
+
+
+/* ********************************************************************** *
+				  URL SEEN SET
+ * ********************************************************************** */
+
+URLSeenSet::URLSeenSet(const std::string& filename, uint64_t bloom_bits,
+			size_t delta_limit)
+: lock(), filename(filename), delta_limit(delta_limit), filter(bloom_bits),
+  delta(), stored_file(), stored(NULL), n_stored(0)
+{
+	unlink(filename.c_str());
+}
+
+URLSeenSet::~URLSeenSet()
+{
+	unlink(filename.c_str());
+}
+
+void URLSeenSet::insert(const std::vector<fingerprint_t>& fps,
+			std::vector<bool>& unseen)
+{
+	AutoLock synchronized(lock);
+
+	const size_t n = fps.size();
+	unseen.assign(n, true);
+
+	// The filter says which ones we could have seen
+	std::vector<size_t> maybe;
+	for(size_t i = 0; i < n; ++i) {
+		if (filter.mightContain(fps[i])) {
+			if (delta.count(fps[i])) {
+				unseen[i] = false;
+			} else {
+				maybe.push_back(i);
+			}
+		}
+	}
+
+	// Look them up in the file in a single pass
+	if (n_stored and not maybe.empty()) {
+		std::sort(maybe.begin(), maybe.end(), FingerprintIndexLess(fps));
+		const fingerprint_t* pos = stored;
+		const fingerprint_t* end = stored + n_stored;
+		for(size_t k = 0; k < maybe.size() and pos != end; ++k) {
+			fingerprint_t fp = fps[maybe[k]];
+			pos = std::lower_bound(pos, end, fp);
+			if (pos != end and *pos == fp) {
+				unseen[maybe[k]] = false;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < n; ++i) {
+		if (not unseen[i]) {
+			continue;
+		}
+		if (delta.insert(fps[i]).second) {
+			filter.insert(fps[i]);
+		} else {
+			// Repeated in this batch
+			unseen[i] = false;
+		}
+	}
+
+	if (delta.size() >= delta_limit) {
+		merge();
+	}
+}
+
+bool URLSeenSet::insert(fingerprint_t fp)
+{
+	std::vector<fingerprint_t> fps(1, fp);
+	std::vector<bool> unseen;
+
+	insert(fps, unseen);
+	return unseen[0];
+}
+
+size_t URLSeenSet::size()
+{
+	AutoLock synchronized(lock);
+
+	return n_stored + delta.size();
+}
+
+//@synchronized(lock)
+void URLSeenSet::merge()
+{
+	std::vector<fingerprint_t> fresh(delta.begin(), delta.end());
+	std::sort(fresh.begin(), fresh.end());
+
+	std::string tmp_filename = filename + ".tmp";
+	FILE* fh = fopen(tmp_filename.c_str(), "wb");
+	if (fh == NULL) {
+		throw ErrnoSysException("Error opening " + tmp_filename);
+	}
+	{
+		ManagedFilePtr file(fh);
+
+		// Merge both sorted sequences, a buffer at a time
+		const size_t BUFFER_SIZE = 1<<16;
+		std::vector<fingerprint_t> out;
+		out.reserve(BUFFER_SIZE);
+
+		const fingerprint_t* s = stored;
+		const fingerprint_t* s_end = stored + n_stored;
+		std::vector<fingerprint_t>::const_iterator f = fresh.begin();
+		while (s != s_end or f != fresh.end()) {
+			if (f == fresh.end() or (s != s_end and *s < *f)) {
+				out.push_back(*s++);
+			} else {
+				out.push_back(*f++);
+			}
+			if (out.size() == BUFFER_SIZE or
+				(s == s_end and f == fresh.end()))
+			{
+				if (fwrite(&out[0], sizeof(fingerprint_t),
+					   out.size(), file) != out.size())
+				{
+					throw ErrnoSysException("Error writing " +
+								tmp_filename);
+				}
+				out.clear();
+			}
+		}
+	}
+
+	if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+		throw ErrnoSysException("Error renaming " + tmp_filename);
+	}
+
+	n_stored += fresh.size();
+	stored_file.reset(new MMapedFile(filename));
+	stored = (const fingerprint_t*) stored_file->getBuf().start;
+	delta.clear();
+}
+
+
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
@@ -0,0 +1,172 @@
+#ifndef __URLSEENSET_H
+#define __URLSEENSET_H
+/**@file urlseenset.h
+ * @brief The set of URLs the crawler has already seen, in a few bytes each.
+ *
+ * URLs are kept as 64-bit FNV fingerprints: most of them in a sorted file
+ * on disk, the recently seen ones in memory. A Bloom filter in front of
+ * both answers most lookups for new URLs without touching either.
+ *
+ * Two different URLs with the same fingerprint are taken as the same one.
+ * With 64-bit fingerprints this should happen about once in a crawl of
+ * 4 billion URLs.
+ */
+
+#include "threadingutils.h"
+#include "mmapedfile.h"
+#include "fnv1hash.hpp"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <ext/hash_set>
+
+
+/* ********************************************************************** *
+				  BLOOM FILTER
+ * ********************************************************************** */
+
+//! A Bloom filter of 64-bit fingerprints.
+class BloomFilter {
+	std::vector<uint64_t> bits;
+	uint64_t n_bits;
+	int n_hashes;
+
+	//! Spread the fingerprint's bits - FNV-1's lower ones are weak.
+	static inline uint64_t mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+public:
+	/**Constructor.
+	 *
+	 * @param n_bits Size of the filter. About 10 bits per element give
+	 * 	  1% of false positives with the default 7 hashes.
+	 */
+	BloomFilter(uint64_t n_bits, int n_hashes=7)
+	: bits((n_bits + 63) / 64), n_bits(bits.size() * 64),
+	  n_hashes(n_hashes)
+	{}
+
+	inline void insert(uint64_t fp)
+	{
+		uint64_t h = mix(fp);
+		uint64_t h1 = h & 0xFFFFFFFF;
+		uint64_t h2 = h >> 32;
+		for(int i = 0; i < n_hashes; ++i) {
+			uint64_t bit = (h1 + i * h2) % n_bits;
+			bits[bit / 64] |= 1ULL << (bit % 64);
+		}
+	}
+
+	//! False if @p fp was never inserted. True if it probably was.
+	inline bool mightContain(uint64_t fp) const
+	{
+		uint64_t h = mix(fp);
+		uint64_t h1 = h & 0xFFFFFFFF;
+		uint64_t h2 = h >> 32;
+		for(int i = 0; i < n_hashes; ++i) {
+			uint64_t bit = (h1 + i * h2) % n_bits;
+			if (not (bits[bit / 64] & (1ULL << (bit % 64)))) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+
+/* ********************************************************************** *
+				  URL SEEN SET
+ * ********************************************************************** */
+
+/**A set of URL fingerprints, mostly on disk.
+ *
+ * Fingerprints are added to a set in memory. Once it holds
+ * @c delta_limit of them, it is merged into the sorted file, which is
+ * mmap'ed for lookups.
+ *
+ * The set is thread-safe. The file is started anew by the constructor.
+ */
+class URLSeenSet {
+public:
+	typedef uint64_t fingerprint_t;
+	typedef __gnu_cxx::hash_set<fingerprint_t> FingerprintSet;
+
+private:
+	//! Guards everything below
+	CatholicShameMutex lock;
+
+	std::string filename;
+	size_t delta_limit;
+
+	BloomFilter filter;
+	FingerprintSet delta;	//!< Seen since the last merge
+	std::auto_ptr<MMapedFile> stored_file;
+	const fingerprint_t* stored;	//!< Sorted, in stored_file
+	size_t n_stored;
+
+	//!This class is non-copyable
+	URLSeenSet(const URLSeenSet&);
+	//!This class is non-copyable
+	URLSeenSet& operator=(const URLSeenSet&);
+
+	/**Merge delta into the file.
+	 *
+	 * @throw ErrnoSysException
+	 */
+	void merge();
+
+public:
+	/**Constructor.
+	 *
+	 * @param filename Where the sorted fingerprints are stored.
+	 * @param bloom_bits Size of the Bloom filter, in bits.
+	 * @param delta_limit How many fingerprints to keep in memory
+	 * 	  before merging them into the file.
+	 */
+	URLSeenSet(const std::string& filename, uint64_t bloom_bits,
+		   size_t delta_limit);
+
+	~URLSeenSet();
+
+	static inline fingerprint_t fingerprint(const std::string& url)
+	{
+		return FNV::hash64(url);
+	}
+
+	/**Add fingerprints to the set, telling which ones are new.
+	 *
+	 * Lookups in the file are done in fingerprint order, for the whole
+	 * batch at once.
+	 *
+	 * @param fps The fingerprints.
+	 * @param[out] unseen unseen[i] is true if fps[i] was not in the set
+	 * 	       - nor earlier in @p fps.
+	 *
+	 * @synchronized(lock)
+	 */
+	void insert(const std::vector<fingerprint_t>& fps,
+		    std::vector<bool>& unseen);
+
+	/**Add a fingerprint to the set.
+	 *
+	 * @return true if it was not there already.
+	 */
+	bool insert(fingerprint_t fp);
+
+	//! Number of fingerprints in the set. @synchronized(lock)
+	size_t size();
+};
+
+
+#endif // __URLSEENSET_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
@@ -0,0 +1,91 @@
+#ifndef __URLSEENSET_TEST_H
+#define __URLSEENSET_TEST_H
+
+#include "urlseenset.h"
+#include "strmisc.h"
+#include "cxxtest/TestSuite.h"
+
+#include <unistd.h>
+
+
+class URLSeenSetTestSuit : public CxxTest::TestSuite {
+	std::string filename;
+
+	std::string url(int i)
+	{
+		return "http://www.a.com.br/page" + toString(i) + ".html";
+	}
+
+public:
+	void setUp()
+	{
+		filename = "/tmp/urlseenset_test." + toString(getpid());
+	}
+
+	void testBloomFilter()
+	{
+		BloomFilter filter(10 * 10000);
+		for(int i = 0; i < 10000; ++i) {
+			filter.insert(URLSeenSet::fingerprint(url(i)));
+		}
+
+		int false_positives = 0;
+		for(int i = 0; i < 10000; ++i) {
+			TS_ASSERT(filter.mightContain(
+					URLSeenSet::fingerprint(url(i))));
+			if (filter.mightContain(URLSeenSet::fingerprint(
+						url(i + 10000)))) {
+				++false_positives;
+			}
+		}
+		// About 1% is expected
+		TS_ASSERT_LESS_THAN(false_positives, 300);
+	}
+
+	void testBatchesAcrossMerges()
+	{
+		// A tiny filter and delta, so both the file and false
+		// positives get exercised
+		URLSeenSet seen(filename, 1024, 100);
+
+		std::vector<URLSeenSet::fingerprint_t> fps;
+		std::vector<bool> unseen;
+		for(int i = 0; i < 1000; ++i) {
+			fps.push_back(URLSeenSet::fingerprint(url(i)));
+		}
+		// Repeated in the batch
+		fps.push_back(URLSeenSet::fingerprint(url(0)));
+
+		seen.insert(fps, unseen);
+		TS_ASSERT_EQUALS(unseen.size(), 1001U);
+		for(int i = 0; i < 1000; ++i) {
+			TS_ASSERT(unseen[i]);
+		}
+		TS_ASSERT(not unseen[1000]);
+		TS_ASSERT_EQUALS(seen.size(), 1000U);
+
+		// Half known, half new
+		fps.clear();
+		for(int i = 500; i < 1500; ++i) {
+			fps.push_back(URLSeenSet::fingerprint(url(i)));
+		}
+		for(int k = 0; k < 5; ++k) {
+			std::vector<URLSeenSet::fingerprint_t> batch(
+					fps.begin() + k * 200,
+					fps.begin() + (k + 1) * 200);
+			seen.insert(batch, unseen);
+			for(int i = 0; i < 200; ++i) {
+				TS_ASSERT_EQUALS(unseen[i], k * 200 + i >= 500);
+			}
+		}
+		TS_ASSERT_EQUALS(seen.size(), 1500U);
+
+		TS_ASSERT(seen.insert(URLSeenSet::fingerprint(url(1500))));
+		TS_ASSERT(not seen.insert(URLSeenSet::fingerprint(url(1500))));
+		TS_ASSERT(not seen.insert(URLSeenSet::fingerprint(url(3))));
+	}
+};
+
+
+#endif // __URLSEENSET_TEST_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
@@ -0,0 +1,110 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "vectorial.hpp"
+#include "isamutils.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+
+/***********************************************************************
+				   NormTable
+ ***********************************************************************/
+
+namespace {
+	//! Reads the norm store into a docid-indexed vector.
+	struct NormLoadingVisitor {
+		std::vector<wdmaxfdt_t>& norms;
+		uint32_t& n_docs;
+
+		NormLoadingVisitor(std::vector<wdmaxfdt_t>& v, uint32_t& n)
+		: norms(v), n_docs(n)
+		{}
+
+		inline void operator()(uint32_t id,
+				const norm_hdr_entry_t* entry, filebuf data)
+		{
+			wdmaxfdt_t* val = (wdmaxfdt_t*)
+						data.read(sizeof(wdmaxfdt_t));
+			if (norms.size() <= entry->docid) {
+				norms.resize(entry->docid + 1);
+			}
+			norms[entry->docid] = *val;
+			++n_docs;
+		}
+	};
+}
+
+std::string NormTable::mk_filename(const std::string& dir)
+{
+	return dir + "/norms.flat";
+}
+
+void NormTable::write(const std::string& dir,
+		      const std::vector<wdmaxfdt_t>& norms, uint32_t n_docs)
+{
+	norm_flat_hdr_t hdr(n_docs, norms.size());
+
+	std::ofstream out;
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(mk_filename(dir).c_str(), std::ios_base::binary);
+	out.write((const char*) &hdr, sizeof(hdr));
+	if (! norms.empty()) {
+		out.write((const char*) &norms[0],
+			  norms.size() * sizeof(wdmaxfdt_t));
+	}
+}
+
+NormTable::NormTable()
+: file(),
+  owned(),
+  table(0),
+  n_entries(0),
+  n_docs(0),
+  missing()
+{}
+
+void NormTable::load(const std::string& dir)
+{
+	const std::string filename = mk_filename(dir);
+
+	if (access(filename.c_str(), R_OK) != 0) {
+		// Older index: read the norm store
+		std::vector<wdmaxfdt_t> norms;
+		uint32_t n = 0;
+		VisitIndexedStore<norm_hdr_entry_t>(dir.c_str(), "norm",
+					NormLoadingVisitor(norms, n));
+		assign(norms, n);
+		return;
+	}
+
+	file.reset(new MMapedFile(filename));
+	filebuf data = file->getBuf();
+	if (data.len() < sizeof(norm_flat_hdr_t)) {
+		throw std::runtime_error(filename + " is truncated");
+	}
+	const norm_flat_hdr_t* hdr = (const norm_flat_hdr_t*)
+					data.read(sizeof(norm_flat_hdr_t));
+	if (data.len() < hdr->n_entries * sizeof(wdmaxfdt_t)) {
+		throw std::runtime_error(filename + " is truncated");
+	}
+
+	owned.clear();
+	table = (const wdmaxfdt_t*) data.current;
+	n_entries = hdr->n_entries;
+	n_docs = hdr->n_docs;
+}
+
+void NormTable::assign(const std::vector<wdmaxfdt_t>& norms, uint32_t n)
+{
+	file.reset();
+	owned = norms;
+	table = owned.empty() ? 0 : &owned[0];
+	n_entries = owned.size();
+	n_docs = n;
+}
+
+
+// EOF
@@ -9,8 +9,12 @@
 
 #include <ext/hash_map>
 #include <tr1/functional>
+#include <vector>
+#include <string>
+#include <memory>
 
 #include "common.h"
+#include "mmapedfile.h"
 
 
 /***********************************************************************
@@ -37,6 +41,33 @@ struct wdmaxfdt_t {
 
 typedef __gnu_cxx::hash_map < docid_t, wdmaxfdt_t> wdmfdt_map_t;
 
+/**Contribution of a term to the similarity between a query and a document.
+ *
+ * That's \f$\frac{f_{t,d}\cdot\log\frac{N}{f_{t}}}{\max_{i}f_{i,d}\cdot
+ * W_d}\f$. A document's similarity is the sum of the contributions of the
+ * query terms it contains.
+ *
+ * @param fdt Frequency of the term in the document.
+ * @param idf The term's \f$\log\frac{N}{f_{t}}\f$.
+ * @param wf The document's norm.
+ */
+inline double term_doc_weight(uint32_t fdt, double idf, const wdmaxfdt_t& wf)
+{
+	return (double(fdt) * idf) / (double(wf.maxfdt) * wf.wd);
+}
+
+//!A vectorial query result entry
+typedef std::pair<docid_t,double> vec_res_t;
+
+//! In descending order.
+inline bool VecResComparator(const vec_res_t& a, const vec_res_t& b)
+{
+	return (a.second > b.second);
+}
+
+//!Vector of results of a vectorial query
+typedef std::vector<vec_res_t> vec_res_vec_t;
+
 /**Structure for document's norm store index's entries.
  */
 struct norm_hdr_entry_t {
@@ -55,9 +86,83 @@ struct norm_hdr_entry_t {
 } __attribute__((packed));
 
 
+/***********************************************************************
+				   NormTable
+ ***********************************************************************/
 
-
-
+/**Document norms, indexed by docid.
+ *
+ * Scoring looks up the norm of every matching document, so norms are kept
+ * in a flat array instead of a hash map: a lookup is a bounds check and
+ * an indexed load.
+ *
+ * mknorms saves the table as @c norms.flat, that is mmaped as is. That's
+ * a norm_flat_hdr_t followed by one wdmaxfdt_t per docid, up to the
+ * biggest one in the collection. Docids that are not in the collection
+ * have a null norm.
+ *
+ * Indexes without @c norms.flat are loaded from the norm store.
+ */
+class NormTable {
+public:
+	//! Header of the @c norms.flat file.
+	struct norm_flat_hdr_t {
+		uint32_t n_docs;	//!< Number of documents in the colection
+		uint32_t n_entries;	//!< Number of entries in the table
+
+		norm_flat_hdr_t(uint32_t docs=0, uint32_t entries=0)
+		: n_docs(docs), n_entries(entries)
+		{}
+	} __attribute__((packed));
+
+	//! Name of the flat norm table file in an index directory.
+	static std::string mk_filename(const std::string& dir);
+
+	/**Save a norm table.
+	 *
+	 * @param dir The index directory.
+	 * @param norms The norms, indexed by docid.
+	 * @param n_docs Number of documents in the collection.
+	 */
+	static void write(const std::string& dir,
+			  const std::vector<wdmaxfdt_t>& norms,
+			  uint32_t n_docs);
+
+private:
+	std::auto_ptr<MMapedFile> file; //!< norms.flat, if mmaped
+	std::vector<wdmaxfdt_t> owned;	//!< The norms, if not mmaped
+	const wdmaxfdt_t* table;
+	uint32_t n_entries;
+	uint32_t n_docs;
+	wdmaxfdt_t missing;		//!< Norm of unknown docids
+
+	//!This class is non-copyable
+	NormTable(const NormTable&);
+	//!This class is non-copyable
+	NormTable& operator=(const NormTable&);
+
+public:
+	NormTable();
+
+	/**Load the norms of an index.
+	 *
+	 * Uses @c norms.flat if the index has one, the norm store
+	 * otherwise.
+	 */
+	void load(const std::string& dir);
+
+	//! Use norms already in memory, indexed by docid.
+	void assign(const std::vector<wdmaxfdt_t>& norms, uint32_t n_docs);
+
+	//! Norm of a document.
+	inline const wdmaxfdt_t& operator[](docid_t doc) const
+	{
+		return (doc < n_entries) ? table[doc] : missing;
+	}
+
+	//! Number of documents in the colection.
+	inline uint32_t getNDocs() const { return n_docs; }
+};
 
 
 #endif // __VECTORIAL_H__
@@ -0,0 +1,101 @@
+#ifndef __VECTORIAL_TEST_H
+#define __VECTORIAL_TEST_H
+
+#include "cxxtest/TestSuite.h"
+#include "vectorial.hpp"
+#include "isamutils.hpp"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <string.h>
+
+
+class NormTableTestSuit : public CxxTest::TestSuite {
+	static const std::string NORMS_SANDBOX_DIR;
+
+	std::vector<wdmaxfdt_t> sample()
+	{
+		// Docids 0 and 3 are not in the collection
+		std::vector<wdmaxfdt_t> norms(6);
+		norms[1] = wdmaxfdt_t(1.5, 2);
+		norms[2] = wdmaxfdt_t(0.25, 7);
+		norms[4] = wdmaxfdt_t(3.0, 1);
+		norms[5] = wdmaxfdt_t(2.0, 4);
+		return norms;
+	}
+
+	void checkSample(const NormTable& table)
+	{
+		std::vector<wdmaxfdt_t> norms = sample();
+
+		TS_ASSERT_EQUALS(table.getNDocs(), 4U);
+		for(docid_t d = 0; d < norms.size(); ++d) {
+			TS_ASSERT_EQUALS(table[d].wd, norms[d].wd);
+			TS_ASSERT_EQUALS(table[d].maxfdt, norms[d].maxfdt);
+		}
+		// Unknown docids have a null norm
+		TS_ASSERT_EQUALS(table[1000].wd, 0.0);
+		TS_ASSERT_EQUALS(table[1000].maxfdt, 1U);
+	}
+
+public:
+	void setUp()
+	{
+		mkdir(NORMS_SANDBOX_DIR.c_str(),S_IRWXU);
+	}
+
+	void tearDown()
+	{
+		std::string cmd_line("rm -rf ");
+		cmd_line += NORMS_SANDBOX_DIR;
+
+		system(cmd_line.c_str());
+	}
+
+	void testAssign()
+	{
+		NormTable table;
+		table.assign(sample(), 4);
+		checkSample(table);
+	}
+
+	void testWriteAndLoad()
+	{
+		NormTable::write(NORMS_SANDBOX_DIR, sample(), 4);
+
+		NormTable table;
+		table.load(NORMS_SANDBOX_DIR);
+		checkSample(table);
+	}
+
+	void testLoadFromNormStore()
+	{
+		// What mknorms used to write, before norms.flat
+		std::vector<wdmaxfdt_t> norms = sample();
+		{
+			const docid_t docids[] = {5, 1, 4, 2};
+			IndexedStoreOutputer<norm_hdr_entry_t> normout(
+					NORMS_SANDBOX_DIR.c_str(), "norm", 4);
+			for(int i = 0; i < 4; ++i) {
+				uint16_t fileno;
+				uint32_t pos;
+				filebuf out = normout.getDataOutputBuffer(
+						sizeof(wdmaxfdt_t), fileno, pos);
+				normout.putIndexEntry(norm_hdr_entry_t(
+						docids[i], fileno, pos));
+				memcpy((void*)out.start, &norms[docids[i]],
+					sizeof(wdmaxfdt_t));
+			}
+		}
+
+		NormTable table;
+		table.load(NORMS_SANDBOX_DIR);
+		checkSample(table);
+	}
+};
+
+const std::string NormTableTestSuit::NORMS_SANDBOX_DIR("_norms_test_dir");
+
+
+#endif // __VECTORIAL_TEST_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
@@ -0,0 +1,484 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+
+#include "vocabulary.hpp"
+#include "fnv1hash.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <unistd.h>
+
+
+/***********************************************************************
+				MMapedVocabulary
+ ***********************************************************************/
+
+const uint32_t MMapedVocabulary::NOT_FOUND;
+const uint32_t MMapedVocabulary::MPH_MAGIC;
+
+namespace {
+	//! Average number of terms per bucket.
+	const uint32_t BUCKET_SIZE = 4;
+
+	//! Give up on a seed after this many displacements for a bucket.
+	const uint32_t MAX_DISPLACEMENT = 1 << 20;
+
+	//! Seeds to try before giving up.
+	const uint32_t MAX_SEEDS = 32;
+
+	//! Words in a mph_hdr_t.
+	const size_t HDR_WORDS = sizeof(MMapedVocabulary::mph_hdr_t) /
+					sizeof(uint32_t);
+
+	//! 64 bit finalizer, from SplitMix64.
+	inline uint64_t mix64(uint64_t x)
+	{
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ULL;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		return x;
+	}
+
+	inline uint32_t bucket(uint64_t h, uint32_t n_buckets)
+	{
+		return (h >> 32) % n_buckets;
+	}
+}
+
+std::string MMapedVocabulary::mk_hash_filename(const std::string& dir)
+{
+	return dir + "/vocabulary.mph";
+}
+
+uint64_t MMapedVocabulary::hash(const char* term, size_t len, uint32_t seed)
+{
+	return mix64(FNV::hash64(term, len) ^
+			(uint64_t(seed) * 0x9e3779b97f4a7c15ULL));
+}
+
+uint32_t MMapedVocabulary::slot(uint64_t h, uint32_t displacement,
+				uint32_t n_slots)
+{
+	return mix64(h + displacement) % n_slots;
+}
+
+void MMapedVocabulary::computeHash(const uint32_t* offsets, size_t n_terms,
+				const char* terms, std::vector<uint32_t>& out)
+{
+	mph_hdr_t hdr;
+	hdr.magic = MPH_MAGIC;
+	hdr.n_keys = n_terms;
+	hdr.n_buckets = n_terms / BUCKET_SIZE + 1;
+	hdr.n_slots = n_terms + n_terms / 100 + 1; // 99% load
+
+	std::vector<uint64_t> hashes(n_terms);
+	std::vector<uint32_t> bucket_start(hdr.n_buckets + 1);
+	std::vector<uint32_t> members(n_terms);	// term ids, by bucket
+	std::vector<uint32_t> order(hdr.n_buckets);
+	std::vector<bool> taken(hdr.n_slots);
+	std::vector<uint32_t> bucket_slots;
+
+	for(hdr.seed = 1; hdr.seed <= MAX_SEEDS; ++hdr.seed) {
+		out.assign(HDR_WORDS + hdr.n_buckets + hdr.n_slots, NOT_FOUND);
+		uint32_t* displacements = &out[HDR_WORDS];
+		uint32_t* slots = displacements + hdr.n_buckets;
+		std::fill(taken.begin(), taken.end(), false);
+
+		// Group terms by bucket (counting sort)
+		std::fill(bucket_start.begin(), bucket_start.end(), 0);
+		for(size_t i = 0; i < n_terms; ++i) {
+			const char* term = terms + offsets[i];
+			hashes[i] = hash(term, strlen(term), hdr.seed);
+			++bucket_start[bucket(hashes[i], hdr.n_buckets) + 1];
+		}
+		for(uint32_t b = 0; b < hdr.n_buckets; ++b) {
+			bucket_start[b + 1] += bucket_start[b];
+		}
+		std::vector<uint32_t> fill(bucket_start.begin(),
+					   bucket_start.end() - 1);
+		for(size_t i = 0; i < n_terms; ++i) {
+			members[fill[bucket(hashes[i], hdr.n_buckets)]++] = i;
+		}
+
+		// Biggest buckets first: they are the hardest to place
+		uint32_t max_size = 0;
+		for(uint32_t b = 0; b < hdr.n_buckets; ++b) {
+			max_size = std::max(max_size,
+					bucket_start[b + 1] - bucket_start[b]);
+		}
+		order.clear();
+		for(uint32_t size = max_size; size > 0; --size) {
+			for(uint32_t b = 0; b < hdr.n_buckets; ++b) {
+				if (bucket_start[b + 1] - bucket_start[b] == size) {
+					order.push_back(b);
+				}
+			}
+		}
+
+		bool failed = false;
+		for(size_t o = 0; o < order.size() && !failed; ++o) {
+			const uint32_t b = order[o];
+			const uint32_t* first = &members[bucket_start[b]];
+			const uint32_t size = bucket_start[b + 1] - bucket_start[b];
+
+			uint32_t d = 0;
+			for(; d < MAX_DISPLACEMENT; ++d) {
+				bucket_slots.clear();
+				uint32_t i = 0;
+				for(; i < size; ++i) {
+					uint32_t s = slot(hashes[first[i]], d,
+							  hdr.n_slots);
+					if (taken[s] || std::find(
+						bucket_slots.begin(),
+						bucket_slots.end(), s) !=
+							bucket_slots.end()) {
+						break;
+					}
+					bucket_slots.push_back(s);
+				}
+				if (i == size) {
+					break;
+				}
+			}
+			if (d == MAX_DISPLACEMENT) {
+				failed = true;
+				break;
+			}
+
+			displacements[b] = d;
+			for(uint32_t i = 0; i < size; ++i) {
+				taken[bucket_slots[i]] = true;
+				slots[bucket_slots[i]] = first[i];
+			}
+		}
+
+		if (! failed) {
+			memcpy(&out[0], &hdr, sizeof(hdr));
+			return;
+		}
+	}
+
+	throw std::runtime_error("Could not build a perfect hash for the "
+				 "vocabulary");
+}
+
+void MMapedVocabulary::buildHash(const std::string& dir)
+{
+	MMapedFile hdr(dir + "/vocabulary.hdr");
+	MMapedFile data(dir + "/vocabulary.data");
+
+	std::vector<uint32_t> hash_data;
+	computeHash((const uint32_t*) hdr.getBuf().start,
+		    hdr.getBuf().len() / sizeof(uint32_t),
+		    data.getBuf().start, hash_data);
+
+	std::ofstream out;
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(mk_hash_filename(dir).c_str(), std::ios_base::binary);
+	out.write((const char*) &hash_data[0],
+		  hash_data.size() * sizeof(uint32_t));
+}
+
+MMapedVocabulary::MMapedVocabulary(const std::string& dir)
+: hdr_file(dir + "/vocabulary.hdr"),
+  data_file(dir + "/vocabulary.data"),
+  hash_file(),
+  hash_data(),
+  offsets((const uint32_t*) hdr_file.getBuf().start),
+  n_terms(hdr_file.getBuf().len() / sizeof(uint32_t)),
+  terms(data_file.getBuf().start),
+  terms_end(data_file.getBuf().end),
+  params(),
+  displacements(0),
+  slots(0)
+{
+	const std::string hash_filename = mk_hash_filename(dir);
+
+	if (access(hash_filename.c_str(), R_OK) == 0) {
+		hash_file.reset(new MMapedFile(hash_filename));
+		filebuf buf = hash_file->getBuf();
+		setHash((const uint32_t*) buf.start,
+			buf.len() / sizeof(uint32_t));
+	} else {
+		// Older index: pay for building it at every start
+		computeHash(offsets, n_terms, terms, hash_data);
+		setHash(&hash_data[0], hash_data.size());
+	}
+}
+
+void MMapedVocabulary::setHash(const uint32_t* start, size_t n_words)
+{
+	if (n_words < HDR_WORDS) {
+		throw std::runtime_error("Vocabulary hash is truncated");
+	}
+	memcpy(&params, start, sizeof(params));
+	if (params.magic != MPH_MAGIC || params.n_keys != n_terms ||
+	    params.n_buckets == 0 || params.n_slots == 0 ||
+	    n_words < HDR_WORDS + size_t(params.n_buckets) + params.n_slots) {
+		throw std::runtime_error("Vocabulary hash doesn't match the "
+					 "vocabulary");
+	}
+
+	displacements = start + HDR_WORDS;
+	slots = displacements + params.n_buckets;
+}
+
+uint32_t MMapedVocabulary::find(const char* term, size_t len) const
+{
+	const uint64_t h = hash(term, len, params.seed);
+	const uint32_t d = displacements[bucket(h, params.n_buckets)];
+	const uint32_t id = slots[slot(h, d, params.n_slots)];
+
+	if (id >= n_terms) {
+		return NOT_FOUND;
+	}
+
+	// Check it is the same term; don't read past the end of the data
+	const char* candidate = terms + offsets[id];
+	if (size_t(terms_end - candidate) <= len ||
+	    memcmp(candidate, term, len) != 0 || candidate[len] != '\0') {
+		return NOT_FOUND;
+	}
+
+	return id;
+}
+
+
+/***********************************************************************
+			      FrontCodedVocabulary
+ ***********************************************************************/
+
+const uint32_t FrontCodedVocabulary::FC_MAGIC;
+const uint32_t FrontCodedVocabulary::BLOCK_SIZE;
+
+namespace {
+	inline void writeVByte(uint32_t val, std::vector<uint8_t>& out)
+	{
+		while (val >= 0x80) {
+			out.push_back(uint8_t(val) | 0x80);
+			val >>= 7;
+		}
+		out.push_back(uint8_t(val));
+	}
+
+	inline uint32_t readVByte(const uint8_t*& p, const uint8_t* end)
+	{
+		uint32_t val = 0;
+		for(int shift = 0; p < end && shift < 32; shift += 7) {
+			const uint8_t b = *p++;
+			val |= uint32_t(b & 0x7f) << shift;
+			if (b < 0x80) {
+				return val;
+			}
+		}
+		throw std::runtime_error("Front-coded vocabulary is corrupted");
+	}
+
+	//! Orders term ids by their terms, bytewise.
+	struct ByTerm {
+		const uint32_t* offsets;
+		const char* terms;
+
+		ByTerm(const uint32_t* offsets, const char* terms)
+		: offsets(offsets), terms(terms)
+		{}
+
+		inline bool operator()(uint32_t a, uint32_t b) const
+		{
+			return strcmp(terms + offsets[a], terms + offsets[b]) < 0;
+		}
+	};
+}
+
+std::string FrontCodedVocabulary::mk_filename(const std::string& dir)
+{
+	return dir + "/vocabulary.fc";
+}
+
+void FrontCodedVocabulary::encode(const uint32_t* offsets, size_t n_terms,
+				const char* terms, std::vector<uint8_t>& out)
+{
+	std::vector<uint32_t> sorted(n_terms);
+	for(uint32_t id = 0; id < n_terms; ++id) {
+		sorted[id] = id;
+	}
+	std::sort(sorted.begin(), sorted.end(), ByTerm(offsets, terms));
+
+	fc_hdr_t hdr;
+	hdr.magic = FC_MAGIC;
+	hdr.n_terms = n_terms;
+	hdr.n_blocks = (n_terms + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	hdr.block_size = BLOCK_SIZE;
+
+	std::vector<uint32_t> block_offsets;
+	std::vector<uint8_t> data;
+	block_offsets.reserve(hdr.n_blocks + 1);
+
+	const char* prev = "";
+	for(size_t i = 0; i < n_terms; ++i) {
+		const char* term = terms + offsets[sorted[i]];
+		size_t shared = 0;
+
+		if (i % BLOCK_SIZE == 0) {
+			block_offsets.push_back(data.size());
+		} else {
+			while (term[shared] != '\0' &&
+			       term[shared] == prev[shared]) {
+				++shared;
+			}
+		}
+		const size_t suffix = strlen(term + shared);
+
+		writeVByte(shared, data);
+		writeVByte(suffix, data);
+		data.insert(data.end(), term + shared, term + shared + suffix);
+		writeVByte(sorted[i], data);
+
+		prev = term;
+	}
+	block_offsets.push_back(data.size());
+
+	out.clear();
+	out.insert(out.end(), (const uint8_t*) &hdr,
+		   (const uint8_t*) &hdr + sizeof(hdr));
+	out.insert(out.end(), (const uint8_t*) &block_offsets[0],
+		   (const uint8_t*) (&block_offsets[0] + block_offsets.size()));
+	out.insert(out.end(), data.begin(), data.end());
+}
+
+void FrontCodedVocabulary::build(const std::string& dir)
+{
+	MMapedFile hdr(dir + "/vocabulary.hdr");
+	MMapedFile data(dir + "/vocabulary.data");
+
+	std::vector<uint8_t> fc_data;
+	encode((const uint32_t*) hdr.getBuf().start,
+	       hdr.getBuf().len() / sizeof(uint32_t),
+	       data.getBuf().start, fc_data);
+
+	std::ofstream out;
+	out.exceptions( std::ios_base::badbit|std::ios_base::failbit);
+	out.open(mk_filename(dir).c_str(), std::ios_base::binary);
+	out.write((const char*) &fc_data[0], fc_data.size());
+}
+
+FrontCodedVocabulary::FrontCodedVocabulary(const std::string& dir)
+: fc_file(),
+  fc_data(),
+  hdr(),
+  block_offsets(0),
+  blocks(0)
+{
+	const std::string filename = mk_filename(dir);
+
+	if (access(filename.c_str(), R_OK) == 0) {
+		fc_file.reset(new MMapedFile(filename));
+		filebuf buf = fc_file->getBuf();
+		setData((const uint8_t*) buf.start, buf.len());
+	} else {
+		// Older index: pay for building it at every start
+		MMapedFile hdr_file(dir + "/vocabulary.hdr");
+		MMapedFile data_file(dir + "/vocabulary.data");
+		encode((const uint32_t*) hdr_file.getBuf().start,
+		       hdr_file.getBuf().len() / sizeof(uint32_t),
+		       data_file.getBuf().start, fc_data);
+		setData(&fc_data[0], fc_data.size());
+	}
+}
+
+void FrontCodedVocabulary::setData(const uint8_t* start, size_t len)
+{
+	if (len < sizeof(hdr)) {
+		throw std::runtime_error("Front-coded vocabulary is truncated");
+	}
+	memcpy(&hdr, start, sizeof(hdr));
+
+	const size_t table_len = (size_t(hdr.n_blocks) + 1) * sizeof(uint32_t);
+	if (hdr.magic != FC_MAGIC || hdr.block_size == 0 ||
+	    len < sizeof(hdr) + table_len) {
+		throw std::runtime_error("Front-coded vocabulary is corrupted");
+	}
+	block_offsets = (const uint32_t*) (start + sizeof(hdr));
+	blocks = start + sizeof(hdr) + table_len;
+
+	if (block_offsets[hdr.n_blocks] > len - sizeof(hdr) - table_len) {
+		throw std::runtime_error("Front-coded vocabulary is truncated");
+	}
+}
+
+int FrontCodedVocabulary::compareFirst(uint32_t b, const char* prefix,
+					size_t len) const
+{
+	const uint8_t* p = blocks + block_offsets[b];
+	const uint8_t* end = blocks + block_offsets[b + 1];
+
+	readVByte(p, end);	// shared: always 0
+	const size_t term_len = readVByte(p, end);
+	if (term_len > size_t(end - p)) {
+		throw std::runtime_error("Front-coded vocabulary is corrupted");
+	}
+
+	int c = memcmp(p, prefix, std::min(term_len, len));
+	if (c == 0 && term_len != len) {
+		c = (term_len < len) ? -1 : 1;
+	}
+	return c;
+}
+
+size_t FrontCodedVocabulary::findPrefix(const char* prefix, size_t len,
+			std::vector<uint32_t>& termids, size_t limit) const
+{
+	// Find the first block whose first term is not smaller than the
+	// prefix. Matches may start at the end of the one before it.
+	uint32_t lo = 0;
+	uint32_t hi = hdr.n_blocks;
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+		if (compareFirst(mid, prefix, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	size_t found = 0;
+	std::string term;
+	for(uint32_t b = (lo > 0) ? lo - 1 : 0; b < hdr.n_blocks; ++b) {
+		const uint8_t* p = blocks + block_offsets[b];
+		const uint8_t* end = blocks + block_offsets[b + 1];
+
+		term.clear();
+		while (p < end) {
+			const size_t shared = readVByte(p, end);
+			const size_t suffix = readVByte(p, end);
+			if (shared > term.size() || suffix > size_t(end - p)) {
+				throw std::runtime_error("Front-coded "
+						"vocabulary is corrupted");
+			}
+			term.resize(shared);
+			term.append((const char*) p, suffix);
+			p += suffix;
+			const uint32_t termid = readVByte(p, end);
+
+			const int c = memcmp(term.data(), prefix,
+					     std::min(term.size(), len));
+			if (c > 0) {
+				return found;	// Past all the matches
+			} else if (c < 0 || term.size() < len) {
+				continue;	// Not there yet
+			} else if (found == limit) {
+				return found;
+			}
+			termids.push_back(termid);
+			++found;
+		}
+	}
+
+	return found;
+}
+
+
+// EOF
@@ -0,0 +1,257 @@
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq:
+#ifndef __VOCABULARY_H__
+#define __VOCABULARY_H__
+/**@file vocabulary.hpp
+ * @brief Memory mapped vocabularies: indexed by a perfect hash function,
+ * for exact lookups, and sorted and front-coded, for prefix lookups.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include <string.h>
+
+#include "mmapedfile.h"
+
+
+/***********************************************************************
+				MMapedVocabulary
+ ***********************************************************************/
+
+/**A dumped vocabulary, used straight from the disk.
+ *
+ * load_vocabulary() builds a hash_map with a std::string per term, and
+ * that takes a while for a big vocabulary. This class just mmaps the
+ * files written by dump_vocabulary() and @c vocabulary.mph, a perfect
+ * hash function over the vocabulary's terms, so there is no loading step
+ * and processes using the same vocabulary share its pages.
+ *
+ * The hash function is built with "hash and displace" (CHD): terms are
+ * hashed into small buckets and, biggest buckets first, each bucket gets
+ * the first displacement that sends all its terms to free slots of a table
+ * just a bit bigger than the vocabulary. Slots hold term ids. A lookup
+ * hashes the term, reads its bucket's displacement and its slot, and then
+ * compares the term with the one with the slot's term id, as a perfect
+ * hash function maps terms not in the vocabulary to arbitrary slots.
+ *
+ * @c vocabulary.mph layout, all in uint32_t:
+ * - a mph_hdr_t;
+ * - @c n_buckets displacements;
+ * - @c n_slots term ids. Empty slots hold NOT_FOUND.
+ *
+ * See Belazzougui, Botelho and Dietzfelbinger, "Hash, displace, and
+ * compress", ESA 2009.
+ *
+ * @see dump_vocabulary
+ */
+class MMapedVocabulary {
+public:
+	//! Returned by find() for terms not in the vocabulary.
+	static const uint32_t NOT_FOUND = 0xffffffff;
+
+	//! Header of @c vocabulary.mph.
+	struct mph_hdr_t {
+		uint32_t magic;		//!< MPH_MAGIC
+		uint32_t seed;		//!< Hash function seed
+		uint32_t n_keys;	//!< Number of terms
+		uint32_t n_buckets;	//!< Number of displacements
+		uint32_t n_slots;	//!< Size of the slot table
+	} __attribute__((packed));
+
+	static const uint32_t MPH_MAGIC = 0x48504d56; // "VMPH"
+
+	//! Name of the perfect hash file of the vocabulary in @p dir.
+	static std::string mk_hash_filename(const std::string& dir);
+
+	/**Build the perfect hash file of a dumped vocabulary.
+	 *
+	 * Reads @c vocabulary.hdr and @c vocabulary.data and writes
+	 * @c vocabulary.mph, all in @p dir.
+	 */
+	static void buildHash(const std::string& dir);
+
+private:
+	MMapedFile hdr_file;
+	MMapedFile data_file;
+	std::auto_ptr<MMapedFile> hash_file;	//!< If there is one
+	std::vector<uint32_t> hash_data;	//!< If there isn't
+
+	const uint32_t* offsets;	//!< Term id -> position in terms
+	size_t n_terms;
+	const char* terms;
+	const char* terms_end;
+
+	mph_hdr_t params;
+	const uint32_t* displacements;
+	const uint32_t* slots;
+
+	//!This class is non-copyable
+	MMapedVocabulary(const MMapedVocabulary&);
+	//!This class is non-copyable
+	MMapedVocabulary& operator=(const MMapedVocabulary&);
+
+	//! Point the hash tables into @c vocabulary.mph's contents.
+	void setHash(const uint32_t* start, size_t n_words);
+
+	//! Slot of a term, given its hash and its bucket's displacement.
+	static uint32_t slot(uint64_t h, uint32_t displacement,
+				uint32_t n_slots);
+
+	//! Seeded hash of a term.
+	static uint64_t hash(const char* term, size_t len, uint32_t seed);
+
+	//! Build the hash of the terms, as in @c vocabulary.mph.
+	static void computeHash(const uint32_t* offsets, size_t n_terms,
+				const char* terms, std::vector<uint32_t>& out);
+
+public:
+	/**Constructor.
+	 *
+	 * @param dir Directory where the dumped vocabulary is.
+	 *
+	 * If @p dir has no @c vocabulary.mph (older indexes) the hash is
+	 * built in memory.
+	 */
+	MMapedVocabulary(const std::string& dir);
+
+	/**Find the term id of a term.
+	 *
+	 * Terms are looked up as they are: normalize them first.
+	 *
+	 * @return NOT_FOUND if the term is not in the vocabulary.
+	 */
+	uint32_t find(const char* term, size_t len) const;
+
+	inline uint32_t find(const std::string& term) const
+	{
+		return find(term.data(), term.size());
+	}
+
+	//! Number of terms.
+	inline size_t size() const { return n_terms; }
+
+	//! The term with a given term id, '\0' terminated.
+	inline const char* getTerm(uint32_t termid) const
+	{
+		return terms + offsets[termid];
+	}
+};
+
+
+/***********************************************************************
+			      FrontCodedVocabulary
+ ***********************************************************************/
+
+/**A dumped vocabulary, sorted and front-coded, for prefix lookups.
+ *
+ * MMapedVocabulary only answers exact lookups. This class finds all the
+ * terms starting with a given prefix, as needed to expand queries like
+ * "univers*", from @c vocabulary.fc: the vocabulary's terms, sorted
+ * (bytewise, as in strcmp) and split in blocks of BLOCK_SIZE terms.
+ *
+ * Inside a block, each term is written as the length of the prefix it
+ * shares with the previous term and the rest of it (front coding), so
+ * sorted terms take a fraction of their size. The first term of a block
+ * shares nothing, so blocks can be decoded on their own and are found by
+ * a binary search over their first terms. A lookup decodes the terms from
+ * the block where the prefix would be until the first term past it.
+ *
+ * @c vocabulary.fc layout:
+ * - a fc_hdr_t;
+ * - @c n_blocks + 1 uint32_t: where each block starts, relative to the
+ *   end of this table, and where the last one ends;
+ * - the blocks. Each term is written as vbyte-encoded shared prefix
+ *   length and suffix length, the suffix bytes and the vbyte-encoded
+ *   term id.
+ *
+ * @see dump_vocabulary
+ */
+class FrontCodedVocabulary {
+public:
+	//! Header of @c vocabulary.fc.
+	struct fc_hdr_t {
+		uint32_t magic;		//!< FC_MAGIC
+		uint32_t n_terms;	//!< Number of terms
+		uint32_t n_blocks;	//!< Number of blocks
+		uint32_t block_size;	//!< Terms per block
+	} __attribute__((packed));
+
+	static const uint32_t FC_MAGIC = 0x31434656; // "VFC1"
+
+	//! Number of terms in each block.
+	static const uint32_t BLOCK_SIZE = 16;
+
+	//! Name of the front-coded vocabulary file in @p dir.
+	static std::string mk_filename(const std::string& dir);
+
+	/**Build the front-coded file of a dumped vocabulary.
+	 *
+	 * Reads @c vocabulary.hdr and @c vocabulary.data and writes
+	 * @c vocabulary.fc, all in @p dir.
+	 */
+	static void build(const std::string& dir);
+
+private:
+	std::auto_ptr<MMapedFile> fc_file;	//!< If there is one
+	std::vector<uint8_t> fc_data;		//!< If there isn't
+
+	fc_hdr_t hdr;
+	const uint32_t* block_offsets;
+	const uint8_t* blocks;
+
+	//!This class is non-copyable
+	FrontCodedVocabulary(const FrontCodedVocabulary&);
+	//!This class is non-copyable
+	FrontCodedVocabulary& operator=(const FrontCodedVocabulary&);
+
+	//! Point the block table into @c vocabulary.fc's contents.
+	void setData(const uint8_t* start, size_t len);
+
+	//! Compare the first term of block @p b with @p prefix, as memcmp.
+	int compareFirst(uint32_t b, const char* prefix, size_t len) const;
+
+	//! Front-code the terms, as in @c vocabulary.fc.
+	static void encode(const uint32_t* offsets, size_t n_terms,
+				const char* terms, std::vector<uint8_t>& out);
+
+public:
+	/**Constructor.
+	 *
+	 * @param dir Directory where the dumped vocabulary is.
+	 *
+	 * If @p dir has no @c vocabulary.fc (older indexes) it is built in
+	 * memory.
+	 */
+	FrontCodedVocabulary(const std::string& dir);
+
+	/**Find the terms starting with a prefix.
+	 *
+	 * Terms are looked up as they are: normalize the prefix first.
+	 *
+	 * @param[out] termids The term ids of the matching terms are
+	 * 		       @b appended here, in the terms' order.
+	 * @param limit Stop after this many matches.
+	 *
+	 * @return The number of term ids appended to @p termids.
+	 */
+	size_t findPrefix(const char* prefix, size_t len,
+			std::vector<uint32_t>& termids,
+			size_t limit = size_t(-1)) const;
+
+	inline size_t findPrefix(const std::string& prefix,
+			std::vector<uint32_t>& termids,
+			size_t limit = size_t(-1)) const
+	{
+		return findPrefix(prefix.data(), prefix.size(), termids, limit);
+	}
+
+	//! Number of terms.
+	inline size_t size() const { return hdr.n_terms; }
+};
+
+
+#endif // __VOCABULARY_H__
+
+//EOF
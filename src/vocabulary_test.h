@@ -0,0 +1,206 @@
+#ifndef __VOCABULARY_TEST_H
+#define __VOCABULARY_TEST_H
+
+#include "cxxtest/TestSuite.h"
+#include "vocabulary.hpp"
+#include "indexerutils.hpp"
+#include "strmisc.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <map>
+
+
+class MMapedVocabularyTestSuit : public CxxTest::TestSuite {
+	static const std::string VOC_SANDBOX_DIR;
+
+	//! Dump @p n terms, "term0" ... plus a few odd ones.
+	StrIntMap makeVocabulary(int n)
+	{
+		StrIntMap voc;
+		int id = 0;
+		voc["ação"] = id++;
+		voc["a"] = id++;
+		voc["ab"] = id++;
+		for(int i = 0; i < n; ++i) {
+			voc["term" + toString(i)] = id++;
+		}
+		dump_vocabulary(voc, VOC_SANDBOX_DIR.c_str());
+		return voc;
+	}
+
+	void checkVocabulary(const StrIntMap& voc)
+	{
+		MMapedVocabulary mvoc(VOC_SANDBOX_DIR);
+		TS_ASSERT_EQUALS(mvoc.size(), voc.size());
+
+		StrIntMap::const_iterator v;
+		for(v = voc.begin(); v != voc.end(); ++v) {
+			TS_ASSERT_EQUALS(mvoc.find(v->first),
+					 uint32_t(v->second));
+			TS_ASSERT_EQUALS(std::string(mvoc.getTerm(v->second)),
+					 v->first);
+		}
+
+		// Prefixes, extensions and strangers are not found
+		const char* missing[] = {"", "aç", "ação!", "abc", "term",
+					 "term00", "nothing"};
+		for(size_t i = 0; i < sizeof(missing)/sizeof(missing[0]); ++i){
+			TS_ASSERT_EQUALS(mvoc.find(missing[i]),
+					 MMapedVocabulary::NOT_FOUND);
+		}
+		TS_ASSERT_EQUALS(mvoc.find("abc", 2),
+				 uint32_t(voc.find("ab")->second));
+	}
+
+public:
+	void setUp()
+	{
+		mkdir(VOC_SANDBOX_DIR.c_str(),S_IRWXU);
+	}
+
+	void tearDown()
+	{
+		std::string cmd_line("rm -rf ");
+		cmd_line += VOC_SANDBOX_DIR;
+
+		system(cmd_line.c_str());
+	}
+
+	void testSmallVocabulary()
+	{
+		checkVocabulary(makeVocabulary(0));
+	}
+
+	void testBigVocabulary()
+	{
+		checkVocabulary(makeVocabulary(50000));
+	}
+
+	void testWithoutHashFile()
+	{
+		StrIntMap voc = makeVocabulary(1000);
+		unlink(MMapedVocabulary::mk_hash_filename(
+					VOC_SANDBOX_DIR).c_str());
+		checkVocabulary(voc);
+	}
+
+	void testStaleHashFile()
+	{
+		makeVocabulary(10);
+		std::string hash_file =
+			MMapedVocabulary::mk_hash_filename(VOC_SANDBOX_DIR);
+		std::string saved = hash_file + ".saved";
+		rename(hash_file.c_str(), saved.c_str());
+
+		makeVocabulary(20);
+		rename(saved.c_str(), hash_file.c_str());
+		TS_ASSERT_THROWS(MMapedVocabulary mvoc(VOC_SANDBOX_DIR),
+				 std::runtime_error);
+	}
+};
+
+const std::string MMapedVocabularyTestSuit::VOC_SANDBOX_DIR("_voc_test_dir");
+
+
+class FrontCodedVocabularyTestSuit : public CxxTest::TestSuite {
+	static const std::string FC_SANDBOX_DIR;
+
+	StrIntMap makeVocabulary()
+	{
+		StrIntMap voc;
+		const char* odd[] = {"a", "ab", "abc", "abd", "b", "ação",
+				     "ações", "univers", "universal",
+				     "universidade", "universo", "univesp",
+				     "z", "zz"};
+		int id = 0;
+		for(size_t i = 0; i < sizeof(odd)/sizeof(odd[0]); ++i) {
+			voc[odd[i]] = id++;
+		}
+		for(int i = 0; i < 5000; ++i) {
+			voc["term" + toString(i)] = id++;
+		}
+		dump_vocabulary(voc, FC_SANDBOX_DIR.c_str());
+		return voc;
+	}
+
+	//! The term ids starting with @p prefix, in sorted term order.
+	std::vector<uint32_t> bruteForce(const StrIntMap& voc,
+					const std::string& prefix)
+	{
+		std::map<std::string, uint32_t> sorted(voc.begin(), voc.end());
+		std::map<std::string, uint32_t>::const_iterator t;
+		std::vector<uint32_t> res;
+
+		for(t = sorted.begin(); t != sorted.end(); ++t) {
+			if (t->first.compare(0, prefix.size(), prefix) == 0) {
+				res.push_back(t->second);
+			}
+		}
+		return res;
+	}
+
+	void checkPrefixes(const StrIntMap& voc)
+	{
+		FrontCodedVocabulary fc(FC_SANDBOX_DIR);
+		TS_ASSERT_EQUALS(fc.size(), voc.size());
+
+		const char* prefixes[] = {"", "a", "ab", "abc", "abcd", "aç",
+					  "univers", "universi", "uni", "term",
+					  "term1", "term4999", "term5", "z",
+					  "zzz", "0", "~", "b"};
+		for(size_t i = 0; i < sizeof(prefixes)/sizeof(prefixes[0]);
+		    ++i) {
+			std::vector<uint32_t> found;
+			std::vector<uint32_t> expected =
+				bruteForce(voc, prefixes[i]);
+			TS_ASSERT_EQUALS(fc.findPrefix(prefixes[i], found),
+					 expected.size());
+			TS_ASSERT(found == expected);
+		}
+
+		// Limits and appending
+		std::vector<uint32_t> found(1, 42);
+		TS_ASSERT_EQUALS(fc.findPrefix("term", found, 10), 10U);
+		TS_ASSERT_EQUALS(found.size(), 11U);
+		TS_ASSERT_EQUALS(found[0], 42U);
+		std::vector<uint32_t> expected = bruteForce(voc, "term");
+		TS_ASSERT(std::equal(found.begin() + 1, found.end(),
+					expected.begin()));
+	}
+
+public:
+	void setUp()
+	{
+		mkdir(FC_SANDBOX_DIR.c_str(),S_IRWXU);
+	}
+
+	void tearDown()
+	{
+		std::string cmd_line("rm -rf ");
+		cmd_line += FC_SANDBOX_DIR;
+
+		system(cmd_line.c_str());
+	}
+
+	void testFindPrefix()
+	{
+		checkPrefixes(makeVocabulary());
+	}
+
+	void testWithoutFrontCodedFile()
+	{
+		StrIntMap voc = makeVocabulary();
+		unlink(FrontCodedVocabulary::mk_filename(
+					FC_SANDBOX_DIR).c_str());
+		checkPrefixes(voc);
+	}
+};
+
+const std::string FrontCodedVocabularyTestSuit::FC_SANDBOX_DIR("_fc_test_dir");
+
+
+#endif // __VOCABULARY_TEST_H
+// vim:syn=cpp.doxygen:autoindent:smartindent:fileencoding=utf-8:fo+=tcroq: